@@ -18,6 +18,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -25,6 +26,8 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <set>
+#include <unordered_map>
 #include <getopt.h>
 #include <sys/stat.h>
 #include <sys/timeb.h>
@@ -164,6 +167,8 @@ using namespace NBody;
 #define  PHYSENGRID 1
 #define  PHASEENGRID 2
 #define  PHYSGRID 3
+///cells are the nodes of an octree built from particles sorted by Morton key that contain fewer than \ref Options.Ncell particles
+#define  MORTONGRID 4
 //@}
 
 /// \name Max number of neighbouring cells used in interpolation of background velocity field.
@@ -187,6 +192,29 @@ using namespace NBody;
 #define  IONCHILADA 5
 //@}
 
+///\defgroup SUBSAMPLETYPES how the particles kept when subsampling the input are chosen, see \ref Options.isubsample
+//@{
+///keep particles whose id is a multiple of the subsampling factor
+#define SUBSAMPLEREGULAR 0
+///keep particles chosen pseudo-randomly from a hash of their id
+#define SUBSAMPLERANDOM 1
+//@}
+
+///\defgroup INPUTFIELDS bit flags of the particle fields beyond positions, velocities, ids and masses read from the input, see \ref Options.iinputfields
+//@{
+///internal energy of gas
+#define INPUTFIELDU 1
+///sph density and other extra sph blocks
+#define INPUTFIELDSPHDEN 2
+///star formation rate of gas
+#define INPUTFIELDSFR 4
+///metallicity of gas and stars
+#define INPUTFIELDZMET 8
+///formation time of stars
+#define INPUTFIELDTAGE 16
+#define INPUTFIELDALL 31
+//@}
+
 
 ///\defgroup OUTPUTTYPES defining format types of output
 //@{
@@ -196,6 +224,28 @@ using namespace NBody;
 #define OUTADIOS 3
 //@}
 
+///\defgroup CHECKPOINTSTAGES stages of the search after which a checkpoint can be written and from which a run can be restarted
+//@{
+#define CHECKPOINTNONE 0
+#define CHECKPOINTFIELD 1
+#define CHECKPOINTSUBSTRUCTURE 2
+#define CHECKPOINTBARYON 3
+#define CHECKPOINTNUMSTAGES 3
+//@}
+
+///\defgroup CHECKPOINTFLAGS compile time options that change the particle layout, stored in checkpoint headers
+//@{
+#define CHECKPOINTGASON 1
+#define CHECKPOINTSTARON 2
+#define CHECKPOINTBHON 4
+#define CHECKPOINTNOMASS 8
+#define CHECKPOINTLOWPRECISIONPOS 16
+#define CHECKPOINTEXTENDEDFOFINFO 32
+#define CHECKPOINTPARTICLEUIDS 64
+#define CHECKPOINTPARTICLEUPIDS 128
+#define CHECKPOINTGASEXTRA 256
+//@}
+
 /// \name For Unbinding
 //@{
 
@@ -233,6 +283,21 @@ using namespace NBody;
 #define omppropnum 50000
 //@}
 
+///size of phase-space grid cells in units of the linking length used by grid based 6D FOF searches (see \ref fofgrid.cxx)
+#define FOFGRIDCELLFAC6D 2.0
+
+///\name number of bins of the histogram used to characterise the distribution of logarithmic density ratios, scaling as \f$ N^{1/3} \f$ (see \ref DetermineDenVRatioDistribution)
+//@{
+#define DENVRATIOBINSFAC 64
+#define DENVRATIOMINBINS 4096
+#define DENVRATIOMAXBINS 1048576
+//@}
+
+///maximum number of cells per dimension of the grid used to skip baryons lying outside all groups (see \ref BuildBaryonSearchGrid)
+#define BARYONGRIDMAXDIM 128
+///number of spatially sorted baryons processed at a time by a thread when associating baryons with groups
+#define BARYONSEARCHBLOCK 256
+
 
 ///\name halo id modifers used with current snapshot value to make temporally unique halo identifiers
 #ifdef LONGINT
@@ -315,6 +380,69 @@ struct cell_loc {
 
 };
 
+///\defgroup ZOOMREGION sizes used to describe the high resolution region of a zoom simulation, see \ref Zoom_Region
+//@{
+///number of bins along each axis used to find the extent of the region
+#define ZOOMREGIONNBINS 4096
+///largest number of cells along each axis of the grid following the shape of the region
+#define ZOOMREGIONMAXCELLS 256
+//@}
+
+/*! Region of a zoom simulation occupied by its high resolution dark matter, found by \ref ZoomRegionFind before the particle
+    data is read. Along each axis the region is an interval, widened by a buffer, that may wrap about a periodic boundary. If
+    cells are used the region is restricted to the cells of a grid spanning these intervals that lie within the buffer of a cell
+    holding high resolution particles. Positions and lengths are in input units.
+*/
+struct Zoom_Region
+{
+    ///set once the region is found, low resolution particles outside it then being skipped when the input is read
+    int iset;
+    ///period of the input, 0 if not periodic
+    double period;
+    ///lower edge and width of the region along each axis
+    double xmin[3], width[3];
+    ///number of cells along each axis of the grid, 0 if the region is simply its bounding box, and flags of the cells in the region
+    int ncells;
+    vector<unsigned char> cells;
+
+    Zoom_Region(){
+        iset=0;
+        period=0;
+        ncells=0;
+        for (int j=0;j<3;j++) xmin[j]=width[j]=0;
+    }
+    ///index of the grid cell holding a position, 0 for every position in the bounding box if no grid is used, -1 outside the box
+    long long CellIndex(double x, double y, double z) const {
+        double pos[3]={x,y,z};
+        long long index=0;
+        for (int j=0;j<3;j++) {
+            double dx=pos[j]-xmin[j];
+            if (period>0) {
+                if (dx<0) dx+=period;
+                else if (dx>=period) dx-=period;
+            }
+            if (dx<0 || dx>width[j]) return -1;
+            if (ncells>0) {
+                int icell=(int)(dx/width[j]*ncells);
+                if (icell>=ncells) icell=ncells-1;
+                index=index*ncells+icell;
+            }
+        }
+        return index;
+    }
+    int InRegion(double x, double y, double z) const {
+        long long index=CellIndex(x,y,z);
+        if (index<0) return 0;
+        return (ncells==0 || cells[index]);
+    }
+    ///whether a particle read is kept, only the low resolution dark matter types \ref DARK2TYPE and \ref DARK3TYPE, which gadget
+    ///and hdf inputs number the same way, being restricted to the region
+    int Keep(int itype, double x, double y, double z) const {
+        if (!iset || (itype!=DARK2TYPE && itype!=DARK3TYPE)) return 1;
+        return InRegion(x,y,z);
+    }
+};
+
 /// Options structure stores useful variables that have user determined values which are altered by \ref GetArgs in \ref ui.cxx
 struct Options
 {
@@ -340,17 +468,40 @@ struct Options
     ///disable particle id related output like fof.grp or catalog_group data. Useful if just want halo properties
     ///and not interested in tracking. Code writes halo properties catalog and exits.
     int inoidoutput;
+    ///write a checkpoint of the particles, group ids, structure hierarchy and halo properties once a stage of the search is complete (see \ref CHECKPOINTSTAGES)
+    int icheckpoint;
+    ///restart from the last stage for which all tasks have written a checkpoint
+    int irestart;
     ///return propery data in in comoving little h units instead of standard physical units
     int icomoveunit;
     /// input is a cosmological simulation so can use box sizes, cosmological parameters, etc to set scales
     int icosmologicalin;
     /// input buffer size when reading data
     long int inputbufsize;
+    ///number of input buffers filled by a prefetch thread while the particles already read are loaded, 0 reads synchronously
+    int inputnprefetchbuffers;
     /// mpi paritcle buffer size when sending input particle information
     long int mpiparticletotbufsize,mpiparticlebufsize;
-    /// mpi factor by which to multiple the memory allocated, ie: buffer region
-    /// to reduce likelihood of having to expand/allocate new memory
-    Double_t mpipartfac;
+    ///use a Peano-Hilbert space filling curve decomposition balanced by estimated work instead of regular slabs
+    int impisfc;
+    ///redistribute field structures across mpi processes by their estimated substructure search cost before searching for substructure
+    int impigrouprebalance;
+    ///start exchanging data of particles near domain boundaries before the local fof and velocity density searches so that communication overlaps computation
+    int impioverlap;
+    ///exchange data in two levels, through shared memory between tasks on the same node and in one aggregated message per pair of nodes otherwise
+    int impihierarchical;
+    ///run a thread that repeatedly calls into the mpi library so that nonblocking exchanges progress while all other threads compute
+    int impiprogressthread;
+    ///keep the positions read while counting the particles in each mpi domain so that particle data is read from the input in a single pass
+    int impisinglepassread;
+    ///have each mpi process read the top level cells in its domain when the input indexes where the particles of each cell are stored
+    int impireadcells;
+    ///keep only one in this many particles of the input, scaling up the masses of the particles kept, for a quick look at a simulation
+    int isubsample;
+    ///how the particles kept when subsampling are chosen, \ref SUBSAMPLEREGULAR or \ref SUBSAMPLERANDOM
+    int isubsampletype;
+    ///particle fields read from the input, a combination of the \ref INPUTFIELDS flags. If -1, set to those the search uses when the config is checked
+    int iinputfields;
 
     ///\name length,m,v,grav conversion units
     //@{
@@ -442,7 +593,7 @@ struct Options
     //@}
     ///verbose output flag
     int iverbose;
-    ///whether or not to write a fof.grp tipsy like array file
+    ///whether or not to write a fof.grp tipsy like array file, with mpi 2 writes a file of particle and group ids per task
     int iwritefof;
     ///whether mass properties for field objects are inclusive
     int iInclusiveHalo;
@@ -485,6 +636,14 @@ struct Options
     ///factor by which a core must be seperated from main core in phase-space in sigma units
     Double_t halocorephasedistsig;
     //@}
+
+    ///\name parameters for running FOF searches of small particle sets on a phase-space hash grid rather than a kd-tree
+    //@{
+    ///maximum number of particles for which the grid is used, 0 disables the grid
+    Int_t fofgridmaxnum;
+    ///flag to also run the tree search on grid searched sets and report timings of both
+    int ifofgridbenchmark;
+    //@}
     ///for storing a snapshot value to make halo ids unique across snapshots
     long long snapshotvalue;
 
@@ -518,6 +677,14 @@ struct Options
     //@{
     /// store the lowest dark matter particle mass
     Double_t zoomlowmassdm;
+    ///read only the low resolution dark matter within a buffer about the region occupied by the high resolution dark matter
+    int izoomregiononly;
+    ///width of the buffer about the high resolution region, in units of the largest extent of the region
+    Double_t zoomregionbuffer;
+    ///number of cells along each axis of the grid describing the high resolution region, 0 to use its bounding box
+    int zoomregionncells;
+    ///the high resolution region, see \ref Zoom_Region
+    Zoom_Region zoomregion;
     //@}
 
     ///\name extra runtime flags
@@ -640,6 +807,9 @@ struct Options
         halocorenumfaciter=1.0;
         halocorephasedistsig=2.0;
 
+        fofgridmaxnum=100000;
+        ifofgridbenchmark=0;
+
         iverbose=0;
         iwritefof=0;
         iseparatefiles=0;
@@ -647,6 +817,8 @@ struct Options
         iextrahalooutput=0;
         iextendedoutput=0;
         inoidoutput=0;
+        icheckpoint=0;
+        irestart=0;
         icomoveunit=0;
         icosmologicalin=1;
 
@@ -669,6 +841,14 @@ struct Options
         iScaleLengths=0;
 
         inputbufsize=100000;
+        inputnprefetchbuffers=2;
+        isubsample=1;
+        isubsampletype=SUBSAMPLEREGULAR;
+        iinputfields=-1;
+
+        izoomregiononly=0;
+        zoomregionbuffer=0.1;
+        zoomregionncells=0;
 
         mpiparticletotbufsize=-1;
         mpiparticlebufsize=-1;
@@ -683,13 +863,35 @@ struct Options
         SphericalOverdensitySeachFac=1.25;
         iSphericalOverdensityPartList=0;
 
-        mpipartfac=0.1;
+        impisfc=0;
+        impigrouprebalance=0;
+        impioverlap=0;
+        impihierarchical=0;
+        impiprogressthread=0;
+        impisinglepassread=1;
+        impireadcells=1;
 #if USEHDF
         ihdfnameconvention=0;
 #endif
     }
 };
 
+///returns whether the particle with the given id is kept when the input is subsampled. The choice depends only on the id
+///so that the same particles are kept regardless of how the input is split into files or read by mpi processes
+inline bool SubsampleKeep(const Options &opt, long long id)
+{
+    if (opt.isubsample<=1) return true;
+    if (opt.isubsampletype==SUBSAMPLERANDOM) {
+        //splitmix64 finaliser, which spreads consecutive ids uniformly
+        unsigned long long x=(unsigned long long)id+0x9E3779B97F4A7C15ULL;
+        x=(x^(x>>30))*0xBF58476D1CE4E5B9ULL;
+        x=(x^(x>>27))*0x94D049BB133111EBULL;
+        x^=(x>>31);
+        return x%(unsigned long long)opt.isubsample==0;
+    }
+    return id%opt.isubsample==0;
+}
+
 struct ConfigInfo{
     //list the name of the info
     vector<string> nameinfo;
@@ -785,6 +987,12 @@ struct ConfigInfo{
         nameinfo.push_back("Halo_core_phase_significance");
         datainfo.push_back(to_string(opt.halocorephasedistsig));
 
+        //grid based fof searches of small particle sets
+        nameinfo.push_back("FOF_grid_max_size");
+        datainfo.push_back(to_string(opt.fofgridmaxnum));
+        nameinfo.push_back("FOF_grid_benchmark");
+        datainfo.push_back(to_string(opt.ifofgridbenchmark));
+
 
         //for changing factors used in iterative search
         nameinfo.push_back("Iterative_threshold_factor");
@@ -880,6 +1088,20 @@ struct ConfigInfo{
         datainfo.push_back(to_string(opt.icosmologicalin));
         nameinfo.push_back("Input_chunk_size");
         datainfo.push_back(to_string(opt.inputbufsize));
+        nameinfo.push_back("Input_prefetch_buffers");
+        datainfo.push_back(to_string(opt.inputnprefetchbuffers));
+        nameinfo.push_back("Input_subsample_factor");
+        datainfo.push_back(to_string(opt.isubsample));
+        nameinfo.push_back("Input_subsample_type");
+        datainfo.push_back(to_string(opt.isubsampletype));
+        nameinfo.push_back("Input_fields");
+        datainfo.push_back(to_string(opt.iinputfields));
+        nameinfo.push_back("Zoom_region_only");
+        datainfo.push_back(to_string(opt.izoomregiononly));
+        nameinfo.push_back("Zoom_region_buffer");
+        datainfo.push_back(to_string(opt.zoomregionbuffer));
+        nameinfo.push_back("Zoom_region_cells");
+        datainfo.push_back(to_string(opt.zoomregionncells));
         nameinfo.push_back("MPI_particle_total_buf_size");
         datainfo.push_back(to_string(opt.mpiparticletotbufsize));
         nameinfo.push_back("Separate_output_files");
@@ -890,6 +1112,10 @@ struct ConfigInfo{
         datainfo.push_back(to_string(opt.icomoveunit));
         nameinfo.push_back("Extended_output");
         datainfo.push_back(to_string(opt.iextendedoutput));
+        nameinfo.push_back("Write_checkpoints");
+        datainfo.push_back(to_string(opt.icheckpoint));
+        nameinfo.push_back("Restart_from_checkpoint");
+        datainfo.push_back(to_string(opt.irestart));
 
         //gadget io related to extra info for sph, stars, bhs,
         nameinfo.push_back("NSPH_extra_blocks");
@@ -900,8 +1126,22 @@ struct ConfigInfo{
         datainfo.push_back(to_string(opt.gnbhblocks));
 
         //mpi related configuration
-        nameinfo.push_back("MPI_part_allocation_fac");
+        nameinfo.push_back("MPI_particle_total_buf_size");
         datainfo.push_back(to_string(opt.mpiparticletotbufsize));
+        nameinfo.push_back("MPI_use_sfc_decomposition");
+        datainfo.push_back(to_string(opt.impisfc));
+        nameinfo.push_back("MPI_group_rebalance");
+        datainfo.push_back(to_string(opt.impigrouprebalance));
+        nameinfo.push_back("MPI_overlap_communication");
+        datainfo.push_back(to_string(opt.impioverlap));
+        nameinfo.push_back("MPI_hierarchical_communication");
+        datainfo.push_back(to_string(opt.impihierarchical));
+        nameinfo.push_back("MPI_progress_thread");
+        datainfo.push_back(to_string(opt.impiprogressthread));
+        nameinfo.push_back("MPI_single_pass_read");
+        datainfo.push_back(to_string(opt.impisinglepassread));
+        nameinfo.push_back("MPI_read_by_cell");
+        datainfo.push_back(to_string(opt.impireadcells));
 #endif
     }
 };
@@ -996,6 +1236,9 @@ struct GridCell
     Double_t mass, rsize;
     //number of particles in cell
     Int_t nparts,*nindex;
+    //mass weighted mean velocity and velocity dispersion tensor of particles in cell
+    Coordinate vm;
+    Matrix vdisp;
     //neighbouring grid cells and distance from cell centers
     Int_t nnidcells[MAXNGRID];
     Double_t nndist[MAXNGRID];
@@ -1984,6 +2227,88 @@ struct StrucLevelData
     }
 };
 
+/*! Structure containing a coarse grid whose cells are flagged if they overlap the bounding sphere of a group (or a particle) padded by the
+    baryon search length. A baryon in a cell that is not flagged cannot be within the search length of any dark matter particle in a group
+    and need not be searched. See \ref BuildBaryonSearchGrid
+*/
+struct BaryonSearchGrid
+{
+    ///lower corner of the grid and the cell size
+    Double_t xmin[3], cellsize[3];
+    ///cells per dimension and whether grid is periodic
+    int ndim[3], iperiodic;
+    ///flag of cells
+    vector<unsigned char> flag;
+    ///return the index of the cell containing the position, -1 if outside of grid
+    Int_t CellIndex(const Double_t *x) const {
+        Int_t index=0;
+        int ix;
+        for (int k=0;k<3;k++) {
+            ix=(int)floor((x[k]-xmin[k])/cellsize[k]);
+            if (iperiodic) {ix%=ndim[k];if (ix<0) ix+=ndim[k];}
+            else if (ix<0||ix>=ndim[k]) return -1;
+            index=index*ndim[k]+ix;
+        }
+        return index;
+    }
+};
+
+///header of checkpoint files, used to check a checkpoint was written by a compatible run (see \ref WriteCheckpoint)
+struct CheckpointHeader
+{
+    char magic[8];
+    int stage, ntasks, itask;
+    int particlesize, propdatasize, intsize;
+    ///compile time options of the particle layout, see \ref CHECKPOINTFLAGS
+    int particleflags;
+    ///total number of particles over all tasks, including baryons searched separately
+    long long ntotal;
+    CheckpointHeader(int s=CHECKPOINTNONE, int n=1, int t=0, long long ntot=0){
+        strncpy(magic,"VRCKPT2",8);
+        stage=s;
+        ntasks=n;
+        itask=t;
+        particlesize=sizeof(Particle);
+        propdatasize=sizeof(PropData);
+        intsize=sizeof(Int_t);
+        particleflags=0;
+#ifdef GASON
+        particleflags|=CHECKPOINTGASON;
+#endif
+#ifdef STARON
+        particleflags|=CHECKPOINTSTARON;
+#endif
+#ifdef BHON
+        particleflags|=CHECKPOINTBHON;
+#endif
+#ifdef NOMASS
+        particleflags|=CHECKPOINTNOMASS;
+#endif
+#ifdef LOWPRECISIONPOS
+        particleflags|=CHECKPOINTLOWPRECISIONPOS;
+#endif
+#ifdef EXTENDEDFOFINFO
+        particleflags|=CHECKPOINTEXTENDEDFOFINFO;
+#endif
+#ifdef PARTICLEUIDS
+        particleflags|=CHECKPOINTPARTICLEUIDS;
+#endif
+#ifdef PARTICLEUPIDS
+        particleflags|=CHECKPOINTPARTICLEUPIDS;
+#endif
+#ifdef GASEXTRA
+        particleflags|=CHECKPOINTGASEXTRA;
+#endif
+        ntotal=ntot;
+    }
+    ///check that header agrees with the one expected
+    bool Compatible(const CheckpointHeader &h) const{
+        return (strncmp(magic,h.magic,8)==0 && stage==h.stage && ntasks==h.ntasks && itask==h.itask
+            && particlesize==h.particlesize && propdatasize==h.propdatasize && intsize==h.intsize
+            && particleflags==h.particleflags && ntotal==h.ntotal);
+    }
+};
+
 #if defined(USEHDF)||defined(USEADIOS)
 ///store the names of datasets in catalog output
 struct DataGroupNames {
@@ -69,24 +69,50 @@ private(i,vel)
     return tree;
 }
 
-///Fills the GridCell struct using KD-Tree initialized by \ref InitializeTreeGrid
+/*! Calculates the mass, centre of mass, mean velocity and velocity dispersion tensor of a cell in a single pass over its particles
+    using a mass weighted Welford update. Particles are Part[start+l] if index is NULL, otherwise Part[index[l]].
+*/
+inline void GetCellStats(GridCell &cell, Particle *Part, Int_t start, Int_t *index)
+{
+    double mtot=0, w, wfac, xm[6], vm[3], dv[3], vdisp[3][3];
+    Particle *p;
+    for (int j=0;j<cell.ndim;j++) xm[j]=0;
+    for (int k=0;k<3;k++) {vm[k]=0;for (int l=0;l<3;l++) vdisp[k][l]=0;}
+    for (Int_t l=0;l<cell.nparts;l++) {
+        if (index==NULL) p=&Part[start+l];
+        else p=&Part[index[l]];
+        w=p->GetMass();
+        mtot+=w;
+        wfac=w/mtot;
+        for (int j=0;j<cell.ndim;j++) xm[j]+=(p->GetPhase(j)-xm[j])*wfac;
+        for (int k=0;k<3;k++) {dv[k]=p->GetVelocity(k)-vm[k];vm[k]+=dv[k]*wfac;}
+        for (int k=0;k<3;k++) for (int m=0;m<3;m++) vdisp[k][m]+=w*dv[k]*(p->GetVelocity(m)-vm[m]);
+    }
+    cell.mass=mtot;
+    for (int j=0;j<cell.ndim;j++) cell.xm[j]=xm[j];
+    mtot=1.0/mtot;
+    for (int k=0;k<3;k++) {
+        cell.vm[k]=vm[k];
+        for (int m=0;m<3;m++) cell.vdisp(k,m)=vdisp[k][m]*mtot;
+    }
+}
+
+///Fills the GridCell struct using KD-Tree initialized by \ref InitializeTreeGrid, calculating cell quantities in parallel from the leaf nodes
 void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *&tree, Particle *Part, GridCell* &grid)
 //void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *tree, Particle *Part, GridCell* grid, PartCellNum *pglist)
 {
     Int_t  i;
     Int_t gridcount=0,ncount=0;
-    //this is used to create tree and search for near neighbours
-    Particle *ptemp=new Particle[ngrid];
     int treetype=tree->GetTreeType();
     int ND;
     if (treetype==tree->TPHYS) ND=3;
     else if (treetype==tree->TPHS) ND=6;
+    vector<Node*> leafnodes(ngrid);
+    vector<Int_t> leafstart(ngrid);
 
     if (opt.iverbose) cout<<"Filling KD-Tree Grid"<<endl;
 
-    //this loop works well for large cells but for small cells may have to replace this with a for loop which goes through every particle
-    //and stores nid and size of node, then builds grid based on these values and then places the particles in the cells.
-    //for leaf nodes, use starts and ends indices (ie what particles in the system are in the node)
+    //first find leaf nodes, using starts and ends indices (ie what particles in the system are in the node)
     while (ncount<nbodies) {
         //check if particle is within start and end, if not just means that splitting is not perfect
         //and this particle is left alone. Go to the next particle
@@ -102,107 +128,185 @@ void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *
             start=((LeafNode*)np)->GetStart();
             end=((LeafNode*)np)->GetEnd();
         }
+        leafnodes[gridcount]=np;
+        leafstart[gridcount]=start;
+        gridcount++; ncount=end;
+    }
 
-        grid[gridcount].ndim=ND;
-        //get center of mass and boundaries of grid cell
+    //then get cell quantities, particles in leaf nodes being contiguous
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(dynamic) if (gridcount>1)
+#endif
+    for (i=0;i<gridcount;i++) {
+        Node *np=leafnodes[i];
+        grid[i].ndim=ND;
+        //get boundaries of grid cell
         for (int j=0;j<ND;j++) {
-            grid[gridcount].xm[j]=0.;
-            grid[gridcount].xbl[j]=np->GetBoundary(j,0);
-            grid[gridcount].xbu[j]=np->GetBoundary(j,1);
+            grid[i].xbl[j]=np->GetBoundary(j,0);
+            grid[i].xbu[j]=np->GetBoundary(j,1);
         }
-        grid[gridcount].nparts=np->GetCount();
-        grid[gridcount].gid=np->GetID();
-        grid[gridcount].nindex=new Int_t[grid[gridcount].nparts];
-
-        Double_t mtot=0.;
-        for (Int_t k=start,l=0;k<end;k++,l++){
-            Int_t id=Part[k].GetID();
-            grid[gridcount].nindex[l]=id;
-            for (int j=0;j<ND;j++)
-                grid[gridcount].xm[j]+=Part[k].GetPosition(j)*Part[k].GetMass();
-            mtot+=Part[k].GetMass();
-        }
-        grid[gridcount].mass=mtot;
-        ptemp[gridcount].SetMass(mtot);
-        mtot=1.0/mtot;
-        for (int j=0;j<ND;j++) grid[gridcount].xm[j]=grid[gridcount].xm[j]*mtot;
-        for (int j=0;j<ND;j++) ptemp[gridcount].SetPhase(j,grid[gridcount].xm[j]);
-        gridcount++; ncount=end;
+        grid[i].nparts=np->GetCount();
+        grid[i].gid=np->GetID();
+        grid[i].nindex=new Int_t[grid[i].nparts];
+        for (Int_t l=0;l<grid[i].nparts;l++) grid[i].nindex[l]=Part[leafstart[i]+l].GetID();
+        GetCellStats(grid[i],Part,leafstart[i],NULL);
     }
-    //final check that no particle is not associated with a leaf node. Note that this check should always be passed.
-    /*for (i=0;i<nbodies;i++) if (pglist[i].glist[0]==-1) {
-        Int_t nid=(tree->FindLeafNode(i))->GetID();
-        //cerr<<"error for particle "<<i<<" which is in leaf node "<<nid<<endl;//exit(9);
-        pglist[i].glist[0]=nid;
-        //for (Int_t j=0;j<ngrid;j++) if (nid==grid[j].gid) {cerr<<"assigning particle to grid cell "<<j<<endl;pglist[i].glist[0]=j;break;}
-        //if (pglist[i].glist[0]==-1) exit(9);
-    }*/
     //resets particle order
     delete tree;
     if (opt.iverbose) cout<<"Done."<<endl;
 }
 
+/*! Builds grid without a kd-tree. Particles are sorted by Morton key within the cube enclosing them, and the cells are the nodes of the
+    implicit octree that contain fewer than \ref Options.Ncell particles (or have reached the maximum depth of the keys). Sparse nodes
+    are merged with their neighbours in key order so that every cell holds at least half that number.
+    The particle array is not reordered. Returns the grid and sets the number of cells.
+*/
+GridCell* FillMortonGrid(Options &opt, const Int_t nbodies, Particle *Part, Int_t &ngrid)
+{
+    const int nbits=21;
+    typedef unsigned long long MortonKey;
+    Double_t xmin[3], xmax[3], boxsize=0, scale;
+    vector<pair<MortonKey,Int_t> > keys(nbodies);
+    vector<Int_t> leafstart, leafend, leaflevel;
+    vector<MortonKey> leafkey;
+    GridCell *grid;
+    Int_t i;
+
+    if (opt.iverbose) cout<<"Building Morton ordered grid"<<endl;
+    for (int k=0;k<3;k++) xmin[k]=xmax[k]=Part[0].GetPosition(k);
+    for (i=1;i<nbodies;i++) for (int k=0;k<3;k++) {
+        if (xmin[k]>Part[i].GetPosition(k)) xmin[k]=Part[i].GetPosition(k);
+        if (xmax[k]<Part[i].GetPosition(k)) xmax[k]=Part[i].GetPosition(k);
+    }
+    for (int k=0;k<3;k++) if (boxsize<xmax[k]-xmin[k]) boxsize=xmax[k]-xmin[k];
+    if (boxsize<=0) boxsize=1.0;
+    boxsize*=(1.0+1e-6);
+    scale=(Double_t)(1<<nbits)/boxsize;
+
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(static) if (nbodies>ompsearchnum)
+#endif
+    for (i=0;i<nbodies;i++) {
+        MortonKey key=0, ix[3];
+        for (int k=0;k<3;k++) {
+            ix[k]=(MortonKey)((Part[i].GetPosition(k)-xmin[k])*scale);
+            if (ix[k]>=(1ULL<<nbits)) ix[k]=(1ULL<<nbits)-1;
+        }
+        for (int b=nbits-1;b>=0;b--) for (int k=0;k<3;k++) key=(key<<1)|((ix[k]>>b)&1ULL);
+        keys[i]=make_pair(key,i);
+    }
+    sort(keys.begin(),keys.end());
+
+    //descend the implicit octree, splitting nodes that contain too many particles
+    vector<Int_t> stackstart(1,0), stackend(1,nbodies), stacklevel(1,0);
+    vector<MortonKey> stackkey(1,0);
+    while (stackstart.size()>0) {
+        Int_t start=stackstart.back(), end=stackend.back();
+        int level=stacklevel.back();
+        MortonKey prefix=stackkey.back();
+        stackstart.pop_back();stackend.pop_back();stacklevel.pop_back();stackkey.pop_back();
+        if (end-start<=opt.Ncell || level==nbits) {
+            leafstart.push_back(start);leafend.push_back(end);leaflevel.push_back(level);leafkey.push_back(prefix);
+            continue;
+        }
+        //push children in reverse so that leaves are produced in key order
+        int shift=3*(nbits-level-1);
+        for (int c=7;c>=0;c--) {
+            MortonKey lo=prefix|((MortonKey)c<<shift), hi=lo+(1ULL<<shift);
+            Int_t cstart=lower_bound(keys.begin()+start,keys.begin()+end,make_pair(lo,(Int_t)0))-keys.begin();
+            Int_t cend=lower_bound(keys.begin()+start,keys.begin()+end,make_pair(hi,(Int_t)0))-keys.begin();
+            if (cend>cstart) {
+                stackstart.push_back(cstart);stackend.push_back(cend);stacklevel.push_back(level+1);stackkey.push_back(lo);
+            }
+        }
+    }
+
+    //leaves of sparsely filled octants can hold only one or two particles, whose velocity dispersion tensor is singular, so leaves
+    //with fewer than half the particles of a full cell are merged with the leaves following them in key order, the last with those before it
+    Int_t nmin=max(opt.Ncell/2,(Int_t)4);
+    vector<Int_t> cellfirst, celllast;
+    for (Int_t l=0;l<(Int_t)leafstart.size();l++) {
+        if (cellfirst.size()==0 || leafend[celllast.back()]-leafstart[cellfirst.back()]>=nmin) {cellfirst.push_back(l);celllast.push_back(l);}
+        else celllast.back()=l;
+    }
+    if (cellfirst.size()>1 && leafend[celllast.back()]-leafstart[cellfirst.back()]<nmin) {
+        celllast[cellfirst.size()-2]=celllast.back();
+        cellfirst.pop_back();celllast.pop_back();
+    }
+
+    ngrid=cellfirst.size();
+    grid=new GridCell[ngrid];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i) schedule(dynamic) if (ngrid>1)
+#endif
+    for (i=0;i<ngrid;i++) {
+        grid[i].ndim=3;
+        for (int k=0;k<3;k++) {grid[i].xbl[k]=MAXVALUE;grid[i].xbu[k]=-MAXVALUE;}
+        //bounds of the cell enclose the octants of the leaves it is made of
+        for (Int_t l=cellfirst[i];l<=celllast[i];l++) {
+            Double_t cellsize=boxsize/(Double_t)(1<<leaflevel[l]);
+            MortonKey ix[3]={0,0,0};
+            //get position of leaf from its key prefix
+            for (int b=nbits-1;b>=0;b--) for (int k=0;k<3;k++) ix[k]|=((leafkey[l]>>(3*b+2-k))&1ULL)<<b;
+            for (int k=0;k<3;k++) {
+                grid[i].xbl[k]=min(grid[i].xbl[k],xmin[k]+ix[k]/scale);
+                grid[i].xbu[k]=max(grid[i].xbu[k],xmin[k]+ix[k]/scale+cellsize);
+            }
+        }
+        grid[i].nparts=leafend[celllast[i]]-leafstart[cellfirst[i]];
+        grid[i].gid=i;
+        grid[i].nindex=new Int_t[grid[i].nparts];
+        for (Int_t l=0;l<grid[i].nparts;l++) grid[i].nindex[l]=keys[leafstart[cellfirst[i]]+l].second;
+        GetCellStats(grid[i],Part,0,grid[i].nindex);
+    }
+    if (opt.iverbose) cout<<"Done."<<endl;
+    return grid;
+}
+
+///Builds the grid used to characterise the background velocity distribution according to \ref Options.gridtype, returning the grid and setting the number of cells
+GridCell* BuildGrid(Options &opt, const Int_t nbodies, Particle *Part, Int_t &ngrid)
+{
+    GridCell *grid;
+    if (opt.gridtype==MORTONGRID) return FillMortonGrid(opt,nbodies,Part,ngrid);
+    KDTree *tree=InitializeTreeGrid(opt,nbodies,Part);
+    ngrid=tree->GetNumLeafNodes();
+    grid=new GridCell[ngrid];
+    //note that after this system is back in original order as tree has been deleted.
+    FillTreeGrid(opt,nbodies,ngrid,tree,Part,grid);
+    return grid;
+}
+
 //@}
 
 ///\name Calculate mean velocity distribution quantities
 //@{
 
-///Calculate CM vel of cell
+///Get CM vel of cell calculated when the grid was filled
 Coordinate* GetCellVel(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngrid, GridCell *grid)
 {
     Int_t i;
-    int nthreads;
-    Double_t mtot;
     Coordinate *gvel;
     gvel=new Coordinate[ngrid];
     if (opt.iverbose) cout<<"Calculating Grid Mean Velocity"<<endl;
 #ifdef USEOPENMP
-#pragma omp parallel default(shared) \
-private(i,mtot)
-{
-#pragma omp for
-#endif
-    for (i=0;i<ngrid;i++) {
-        for (int k=0;k<3;k++) gvel[i][k]=0.;
-        for (int j=0;j<grid[i].nparts;j++) {
-            for (int k=0;k<3;k++) gvel[i][k]+=Part[grid[i].nindex[j]].GetVelocity(k)*Part[grid[i].nindex[j]].GetMass();
-        }
-        mtot=1.0/grid[i].mass;
-        for (int k=0;k<3;k++)gvel[i][k]*=mtot;
-    }
-#ifdef USEOPENMP
-}
+#pragma omp parallel for default(shared) private(i) if (ngrid>ompsearchnum)
 #endif
+    for (i=0;i<ngrid;i++) gvel[i]=grid[i].vm;
     if (opt.iverbose) cout<<"Done"<<endl;
     return gvel;
 }
 
-///Calculate velocity dispersion tensor of cell
+///Get velocity dispersion tensor of cell calculated when the grid was filled
 Matrix* GetCellVelDisp(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngrid, GridCell *grid, Coordinate *gvel)
 {
     Int_t i;
-    int nthreads;
-    Double_t mtot;
     Matrix *gveldisp;
     gveldisp=new Matrix[ngrid];
     if (opt.iverbose) cout<<"Calculating Grid Velocity Dispersion"<<endl;
 #ifdef USEOPENMP
-#pragma omp parallel default(shared) \
-private(i,mtot)
-{
-#pragma omp for
-#endif
-    for (i=0;i<ngrid;i++) {
-        for (int k=0;k<3;k++) for (int l=0;l<3;l++) gveldisp[i](k,l)=0.;
-        for (int j=0;j<grid[i].nparts;j++) {
-            for (int k=0;k<3;k++) for (int l=0;l<3;l++) gveldisp[i](k,l)+=(Part[grid[i].nindex[j]].GetVelocity(k)-gvel[i][k])*(Part[grid[i].nindex[j]].GetVelocity(l)-gvel[i][l])*Part[grid[i].nindex[j]].GetMass();
-        }
-        mtot=1.0/grid[i].mass;
-        for (int k=0;k<3;k++)for (int l=0;l<3;l++)gveldisp[i](k,l)*=mtot;
-    }
-#ifdef USEOPENMP
-}
+#pragma omp parallel for default(shared) private(i) if (ngrid>ompsearchnum)
 #endif
+    for (i=0;i<ngrid;i++) gveldisp[i]=grid[i].vdisp;
     if (opt.iverbose) cout<<"Done"<<endl;
     return gveldisp;
 }
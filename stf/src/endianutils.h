@@ -1,5 +1,7 @@
 ///Math code
 #include <NBodyMath.h>
+#include <cstring>
+#include <cstdint>
 using namespace Math;
 
 #ifndef ENDIANUTILS_H
@@ -130,6 +132,29 @@ inline double DoubleSwap( double f )
 }
 inline double DoubleNoSwap( double f ){return f;}
 
+//Block versions of the swaps for when a whole array of values has been read at once.
+//The words are moved through memcpy so the loops stay free of aliasing issues and the compiler can vectorise them.
+inline void ByteSwap4Array(void *data, size_t n)
+{
+  unsigned char *b=(unsigned char*)data;
+  uint32_t w;
+  for (size_t i=0;i<n;i++) {
+    memcpy(&w,b+4*i,4);
+    w=__builtin_bswap32(w);
+    memcpy(b+4*i,&w,4);
+  }
+}
+inline void ByteSwap8Array(void *data, size_t n)
+{
+  unsigned char *b=(unsigned char*)data;
+  uint64_t w;
+  for (size_t i=0;i<n;i++) {
+    memcpy(&w,b+8*i,8);
+    w=__builtin_bswap64(w);
+    memcpy(b+8*i,&w,8);
+  }
+}
+
 //This is code I've written which I think will do a generic switch. Use a template
 /*template <class T, unsigned int size> inline T SwapValue(T value)
 {
@@ -301,6 +326,12 @@ inline void InitEndian( void )
   }
 }
 
+//and the array versions, which convert big endian data in place (and do nothing on big endian systems)
+inline void BigFloatArray(float *f, size_t n){if (!BigEndianSystem) ByteSwap4Array(f,n);}
+inline void BigIntArray(int *i, size_t n){if (!BigEndianSystem) ByteSwap4Array(i,n);}
+inline void BigDoubleArray(double *f, size_t n){if (!BigEndianSystem) ByteSwap8Array(f,n);}
+inline void BigLongIntArray(long long *i, size_t n){if (!BigEndianSystem) ByteSwap8Array(i,n);}
+
 //now with this code, I can alter how structures are read and make it endian independent.
 
 #endif
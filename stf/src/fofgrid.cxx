@@ -0,0 +1,329 @@
+/*! \file fofgrid.cxx
+ *  \brief this file contains routines that search small particle sets using FOF routines on a uniform hash grid instead of a kd-tree
+ */
+
+//--  Suboutines that search particle list using a grid
+
+#include "stf.h"
+
+/// \name Grid based FOF search
+//@{
+
+///occupied cell of the phase-space grid, storing the key of the cell and the range of the cell in the key ordered index list
+struct FOFGridCell
+{
+    unsigned long long key;
+    Int_t start, end;
+};
+
+///hash of a grid key used to place cells in the open addressing hash table
+inline unsigned long long FOFGridHash(unsigned long long key, int shift)
+{
+    return (key*0x9E3779B97F4A7C15ULL)>>shift;
+}
+
+/*!
+    FOF search of a particle set where the neighbour search is done by placing particles in a uniform grid of cells
+    set by the linking lengths (params[6] is physical linking length squared and params[7] is the velocity linking length squared).
+    In 6D cells are \ref FOFGRIDCELLFAC6D times the linking length and only neighbouring cells whose faces are within a linking length are searched.
+    Only occupied cells are stored and these are accessed with a hash table so the memory cost scales with the number of particles and
+    not the volume of the phase-space bounding box. For small particle sets this avoids building a kd-tree.
+
+    The routine follows the same conventions as \ref NBody::KDTree::FOFCriterion, that is the group array returned is indexed by particle id
+    so ids must range from 0 to nbodies-1, the pHead, pNext, pTail arrays (if passed) are indexed by position in the particle array
+    and if order!=0 groups are ordered by size. The particle array is not altered. The search is not periodic and the comparison function
+    must not link particles that lie outside the ellipsoid defined by the linking lengths.
+
+    \param nbodies number of particles
+    \param Part particle array
+    \param griddim 3 for a physical grid or 6 for a phase-space grid
+    \param cmp comparison function
+    \param params parameters passed to the comparison function
+    \param numgroup number of groups found
+    \param minnum minimum number of particles in a group
+    \param order whether groups are ordered by size
+    \param ipcheckflag whether to use the check function to set initial group values
+    \param check check function
+
+    \return the group array or NULL if the grid could not be constructed, in which case a tree based search should be used instead.
+*/
+Int_t *FOFCriterionGrid(const Int_t nbodies, Particle *Part, int griddim, FOFcompfunc cmp, Double_t *params, Int_t &numgroup, Int_t minnum, int order, int ipcheckflag, FOFcheckfunc check, Int_tree_t *pHead, Int_tree_t *pNext, Int_tree_t *pTail, Int_tree_t *pLen)
+{
+    Double_t ell[6], ellinv[6], xmin[6], xmax[6], dtotcells=1.0;
+    unsigned long long ncell[6], stride[6];
+    int shift;
+    //cells are larger than the linking length in 6D so that the neighbouring cells that must be searched are limited to those
+    //whose faces are within a linking length of the target, otherwise sparsely occupied cells mean 3^6 cells searched per particle
+    Double_t cellfac=(griddim==6)?FOFGRIDCELLFAC6D:1.0;
+
+    if (nbodies<=0 || (griddim!=3 && griddim!=6)) return NULL;
+    for (int k=0;k<griddim;k++) {
+        ell[k]=sqrt(params[6+(k>=3)])*cellfac;
+        if (!(ell[k]>0)) return NULL;
+        ellinv[k]=1.0/ell[k];
+        xmin[k]=xmax[k]=Part[0].GetPhase(k);
+    }
+    for (Int_t i=1;i<nbodies;i++) {
+        for (int k=0;k<griddim;k++) {
+            if (Part[i].GetPhase(k)<xmin[k]) xmin[k]=Part[i].GetPhase(k);
+            if (Part[i].GetPhase(k)>xmax[k]) xmax[k]=Part[i].GetPhase(k);
+        }
+    }
+    //keys of cells must fit into 64 bits, otherwise let caller fall back to a tree
+    for (int k=0;k<griddim;k++) {
+        dtotcells*=floor((xmax[k]-xmin[k])*ellinv[k])+1.0;
+        if (dtotcells>=pow(2.0,62.0)) return NULL;
+        ncell[k]=(unsigned long long)((xmax[k]-xmin[k])*ellinv[k])+1;
+    }
+    stride[0]=1;
+    for (int k=1;k<griddim;k++) stride[k]=stride[k-1]*ncell[k-1];
+
+    //get cell key of each particle and sort the index list by key so that particles in a cell are contiguous
+    vector<pair<unsigned long long, Int_t> > keyindex(nbodies);
+    for (Int_t i=0;i<nbodies;i++) {
+        unsigned long long key=0, icell;
+        for (int k=0;k<griddim;k++) {
+            icell=(unsigned long long)((Part[i].GetPhase(k)-xmin[k])*ellinv[k]);
+            if (icell>=ncell[k]) icell=ncell[k]-1;
+            key+=icell*stride[k];
+        }
+        keyindex[i]=make_pair(key,i);
+    }
+    sort(keyindex.begin(),keyindex.end());
+    Int_t *order_index=new Int_t[nbodies];
+    vector<FOFGridCell> cells;
+    for (Int_t i=0;i<nbodies;i++) {
+        order_index[i]=keyindex[i].second;
+        if (i==0 || keyindex[i].first!=keyindex[i-1].first) {
+            FOFGridCell c;
+            c.key=keyindex[i].first;
+            c.start=i;
+            cells.push_back(c);
+        }
+        cells.back().end=i+1;
+    }
+    vector<pair<unsigned long long, Int_t> >().swap(keyindex);
+
+    //build hash table of occupied cells, with table size a power of two at least twice the number of cells
+    Int_t ncells=cells.size();
+    unsigned long long tablesize=2;
+    shift=63;
+    while (tablesize<2*(unsigned long long)ncells) {tablesize<<=1;shift--;}
+    unsigned long long tablemask=tablesize-1;
+    Int_t *table=new Int_t[tablesize];
+    for (unsigned long long j=0;j<tablesize;j++) table[j]=-1;
+    for (Int_t j=0;j<ncells;j++) {
+        unsigned long long slot=FOFGridHash(cells[j].key,shift);
+        while (table[slot]!=-1) slot=(slot+1)&tablemask;
+        table[slot]=j;
+    }
+
+    Int_t *pGroup=new Int_t[nbodies];
+    Int_tree_t *pGroupHead=new Int_tree_t[nbodies];
+    Int_tree_t *Fifo=new Int_tree_t[nbodies];
+    short *pCellFlag=new short[ncells];
+
+    bool iph,ipt,ipn,ipl;
+    iph=ipt=ipn=ipl=false;
+    if (pHead==NULL)    {pHead=new Int_tree_t[nbodies];iph=true;}
+    if (pNext==NULL)    {pNext=new Int_tree_t[nbodies];ipn=true;}
+    if (pLen==NULL)     {pLen=new Int_tree_t[nbodies];ipl=true;}
+    if (pTail==NULL)    {pTail=new Int_tree_t[nbodies];ipt=true;}
+
+    Int_t iGroup=0,iHead=0,iTail=0,id,iid;
+
+    //initial arrays
+    for (Int_t i=0;i<nbodies;i++) {
+        id=Part[i].GetID();
+        if (ipcheckflag) pGroup[id]=check(Part[i],params);
+        else pGroup[id]=0;
+        pHead[i]=pTail[i]=i;
+        pNext[i]=-1;
+    }
+    for (Int_t j=0;j<ncells;j++) pCellFlag[j]=0;
+
+    //seed groups in key order so that searches move coherently through memory
+    for (Int_t s=0;s<nbodies;s++){
+        Int_t i=order_index[s];
+        //if particle already member of group, ignore and go to next particle
+        id=Part[i].GetID();
+        if(pGroup[id]!=0) continue;
+        pGroup[id]=++iGroup;
+        pLen[iGroup]=1;
+        pGroupHead[iGroup]=i;
+        Fifo[iTail++]=i;
+
+        //if reach the end of particle list, set iTail to zero and wrap around
+        if(iTail==nbodies) iTail=0;
+        //continue search for this group until one has wrapped around such that iHead==iTail
+        while(iHead!=iTail) {
+            iid=Fifo[iHead++];
+            if (iHead==nbodies) iHead=0;
+
+            //get the cell of the target and for each dimension the neighbouring cells whose faces lie within a linking length
+            //along with the squared distance to these faces in linking length units
+            long long tcell[6];
+            int noff[6], ioff[6];
+            long long offkey[6][3];
+            Double_t offdist2[6][3];
+            for (int k=0;k<griddim;k++) {
+                Double_t x=(Part[iid].GetPhase(k)-xmin[k])*ellinv[k], d;
+                tcell[k]=(long long)x;
+                if (tcell[k]>=(long long)ncell[k]) tcell[k]=ncell[k]-1;
+                noff[k]=1;
+                offkey[k][0]=tcell[k]*stride[k];
+                offdist2[k][0]=0;
+                d=(x-tcell[k])*cellfac;
+                if (tcell[k]>0 && d<1.0) {
+                    offkey[k][noff[k]]=(tcell[k]-1)*stride[k];
+                    offdist2[k][noff[k]++]=d*d;
+                }
+                d=(1.0-(x-tcell[k]))*cellfac;
+                if (tcell[k]<(long long)ncell[k]-1 && d<1.0) {
+                    offkey[k][noff[k]]=(tcell[k]+1)*stride[k];
+                    offdist2[k][noff[k]++]=d*d;
+                }
+                ioff[k]=0;
+            }
+            //search the neighbouring cells that can contain particles within the linking ellipsoid
+            bool idone=false;
+            while (!idone) {
+                Double_t dist2=0;
+                unsigned long long key=0;
+                for (int k=0;k<griddim;k++) {dist2+=offdist2[k][ioff[k]];key+=offkey[k][ioff[k]];}
+                //move to next combination of neighbouring cells
+                int kk=0;
+                while (kk<griddim && ++ioff[kk]==noff[kk]) ioff[kk++]=0;
+                idone=(kk==griddim);
+                if (dist2>=1.0) continue;
+                unsigned long long slot=FOFGridHash(key,shift);
+                Int_t icell=-1;
+                while (table[slot]!=-1) {
+                    if (cells[table[slot]].key==key) {icell=table[slot];break;}
+                    slot=(slot+1)&tablemask;
+                }
+                if (icell==-1) continue;
+                Int_t cstart=cells[icell].start, cend=cells[icell].end;
+                //if cell already linked and particle already part of group, do nothing.
+                if (pCellFlag[icell]&&pHead[iid]==pHead[order_index[cstart]]) continue;
+                //flag initialized to !=0 and if entire cell searched and all particles already linked then pCellFlag=1
+                Int_t flag=pHead[order_index[cstart]];
+                for (Int_t j=cstart;j<cend;j++) {
+                    Int_t ii=order_index[j];
+                    if (flag!=pHead[ii]) flag=0;
+                    Int_t jd=Part[ii].GetID();
+                    //if already linked don't do anything
+                    if (pGroup[jd]==iGroup) continue;
+                    //if tag below zero then don't do anything
+                    if (pGroup[jd]<0) continue;
+                    if (cmp(Part[iid],Part[ii],params)) {
+                        pGroup[jd]=iGroup;
+                        Fifo[iTail++]=ii;
+                        pLen[iGroup]++;
+
+                        pNext[pTail[pHead[iid]]]=pHead[ii];
+                        pTail[pHead[iid]]=pTail[pHead[ii]];
+                        pHead[ii]=pHead[iid];
+                        if(iTail==nbodies)iTail=0;
+                        flag=0;
+                    }
+                }
+                if (flag) pCellFlag[icell]=1;
+            }
+        }
+
+        //make sure group big enough
+        if(pLen[iGroup]<minnum){
+            Int_t ii=pHead[pGroupHead[iGroup]];
+            do {
+                pGroup[Part[ii].GetID()]=-1;
+            } while ((ii=pNext[ii])!=-1);
+            pLen[iGroup--]=0;
+        }
+    }
+
+    //for all groups that were too small reset id to 0
+    for (Int_t i=0;i<nbodies;i++) if(pGroup[Part[i].GetID()]==-1)pGroup[Part[i].GetID()]=0;
+
+    //free memory for arrays that are not needed
+    delete[] Fifo;
+    delete[] pCellFlag;
+    delete[] table;
+    delete[] order_index;
+    if (iph) delete[] pHead;
+    if (ipt) delete[] pTail;
+    if (ipn) delete[] pNext;
+
+    if (iGroup>0 && order) {
+        //generate pList array to store go through particle list and generate linked list
+        Int_t **pList, *pCount;
+        pList=new Int_t*[iGroup+1];
+        pCount=new Int_t[iGroup+1];
+        for (Int_t i=1;i<=iGroup;i++) {pList[i]=new Int_t[pLen[i]];pCount[i]=0;}
+        for (Int_t i=0;i<nbodies;i++) {
+            Int_t gid=pGroup[Part[i].GetID()];
+            if (gid>0) pList[gid][pCount[gid]++]=i;
+        }
+        //now order group indices
+        PriorityQueue *pq=new PriorityQueue(iGroup);
+        for (Int_t i = 1; i <=iGroup; i++) pq->Push(i, pLen[i]);
+        for (Int_t i = 1;i<=iGroup; i++) {
+            Int_t groupid=pq->TopQueue();
+            pq->Pop();
+            for (Int_t j=0;j<pLen[groupid];j++) pGroup[Part[pList[groupid][j]].GetID()]=i;
+            delete[] pList[groupid];
+        }
+        delete[] pList;
+        delete[] pCount;
+        delete pq;
+    }
+
+    if (ipl) delete[] pLen;
+    delete[] pGroupHead;
+    numgroup=iGroup;
+    return pGroup;
+}
+
+/*!
+    Run a FOF criterion search on a particle set for which a tree has already been built, using the grid search if the
+    set is small enough (see \ref Options.fofgridmaxnum) and falling back to the tree otherwise.
+    If \ref Options.ifofgridbenchmark is set, both searches are run, timings reported and the grid result returned.
+*/
+Int_t *FOFCriterionGridOrTree(Options &opt, KDTree *tree, const Int_t nbodies, Particle *Part, int griddim, FOFcompfunc cmp, Double_t *params, Int_t &numgroup, Int_t minnum, int order, int ipcheckflag, FOFcheckfunc check)
+{
+    Int_t *pfofgrid=NULL, *pfoftree, nggrid, ngtree;
+    Double_t tgrid=0, ttree;
+    if (nbodies<=opt.fofgridmaxnum) {
+        tgrid=MyGetTime();
+        pfofgrid=FOFCriterionGrid(nbodies,Part,griddim,cmp,params,nggrid,minnum,order,ipcheckflag,check);
+        tgrid=MyGetTime()-tgrid;
+        if (pfofgrid!=NULL && opt.ifofgridbenchmark==0) {numgroup=nggrid;return pfofgrid;}
+    }
+    ttree=MyGetTime();
+    pfoftree=tree->FOFCriterion(cmp,params,ngtree,minnum,order,ipcheckflag,check);
+    ttree=MyGetTime()-ttree;
+    if (pfofgrid==NULL) {numgroup=ngtree;return pfoftree;}
+    FOFGridBenchmarkReport(opt,nbodies,tgrid,ttree,pfofgrid,nggrid,pfoftree,ngtree);
+    delete[] pfoftree;
+    numgroup=nggrid;
+    return pfofgrid;
+}
+
+///Report the time taken by the grid and tree based searches of the same particle set along with whether the groups found agree
+void FOFGridBenchmarkReport(Options &opt, const Int_t nbodies, Double_t tgrid, Double_t ttree, Int_t *pfofgrid, Int_t nggrid, Int_t *pfoftree, Int_t ngtree)
+{
+#ifndef USEMPI
+    int ThisTask=0;
+#endif
+    Int_t nmismatch=0;
+    for (Int_t i=0;i<nbodies;i++) nmismatch+=((pfofgrid[i]>0)!=(pfoftree[i]>0));
+#ifdef USEOPENMP
+#pragma omp critical (fofgridbenchmark)
+#endif
+    {
+    cout<<ThisTask<<" FOF grid benchmark: "<<nbodies<<" particles, grid "<<tgrid<<" tree "<<ttree<<" speedup "<<((tgrid>0)?ttree/tgrid:0);
+    cout<<" groups grid "<<nggrid<<" tree "<<ngtree<<" particles with differing membership "<<nmismatch<<endl;
+    }
+}
+
+//@}
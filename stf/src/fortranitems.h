@@ -0,0 +1,94 @@
+/*! \file fortranitems.h
+ *  \brief this file contains the definitions used to read files of fortran unformatted records, as written by gadget and ramses
+ */
+
+#ifndef FORTRANITEMS_H
+#define FORTRANITEMS_H
+
+//for endian independance
+#include "endianutils.h"
+//for memory mapping files
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+///size in bytes of the reads used to load a file that can not be memory mapped
+#define FORTRANREADBLOCKSIZE 67108864
+
+///\name Record access to fortran unformatted files
+//@{
+/*! Holds a file of fortran unformatted records in memory, memory mapped or, if that is not possible, loaded with a few large
+    reads, and locates its records from their record markers. The data of a record is then accessed straight from memory rather
+    than with read calls.
+*/
+struct fortran_file_records
+{
+    char *data;
+    size_t size;
+    int imapped;
+    ///offset of the data of each record and its size in bytes
+    vector<size_t> offset, nbytes;
+
+    fortran_file_records(){data=NULL;size=0;imapped=0;}
+    ~fortran_file_records(){Close();}
+    ///open a file and locate its records, returning 0 if the file can not be opened or read.
+    ///If ilittleendian is set the record markers are stored little endian, otherwise in the native byte order.
+    int Open(const char *fname, int ilittleendian=0)
+    {
+        struct stat sb;
+        int fd=open(fname,O_RDONLY);
+        if (fd<0) return 0;
+        if (fstat(fd,&sb)<0) {close(fd);return 0;}
+        size=sb.st_size;
+        data=(char*)mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (data!=MAP_FAILED) {
+            imapped=1;
+            madvise(data,size,MADV_SEQUENTIAL);
+        }
+        else {
+            imapped=0;
+            data=new char[size];
+            size_t nread=0;
+            while (nread<size) {
+                ssize_t n=pread(fd,data+nread,min(size-nread,(size_t)FORTRANREADBLOCKSIZE),nread);
+                if (n<=0) break;
+                nread+=n;
+            }
+            if (nread<size) {close(fd);Close();return 0;}
+        }
+        close(fd);
+        size_t off=0;
+        unsigned int marker, endmarker;
+        while (off+2*sizeof(unsigned int)<=size) {
+            memcpy(&marker,data+off,sizeof(marker));
+            if (ilittleendian) marker=LittleInt(marker);
+            if (off+2*sizeof(unsigned int)+marker>size) break;
+            memcpy(&endmarker,data+off+sizeof(unsigned int)+marker,sizeof(endmarker));
+            if (ilittleendian) endmarker=LittleInt(endmarker);
+            if (endmarker!=marker) break;
+            offset.push_back(off+sizeof(unsigned int));
+            nbytes.push_back(marker);
+            off+=2*sizeof(unsigned int)+marker;
+        }
+        return 1;
+    }
+    void Close()
+    {
+        if (data!=NULL) {
+            if (imapped) munmap(data,size);
+            else delete[] data;
+        }
+        data=NULL;size=0;
+        offset.clear();nbytes.clear();
+    }
+    int NumRecords(){return offset.size();}
+    const char *Record(int irec){return data+offset[irec];}
+};
+//@}
+
+#endif
@@ -11,16 +11,14 @@
 
 ///reads a gadget file. If cosmological simulation uses cosmology (generally assuming LCDM or small deviations from this) to estimate the mean interparticle spacing
 ///and scales physical linking length passed by this distance. Also reads header and over rides passed cosmological parameters with ones stored in header.
-void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons)
+void ReadGadget(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons)
 {
     //counters
-    Int_t i,j,k,n,m,temp,count,countsph,countstar,countbh,count2,bcount,bcount2,pc,pc_new, Ntot,indark,ingas,instar,Ntotfile;
+    Int_t i,k,n,count,count2,bcount,bcount2,pc,pc_new,Ntotfile;
     Int_t ntot_withmasses;
     //used to read gadget data
     unsigned int dummy;
     GADGETIDTYPE idval;
-    FLOAT ctemp[3],sphtemp;
-    REAL dtemp;
     char buf[2000];
     char DATA[5];
     //store cosmology
@@ -28,12 +26,20 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
 
     fstream *Fgad;
     struct gadget_header *header;
+    //used to read the particle data blocks
+    gadget_file_blocks gfile;
+    int iblock;
+    Int_t typestart[NGTYPE+1];
+#ifndef NOMASS
+    Int_t massoffset[NGTYPE];
+#endif
+    double tread, treadtotal=0, nbytesread=0;
     Double_t mscale,lscale,lvscale;
     Double_t MP_DM=MAXVALUE,LN,N_DM,MP_B=MAXVALUE;
-    int ifirstfile=0,*ireadfile,*ireadtask,*readtaskID;
+    int ifirstfile=0,*ireadfile,*ireadtask;
 #ifndef USEMPI
     Int_t Ntotal;
-    int ThisTask=0,NProcs=1;
+    int NProcs=1;
     ireadfile=new int[opt.num_files];
     for (i=0;i<opt.num_files;i++) ireadfile[i]=1;
     ireadtask=new int[NProcs];
@@ -45,32 +51,32 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
 #ifdef USEMPI
     //since positions, velocities, masses are all at different points in the file,
     //to correctly assign particle to proccessor with correct velocities and mass must have several file pointers
-    fstream *Fgadvel, *Fgadid, *Fgadmass, *Fgadsph;
-    fstream *Fgadstar, *Fgadbh;
-    FLOAT vtemp[3];
-    MPI_Status status;
+    FLOAT ctemp[3],vtemp[3];
+    REAL dtemp;
+    int *readtaskID;
     MPI_Comm mpi_comm_read;
     Particle *Pbuf;
     vector<Particle> *Preadbuf;
     Int_t chunksize=opt.inputbufsize,nchunk;
     Int_t BufSize=opt.mpiparticlebufsize;
-    FLOAT *ctempchunk, *vtempchunk, *sphtempchunk;
-    FLOAT *startempchunk, *bhtempchunk;
-    REAL *dtempchunk;
-    GADGETIDTYPE *idvalchunk;
+    //index of the blocks in the file
+    int ipos,ivel,iid,icache=0;
+#ifdef GASON
+    int isph;
+#endif
+#ifdef STARON
+    int istar;
+#endif
     //for parallel io
-    Int_t Nlocalbuf,*Nbuf, *Nreadbuf,*nreadoffset;
-    int ibuf=0,itask;
+    Int_t *Nbuf, *Nreadbuf;
+    int ibuf=0;
     Int_t ibufindex;
-    Int_t *Nlocalthreadbuf,Nlocaltotalbuf;
-    int *irecv, sendTask,recvTask,irecvflag, *mpi_irecvflag;
+    Int_t *Nlocalthreadbuf;
+    int *irecv, *mpi_irecvflag;
     MPI_Request *mpi_request;
-    Int_t *mpi_nsend_baryon;
-    if (opt.iBaryonSearch && opt.partsearchtype!=PSTALL) mpi_nsend_baryon=new Int_t[NProcs*NProcs];
     Int_t inreadsend,totreadsend;
     Int_t *mpi_nsend_readthread;
     Int_t *mpi_nsend_readthread_baryon;
-    if (opt.iBaryonSearch) mpi_nsend_baryon=new Int_t[NProcs*NProcs];
     if (opt.nsnapread>1) {
         mpi_nsend_readthread=new Int_t[opt.nsnapread*opt.nsnapread];
         if (opt.iBaryonSearch) mpi_nsend_readthread_baryon=new Int_t[opt.nsnapread*opt.nsnapread];
@@ -80,7 +86,6 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
     //this means that all ThisTask==0 need to be changed!
     //if (ThisTask==0) {
     Nbuf=new Int_t[NProcs];
-    nreadoffset=new Int_t[opt.nsnapread];
     ireadtask=new int[NProcs];
     readtaskID=new int[opt.nsnapread];
     MPIDistributeReadTasks(opt,ireadtask,readtaskID);
@@ -103,20 +108,6 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
         inreadsend=0;
         for (int j=0;j<opt.num_files;j++) inreadsend+=ireadfile[j];
         MPI_Allreduce(&inreadsend,&totreadsend,1,MPI_Int_t,MPI_MIN,mpi_comm_read);
-
-        ctempchunk=new FLOAT[3*chunksize];
-        vtempchunk=new FLOAT[3*chunksize];
-        dtempchunk=new REAL[chunksize];
-        idvalchunk=new GADGETIDTYPE[chunksize];
-#ifdef GASON
-        sphtempchunk=new FLOAT[NUMGADGETSPHBLOCKS*chunksize];
-#endif
-#ifdef STARON
-        startempchunk=new FLOAT[NUMGADGETSTARBLOCKS*chunksize];
-#endif
-#ifdef BHON
-        bhtempchunk=new FLOAT[NUMGADGETBHBLOCKS*chunksize];
-#endif
     }
     else {
         Nlocalthreadbuf=new Int_t[opt.nsnapread];
@@ -133,9 +124,6 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
 #endif
     //opening file
 #define SKIP2 Fgad[i].read((char*)&dummy, sizeof(dummy));
-#define SKIPV2 Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-#define SKIPI2 Fgadid[i].read((char*)&dummy, sizeof(dummy));
-#define SKIPM2 Fgadmass[i].read((char*)&dummy, sizeof(dummy));
 
     Fgad=new fstream[opt.num_files];
     header=new gadget_header[opt.num_files];
@@ -162,6 +150,8 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
         Fgad[i].read((char*)&dummy, sizeof(dummy));
         //endian indep call
         header[i].Endian();
+        //particle data is read in blocks, see below
+        Fgad[i].close();
     }
     opt.p=header[ifirstfile].BoxSize;
     //if input is from a cosmological box, the following cosmological parameters have meaning
@@ -230,478 +220,203 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
 
     count2=bcount2=0;
 #ifndef USEMPI
-    //now read and store data appropriately
+    //each file is held in memory and the blocks decoded in parallel. The local index of every particle in the file, which is
+    //ipart>=0 for Part, -2-ipart for Pbaryons and -1 if not stored, is found once and used to decode every block.
+    vector<Int_t> ipart;
+    vector<int> ptype;
+    double mpdm=MAXVALUE, mpb=MAXVALUE;
     for(i=0,count=0,bcount=0,pc=0;i<opt.num_files; i++,pc=pc_new,count=count2,bcount=bcount2)
     {
-        indark=instar=ingas=0;
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
-#endif
+        if(opt.num_files>1) sprintf(buf,"%s.%d",opt.fname,i);
+        else sprintf(buf,"%s",opt.fname);
+        tread=MyGetTime();
+        if (!gfile.Open(buf)) {cout<<"can't open file "<<buf<<endl;exit(0);}
+        iblock=0;
+        //determine number of particles with masses that need to be read and where each type starts in the blocks
+        for(k=0, Ntotfile=0, ntot_withmasses=0; k<NGTYPE; k++) {
+            typestart[k]=Ntotfile;Ntotfile+=header[i].npart[k];
 #ifndef NOMASS
-        //determine number of particles with masses that need to be read
-        for(k=0, ntot_withmasses=0; k<NGTYPE; k++) if(header[i].mass[k]==0) ntot_withmasses+= header[i].npart[k];
-#endif
-        for(k=0, Ntotfile=0; k<NGTYPE; k++) Ntotfile+=header[i].npart[k];
-        //and read positions, velocities, ids, masses, etc
-        SKIP2;
-        if (dummy/Ntotfile/3!=sizeof(FLOAT)) {cout<<" mismatch in position type size, file has "<<dummy/Ntotfile/3<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
+            massoffset[k]=ntot_withmasses;
+#endif
+            if(header[i].mass[k]==0) ntot_withmasses+=header[i].npart[k];
+        }
+        typestart[NGTYPE]=Ntotfile;
+        ipart.resize(Ntotfile);
+        ptype.resize(Ntotfile);
+        //the particles kept when subsampling are chosen by id, the third block after the header
+        if (opt.isubsample>1 && (gfile.NumBlocks()<=3 || (Ntotfile>0 && gfile.nbytes[3]/Ntotfile!=sizeof(idval)))) {cout<<buf<<" has no id block of the expected size to subsample"<<endl;exit(9);}
+        //and the low resolution particles kept when reading the high resolution region of a zoom simulation by position, the first block
+        if (opt.zoomregion.iset && (gfile.NumBlocks()<=1 || (Ntotfile>0 && gfile.nbytes[1]/Ntotfile/3!=sizeof(FLOAT)))) {cout<<buf<<" has no position block of the expected size to select the zoom region"<<endl;exit(9);}
+        for(k=0,count2=count,bcount2=bcount;k<NGTYPE;k++)
         {
-            for(n=0;n<header[i].npart[k];n++)
+            for(n=typestart[k];n<typestart[k+1];n++)
             {
-                Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT)*3);
-                if (opt.partsearchtype==PSTALL) {
-                    for (m=0;m<3;m++) Part[count2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                    count2++;
-                }
+                ptype[n]=k;
+                ipart[n]=-1;
+                if (opt.isubsample>1 && !SubsampleKeep(opt,GadgetBlockValue<GADGETIDTYPE>(gfile.Block(3),n))) continue;
+                if (opt.zoomregion.iset && !opt.zoomregion.Keep(k,GadgetBlockValue<FLOAT>(gfile.Block(1),3*n),
+                    GadgetBlockValue<FLOAT>(gfile.Block(1),3*n+1),GadgetBlockValue<FLOAT>(gfile.Block(1),3*n+2))) continue;
+                if (opt.partsearchtype==PSTALL) ipart[n]=count2++;
                 else if (opt.partsearchtype==PSTDARK) {
-                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) {
-                        for (m=0;m<3;m++) Part[count2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                    else {
-                        if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE)) {
-                            for (m=0;m<3;m++) Pbaryons[bcount2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                            bcount2++;
-                        }
-                    }
+                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) ipart[n]=count2++;
+                    else if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE)) ipart[n]=-2-(bcount2++);
                 }
                 else if (opt.partsearchtype==PSTSTAR) {
-                    if (k==GSTARTYPE) {
-                        for (m=0;m<3;m++) Part[count2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
+                    if (k==GSTARTYPE) ipart[n]=count2++;
                 }
                 else if (opt.partsearchtype==PSTGAS) {
-                    if (k==GGASTYPE) {
-                        for (m=0;m<3;m++) Part[count2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
+                    if (k==GGASTYPE) ipart[n]=count2++;
                 }
-                pc_new++;
             }
         }
-        SKIP2;
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
+        pc_new=pc+Ntotfile;
+#define GADGETPART(n) ((ipart[n]>=0)?Part[ipart[n]]:Pbaryons[-2-ipart[n]])
+#define NEXTBLOCK(name) if (++iblock>=gfile.NumBlocks()) {cout<<buf<<" has no "<<name<<" block"<<endl;exit(9);} \
+        if (gfile.label[iblock].size()>0) cout<<"reading "<<gfile.label[iblock]<<endl;
+
+        //and read positions, velocities, ids, masses, etc
+        NEXTBLOCK("position");
+        if (Ntotfile>0 && gfile.nbytes[iblock]/Ntotfile/3!=sizeof(FLOAT)) {cout<<" mismatch in position type size, file has "<<gfile.nbytes[iblock]/Ntotfile/3<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
 #endif
-        SKIP2;
-        if (dummy/Ntotfile/3!=sizeof(FLOAT)) {cout<<" mismatch in velocity type size, file has "<<dummy/Ntotfile/3<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            for(n=0;n<header[i].npart[k];n++)
-            {
-                Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT)*3);
-                if (opt.partsearchtype==PSTALL) {
-                    for (m=0;m<3;m++) Part[count2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                    count2++;
-                }
-                else if (opt.partsearchtype==PSTDARK) {
-                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) {
-                        for (m=0;m<3;m++) Part[count2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                    else {
-                        if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE)) {
-                            for (m=0;m<3;m++) Pbaryons[bcount2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                            bcount2++;
-                        }
-                    }
-                }
-                else if (opt.partsearchtype==PSTSTAR) {
-                    if (k==GSTARTYPE) {
-                        for (m=0;m<3;m++) Part[count2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                }
-                else if (opt.partsearchtype==PSTGAS) {
-                    if (k==GGASTYPE) {
-                        for (m=0;m<3;m++) Part[count2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                }
-                pc_new++;
-            }
-        }
-        SKIP2;
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
+        for(n=0;n<Ntotfile;n++) if (ipart[n]!=-1)
+            for (int m=0;m<3;m++) GADGETPART(n).SetPosition(m,GadgetBlockValue<FLOAT>(gfile.Block(iblock),3*n+m));
+
+        NEXTBLOCK("velocity");
+        if (Ntotfile>0 && gfile.nbytes[iblock]/Ntotfile/3!=sizeof(FLOAT)) {cout<<" mismatch in velocity type size, file has "<<gfile.nbytes[iblock]/Ntotfile/3<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
 #endif
-        SKIP2;
-        if (dummy/Ntotfile!=sizeof(idval)) {cout<<" mismatch in ID type size, file has "<<dummy/Ntotfile<<" but using "<<sizeof(idval)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            for(n=0;n<header[i].npart[k];n++) {
-                Fgad[i].read((char*)&idval, sizeof(idval));
-#ifdef GADGETLONGID
-                idval=LittleLongInt(idval);
-#else
-                idval=LittleInt(idval);
+        for(n=0;n<Ntotfile;n++) if (ipart[n]!=-1)
+            for (int m=0;m<3;m++) GADGETPART(n).SetVelocity(m,GadgetBlockValue<FLOAT>(gfile.Block(iblock),3*n+m));
+
+        NEXTBLOCK("id");
+        if (Ntotfile>0 && gfile.nbytes[iblock]/Ntotfile!=sizeof(idval)) {cout<<" mismatch in ID type size, file has "<<gfile.nbytes[iblock]/Ntotfile<<" but using "<<sizeof(idval)<<endl;exit(9);}
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static) private(k)
 #endif
-                if (opt.partsearchtype==PSTALL) {
-                    Part[count2].SetPID(idval);
-                    Part[count2].SetID(count2);
+        for(n=0;n<Ntotfile;n++) if (ipart[n]!=-1)
+        {
+            k=ptype[n];
+            Particle &p=GADGETPART(n);
+            p.SetPID(GadgetBlockValue<GADGETIDTYPE>(gfile.Block(iblock),n));
+            if (ipart[n]>=0) p.SetID(ipart[n]);
+            else p.SetID(-2-ipart[n]+nbodies);
+            if (opt.partsearchtype==PSTALL) {
 #ifdef HIGHRES
-                    if (!(k==GGASTYPE || k==GSTARTYPE || k==GBHTYPE)) Part[count2].SetType(DARKTYPE);
-                    else Part[count2].SetType(k);
+                if (!(k==GGASTYPE || k==GSTARTYPE || k==GBHTYPE)) p.SetType(DARKTYPE);
+                else p.SetType(k);
 #else
-                    Part[count2].SetType(k);
+                p.SetType(k);
 #endif
-                    count2++;
-                }
-                else if (opt.partsearchtype==PSTDARK) {
-                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) {
-                        Part[count2].SetPID(idval);
-                        Part[count2].SetID(count2);
-                        Part[count2].SetType(DARKTYPE);
-                        count2++;
-                    }
-                    else {
-                        if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE || k==GBHTYPE)) {
-                            Pbaryons[bcount2].SetPID(idval);
-                            Pbaryons[bcount2].SetID(bcount2+nbodies);
-                            Pbaryons[bcount2].SetType(STARTYPE*(k==GSTARTYPE)+GASTYPE*(k==GGASTYPE)+BHTYPE*(k==GBHTYPE));
-                            bcount2++;
-                        }
-                    }
-                }
-                else if (opt.partsearchtype==PSTSTAR) {
-                    if (k==GSTARTYPE) {
-                        Part[count2].SetPID(idval);
-                        Part[count2].SetID(count2);
-                        Part[count2].SetType(STARTYPE);
-                        count2++;
-                    }
-                }
-                else if (opt.partsearchtype==PSTGAS) {
-                    if (k==GGASTYPE) {
-                        Part[count2].SetPID(idval);
-                        Part[count2].SetID(count2);
-                        Part[count2].SetType(GASTYPE);
-                        count2++;
-                    }
-                }
-                pc_new++;
             }
+            else if (opt.partsearchtype==PSTDARK) {
+                if (ipart[n]>=0) p.SetType(DARKTYPE);
+                else p.SetType(STARTYPE*(k==GSTARTYPE)+GASTYPE*(k==GGASTYPE)+BHTYPE*(k==GBHTYPE));
+            }
+            else if (opt.partsearchtype==PSTSTAR) p.SetType(STARTYPE);
+            else if (opt.partsearchtype==PSTGAS) p.SetType(GASTYPE);
         }
-        SKIP2;
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
-#endif
 #ifndef NOMASS
+        //if mass is read from header then does not need to be altered for endian, but must be altered if read from file.
         if(ntot_withmasses>0) {
-        SKIP2;
-        if (dummy/ntot_withmasses!=sizeof(REAL)) {cout<<" mismatch in mass type size, file has "<<dummy/ntot_withmasses<<" but using "<<sizeof(REAL)<<endl;exit(9);}
+        NEXTBLOCK("mass");
+        if (gfile.nbytes[iblock]/ntot_withmasses!=sizeof(REAL)) {cout<<" mismatch in mass type size, file has "<<gfile.nbytes[iblock]/ntot_withmasses<<" but using "<<sizeof(REAL)<<endl;exit(9);}
         }
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static) private(k) reduction(min:mpdm,mpb)
+#endif
+        for(n=0;n<Ntotfile;n++)
         {
-            for(n=0;n<header[i].npart[k];n++)
-            {
-                //if mass is read from header then does not need to
-                //be altered for endian. but must be altered if read from file.
-                if(header[i].mass[k]==0) {
-                    Fgad[i].read((char*)&dtemp, sizeof(REAL));
-                    dtemp=LittleREAL(dtemp);
-                }
-                else dtemp=header[i].mass[k];
-                if(k!=GGASTYPE && k!=GSTARTYPE && dtemp<MP_DM&&dtemp>0) MP_DM=dtemp;
-                if(k==GGASTYPE && dtemp<MP_B&&dtemp>0) MP_B=dtemp;
-                if (opt.partsearchtype==PSTALL) {
-                    Part[count2].SetMass(dtemp);
-                    count2++;
-                }
-                else if (opt.partsearchtype==PSTDARK) {
-                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) {
-                        Part[count2].SetMass(dtemp);
-                        count2++;
-                    }
-                    else {
-                        if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE)) {
-                            Pbaryons[bcount2].SetMass(dtemp);
-                            bcount2++;
-                        }
-                    }
-                }
-                else if (opt.partsearchtype==PSTSTAR) {
-                    if (k==GSTARTYPE) {
-                        Part[count2].SetMass(dtemp);
-                        count2++;
-                    }
-                }
-                else if (opt.partsearchtype==PSTGAS) {
-                    if (k==GGASTYPE) {
-                        Part[count2].SetMass(dtemp);
-                        count2++;
-                    }
-                }
-                pc_new++;
-            }
+            k=ptype[n];
+            REAL dtemp;
+            if(header[i].mass[k]==0) dtemp=GadgetBlockValue<REAL>(gfile.Block(iblock),massoffset[k]+n-typestart[k]);
+            else dtemp=header[i].mass[k];
+            if(k!=GGASTYPE && k!=GSTARTYPE && dtemp<mpdm&&dtemp>0) mpdm=dtemp;
+            if(k==GGASTYPE && dtemp<mpb&&dtemp>0) mpb=dtemp;
+            if (ipart[n]!=-1) GADGETPART(n).SetMass(dtemp);
         }
-        if(ntot_withmasses>0) SKIP2;
+#else
+        //masses are not stored but the block must still be skipped
+        if(ntot_withmasses>0) iblock++;
 #endif
         //more information contained in sph particles and if there is sf feed back but for the moment, ignore
         //other quantities
         if (header[i].npartTotal[GGASTYPE]>0) {
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
-#endif
-        SKIP2;
-        if (dummy/header[i].npart[GGASTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in SPH type size, file has "<<dummy/header[i].npart[GGASTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            if (k==GGASTYPE) {
-                if ((opt.partsearchtype==PSTALL || opt.partsearchtype==PSTGAS || (opt.partsearchtype==PSTDARK && opt.iBaryonSearch==1))) {
-                for(n=0;n<header[i].npart[k];n++) {
-                    Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT));
-                    if (opt.partsearchtype==PSTALL || opt.partsearchtype==PSTGAS) {
+        NEXTBLOCK("SPH");
+        if (header[i].npart[GGASTYPE]>0 && gfile.nbytes[iblock]/header[i].npart[GGASTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in SPH type size, file has "<<gfile.nbytes[iblock]/header[i].npart[GGASTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
 #ifdef GASON
-                        Part[count2].SetU(ctemp[0]);
+        if (opt.iinputfields&INPUTFIELDU) {
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
 #endif
-                        count2++;
-                    }
-                    else if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch==1) {
-#ifdef GASON
-                        Pbaryons[bcount2].SetU(ctemp[0]);
-#endif
-                        bcount2++;
-                    }
-                    pc_new++;
-                }
-                }
-                else Fgad[i].seekg(header[i].npart[GGASTYPE]*sizeof(FLOAT),ios::cur);
-            }
+        for(n=typestart[GGASTYPE];n<typestart[GGASTYPE+1];n++) if (ipart[n]!=-1) GADGETPART(n).SetU(GadgetBlockValue<FLOAT>(gfile.Block(iblock),n-typestart[GGASTYPE]));
         }
-        SKIP2
+#endif
 #if defined(EXTRASPHINFO)&&defined(GASON)
         //then gas densities and softening lengths
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
+        NEXTBLOCK("SPH");
+        if (header[i].npart[GGASTYPE]>0 && gfile.nbytes[iblock]/header[i].npart[GGASTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in SPH type size, file has "<<gfile.nbytes[iblock]/header[i].npart[GGASTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
+        if (opt.iinputfields&INPUTFIELDSPHDEN) {
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
 #endif
-        SKIP2;
-        if (dummy/header[i].npart[GGASTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in SPH type size, file has "<<dummy/header[i].npart[GGASTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            if (k==GGASTYPE) {
-                if ((opt.partsearchtype==PSTALL || opt.partsearchtype==PSTGAS || (opt.partsearchtype==PSTDARK && opt.iBaryonSearch==1))) {
-                for(n=0;n<header[i].npart[k];n++) {
-                    Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT));
-                    if (opt.partsearchtype==PSTALL || opt.partsearchtype==PSTGAS) {
-                        Part[count2].SetSPHDen(ctemp[0]);
-                        count2++;
-                    }
-                    else if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch==1) {
-                        Pbaryons[bcount2].SetSPHDen(ctemp[0]);
-                        bcount2++;
-                    }
-                    pc_new++;
-                }
-                }
-                else Fgad[i].seekg(header[i].npart[GGASTYPE]*sizeof(FLOAT),ios::cur);
-            }
+        for(n=typestart[GGASTYPE];n<typestart[GGASTYPE+1];n++) if (ipart[n]!=-1) GADGETPART(n).SetSPHDen(GadgetBlockValue<FLOAT>(gfile.Block(iblock),n-typestart[GGASTYPE]));
         }
-        SKIP2
 
         //next skip N gas blocks where, typically N is 4 for Ne, Nh, HSML, SFR. Note that if header indicates SFR block, data is kept
         for (int nsphblocks=0;nsphblocks<opt.gnsphblocks;nsphblocks++) {
-        //ignored
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
-#endif
-        if (!strcmp(DATA,"SFR ")){
-        SKIP2;
-        if (dummy/header[i].npart[GGASTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in SPH type size, file has "<<dummy/header[i].npart[GGASTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        Fgad[i].seekg(header[i].npart[GGASTYPE]*sizeof(FLOAT),ios::cur);
-        SKIP2;
-        }
-        else {
-        SKIP2;
-        if (dummy/header[i].npart[GGASTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in SPH type size, file has "<<dummy/header[i].npart[GGASTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            if (k==GGASTYPE) {
-                if ((opt.partsearchtype==PSTALL || opt.partsearchtype==PSTGAS || (opt.partsearchtype==PSTDARK && opt.iBaryonSearch==1))) {
-                for(n=0;n<header[i].npart[k];n++) {
-                    Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT));
-                    if (opt.partsearchtype==PSTALL || opt.partsearchtype==PSTGAS) {
+        NEXTBLOCK("SPH");
+        if (header[i].npart[GGASTYPE]>0 && gfile.nbytes[iblock]/header[i].npart[GGASTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in SPH type size, file has "<<gfile.nbytes[iblock]/header[i].npart[GGASTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
+        if (gfile.label[iblock]=="SFR ") continue;
+        if (opt.iinputfields&INPUTFIELDSFR) {
 #ifdef STARON
-                        Part[count2].SetSFR(ctemp[0]);
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
 #endif
-                        count2++;
-                    }
-                    else if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch==1) {
-#ifdef STARON
-                        Pbaryons[bcount2].SetSFR(ctemp[0]);
+        for(n=typestart[GGASTYPE];n<typestart[GGASTYPE+1];n++) if (ipart[n]!=-1) GADGETPART(n).SetSFR(GadgetBlockValue<FLOAT>(gfile.Block(iblock),n-typestart[GGASTYPE]));
 #endif
-                        bcount2++;
-                    }
-                    pc_new++;
-                }
-                }
-                else Fgad[i].seekg(header[i].npart[GGASTYPE]*sizeof(FLOAT),ios::cur);
-            }
-        }
-        SKIP2;
         }
         }
-
 #endif
         }
 
 #ifdef EXTRASTARINFO
         //then star ages
         if (header[i].npartTotal[GSTARTYPE]>0) {
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
-#endif
-        SKIP2;
-        if (dummy/header[i].npart[GSTARTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in Star type size, file has "<<dummy/header[i].npart[GSTARTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            for(n=0;n<header[i].npart[k];n++) {
-                if (k==GSTARTYPE) Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT));
-                if (opt.partsearchtype==PSTALL) {
-                    if (k==GSTARTYPE) {
-#ifdef STARON
-                        Part[count2].SetTage(ctemp[0]);
-#endif
-                    }
-                    count2++;
-                }
-                else if (opt.partsearchtype==PSTDARK) {
-                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) {
-                        count2++;
-                    }
-                    else {
-                        if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE)) {
-                            if (k==GSTARTYPE) {
+        NEXTBLOCK("star age");
+        if (header[i].npart[GSTARTYPE]>0 && gfile.nbytes[iblock]/header[i].npart[GSTARTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in Star type size, file has "<<gfile.nbytes[iblock]/header[i].npart[GSTARTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
 #ifdef STARON
-                                Pbaryons[bcount2].SetTage(ctemp[0]);
+        if (opt.iinputfields&INPUTFIELDTAGE) {
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
 #endif
-                            }
-                            bcount2++;
-                        }
-                    }
-                }
-                else if (opt.partsearchtype==PSTSTAR) {
-                    if (k==GSTARTYPE) {
-#ifdef STARON
-                        Part[count2].SetTage(ctemp[0]);
-#endif
-                        count2++;
-                    }
-                }
-                else if (opt.partsearchtype==PSTGAS) {
-                    if (k==GGASTYPE) {
-                        count2++;
-                    }
-                }
-                pc_new++;
-            }
+        for(n=typestart[GSTARTYPE];n<typestart[GSTARTYPE+1];n++) if (ipart[n]!=-1)
+            GADGETPART(n).SetTage(GadgetBlockValue<FLOAT>(gfile.Block(iblock),n-typestart[GSTARTYPE]));
         }
-        SKIP2;
-        //then metallicity of gas AND stars
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
-#endif
-        SKIP2;
-        if (dummy/(header[i].npart[GSTARTYPE]+header[i].npart[GGASTYPE])!=sizeof(FLOAT)) {cout<<" mismatch in SPH+STAR type size, file has "<<dummy/(header[i].npart[GSTARTYPE]+header[i].npart[GGASTYPE])<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            for(n=0;n<header[i].npart[k];n++) {
-                if (k==GSTARTYPE||k==GGASTYPE) Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT));
-                if (opt.partsearchtype==PSTALL) {
-                    if (k==GSTARTYPE||k==GGASTYPE) {
-#if defined(STARON)
-                        Part[count2].SetZmet(ctemp[0]);
 #endif
-                    }
-                    count2++;
-                }
-                else if (opt.partsearchtype==PSTDARK) {
-                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) {
-                        count2++;
-                    }
-                    else {
-                        if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE)) {
-                            if (k==GSTARTYPE||k==GGASTYPE) {
-#if defined(STARON)
-                                Pbaryons[bcount2].SetZmet(ctemp[0]);
-#endif
-                            }
-                            bcount2++;
-                        }
-                    }
-                }
-                else if (opt.partsearchtype==PSTSTAR) {
-                    if (k==GSTARTYPE) {
-#if defined(STARON)
-                        Part[count2].SetZmet(ctemp[0]);
+        //then metallicity of gas AND stars
+        NEXTBLOCK("metallicity");
+        if ((header[i].npart[GSTARTYPE]+header[i].npart[GGASTYPE])>0 && gfile.nbytes[iblock]/(header[i].npart[GSTARTYPE]+header[i].npart[GGASTYPE])!=sizeof(FLOAT)) {cout<<" mismatch in SPH+STAR type size, file has "<<gfile.nbytes[iblock]/(header[i].npart[GSTARTYPE]+header[i].npart[GGASTYPE])<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
+#ifdef STARON
+        if (opt.iinputfields&INPUTFIELDZMET) {
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
 #endif
-                        count2++;
-                    }
-                }
-                else if (opt.partsearchtype==PSTGAS) {
-                    if (k==GGASTYPE) {
-#if defined(STARON)
-                        Part[count2].SetZmet(ctemp[0]);
+        for(n=typestart[GGASTYPE];n<typestart[GGASTYPE+1];n++) if (ipart[n]!=-1)
+            GADGETPART(n).SetZmet(GadgetBlockValue<FLOAT>(gfile.Block(iblock),n-typestart[GGASTYPE]));
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
 #endif
-                        count2++;
-                    }
-                }
-                pc_new++;
-            }
+        for(n=typestart[GSTARTYPE];n<typestart[GSTARTYPE+1];n++) if (ipart[n]!=-1)
+            GADGETPART(n).SetZmet(GadgetBlockValue<FLOAT>(gfile.Block(iblock),header[i].npart[GGASTYPE]+n-typestart[GSTARTYPE]));
         }
-        SKIP2;
-
+#endif
         //extra star blocks
         for (int nstarblocks=0;nstarblocks<opt.gnstarblocks;nstarblocks++) {
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
-#endif
-        SKIP2;
-        if (dummy/header[i].npart[GSTARTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in STAR type size, file has "<<dummy/header[i].npart[GSTARTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        Fgad[i].seekg(header[i].npart[GSTARTYPE]*sizeof(FLOAT),ios::cur);
-        SKIP2;
+        NEXTBLOCK("star");
+        if (header[i].npart[GSTARTYPE]>0 && gfile.nbytes[iblock]/header[i].npart[GSTARTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in STAR type size, file has "<<gfile.nbytes[iblock]/header[i].npart[GSTARTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
         }
         }
 #endif
@@ -710,23 +425,26 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
         //typical to have black hole ages, black hole scale, black hole mass perhaps
         if (header[i].npartTotal[GBHTYPE]>0) {
         for (int nbhblocks=0;nbhblocks<opt.gnbhblocks;nbhblocks++) {
-#ifdef GADGET2FORMAT
-        SKIP2;
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        SKIP2;
-        SKIP2;
-        cout<<"reading "<<DATA<<endl;
-#endif
-        SKIP2;
-        if (dummy/header[i].npart[GBHTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in BH type size, file has "<<dummy/header[i].npart[GBHTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        Fgad[i].seekg(header[i].npart[GBHTYPE]*sizeof(FLOAT),ios::cur);
-        SKIP2;
+        NEXTBLOCK("BH");
+        if (header[i].npart[GBHTYPE]>0 && gfile.nbytes[iblock]/header[i].npart[GBHTYPE]!=sizeof(FLOAT)) {cout<<" mismatch in BH type size, file has "<<gfile.nbytes[iblock]/header[i].npart[GBHTYPE]<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
         }
         }
 #endif
-
-        Fgad[i].close();
+#undef NEXTBLOCK
+#undef GADGETPART
+        nbytesread+=gfile.size;
+        treadtotal+=MyGetTime()-tread;
+        gfile.Close();
+    }
+    MP_DM=mpdm;MP_B=mpb;
+    //number stored is smaller than that in the header if the input is subsampled or only the high resolution region of a zoom simulation
+    //is read, in which case baryons are indexed after those stored
+    if (opt.isubsample>1 || opt.zoomregion.iset) {
+        nbodies=count2;
+        nbaryons=bcount2;
+        for (i=0;i<nbaryons;i++) Pbaryons[i].SetID(i+nbodies);
     }
+    cout<<"Read "<<nbytesread/1048576.0<<" MB of gadget data in "<<treadtotal<<" s ("<<nbytesread/1048576.0/max(treadtotal,1e-9)<<" MB/s)"<<endl;
     //finally adjust to appropriate units
     for (i=0;i<nbodies;i++)
     {
@@ -748,306 +466,59 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
 
 #else
     inreadsend=0;
-    Fgadvel=new fstream[opt.num_files];
-    Fgadid=new fstream[opt.num_files];
-    Fgadmass=new fstream[opt.num_files];
-    Fgadsph=new fstream[opt.num_files*NUMGADGETSPHBLOCKS];
-    Fgadstar=new fstream[opt.num_files*NUMGADGETSTARBLOCKS];
-    Fgadbh=new fstream[opt.num_files*NUMGADGETBHBLOCKS];
-    for(i=0; i<opt.num_files; i++)
+    //each file is held in memory and the blocks of a chunk of particles decoded in parallel before the particles are distributed
+    vector<FLOAT> ctempchunk(3*chunksize), vtempchunk(3*chunksize);
+    vector<GADGETIDTYPE> idvalchunk(chunksize);
+#ifndef NOMASS
+    vector<REAL> dtempchunk(chunksize);
+#endif
+#ifdef GASON
+    vector<FLOAT> sphtempchunk(NUMGADGETSPHBLOCKS*chunksize);
+#endif
+#ifdef STARON
+    vector<FLOAT> startempchunk(NUMGADGETSTARBLOCKS*chunksize);
+#endif
+    for(i=0,count=0,pc=0;i<opt.num_files; i++,pc=pc_new,count=count2)
     if (ireadfile[i])
     {
         if(opt.num_files>1) sprintf(buf,"%s.%d",opt.fname,i);
         else sprintf(buf,"%s",opt.fname);
-
-        count=0;for(k=0;k<NGTYPE;k++)count+=header[i].npart[k];
-
-        //offset all the files for easy reading
-        Fgadvel[i].open(buf,ios::in);
-        Fgadid[i].open(buf,ios::in);
-        Fgadmass[i].open(buf,ios::in);
-        for (int sphblocks=0;sphblocks<NUMGADGETSPHBLOCKS;sphblocks++) Fgadsph[i+sphblocks].open(buf,ios::in);
-        for (int starblocks=0;starblocks<NUMGADGETSTARBLOCKS;starblocks++) Fgadstar[i+starblocks].open(buf,ios::in);
-        for (int bhblocks=0;bhblocks<NUMGADGETBHBLOCKS;bhblocks++) Fgadbh[i+bhblocks].open(buf,ios::in);
-#ifdef GADGET2FORMAT
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].read((char*)&header[i], sizeof(gadget_header));
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&header[i], sizeof(gadget_header));
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&header[i], sizeof(gadget_header));
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        //endian indep call
-        header[i].Endian();
-
-        //move to velocities
-#ifdef GADGET2FORMAT
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].seekg(count*3*sizeof(FLOAT),ios::cur);
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-
-        //move to ids
-#ifdef GADGET2FORMAT
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].seekg(count*3*sizeof(FLOAT),ios::cur);
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-#ifdef GADGET2FORMAT
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].seekg(count*3*sizeof(FLOAT),ios::cur);
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-
-        //move to masses
-#ifdef GADGET2FORMAT
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].seekg(count*3*sizeof(FLOAT),ios::cur);
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-#ifdef GADGET2FORMAT
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].seekg(count*3*sizeof(FLOAT),ios::cur);
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-
-#ifdef GADGET2FORMAT
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].seekg(count*sizeof(idval),ios::cur);
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-
-#ifdef GASON
-        //move to sph
-        for (int sphblocks=0;sphblocks<NUMGADGETSPHBLOCKS;sphblocks++){
-#ifdef GADGET2FORMAT
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].seekg(count*3*sizeof(FLOAT),ios::cur);
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-#ifdef GADGET2FORMAT
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].seekg(count*3*sizeof(FLOAT),ios::cur);
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-
-#ifdef GADGET2FORMAT
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].seekg(count*sizeof(idval),ios::cur);
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-
-#ifdef GADGET2FORMAT
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        for (int k=0;k<NGTYPE;k++)
-            if(header[i].mass[k]==0)
-              Fgadsph[i+sphblocks].seekg(header[i].npart[k]*sizeof(REAL),ios::cur);
-        Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        }
-
-        //offset each sph block appropriately
-        for (int sphstart=1;sphstart<NUMGADGETSPHBLOCKS;sphstart++){
-        for (int  sphblocks=0;sphblocks<sphstart;sphblocks++){
-#ifdef GADGET2FORMAT
-            Fgadsph[i+sphstart].read((char*)&dummy, sizeof(dummy));
-            Fgadsph[i+sphstart].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-            Fgadsph[i+sphstart].read((char*)&dummy, sizeof(dummy));
-            Fgadsph[i+sphstart].read((char*)&dummy, sizeof(dummy));
-#endif
-            Fgadsph[i+sphstart].read((char*)&dummy, sizeof(dummy));
-            countsph=dummy;
-            Fgadsph[i+sphstart].seekg(countsph,ios::cur);
-            Fgadsph[i+sphstart].read((char*)&dummy, sizeof(dummy));
-        }
+        tread=MyGetTime();
+        if (!gfile.Open(buf)) {cout<<"can't open file "<<buf<<endl;MPIStopProgressThread();MPI_Abort(MPI_COMM_WORLD,8);}
+        //determine number of particles with masses that need to be read and where each type starts in the blocks
+        for(k=0, Ntotfile=0, ntot_withmasses=0; k<NGTYPE; k++) {
+            typestart[k]=Ntotfile;Ntotfile+=header[i].npart[k];
+#ifndef NOMASS
+            massoffset[k]=ntot_withmasses;
+#endif
+            if(header[i].mass[k]==0) ntot_withmasses+=header[i].npart[k];
         }
+        //blocks following the header are positions, velocities, ids, masses if any are not in the header, then sph and star blocks
+        iblock=1;
+        ipos=iblock++;ivel=iblock++;iid=iblock++;
+        if (ntot_withmasses>0) iblock++;
+#ifdef GASON
+        isph=iblock;
 #endif
-
+        if (header[i].npartTotal[GGASTYPE]>0) iblock+=NUMGADGETSPHBLOCKS;
 #ifdef STARON
-        //move to star
-        for (int starblocks=0;starblocks<NUMGADGETSTARBLOCKS;starblocks++){
-#ifdef GADGET2FORMAT
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].seekg(count*3*sizeof(FLOAT),ios::cur);
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-#ifdef GADGET2FORMAT
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].seekg(count*3*sizeof(FLOAT),ios::cur);
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-
-#ifdef GADGET2FORMAT
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].seekg(count*sizeof(idval),ios::cur);
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-
-#ifdef GADGET2FORMAT
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        for (int k=0;k<NGTYPE;k++)
-            if(header[i].mass[k]==0)
-              Fgadstar[i+starblocks].seekg(header[i].npart[k]*sizeof(REAL),ios::cur);
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-
-        for (int sphblocks=0;sphblocks<NUMGADGETSPHBLOCKS;sphblocks++){
-#ifdef GADGET2FORMAT
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-#endif
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        Fgadstar[i+starblocks].seekg(header[i].npart[GGASTYPE]*sizeof(FLOAT),ios::cur);
-        Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        }
-        }
-
-        //offset each star block appropriately
-        for (int starstart=1;starstart<NUMGADGETSTARBLOCKS;starstart++){
-        for (int starblocks=0;starblocks<starstart;starblocks++){
-#ifdef GADGET2FORMAT
-            Fgadstar[i+starstart].read((char*)&dummy, sizeof(dummy));
-            Fgadstar[i+starstart].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-            Fgadstar[i+starstart].read((char*)&dummy, sizeof(dummy));
-            Fgadstar[i+starstart].read((char*)&dummy, sizeof(dummy));
-#endif
-            Fgadstar[i+starstart].read((char*)&dummy, sizeof(dummy));
-            countstar=dummy;
-            Fgadstar[i+starstart].seekg(countstar,ios::cur);
-            Fgadstar[i+starstart].read((char*)&dummy, sizeof(dummy));
-        }
-        }
+        istar=iblock;
 #endif
-
-        //need black hole offset
-
-#ifdef GADGET2FORMAT
-        Fgad[i].read((char*)&dummy, sizeof(dummy));
-        Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgad[i].read((char*)&dummy, sizeof(dummy));
-        Fgad[i].read((char*)&dummy, sizeof(dummy));
-
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-
-        for (int sphblocks=0;sphblocks<NUMGADGETSPHBLOCKS;sphblocks++){
-            Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-            Fgadsph[i+sphblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-            Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-            Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        }
-
-        for (int starblocks=0;starblocks<NUMGADGETSTARBLOCKS;starblocks++){
-            Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-            Fgadstar[i+starblocks].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-            Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-            Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
-        }
+        if (gfile.NumBlocks()<=iid) {cout<<buf<<" is missing position, velocity or id blocks"<<endl;MPIStopProgressThread();MPI_Abort(MPI_COMM_WORLD,8);}
+        if (Ntotfile>0 && gfile.nbytes[ipos]/Ntotfile/3!=sizeof(FLOAT)) {cout<<" mismatch in position type size, file has "<<gfile.nbytes[ipos]/Ntotfile/3<<" but using "<<sizeof(FLOAT)<<endl;MPIStopProgressThread();MPI_Abort(MPI_COMM_WORLD,9);}
+        if (Ntotfile>0 && gfile.nbytes[iid]/Ntotfile!=sizeof(idval)) {cout<<" mismatch in ID type size, file has "<<gfile.nbytes[iid]/Ntotfile<<" but using "<<sizeof(idval)<<endl;MPIStopProgressThread();MPI_Abort(MPI_COMM_WORLD,9);}
+#ifndef NOMASS
+        if (ntot_withmasses>0 && gfile.NumBlocks()<=iid+1) {cout<<buf<<" has no mass block"<<endl;MPIStopProgressThread();MPI_Abort(MPI_COMM_WORLD,8);}
+#endif
+#ifdef GASON
+        if (header[i].npartTotal[GGASTYPE]>0 && gfile.NumBlocks()<=isph+1) {cout<<buf<<" has no SPH blocks"<<endl;MPIStopProgressThread();MPI_Abort(MPI_COMM_WORLD,8);}
+#endif
+#ifdef STARON
+        if (header[i].npartTotal[GSTARTYPE]>0 && gfile.NumBlocks()<=istar) {cout<<buf<<" has no star blocks"<<endl;MPIStopProgressThread();MPI_Abort(MPI_COMM_WORLD,8);}
 #endif
 
-    }
-    //all fstreams now at appropriate points in the input file so data easily read
-    for(i=0,count=0,pc=0;i<opt.num_files; i++,pc=pc_new,count=count2)
-    if (ireadfile[i])
-    {
-        //determine number of particles with masses that need to be read
-        for(k=0, ntot_withmasses=0; k<NGTYPE; k++) if(header[i].mass[k]==0) ntot_withmasses+= header[i].npart[k];
-        for(k=0, Ntotfile=0; k<NGTYPE; k++) Ntotfile+=header[i].npart[k];
-        //and read positions, velocities, masses, etc
-        Fgad[i].read((char*)&dummy, sizeof(dummy));
-        Fgadvel[i].read((char*)&dummy, sizeof(dummy));
-        Fgadid[i].read((char*)&dummy, sizeof(dummy));
-        Fgadmass[i].read((char*)&dummy, sizeof(dummy));
-        for (int sphblocks=0;sphblocks<NUMGADGETSPHBLOCKS;sphblocks++) Fgadsph[i+sphblocks].read((char*)&dummy, sizeof(dummy));
-        for (int starblocks=0;starblocks<NUMGADGETSTARBLOCKS;starblocks++) Fgadstar[i+starblocks].read((char*)&dummy, sizeof(dummy));
+        //positions and the tasks particles belong to may have been kept when counting the particles in each domain, see \ref MPINumInDomain
+        icache=(mpi_readcache.size()>(size_t)i && mpi_readcache[i].size()==NGTYPE);
 
         for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)if (header[i].npart[k]>0)
         {
@@ -1057,45 +528,38 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
             for(n=0;n<header[i].npart[k];n+=nchunk)
             {
                 if (header[i].npart[k]-n<chunksize&&header[i].npart[k]-n>0)nchunk=header[i].npart[k]-n;
-                Fgad[i].read((char*)ctempchunk, sizeof(FLOAT)*3*nchunk);
-                Fgadvel[i].read((char*)vtempchunk, sizeof(FLOAT)*3*nchunk);
-                Fgadid[i].read((char*)idvalchunk, sizeof(idval)*nchunk);
+                //decode the chunk, sph and star quantities being indexed from the start of the gas and star particles respectively
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
+#endif
+                for (Int_t nn=0;nn<nchunk;nn++) {
+                    Int_t ipart=typestart[k]+n+nn;
+                    for (int kk=0;kk<3;kk++) {
+                        if (icache) ctempchunk[3*nn+kk]=mpi_readcache[i][k].pos[3*(n+nn)+kk];
+                        else ctempchunk[3*nn+kk]=GadgetBlockValue<FLOAT>(gfile.Block(ipos),3*ipart+kk);
+                        vtempchunk[3*nn+kk]=GadgetBlockValue<FLOAT>(gfile.Block(ivel),3*ipart+kk);
+                    }
+                    idvalchunk[nn]=GadgetBlockValue<GADGETIDTYPE>(gfile.Block(iid),ipart);
+#ifndef NOMASS
+                    if(header[i].mass[k]==0) dtempchunk[nn]=GadgetBlockValue<REAL>(gfile.Block(iid+1),massoffset[k]+n+nn);
+#endif
 #ifdef GASON
-                for (int sphblocks=0;sphblocks<NUMGADGETSPHBLOCKS;sphblocks++){
-                    Fgadsph[i+sphblocks].read((char*)&sphtempchunk[sphblocks*nchunk], sizeof(FLOAT)*nchunk);
-                }
+                    //only the internal energy and density blocks used by the run are decoded
+                    if (k==GGASTYPE) for (int sphblocks=0;sphblocks<NUMGADGETSPHBLOCKS;sphblocks++)
+                        sphtempchunk[sphblocks*nchunk+nn]=(isph+sphblocks<gfile.NumBlocks() && (opt.iinputfields&(sphblocks==0?INPUTFIELDU:INPUTFIELDSPHDEN)))?GadgetBlockValue<FLOAT>(gfile.Block(isph+sphblocks),n+nn):0;
 #endif
 #ifdef STARON
-                for (int starblocks=0;starblocks<NUMGADGETSTARBLOCKS;starblocks++){
-                    Fgadstar[i+starblocks].read((char*)&startempchunk[starblocks*nchunk], sizeof(FLOAT)*nchunk);
-                }
-#endif
-#ifndef NOMASS
-                if(header[i].mass[k]==0) Fgadmass[i].read((char*)dtempchunk, sizeof(REAL)*nchunk);
+                    if (k==GSTARTYPE) for (int starblocks=0;starblocks<NUMGADGETSTARBLOCKS;starblocks++)
+                        startempchunk[starblocks*nchunk+nn]=(istar+starblocks<gfile.NumBlocks() && (opt.iinputfields&INPUTFIELDTAGE))?GadgetBlockValue<FLOAT>(gfile.Block(istar+starblocks),n+nn):0;
 #endif
+                }
                 //once a block of data is in memory, start parsing it.
                 for (int nn=0;nn<nchunk;nn++) {
                 ctemp[0]=ctempchunk[0+3*nn];ctemp[1]=ctempchunk[1+3*nn];ctemp[2]=ctempchunk[2+3*nn];
                 vtemp[0]=vtempchunk[0+3*nn];vtemp[1]=vtempchunk[1+3*nn];vtemp[2]=vtempchunk[2+3*nn];
                 idval=idvalchunk[nn];
-                for (int kk=0;kk<3;kk++) {ctemp[kk]=LittleFLOAT(ctemp[kk]);vtemp[kk]=LittleFLOAT(vtemp[kk]);}
-#ifdef GASON
-                for (int sphblocks=0;sphblocks<NUMGADGETSPHBLOCKS;sphblocks++)sphtempchunk[sphblocks*nchunk+nn]=LittleFLOAT(sphtempchunk[sphblocks*nchunk+nn]);
-#endif
-#ifdef STARON
-                for (int starblocks=0;starblocks<NUMGADGETSTARBLOCKS;starblocks++)startempchunk[starblocks*nchunk+nn]=LittleFLOAT(startempchunk[starblocks*nchunk+nn]);
-#endif
-
-#ifdef GADGETLONGID
-                idval=LittleLongInt(idval);
-#else
-                idval=LittleInt(idval);
-#endif
 #ifndef NOMASS
-                if(header[i].mass[k]==0) {
-                    dtemp=dtempchunk[nn];
-                    dtemp=LittleREAL(dtemp);
-                }
+                if(header[i].mass[k]==0) dtemp=dtempchunk[nn];
                 else dtemp=header[i].mass[k];
 #else
                 dtemp=1.0;
@@ -1103,9 +567,11 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
                 //useful to store smallest mass
                 if(k!=GGASTYPE && k!= GSTARTYPE && k!=GBHTYPE && dtemp<MP_DM&&dtemp>0) MP_DM=dtemp;
                 if(k==GGASTYPE && dtemp<MP_B&&dtemp>0) MP_B=dtemp;
+                if (!SubsampleKeep(opt,idval) || !opt.zoomregion.Keep(k,ctemp[0],ctemp[1],ctemp[2])) {pc_new++;continue;}
 
                 //determine processor this particle belongs on based on its spatial position
-                ibuf=MPIGetParticlesProcessor(ctemp[0],ctemp[1],ctemp[2]);
+                if (icache) ibuf=mpi_readcache[i][k].task[n+nn];
+                else ibuf=MPIGetParticlesProcessor(ctemp[0],ctemp[1],ctemp[2]);
                 ibufindex=ibuf*BufSize+Nbuf[ibuf];
                 //when running hydro runs, need to reset particle buffer quantities
                 //related to hydro info to zero
@@ -1241,13 +707,13 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
             }
         }
         //more information contained in sph particles and if there is sf feed back but for the moment, ignore
-        Fgad[i].close();
-        Fgadvel[i].close();
-        Fgadid[i].close();
-        Fgadmass[i].close();
-        for (int sphblocks=0;sphblocks<NUMGADGETSPHBLOCKS;sphblocks++) Fgadsph[i+sphblocks].close();
-        for (int starblocks=0;starblocks<NUMGADGETSTARBLOCKS;starblocks++) Fgadstar[i+starblocks].close();
-        for (int bhblocks=0;bhblocks<NUMGADGETBHBLOCKS;bhblocks++) Fgadbh[i+bhblocks].close();
+        nbytesread+=gfile.size;
+        if (icache) {
+            nbytesread-=gfile.nbytes[ipos];
+            mpi_readcache[i].clear();
+        }
+        treadtotal+=MyGetTime()-tread;
+        gfile.Close();
         //send information between read threads
         if (opt.nsnapread>1&&inreadsend<totreadsend){
             MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
@@ -1256,6 +722,8 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
             for(ibuf = 0; ibuf < opt.nsnapread; ibuf++) Nreadbuf[ibuf]=0;
         }
     }//end of loop over input files
+    mpi_readcache.clear();
+    cout<<ThisTask<<" read "<<nbytesread/1048576.0<<" MB of gadget data in "<<treadtotal<<" s ("<<nbytesread/1048576.0/max(treadtotal,1e-9)<<" MB/s)"<<endl;
     //once finished reading the file if there are any particles left in the buffer broadcast them
     for(ibuf = 0; ibuf < NProcs; ibuf++) if (ireadtask[ibuf]<0)
     {
@@ -1347,7 +815,6 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
     //a bit of clean up
 #ifdef USEMPI
     MPI_Comm_free(&mpi_comm_read);
-    if (opt.iBaryonSearch) delete[] mpi_nsend_baryon;
     if (opt.nsnapread>1) {
         delete[] mpi_nsend_readthread;
         if (opt.iBaryonSearch) delete[] mpi_nsend_readthread_baryon;
@@ -1363,3 +830,58 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
     delete[] readtaskID;
 #endif
 }
+
+///reads the positions of the high resolution dark matter, gadget type 1, for \ref ZoomRegionFind, passing them on in chunks.
+///With mpi each task reads every NProcs-th file. The box size, in input units, is set before any positions are passed on
+void GadgetZoomRegionPositions(Options &opt, double &boxsize, function<void(const double*, Int_t)> add)
+{
+    char buf[2000];
+    gadget_file_blocks gfile;
+    struct gadget_header header;
+    Int_t chunksize=opt.inputbufsize, Ntotfile;
+    vector<double> pos;
+#ifndef USEMPI
+    int ThisTask=0,NProcs=1;
+#endif
+    for (int i=ThisTask;i<opt.num_files;i+=NProcs)
+    {
+        if(opt.num_files>1) sprintf(buf,"%s.%d",opt.fname,i);
+        else sprintf(buf,"%s",opt.fname);
+        if (!gfile.Open(buf) || gfile.NumBlocks()<2 || gfile.nbytes[0]<sizeof(gadget_header)) {
+            cout<<"can't read positions from "<<buf<<endl;
+#ifdef USEMPI
+            MPIStopProgressThread();
+            MPI_Abort(MPI_COMM_WORLD,8);
+#else
+            exit(8);
+#endif
+        }
+        memcpy(&header,gfile.Block(0),sizeof(gadget_header));
+        header.Endian();
+        boxsize=header.BoxSize;
+        Ntotfile=0;
+        for (int k=0;k<NGTYPE;k++) Ntotfile+=header.npart[k];
+        if (Ntotfile>0 && gfile.nbytes[1]/Ntotfile/3!=sizeof(FLOAT)) {
+            cout<<" mismatch in position type size, file has "<<gfile.nbytes[1]/Ntotfile/3<<" but using "<<sizeof(FLOAT)<<endl;
+#ifdef USEMPI
+            MPIStopProgressThread();
+            MPI_Abort(MPI_COMM_WORLD,9);
+#else
+            exit(9);
+#endif
+        }
+        //positions of type 1 follow those of the gas in the position block
+        Int_t nstart=header.npart[GGASTYPE], num=header.npart[GDMTYPE];
+        for (Int_t n=0;n<num;n+=chunksize) {
+            Int_t nchunk=min(chunksize,num-n);
+            pos.resize(3*nchunk);
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for (Int_t nn=0;nn<nchunk;nn++)
+                for (int m=0;m<3;m++) pos[3*nn+m]=GadgetBlockValue<FLOAT>(gfile.Block(1),3*(nstart+n+nn)+m);
+            add(pos.data(),nchunk);
+        }
+        gfile.Close();
+    }
+}
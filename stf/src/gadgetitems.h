@@ -1,8 +1,8 @@
 #ifndef GADGETITEMS_H
 #define GADGETITEMS_H
 
-//for endian independance
-#include "endianutils.h"
+//for endian independance and memory mapping gadget files
+#include "fortranitems.h"
 
 ///for gadget coords
 #ifdef GADGETDOUBLEPRECISION
@@ -163,6 +163,57 @@ inline int find_files(char *fname)
   return 0;
 }
 
+///\name Block access to gadget files
+//@{
+/*! Holds a gadget file in memory (see \ref fortran_file_records) and locates its blocks, which for format 2 files follow the
+    four character label record preceding each block. Blocks of positions, velocities, ids, masses and so on are then decoded
+    straight from memory with \ref GadgetBlockValue rather than with one read call per particle.
+*/
+struct gadget_file_blocks : public fortran_file_records
+{
+    ///labels of the blocks of format 2 files
+    vector<string> label;
+
+    ///open a file and locate its blocks, returning 0 if the file can not be opened or read
+    int Open(const char *fname)
+    {
+        if (!fortran_file_records::Open(fname,1)) return 0;
+#ifdef GADGET2FORMAT
+        //label records, holding the label and the size of the next block, alternate with data records
+        size_t nblocks=offset.size()/2;
+        for (size_t iblock=0;iblock<nblocks;iblock++) {
+            label.push_back(string(data+offset[2*iblock],4));
+            offset[iblock]=offset[2*iblock+1];
+            nbytes[iblock]=nbytes[2*iblock+1];
+        }
+        offset.resize(nblocks);nbytes.resize(nblocks);
+#else
+        label.resize(offset.size());
+#endif
+        return 1;
+    }
+    void Close()
+    {
+        fortran_file_records::Close();
+        label.clear();
+    }
+    int NumBlocks(){return NumRecords();}
+    const char *Block(int iblock){return Record(iblock);}
+};
+
+///return the index-th value of type T stored little endian in a block of a gadget file, in the native byte order
+template<class T> inline T GadgetBlockValue(const char *block, size_t index)
+{
+    T value;
+    memcpy(&value, block+index*sizeof(T), sizeof(T));
+    if (BigEndianSystem) {
+        unsigned char *p=(unsigned char*)&value;
+        std::reverse(p,p+sizeof(T));
+    }
+    return value;
+}
+//@}
+
 //get number of particles (-1 is all, -2 is all dark, otherwise specify specific gadget type
 inline Int_t get_nbodies(char *fname, int ptype=-1)
 {
@@ -66,7 +66,7 @@ extern "C" herr_t file_info(hid_t loc_id, const char *name, const H5L_info_t *li
 }
 
 ///reads an hdf5 formatted file.
-void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons)
+void ReadHDF(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons)
 {
     //structure stores the names of the groups in the hdf input
     char buf[2000];
@@ -94,7 +94,6 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     DataSpace *headerdataspace;
     DataSet *partsdataset;
     DataSpace *partsdataspace;
-    DataSpace chunkspace;
     int chunksize=opt.inputbufsize;
     //buffers to load data
     int *intbuff=new int[chunksize];
@@ -102,17 +101,9 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     unsigned int *uintbuff=new unsigned int[chunksize];
     float *floatbuff=new float[chunksize*3];
     double *doublebuff=new double[chunksize*3];
-    void *integerbuff,*realbuff;
-    //arrays to store number of items to read and offsets when selecting hyperslabs
-    hsize_t filespacecount[HDFMAXPROPDIM],filespaceoffset[HDFMAXPROPDIM];
     //to determine types
     IntType inttype;
     FloatType floattype;
-    PredType HDFREALTYPE(PredType::NATIVE_FLOAT);
-    PredType HDFINTEGERTYPE(PredType::NATIVE_LONG);
-    int ifloat,ifloat_pos, iint;
-    int datarank;
-    hsize_t datadim[5];
 
     ///array listing number of particle types used.
     ///Since Illustris contains an unused type of particles (2) and tracer particles (3) really not useful to iterate over all particle types in loops
@@ -148,7 +139,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
         nusetypes=1;usetypes[0]=HDFBHTYPE;
     }
 
-    Int_t i,j,k,n,nchunk,count,bcount,itemp,count2,bcount2;
+    Int_t i,j,k,n,count,bcount,itemp,count2,bcount2;
 
     //store cosmology
     double z,aadjust,Hubble,Hubbleflow;
@@ -194,19 +185,18 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     //for parallel input
     MPI_Comm mpi_comm_read;
     vector<Particle> *Preadbuf;
-    Int_t BufSize=opt.mpiparticlebufsize;
+    //particles for a task are staged in a pair of buffers for the nonblocking sends below, each half the size per task set by
+    //MPI_particle_total_buf_size so that together they use the memory it gives
+    Int_t BufSize=max((Int_t)(opt.mpiparticlebufsize/2),(Int_t)1);
     Int_t *Nbuf, *Nreadbuf,*nreadoffset;
     int ibuf=0;
     Int_t ibufindex;
     Int_t *Nlocalthreadbuf;
     int *irecv, *mpi_irecvflag;
     MPI_Request *mpi_request;
-    Int_t *mpi_nsend_baryon;
-    if (opt.iBaryonSearch && opt.partsearchtype!=PSTALL) mpi_nsend_baryon=new Int_t[NProcs*NProcs];
     Int_t inreadsend,totreadsend;
     Int_t *mpi_nsend_readthread;
     Int_t *mpi_nsend_readthread_baryon;
-    if (opt.iBaryonSearch) mpi_nsend_baryon=new Int_t[NProcs*NProcs];
     if (opt.nsnapread>1) {
         mpi_nsend_readthread=new Int_t[opt.nsnapread*opt.nsnapread];
         if (opt.iBaryonSearch) mpi_nsend_readthread_baryon=new Int_t[opt.nsnapread*opt.nsnapread];
@@ -216,25 +206,6 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     DataSet *partsdatasetall;
     DataSpace *partsdataspaceall;
 
-    //extra blocks to store info
-    float *velfloatbuff=new float[chunksize*3];
-    double *veldoublebuff=new double[chunksize*3];
-    float *massfloatbuff=new float[chunksize];
-    double *massdoublebuff=new double[chunksize];
-#ifdef GASON
-    float *ufloatbuff=new float[chunksize];
-    double *udoublebuff=new double[chunksize];
-#endif
-#if defined(GASON)&&defined(STARON)
-    float *Zfloatbuff=new float[chunksize];
-    double *Zdoublebuff=new double[chunksize];
-    float *SFRfloatbuff=new float[chunksize];
-    double *SFRdoublebuff=new double[chunksize];
-#endif
-#ifdef STARON
-    float *Tagefloatbuff=new float[chunksize];
-    double *Tagedoublebuff=new double[chunksize];
-#endif
     Pbuf = NULL; /* Keep Pbuf NULL or allocated so we can check its status later */
 
     Nbuf=new Int_t[NProcs];
@@ -245,11 +216,21 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     MPIDistributeReadTasks(opt,ireadtask,readtaskID);
     MPI_Comm_split(MPI_COMM_WORLD, (ireadtask[ThisTask]>=0), ThisTask, &mpi_comm_read);
 
-    if (ThisTask==0) cout<<"There are "<<opt.nsnapread<<" threads reading "<<opt.num_files<<" files "<<endl;
-    if (ireadtask[ThisTask]>=0)
+    //tasks reading input, which when reading by cell are the tasks with cells in their domain, see \ref MPIDomainDecompositionHDF
+    int ireadlocal=(ireadtask[ThisTask]>=0);
+    if (ThisTask==0 && mpi_ireadcells==0) cout<<"There are "<<opt.nsnapread<<" threads reading "<<opt.num_files<<" files "<<endl;
+    if (mpi_ireadcells) {
+        //read the files storing the cells of this task, with the first task also reading the header of the first file
+        ireadfile=new int[opt.num_files];
+        for (i=0;i<opt.num_files;i++) ireadfile[i]=(ThisTask==0 && i==0);
+        for (auto &c:mpi_readcells) ireadfile[c.ifile]=1;
+        ireadlocal=0;
+        for (i=opt.num_files-1;i>=0;i--) if (ireadfile[i]) {ifirstfile=i;ireadlocal=1;}
+    }
+    else if (ireadtask[ThisTask]>=0)
     {
-        //to temporarily store data from gadget file
-        Pbuf=new Particle[BufSize*NProcs];
+        //to temporarily store data from the input, two buffers for each task
+        Pbuf=new Particle[2*BufSize*NProcs];
         Nreadbuf=new Int_t[opt.num_files];
         for (int j=0;j<opt.num_files;j++) Nreadbuf[j]=0;
         if (opt.nsnapread>1){
@@ -274,7 +255,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     Nlocal=0;
     if (opt.iBaryonSearch) Nlocalbaryon[0]=0;
 
-    if (ireadtask[ThisTask]>=0) {
+    if (ireadlocal) {
 #endif
     //read the header
     Fhdf=new H5File[opt.num_files];
@@ -522,6 +503,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #ifdef USEMPI
     MPI_Allreduce(&ireaderror, &mpi_ireaderror, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
     if (mpi_ireaderror) {
+      MPIStopProgressThread();
       MPI_Finalize();
       exit(9);
     }
@@ -531,8 +513,20 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     //after finished reading the header, start on the actual particle information
 
 #ifndef USEMPI
+    Int_t nchunk;
+    DataSpace chunkspace;
+    void *integerbuff,*realbuff;
+    //arrays to store number of items to read and offsets when selecting hyperslabs
+    hsize_t filespacecount[HDFMAXPROPDIM],filespaceoffset[HDFMAXPROPDIM];
+    PredType HDFREALTYPE(PredType::NATIVE_FLOAT);
+    PredType HDFINTEGERTYPE(PredType::NATIVE_LONG);
+    int ifloat, iint;
+    int datarank;
+    hsize_t datadim[5];
     //init counters
     count2=bcount2=0;
+    vector<unsigned char> izoomkeep;
+    if (opt.zoomregion.iset) izoomkeep.resize(nbodies,1);
     //start loding particle data
     for(i=0; i<opt.num_files; i++) {
       if(ireadfile[i])
@@ -717,6 +711,9 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
               if (iint) Part[count].SetPID(intbuff[nn]);
               else Part[count].SetPID(longbuff[nn]);
               Part[count].SetID(count);
+              //low resolution particles outside the high resolution region of a zoom simulation, whose positions are stored by now,
+              //are flagged to be removed once all the input is read
+              if (opt.zoomregion.iset) izoomkeep[count]=opt.zoomregion.Keep(k,Part[count].GetPosition(0),Part[count].GetPosition(1),Part[count].GetPosition(2));
               if (k==HDFGASTYPE) Part[count].SetType(GASTYPE);
               else if (k==HDFDMTYPE) Part[count].SetType(DARKTYPE);
               else if (k==HDFSTARTYPE) Part[count].SetType(STARTYPE);
@@ -837,53 +834,27 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
         if (!(opt.partsearchtype==PSTDARK && opt.iBaryonSearch==0)) {
 #ifdef GASON
           //first gas internal energy
-          for (j=0;j<nusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFGASTYPE){
-              if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[5]<<endl;
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[5]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
-            }
-          }
-          if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFGASTYPE){
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[5]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
-            }
-          }
-          count=count2;
-          bcount=bcount2;
-          for (j=0;j<nusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFGASTYPE) {
-              //data loaded into memory in chunks
-              if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
-              else nchunk=chunksize;
-              for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
-              {
-                if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
-                //setup hyperslab so that it is loaded into the buffer
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
-
-                if (ifloat) for (int nn=0;nn<nchunk;nn++) Part[count++].SetU(floatbuff[nn]);
-                else for (int nn=0;nn<nchunk;nn++) Part[count++].SetU(doublebuff[nn]);
+          if (opt.iinputfields&INPUTFIELDU) {
+            for (j=0;j<nusetypes;j++) {
+              k=usetypes[j];
+              if (k==HDFGASTYPE){
+                if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[5]<<endl;
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[5]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
               }
             }
-            else {
-              count+=hdf_header_info[i].npart[k];
+            if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+              k=usetypes[j];
+              if (k==HDFGASTYPE){
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[5]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
+              }
             }
-          }
-          if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
-            for (j=1;j<=nbusetypes;j++) {
+            count=count2;
+            bcount=bcount2;
+            for (j=0;j<nusetypes;j++) {
               k=usetypes[j];
               if (k==HDFGASTYPE) {
                 //data loaded into memory in chunks
@@ -901,64 +872,66 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
                   partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
 
-                  if (ifloat) for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetU(floatbuff[nn]);
-                  else for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetU(doublebuff[nn]);
+                  if (ifloat) for (int nn=0;nn<nchunk;nn++) Part[count++].SetU(floatbuff[nn]);
+                  else for (int nn=0;nn<nchunk;nn++) Part[count++].SetU(doublebuff[nn]);
                 }
               }
               else {
                 count+=hdf_header_info[i].npart[k];
               }
             }
+            if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
+              for (j=1;j<=nbusetypes;j++) {
+                k=usetypes[j];
+                if (k==HDFGASTYPE) {
+                  //data loaded into memory in chunks
+                  if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
+                  else nchunk=chunksize;
+                  for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
+                  {
+                    if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
+                    //setup hyperslab so that it is loaded into the buffer
+                    datarank=1;
+                    datadim[0]=nchunk;
+                    chunkspace=DataSpace(datarank,datadim);
+                    filespacecount[0]=nchunk;filespacecount[1]=1;
+                    filespaceoffset[0]=n;filespaceoffset[1]=0;
+                    partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
+                    partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
+
+                    if (ifloat) for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetU(floatbuff[nn]);
+                    else for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetU(doublebuff[nn]);
+                  }
+                }
+                else {
+                  count+=hdf_header_info[i].npart[k];
+                }
+              }
+            }
           }
 #ifdef STARON
           //if star forming get star formation rate
-          for (j=0;j<nusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFGASTYPE){
-              if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[6]<<endl;
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[6]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
-            }
-          }
-          if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFGASTYPE){
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[6]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
-            }
-          }
-          count=count2;
-          bcount=bcount2;
-          for (j=0;j<nusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFGASTYPE) {
-              //data loaded into memory in chunks
-              if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
-              else nchunk=chunksize;
-              for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
-              {
-                if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
-                //setup hyperslab so that it is loaded into the buffer
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
-
-                if (ifloat) for (int nn=0;nn<nchunk;nn++) Part[count++].SetSFR(floatbuff[nn]);
-                else for (int nn=0;nn<nchunk;nn++) Part[count++].SetSFR(doublebuff[nn]);
+          if (opt.iinputfields&INPUTFIELDSFR) {
+            for (j=0;j<nusetypes;j++) {
+              k=usetypes[j];
+              if (k==HDFGASTYPE){
+                if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[6]<<endl;
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[6]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
               }
             }
-            else {
-              count+=hdf_header_info[i].npart[k];
+            if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+              k=usetypes[j];
+              if (k==HDFGASTYPE){
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[6]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
+              }
             }
-          }
-          if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
-            for (j=1;j<=nbusetypes;j++) {
+            count=count2;
+            bcount=bcount2;
+            for (j=0;j<nusetypes;j++) {
               k=usetypes[j];
               if (k==HDFGASTYPE) {
                 //data loaded into memory in chunks
@@ -976,74 +949,76 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
                   partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
 
-                  if (ifloat) for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetSFR(floatbuff[nn]);
-                  else for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetSFR(doublebuff[nn]);
+                  if (ifloat) for (int nn=0;nn<nchunk;nn++) Part[count++].SetSFR(floatbuff[nn]);
+                  else for (int nn=0;nn<nchunk;nn++) Part[count++].SetSFR(doublebuff[nn]);
                 }
               }
               else {
                 count+=hdf_header_info[i].npart[k];
               }
             }
-          }
-          //then metallicity
-          for (j=0;j<nusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFGASTYPE){
-              if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]<<endl;
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
-            }
-            if (k==HDFSTARTYPE){
-              if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]<<endl;
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
-            }
-          }
-          if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFGASTYPE){
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
-            }
-            if (k==HDFSTARTYPE){
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
+            if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
+              for (j=1;j<=nbusetypes;j++) {
+                k=usetypes[j];
+                if (k==HDFGASTYPE) {
+                  //data loaded into memory in chunks
+                  if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
+                  else nchunk=chunksize;
+                  for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
+                  {
+                    if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
+                    //setup hyperslab so that it is loaded into the buffer
+                    datarank=1;
+                    datadim[0]=nchunk;
+                    chunkspace=DataSpace(datarank,datadim);
+                    filespacecount[0]=nchunk;filespacecount[1]=1;
+                    filespaceoffset[0]=n;filespaceoffset[1]=0;
+                    partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
+                    partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
+
+                    if (ifloat) for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetSFR(floatbuff[nn]);
+                    else for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetSFR(doublebuff[nn]);
+                  }
+                }
+                else {
+                  count+=hdf_header_info[i].npart[k];
+                }
+              }
             }
           }
-          count=count2;
-          bcount=bcount2;
-          for (j=0;j<nusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFGASTYPE||k==HDFSTARTYPE) {
-              //data loaded into memory in chunks
-              if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
-              else nchunk=chunksize;
-              for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
-              {
-                if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
-                //setup hyperslab so that it is loaded into the buffer
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
-
-                if (ifloat) for (int nn=0;nn<nchunk;nn++) Part[count++].SetZmet(floatbuff[nn]*ILLUSTRISZMET);
-                else for (int nn=0;nn<nchunk;nn++) Part[count++].SetZmet(doublebuff[nn]*ILLUSTRISZMET);
+          //then metallicity
+          if (opt.iinputfields&INPUTFIELDZMET) {
+            for (j=0;j<nusetypes;j++) {
+              k=usetypes[j];
+              if (k==HDFGASTYPE){
+                if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]<<endl;
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
+              }
+              if (k==HDFSTARTYPE){
+                if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]<<endl;
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
               }
             }
-            else {
-              count+=hdf_header_info[i].npart[k];
+            if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+              k=usetypes[j];
+              if (k==HDFGASTYPE){
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
+              }
+              if (k==HDFSTARTYPE){
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
+              }
             }
-          }
-          if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
-            for (j=1;j<=nbusetypes;j++) {
+            count=count2;
+            bcount=bcount2;
+            for (j=0;j<nusetypes;j++) {
               k=usetypes[j];
               if (k==HDFGASTYPE||k==HDFSTARTYPE) {
                 //data loaded into memory in chunks
@@ -1061,65 +1036,67 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
                   partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
 
-                  if (ifloat) for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetZmet(floatbuff[nn]*ILLUSTRISZMET);
-                  else for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetZmet(doublebuff[nn]*ILLUSTRISZMET);
+                  if (ifloat) for (int nn=0;nn<nchunk;nn++) Part[count++].SetZmet(floatbuff[nn]*ILLUSTRISZMET);
+                  else for (int nn=0;nn<nchunk;nn++) Part[count++].SetZmet(doublebuff[nn]*ILLUSTRISZMET);
                 }
               }
               else {
                 count+=hdf_header_info[i].npart[k];
               }
             }
-          }
-          //then get star formation time, must also adjust so that if tage<0 this is a wind particle in Illustris so change particle type
-          for (j=0;j<nusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFSTARTYPE){
-              if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIAGE]]<<endl;
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIAGE]]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
-            }
-          }
-          if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFSTARTYPE){
-              partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIAGE]]);
-              partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
-              floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
+            if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
+              for (j=1;j<=nbusetypes;j++) {
+                k=usetypes[j];
+                if (k==HDFGASTYPE||k==HDFSTARTYPE) {
+                  //data loaded into memory in chunks
+                  if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
+                  else nchunk=chunksize;
+                  for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
+                  {
+                    if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
+                    //setup hyperslab so that it is loaded into the buffer
+                    datarank=1;
+                    datadim[0]=nchunk;
+                    chunkspace=DataSpace(datarank,datadim);
+                    filespacecount[0]=nchunk;filespacecount[1]=1;
+                    filespaceoffset[0]=n;filespaceoffset[1]=0;
+                    partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
+                    partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
+
+                    if (ifloat) for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetZmet(floatbuff[nn]*ILLUSTRISZMET);
+                    else for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetZmet(doublebuff[nn]*ILLUSTRISZMET);
+                  }
+                }
+                else {
+                  count+=hdf_header_info[i].npart[k];
+                }
+              }
             }
           }
-          count=count2;
-          bcount=bcount2;
-          for (j=0;j<nusetypes;j++) {
-            k=usetypes[j];
-            if (k==HDFSTARTYPE) {
-              //data loaded into memory in chunks
-              if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
-              else nchunk=chunksize;
-              for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
-              {
-                if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
-                //setup hyperslab so that it is loaded into the buffer
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
-
-                if (ifloat) for (int nn=0;nn<nchunk;nn++) {if (floatbuff[nn]<0) Part[count].SetType(WINDTYPE);Part[count++].SetTage(floatbuff[nn]);}
-                else for (int nn=0;nn<nchunk;nn++) {if (doublebuff[nn]<0) Part[count].SetType(WINDTYPE);Part[count++].SetTage(doublebuff[nn]);}
+          //then get star formation time, must also adjust so that if tage<0 this is a wind particle in Illustris so change particle type
+          if (opt.iinputfields&INPUTFIELDTAGE) {
+            for (j=0;j<nusetypes;j++) {
+              k=usetypes[j];
+              if (k==HDFSTARTYPE){
+                if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIAGE]]<<endl;
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIAGE]]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
               }
             }
-            else {
-              count+=hdf_header_info[i].npart[k];
+            if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+              k=usetypes[j];
+              if (k==HDFSTARTYPE){
+                partsdataset[i*NHDFTYPE+k]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIAGE]]);
+                partsdataspace[i*NHDFTYPE+k]=partsdataset[i*NHDFTYPE+k].getSpace();
+                floattype=partsdataset[i*NHDFTYPE+k].getFloatType();
+              }
             }
-          }
-          if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
-            for (j=1;j<=nbusetypes;j++) {
+            count=count2;
+            bcount=bcount2;
+            for (j=0;j<nusetypes;j++) {
               k=usetypes[j];
-              if (k==HDFGASTYPE||k==HDFSTARTYPE) {
+              if (k==HDFSTARTYPE) {
                 //data loaded into memory in chunks
                 if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
                 else nchunk=chunksize;
@@ -1135,16 +1112,43 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
                   partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
 
-                  if (ifloat) for (int nn=0;nn<nchunk;nn++) {if (floatbuff[nn]<0) Pbaryons[bcount].SetType(WINDTYPE);Pbaryons[bcount++].SetTage(floatbuff[nn]);}
-                  else for (int nn=0;nn<nchunk;nn++) {if (doublebuff[nn]<0) Pbaryons[bcount].SetType(WINDTYPE);Pbaryons[bcount++].SetTage(doublebuff[nn]);}
+                  if (ifloat) for (int nn=0;nn<nchunk;nn++) {if (floatbuff[nn]<0) Part[count].SetType(WINDTYPE);Part[count++].SetTage(floatbuff[nn]);}
+                  else for (int nn=0;nn<nchunk;nn++) {if (doublebuff[nn]<0) Part[count].SetType(WINDTYPE);Part[count++].SetTage(doublebuff[nn]);}
                 }
               }
               else {
                 count+=hdf_header_info[i].npart[k];
               }
             }
+            if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
+              for (j=1;j<=nbusetypes;j++) {
+                k=usetypes[j];
+                if (k==HDFGASTYPE||k==HDFSTARTYPE) {
+                  //data loaded into memory in chunks
+                  if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
+                  else nchunk=chunksize;
+                  for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
+                  {
+                    if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
+                    //setup hyperslab so that it is loaded into the buffer
+                    datarank=1;
+                    datadim[0]=nchunk;
+                    chunkspace=DataSpace(datarank,datadim);
+                    filespacecount[0]=nchunk;filespacecount[1]=1;
+                    filespaceoffset[0]=n;filespaceoffset[1]=0;
+                    partsdataspace[i*NHDFTYPE+k].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
+                    partsdataset[i*NHDFTYPE+k].read(realbuff,HDFREALTYPE,chunkspace,partsdataspace[i*NHDFTYPE+k]);
+
+                    if (ifloat) for (int nn=0;nn<nchunk;nn++) {if (floatbuff[nn]<0) Pbaryons[bcount].SetType(WINDTYPE);Pbaryons[bcount++].SetTage(floatbuff[nn]);}
+                    else for (int nn=0;nn<nchunk;nn++) {if (doublebuff[nn]<0) Pbaryons[bcount].SetType(WINDTYPE);Pbaryons[bcount++].SetTage(doublebuff[nn]);}
+                  }
+                }
+                else {
+                  count+=hdf_header_info[i].npart[k];
+                }
+              }
+            }
           }
-
 #endif
 #endif
         }
@@ -1155,6 +1159,19 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
       }
     }
 
+    //the particles kept when subsampling are chosen by id, which is read after the positions and velocities have been stored,
+    //so the particles not kept, and those flagged outside the high resolution region, are removed once all the input has been read
+    if (opt.isubsample>1 || opt.zoomregion.iset) {
+      Int_t nkeep=0;
+      for (i=0;i<nbodies;i++) if (SubsampleKeep(opt,Part[i].GetPID()) && (izoomkeep.size()==0 || izoomkeep[i])) {Part[nkeep]=Part[i];Part[nkeep].SetID(nkeep);nkeep++;}
+      nbodies=nkeep;
+      if (Pbaryons!=NULL && opt.iBaryonSearch==1) {
+        nkeep=0;
+        for (i=0;i<nbaryons;i++) if (SubsampleKeep(opt,Pbaryons[i].GetPID())) {Pbaryons[nkeep]=Pbaryons[i];Pbaryons[nkeep].SetID(nkeep);nkeep++;}
+        nbaryons=nkeep;
+      }
+    }
+
     //finally adjust to appropriate units
     for (i=0;i<nbodies;i++)
     {
@@ -1179,8 +1196,22 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 
 #else
     //for all mpi threads that are reading input data, open file load access to data structures and begin loading into either local buffer or temporary buffer to be send to
-    //non-read threads
-    if (ireadtask[ThisTask]>=0) {
+    //non-read threads. When reading by cell, tasks only read the cells in their own domain
+    if (ireadlocal) {
+      //particles for a task that does not read are sent with nonblocking sends from one of its pair of buffers while the other is
+      //filled, waiting for the sends from the other buffer to complete before switching to it
+      vector<int> isendbuf(NProcs,0);
+      vector<Int_t> nsendbuf(2*NProcs,0);
+      vector<MPI_Request> sendrequests(4*NProcs,MPI_REQUEST_NULL);
+      auto sendbuffer=[&](int itask) {
+        int ihalf=isendbuf[itask];
+        nsendbuf[2*itask+ihalf]=Nbuf[itask];
+        MPI_Isend(&nsendbuf[2*itask+ihalf],1,MPI_Int_t,itask,itask+NProcs,MPI_COMM_WORLD,&sendrequests[4*itask+2*ihalf]);
+        MPI_Isend(&Pbuf[(2*itask+ihalf)*BufSize],sizeof(Particle)*Nbuf[itask],MPI_BYTE,itask,itask,MPI_COMM_WORLD,&sendrequests[4*itask+2*ihalf+1]);
+        ihalf=isendbuf[itask]=1-ihalf;
+        MPI_Waitall(2,&sendrequests[4*itask+2*ihalf],MPI_STATUSES_IGNORE);
+        Nbuf[itask]=0;
+      };
       inreadsend=0;
       count2=bcount2=0;
       for(i=0; i<opt.num_files; i++) {
@@ -1232,7 +1263,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
               itemp=4;
 #ifdef GASON
               //first gas internal energy
-              for (j=0;j<nusetypes;j++) {
+              if (opt.iinputfields&INPUTFIELDU) for (j=0;j<nusetypes;j++) {
                 k=usetypes[j];
                 if (k==HDFGASTYPE){
                   if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[5]<<endl;
@@ -1240,7 +1271,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getSpace();
                 }
               }
-              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+              if ((opt.iinputfields&INPUTFIELDU) && opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
                 k=usetypes[j];
                 if (k==HDFGASTYPE){
                   partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[5]);
@@ -1250,7 +1281,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #ifdef STARON
               //if star forming get star formation rate
               itemp++;
-              for (j=0;j<nusetypes;j++) {
+              if (opt.iinputfields&INPUTFIELDSFR) for (j=0;j<nusetypes;j++) {
                 k=usetypes[j];
                 if (k==HDFGASTYPE){
                   if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[6]<<endl;
@@ -1258,7 +1289,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getSpace();
                 }
               }
-              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+              if ((opt.iinputfields&INPUTFIELDSFR) && opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
                 k=usetypes[j];
                 if (k==HDFGASTYPE){
                   partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[6]);
@@ -1267,7 +1298,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
               }
               //then metallicity
               itemp++;
-              for (j=0;j<nusetypes;j++) {
+              if (opt.iinputfields&INPUTFIELDZMET) for (j=0;j<nusetypes;j++) {
                 k=usetypes[j];
                 if (k==HDFGASTYPE){
                   if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]<<endl;
@@ -1280,7 +1311,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getSpace();
                 }
               }
-              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+              if ((opt.iinputfields&INPUTFIELDZMET) && opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
                 k=usetypes[j];
                 if (k==HDFGASTYPE){
                   partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
@@ -1293,7 +1324,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
               }
               //then get star formation time, must also adjust so that if tage<0 this is a wind particle in Illustris so change particle type
               itemp++;
-              for (j=0;j<nusetypes;j++) {
+              if (opt.iinputfields&INPUTFIELDTAGE) for (j=0;j<nusetypes;j++) {
                 k=usetypes[j];
                 if (k==HDFSTARTYPE){
                   if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIAGE]]<<endl;
@@ -1301,7 +1332,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getSpace();
                 }
               }
-              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+              if ((opt.iinputfields&INPUTFIELDTAGE) && opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
                 k=usetypes[j];
                 if (k==HDFSTARTYPE){
                   partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=partsgroup[i*NHDFTYPE+k].openDataSet(hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIAGE]]);
@@ -1314,392 +1345,197 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
             }
 
 
+            //list the chunks in which particles are read so that reading can run ahead of loading the particles
+            vector<HDF_Part_Chunk> chunkinfo;
+            HDF_Part_Chunk cinfo;
+            int icachetype[NHDFTYPE];
+            for (k=0;k<NHDFTYPE;k++) icachetype[k]=0;
+            cinfo.task=-1;
             for (j=0;j<nusetypes;j++) {
               k=usetypes[j];
-              //data loaded into memory in chunks
-              if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
-              else nchunk=chunksize;
-              for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
-              {
-                if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
-                //setup hyperslab so that it is loaded into the buffer
-                //load positions
-                itemp=0;
-                //set hyperslab
-                datarank=1;
-                datadim[0]=nchunk*3;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=3;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                //set type
-                floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=floatbuff;ifloat_pos=1;}
-                else {HDFREALTYPE=PredType::NATIVE_DOUBLE ;realbuff=doublebuff;ifloat_pos=0;}
-                //read hyperslab into local buffer
-                partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                //velocities
-                itemp++;
-                datarank=1;
-                datadim[0]=nchunk*3;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=3;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=velfloatbuff;ifloat=1;}
-                else {HDFREALTYPE=PredType::NATIVE_DOUBLE ;realbuff=veldoublebuff;ifloat=0;}
-                partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                //ids
-                itemp++;
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                inttype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getIntType();
-                if (inttype.getSize()==sizeof(int)) {HDFINTEGERTYPE=PredType::NATIVE_INT;integerbuff=intbuff;iint=1;}
-                else {HDFINTEGERTYPE=PredType::NATIVE_LONG;integerbuff=longbuff;iint=0;}
-                partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(integerbuff,HDFINTEGERTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                //masses
-                itemp++;
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                if (hdf_header_info[i].mass[k]==0){
-                  floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                  if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=massfloatbuff;ifloat=1;}
-                  else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=massdoublebuff;ifloat=0;}
-                  partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                  partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                }
-#ifdef GASON
-                //self-energy
-                itemp++;
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                if (k == HDFGASTYPE) {
-                  floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                  if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=ufloatbuff;ifloat=1;}
-                  else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=udoublebuff;ifloat=0;}
-                  partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                  partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                }
-#ifdef STARON
-                //star formation rate
-                itemp++;
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                if (k == HDFGASTYPE) {
-                  floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                  if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=SFRfloatbuff;ifloat=1;}
-                  else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=SFRdoublebuff;ifloat=0;}
-                  partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                  partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                }
-
-                //metallicity
-                itemp++;
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                if (k == HDFGASTYPE || k == HDFSTARTYPE) {
-                  floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                  if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=Zfloatbuff;ifloat=1;}
-                  else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=Zdoublebuff;ifloat=0;}
-                  partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                  partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                }
-
-                //stellar age
-                itemp++;
-                datarank=1;
-                datadim[0]=nchunk;
-                chunkspace=DataSpace(datarank,datadim);
-                filespacecount[0]=nchunk;filespacecount[1]=1;
-                filespaceoffset[0]=n;filespaceoffset[1]=0;
-                if (k == HDFSTARTYPE) {
-                  floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                  if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=Tagefloatbuff;ifloat=1;}
-                  else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=Tagedoublebuff;ifloat=0;}
-                  partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                  partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                }
-#endif
-#endif
-
-                for (int nn=0;nn<nchunk;nn++) {
-                    if (ifloat_pos) ibuf=MPIGetParticlesProcessor(floatbuff[nn*3],floatbuff[nn*3+1],floatbuff[nn*3+2]);
-                    else ibuf=MPIGetParticlesProcessor(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
-                    ibufindex=ibuf*BufSize+Nbuf[ibuf];
-                    //reset hydro quantities of buffer
-#ifdef GASON
-                    Pbuf[ibufindex].SetU(0);
-#ifdef STARON
-                    Pbuf[ibufindex].SetSFR(0);
-                    Pbuf[ibufindex].SetZmet(0);
-#endif
-#endif
-#ifdef STARON
-                    Pbuf[ibufindex].SetZmet(0);
-                    Pbuf[ibufindex].SetTage(0);
-#endif
-#ifdef BHON
-#endif
-                    //store particle info in Ptemp;
-                    if (ifloat_pos)
-                        Pbuf[ibufindex].SetPosition(floatbuff[nn*3],floatbuff[nn*3+1],floatbuff[nn*3+2]);
-                    else
-                        Pbuf[ibufindex].SetPosition(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
-                    if (ifloat) {
-                        Pbuf[ibufindex].SetVelocity(velfloatbuff[nn*3],velfloatbuff[nn*3+1],velfloatbuff[nn*3+2]);
-                        if (hdf_header_info[i].mass[k]==0)Pbuf[ibufindex].SetMass(massfloatbuff[nn]);
-                        else Pbuf[ibufindex].SetMass(hdf_header_info[i].mass[k]);
-                    }
-                    else {
-                        Pbuf[ibufindex].SetVelocity(veldoublebuff[nn*3],veldoublebuff[nn*3+1],veldoublebuff[nn*3+2]);
-                        if (hdf_header_info[i].mass[k]==0)Pbuf[ibufindex].SetMass(massdoublebuff[nn]);
-                        else Pbuf[ibufindex].SetMass(hdf_header_info[i].mass[k]);
-                    }
-                    if (iint) Pbuf[ibufindex].SetPID(intbuff[nn]);
-                    else Pbuf[ibufindex].SetPID(longbuff[nn]);
-                    Pbuf[ibufindex].SetID(nn);
-                    if (k==HDFGASTYPE) Pbuf[ibufindex].SetType(GASTYPE);
-                    else if (k==HDFDMTYPE) Pbuf[ibufindex].SetType(DARKTYPE);
-                    else if (k==HDFSTARTYPE) Pbuf[ibufindex].SetType(STARTYPE);
-                    else if (k==HDFBHTYPE) Pbuf[ibufindex].SetType(BHTYPE);
-
-#ifdef GASON
-                  if (k==HDFGASTYPE) {
-                    if (ifloat) Pbuf[ibufindex].SetU(ufloatbuff[nn]);
-                    else Pbuf[ibufindex].SetU(udoublebuff[nn]);
-#ifdef STARON
-                    if (ifloat) Pbuf[ibufindex].SetSFR(SFRfloatbuff[nn]);
-                    else Pbuf[ibufindex].SetSFR(SFRdoublebuff[nn]);
-                    if (ifloat) Pbuf[ibufindex].SetZmet(Zfloatbuff[nn]);
-                    else Pbuf[ibufindex].SetZmet(Zdoublebuff[nn]);
-#endif
-
-                  }
-#endif
-#ifdef STARON
-                  if (k==HDFSTARTYPE) {
-                    if (ifloat) Pbuf[ibufindex].SetZmet(Zfloatbuff[nn]);
-                    else Pbuf[ibufindex].SetZmet(Zdoublebuff[nn]);
-                    if (ifloat) {if (Tagefloatbuff[nn]<0) Pbuf[ibufindex].SetType(WINDTYPE); Pbuf[ibufindex].SetTage(Tagefloatbuff[nn]);}
-                    else {if (Tagedoublebuff[nn]<0) Pbuf[ibufindex].SetType(WINDTYPE);Pbuf[ibufindex].SetTage(Tagedoublebuff[nn]);}
+              //positions and the tasks particles belong to may have been kept when counting the particles in each domain, see \ref MPINumInDomain
+              icachetype[k]=(mpi_readcache.size()>(size_t)i && mpi_readcache[i].size()==NHDFTYPE && mpi_readcache[i][k].Num()==hdf_header_info[i].npart[k]);
+              cinfo.k=k;cinfo.ibaryon=0;
+              if (mpi_ireadcells) {
+                //only the cells of this task stored in this file
+                cinfo.task=ThisTask;
+                for (auto &cell:mpi_readcells) if (cell.ifile==i && cell.itype==k) {
+                  for (n=0;n<cell.num;n+=chunksize) {
+                    cinfo.noffset=cell.offset+n;cinfo.num=min((Int_t)chunksize,cell.num-n);
+                    chunkinfo.push_back(cinfo);
                   }
-#endif
-                  Nbuf[ibuf]++;
-                  MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocal, Part.data(), Nreadbuf, Preadbuf);
                 }
+                continue;
+              }
+              for (n=0;n<hdf_header_info[i].npart[k];n+=chunksize) {
+                cinfo.noffset=n;cinfo.num=min((Int_t)chunksize,hdf_header_info[i].npart[k]-n);
+                chunkinfo.push_back(cinfo);
               }
             }
             if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
               for (j=1;j<=nbusetypes;j++) {
                 k=usetypes[j];
-                if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
-                else nchunk=chunksize;
-                for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
-                {
-                  if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
-                  //setup hyperslab so that it is loaded into the buffer
-                  //load positions
-                  itemp=0;
-                  //set hyperslab
-                  datarank=1;
-                  datadim[0]=nchunk*3;
-                  chunkspace=DataSpace(datarank,datadim);
-                  filespacecount[0]=nchunk;filespacecount[1]=3;
-                  filespaceoffset[0]=n;filespaceoffset[1]=0;
-                  //set type
-                  floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                  if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=floatbuff;ifloat_pos=1;}
-                  else {HDFREALTYPE=PredType::NATIVE_DOUBLE ;realbuff=doublebuff;ifloat_pos=0;}
-                  //read hyperslab into local buffer
-                  partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                  partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                  //velocities
-                  itemp++;
-                  datarank=1;
-                  datadim[0]=nchunk*3;
-                  chunkspace=DataSpace(datarank,datadim);
-                  filespacecount[0]=nchunk;filespacecount[1]=3;
-                  filespaceoffset[0]=n;filespaceoffset[1]=0;
-                  floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                  if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=velfloatbuff;ifloat=1;}
-                  else {HDFREALTYPE=PredType::NATIVE_DOUBLE ;realbuff=veldoublebuff;ifloat=0;}
-                  partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                  partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                  //ids
-                  itemp++;
-                  datarank=1;
-                  datadim[0]=nchunk;
-                  chunkspace=DataSpace(datarank,datadim);
-                  filespacecount[0]=nchunk;filespacecount[1]=1;
-                  filespaceoffset[0]=n;filespaceoffset[1]=0;
-                  inttype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getIntType();
-                  if (inttype.getSize()==sizeof(int)) {HDFINTEGERTYPE=PredType::NATIVE_INT;integerbuff=intbuff;iint=1;}
-                  else {HDFINTEGERTYPE=PredType::NATIVE_LONG;integerbuff=longbuff;iint=0;}
-                  partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                  partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(integerbuff,HDFINTEGERTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                  //masses
-                  itemp++;
-                  datarank=1;
-                  datadim[0]=nchunk;
-                  chunkspace=DataSpace(datarank,datadim);
-                  filespacecount[0]=nchunk;filespacecount[1]=1;
-                  filespaceoffset[0]=n;filespaceoffset[1]=0;
-                  if (hdf_header_info[i].mass[k]==0){
-                    floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                    if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=massfloatbuff;ifloat=1;}
-                    else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=massdoublebuff;ifloat=0;}
-                    partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                    partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                  }
-#ifdef GASON
-                  //self-energy
-                  itemp++;
-                  datarank=1;
-                  datadim[0]=nchunk;
-                  chunkspace=DataSpace(datarank,datadim);
-                  filespacecount[0]=nchunk;filespacecount[1]=1;
-                  filespaceoffset[0]=n;filespaceoffset[1]=0;
-                  if (k==HDFGASTYPE) {
-                    floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                    if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=ufloatbuff;ifloat=1;}
-                    else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=udoublebuff;ifloat=0;}
-                    partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                    partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                  }
-#ifdef STARON
-                  //star formation rate
-                  itemp++;
-                  datarank=1;
-                  datadim[0]=nchunk;
-                  chunkspace=DataSpace(datarank,datadim);
-                  filespacecount[0]=nchunk;filespacecount[1]=1;
-                  filespaceoffset[0]=n;filespaceoffset[1]=0;
-                  if (k==HDFGASTYPE) {
-                    floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                    if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=SFRfloatbuff;ifloat=1;}
-                    else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=SFRdoublebuff;ifloat=0;}
-                    partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                    partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                  }
-
-                  //metallicity
-                  itemp++;
-                  datarank=1;
-                  datadim[0]=nchunk;
-                  chunkspace=DataSpace(datarank,datadim);
-                  filespacecount[0]=nchunk;filespacecount[1]=1;
-                  filespaceoffset[0]=n;filespaceoffset[1]=0;
-                  if (k==HDFGASTYPE || k==HDFSTARTYPE) {
-                    floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                    if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=Zfloatbuff;ifloat=1;}
-                    else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=Zdoublebuff;ifloat=0;}
-                    partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                    partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                  }
-
-                  //stellar age
-                  itemp++;
-                  datarank=1;
-                  datadim[0]=nchunk;
-                  chunkspace=DataSpace(datarank,datadim);
-                  filespacecount[0]=nchunk;filespacecount[1]=1;
-                  filespaceoffset[0]=n;filespaceoffset[1]=0;
-                  if (k==HDFSTARTYPE) {
-                    floattype=partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].getFloatType();
-                    if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=Tagefloatbuff;ifloat=1;}
-                    else {HDFREALTYPE=PredType::NATIVE_DOUBLE;realbuff=Tagedoublebuff;ifloat=0;}
-                    partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
-                    partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp].read(realbuff,HDFREALTYPE,chunkspace,partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
-                  }
-#endif
-#endif
+                cinfo.k=k;cinfo.ibaryon=1;
+                for (n=0;n<hdf_header_info[i].npart[k];n+=chunksize) {
+                  cinfo.noffset=n;cinfo.num=min((Int_t)chunksize,hdf_header_info[i].npart[k]-n);
+                  chunkinfo.push_back(cinfo);
+                }
+              }
+            }
 
-                  for (int nn=0;nn<nchunk;nn++) {
-                    if (ifloat_pos) ibuf=MPIGetParticlesProcessor(floatbuff[nn*3],floatbuff[nn*3+1],floatbuff[nn*3+2]);
-                    else ibuf=MPIGetParticlesProcessor(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
-                    ibufindex=ibuf*BufSize+Nbuf[ibuf];
-                    //reset hydro quantities of buffer
+            //read a chunk through hyperslabs of the data sets of its particle type
+            auto readchunk=[&](HDF_Part_Chunk &c) {
+              int k=c.k, iset=i*NHDFTYPE*NHDFDATABLOCK+c.k*NHDFDATABLOCK;
+              hsize_t count[2],offset[2],dim[1];
+              DataSpace memspace;
+              auto readblock=[&](int itemp, int ndim, const DataType &memtype, void *buff) {
+                dim[0]=c.num*ndim;
+                memspace=DataSpace(1,dim);
+                count[0]=c.num;count[1]=ndim;
+                offset[0]=c.noffset;offset[1]=0;
+                partsdataspaceall[iset+itemp].selectHyperslab(H5S_SELECT_SET, count, offset);
+                partsdatasetall[iset+itemp].read(buff,memtype,memspace,partsdataspaceall[iset+itemp]);
+              };
+              c.pos.resize(3*c.num);
+              c.vel.resize(3*c.num);
+              c.id.resize(c.num);
+              if (!(c.ibaryon==0 && icachetype[k])) readblock(0,3,PredType::NATIVE_DOUBLE,c.pos.data());
+              readblock(1,3,PredType::NATIVE_DOUBLE,c.vel.data());
+              readblock(2,1,PredType::NATIVE_LLONG,c.id.data());
+              if (hdf_header_info[i].mass[k]==0) {
+                c.mass.resize(c.num);
+                readblock(3,1,PredType::NATIVE_DOUBLE,c.mass.data());
+              }
 #ifdef GASON
-                    Pbuf[ibufindex].SetU(0);
+              if (k==HDFGASTYPE && (opt.iinputfields&INPUTFIELDU)) {
+                c.u.resize(c.num);
+                readblock(4,1,PredType::NATIVE_DOUBLE,c.u.data());
+              }
 #ifdef STARON
-                    Pbuf[ibufindex].SetSFR(0);
-                    Pbuf[ibufindex].SetZmet(0);
-#endif
+              if (k==HDFGASTYPE && (opt.iinputfields&INPUTFIELDSFR)) {
+                c.sfr.resize(c.num);
+                readblock(5,1,PredType::NATIVE_DOUBLE,c.sfr.data());
+              }
+              if ((k==HDFGASTYPE || k==HDFSTARTYPE) && (opt.iinputfields&INPUTFIELDZMET)) {
+                c.zmet.resize(c.num);
+                readblock(6,1,PredType::NATIVE_DOUBLE,c.zmet.data());
+              }
+              if (k==HDFSTARTYPE && (opt.iinputfields&INPUTFIELDTAGE)) {
+                c.tage.resize(c.num);
+                readblock(7,1,PredType::NATIVE_DOUBLE,c.tage.data());
+              }
 #endif
-#ifdef STARON
-                    Pbuf[ibufindex].SetZmet(0);
-                    Pbuf[ibufindex].SetTage(0);
 #endif
-#ifdef BHON
+            };
+
+            //convert a chunk to particles using all threads then add them to the buffers of the tasks they belong to
+            vector<Particle> Pchunk;
+            vector<int> ichunktask;
+            auto loadchunk=[&](HDF_Part_Chunk &c) {
+              int k=c.k, icache=(c.ibaryon==0 && icachetype[k]);
+              Pchunk.resize(c.num);
+              ichunktask.resize(c.num);
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
 #endif
-                    //store particle info in Ptemp;
-                    if(ifloat_pos) {
-                      Pbuf[ibufindex].SetPosition(floatbuff[nn*3],floatbuff[nn*3+1],floatbuff[nn*3+2]);
-                    }
-                    else {
-                      Pbuf[ibufindex].SetPosition(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
-                    }
-                    if (ifloat) {
-                      Pbuf[ibufindex].SetVelocity(velfloatbuff[nn*3],velfloatbuff[nn*3+1],velfloatbuff[nn*3+2]);
-                      if (hdf_header_info[i].mass[k]==0)Pbuf[ibufindex].SetMass(massfloatbuff[nn]);
-                      else Pbuf[ibufindex].SetMass(hdf_header_info[i].mass[k]);
-                    }
-                    else {
-                      Pbuf[ibufindex].SetVelocity(veldoublebuff[nn*3],veldoublebuff[nn*3+1],veldoublebuff[nn*3+2]);
-                      if (hdf_header_info[i].mass[k]==0)Pbuf[ibufindex].SetMass(massdoublebuff[nn]);
-                      else Pbuf[ibufindex].SetMass(hdf_header_info[i].mass[k]);
-                    }
-                    if (iint) Pbuf[ibufindex].SetPID(intbuff[nn]);
-                    else Pbuf[ibufindex].SetPID(longbuff[nn]);
-                    Pbuf[ibufindex].SetID(nn);
-                    if (k==HDFGASTYPE) Pbuf[ibufindex].SetType(GASTYPE);
-                    else if (k==HDFDMTYPE) Pbuf[ibufindex].SetType(DARKTYPE);
-                    else if (k==HDFSTARTYPE) Pbuf[ibufindex].SetType(STARTYPE);
-                    else if (k==HDFBHTYPE) Pbuf[ibufindex].SetType(BHTYPE);
+              for (Int_t nn=0;nn<c.num;nn++) {
+                Particle &p=Pchunk[nn];
+                double *pos=(icache)?&mpi_readcache[i][k].pos[3*(c.noffset+nn)]:&c.pos[3*nn];
+                //particles not kept when subsampling or outside the high resolution region of a zoom simulation are flagged with no task
+                if (!SubsampleKeep(opt,c.id[nn]) || !opt.zoomregion.Keep(k,pos[0],pos[1],pos[2])) {ichunktask[nn]=-1;continue;}
+                if (c.task>=0) ichunktask[nn]=c.task;
+                else if (icache) ichunktask[nn]=mpi_readcache[i][k].task[c.noffset+nn];
+                else ichunktask[nn]=MPIGetParticlesProcessor(pos[0],pos[1],pos[2]);
+                p.SetPosition(pos[0],pos[1],pos[2]);
+                p.SetVelocity(c.vel[nn*3],c.vel[nn*3+1],c.vel[nn*3+2]);
+                if (hdf_header_info[i].mass[k]==0) p.SetMass(c.mass[nn]);
+                else p.SetMass(hdf_header_info[i].mass[k]);
+                p.SetPID(c.id[nn]);
+                p.SetID(nn);
+                if (k==HDFGASTYPE) p.SetType(GASTYPE);
+                else if (k==HDFDMTYPE) p.SetType(DARKTYPE);
+                else if (k==HDFSTARTYPE) p.SetType(STARTYPE);
+                else if (k==HDFBHTYPE) p.SetType(BHTYPE);
 #ifdef GASON
-                    if (k==HDFGASTYPE) {
-                      if (ifloat) Pbuf[ibufindex].SetU(ufloatbuff[nn]);
-                      else Pbuf[ibufindex].SetU(udoublebuff[nn]);
-#ifdef STARON
-                      if (ifloat) Pbuf[ibufindex].SetSFR(SFRfloatbuff[nn]);
-                      else Pbuf[ibufindex].SetSFR(SFRdoublebuff[nn]);
-                      if (ifloat) Pbuf[ibufindex].SetZmet(Zfloatbuff[nn]);
-                      else Pbuf[ibufindex].SetZmet(Zdoublebuff[nn]);
-#endif
-
-                    }
+                //fields not read are left at zero
+                p.SetU(0);
+                if (k==HDFGASTYPE && c.u.size()) p.SetU(c.u[nn]);
 #endif
 #ifdef STARON
-                    if (k==HDFSTARTYPE) {
-                      if (ifloat) Pbuf[ibufindex].SetZmet(Zfloatbuff[nn]);
-                      else Pbuf[ibufindex].SetZmet(Zdoublebuff[nn]);
-                      if (ifloat) {if (Tagefloatbuff[nn]<0) Pbuf[ibufindex].SetType(WINDTYPE); Pbuf[ibufindex].SetTage(Tagefloatbuff[nn]);}
-                      else {if (Tagedoublebuff[nn]<0) Pbuf[ibufindex].SetType(WINDTYPE);Pbuf[ibufindex].SetTage(Tagedoublebuff[nn]);}
-                    }
+                p.SetSFR(0);
+                p.SetZmet(0);
+                p.SetTage(0);
+#ifdef GASON
+                if (k==HDFGASTYPE) {
+                  if (c.sfr.size()) p.SetSFR(c.sfr[nn]);
+                  if (c.zmet.size()) p.SetZmet(c.zmet[nn]);
+                }
+                if (k==HDFSTARTYPE) {
+                  if (c.zmet.size()) p.SetZmet(c.zmet[nn]);
+                  if (c.tage.size()) {
+                    if (c.tage[nn]<0) p.SetType(WINDTYPE);
+                    p.SetTage(c.tage[nn]);
+                  }
+                }
+#endif
 #endif
-                    Nbuf[ibuf]++;
-                    MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocalbaryon[0], Pbaryons, Nreadbuf, Preadbuf);
+              }
+              //particles of cells in the local domain need no buffering
+              if (c.task==ThisTask) {
+                if (c.ibaryon) {
+                  for (Int_t nn=0;nn<c.num;nn++) if (ichunktask[nn]>=0) Pbaryons[Nlocalbaryon[0]++]=Pchunk[nn];
+                }
+                else {
+                  for (Int_t nn=0;nn<c.num;nn++) if (ichunktask[nn]>=0) Part[Nlocal++]=Pchunk[nn];
+                }
+                return;
+              }
+              for (Int_t nn=0;nn<c.num;nn++) {
+                if (ichunktask[nn]<0) continue;
+                ibuf=ichunktask[nn];
+                ibufindex=(2*ibuf+isendbuf[ibuf])*BufSize+Nbuf[ibuf];
+                Pbuf[ibufindex]=Pchunk[nn];
+                Nbuf[ibuf]++;
+                if (ibuf!=ThisTask && ireadtask[ibuf]<0) {if (Nbuf[ibuf]==BufSize) sendbuffer(ibuf);}
+                else if (c.ibaryon) MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocalbaryon[0], Pbaryons, Nreadbuf, Preadbuf);
+                else MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocal, Part.data(), Nreadbuf, Preadbuf);
+              }
+            };
+
+            //a prefetch thread, the only one calling the hdf library until all chunks are read, fills a ring of buffers
+            //while this thread loads the particles of the chunks already read
+            if (opt.inputnprefetchbuffers>0) {
+              HDF_Chunk_Ring ring(opt.inputnprefetchbuffers);
+              HDF_Part_Chunk *c;
+              thread prefetch([&](){
+                try {
+                  for (auto &ci:chunkinfo) {
+                    HDF_Part_Chunk *cfill=ring.NextFree();
+                    cfill->SetChunk(ci);
+                    readchunk(*cfill);
+                    ring.Filled();
                   }
-                }//end of chunk
-              }//end of party type
-            }//end of baryon if
+                }
+                catch(H5::Exception &error)
+                {
+                  HDF5PrintError(error);
+                  ireaderror=1;
+                }
+                ring.Finished();
+              });
+              while ((c=ring.NextFilled())!=NULL) {
+                loadchunk(*c);
+                ring.Emptied();
+              }
+              prefetch.join();
+            }
+            else {
+              for (auto &ci:chunkinfo) {
+                cinfo.SetChunk(ci);
+                readchunk(cinfo);
+                loadchunk(cinfo);
+              }
+            }
 
           }
           catch(GroupIException error)
@@ -1732,28 +1568,27 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
           }
           Fhdf[i].close();
           //send info between read threads
-          if (opt.nsnapread>1&&inreadsend<totreadsend){
+          if (mpi_ireadcells==0 && opt.nsnapread>1&&inreadsend<totreadsend){
             MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
             MPISendParticlesBetweenReadThreads(opt, Preadbuf, Part.data(), ireadtask, readtaskID, Pbaryons, mpi_comm_read, mpi_nsend_readthread, mpi_nsend_readthread_baryon);
             inreadsend++;
             for(ibuf = 0; ibuf < opt.nsnapread; ibuf++) Nreadbuf[ibuf]=0;
           }
 
+          if (mpi_readcache.size()>(size_t)i) mpi_readcache[i].clear();
         }//end of read file if
       }//end of file
+      mpi_readcache.clear();
       //once finished reading the file if there are any particles left in the buffer broadcast them
-      for(ibuf = 0; ibuf < NProcs; ibuf++) if (ireadtask[ibuf]<0)
+      if (mpi_ireadcells==0) for(ibuf = 0; ibuf < NProcs; ibuf++) if (ireadtask[ibuf]<0)
       {
-        MPI_Ssend(&Nbuf[ibuf],1,MPI_Int_t, ibuf, ibuf+NProcs, MPI_COMM_WORLD);
-        if (Nbuf[ibuf]>0) {
-          MPI_Ssend(&Pbuf[ibuf*BufSize], sizeof(Particle)*Nbuf[ibuf], MPI_BYTE, ibuf, ibuf, MPI_COMM_WORLD);
-          Nbuf[ibuf]=0;
-          //last broadcast with Nbuf[ibuf]=0 so that receiver knows no more particles are to be broadcast
-          MPI_Ssend(&Nbuf[ibuf],1,MPI_Int_t,ibuf,ibuf+NProcs,MPI_COMM_WORLD);
-        }
+        if (Nbuf[ibuf]>0) sendbuffer(ibuf);
+        MPI_Waitall(4,&sendrequests[4*ibuf],MPI_STATUSES_IGNORE);
+        //last broadcast with Nbuf[ibuf]=0 so that receiver knows no more particles are to be broadcast
+        MPI_Ssend(&Nbuf[ibuf],1,MPI_Int_t,ibuf,ibuf+NProcs,MPI_COMM_WORLD);
       }
       //do final send between read threads
-      if (opt.nsnapread>1){
+      if (mpi_ireadcells==0 && opt.nsnapread>1){
         MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
         MPISendParticlesBetweenReadThreads(opt, Preadbuf, Part.data(), ireadtask, readtaskID, Pbaryons, mpi_comm_read, mpi_nsend_readthread, mpi_nsend_readthread_baryon);
         inreadsend++;
@@ -1761,7 +1596,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
       }
     }
     //if not reading information than waiting to receive information
-    else {
+    else if (mpi_ireadcells==0) {
       MPIReceiveParticlesFromReadThreads(opt,Pbuf,Part.data(),readtaskID, irecv, mpi_irecvflag, Nlocalthreadbuf, mpi_request,Pbaryons);
     }
 #endif
@@ -1836,14 +1671,14 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     //a bit of clean up
 #ifdef USEMPI
     MPI_Comm_free(&mpi_comm_read);
-    if (opt.iBaryonSearch) delete[] mpi_nsend_baryon;
     if (opt.nsnapread>1) {
       delete[] mpi_nsend_readthread;
       if (opt.iBaryonSearch) delete[] mpi_nsend_readthread_baryon;
-      if (ireadtask[ThisTask]>=0) delete[] Preadbuf;
+      if (mpi_ireadcells==0 && ireadtask[ThisTask]>=0) delete[] Preadbuf;
     }
     delete[] Nbuf;
-    if (ireadtask[ThisTask]>=0) {
+    if (mpi_ireadcells) delete[] ireadfile;
+    else if (ireadtask[ThisTask]>=0) {
       delete[] Nreadbuf;
       delete[] Pbuf;
       delete[] ireadfile;
@@ -1878,4 +1713,67 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 
 }
 
+///reads the positions of the high resolution dark matter, hdf type 1, for \ref ZoomRegionFind, passing them on in chunks.
+///With mpi each task reads every NProcs-th file. The box size, in input units, is set before any positions are passed on
+void HDFZoomRegionPositions(Options &opt, double &boxsize, function<void(const double*, Int_t)> add)
+{
+    char buf[2000];
+    HDF_Group_Names hdf_gnames(opt.ihdfnameconvention);
+    HDF_Header hdf_header_info(opt.ihdfnameconvention);
+    HDF_Part_Info hdf_dm_info(HDFDMTYPE,opt.ihdfnameconvention);
+    H5File Fhdf;
+    Attribute headerattribs;
+    DataSet partsdataset;
+    DataSpace partsdataspace, chunkspace;
+    hsize_t filespacecount[2],filespaceoffset[2],datadim[1];
+    long long npart[NHDFTYPE];
+    Int_t chunksize=opt.inputbufsize;
+    vector<double> pos;
+#ifndef USEMPI
+    int ThisTask=0,NProcs=1;
+#endif
+    for (int i=ThisTask;i<opt.num_files;i+=NProcs)
+    {
+        if(opt.num_files>1) sprintf(buf,"%s.%d.hdf5",opt.fname,i);
+        else sprintf(buf,"%s.hdf5",opt.fname);
+        try
+        {
+            Exception::dontPrint();
+            Fhdf.openFile(buf, H5F_ACC_RDONLY);
+            //values are converted to the types asked for whatever the type in which they are stored
+            headerattribs=get_attribute(Fhdf, hdf_header_info.names[hdf_header_info.IBoxSize]);
+            headerattribs.read(PredType::NATIVE_DOUBLE,&boxsize);
+            headerattribs=get_attribute(Fhdf, hdf_header_info.names[hdf_header_info.INuminFile]);
+            headerattribs.read(PredType::NATIVE_LLONG,npart);
+            if (npart[HDFDMTYPE]>0) {
+                partsdataset=Fhdf.openGroup(hdf_gnames.part_names[HDFDMTYPE]).openDataSet(hdf_dm_info.names[0]);
+                partsdataspace=partsdataset.getSpace();
+            }
+            for (Int_t n=0;n<npart[HDFDMTYPE];n+=chunksize) {
+                Int_t nchunk=min(chunksize,(Int_t)(npart[HDFDMTYPE]-n));
+                pos.resize(3*nchunk);
+                datadim[0]=nchunk*3;
+                chunkspace=DataSpace(1,datadim);
+                filespacecount[0]=nchunk;filespacecount[1]=3;
+                filespaceoffset[0]=n;filespaceoffset[1]=0;
+                partsdataspace.selectHyperslab(H5S_SELECT_SET, filespacecount, filespaceoffset);
+                partsdataset.read(pos.data(),PredType::NATIVE_DOUBLE,chunkspace,partsdataspace);
+                add(pos.data(),nchunk);
+            }
+            Fhdf.close();
+        }
+        catch(const H5::Exception &error)
+        {
+            HDF5PrintError(error);
+            cerr<<"Could not read the high resolution particle positions from "<<buf<<endl;
+#ifdef USEMPI
+            MPIStopProgressThread();
+            MPI_Abort(MPI_COMM_WORLD,8);
+#else
+            exit(8);
+#endif
+        }
+    }
+}
+
 #endif
@@ -8,6 +8,7 @@
 #define HDFITEMS_H
 
 
+#include "streamitems.h"
 #include "H5Cpp.h"
 using namespace H5;
 
@@ -784,4 +785,116 @@ inline Int_t HDF_get_nfiles(char *fname, int ptype)
 
 
 
+
+/// \name Index of the particles in the top level cells of a snapshot
+/// SWIFT snapshots store the particles of each type ordered by the top level cell they are in and list in the Cells group
+/// how many particles of each type are in each cell, the file storing them and their offset in that file
+//@{
+///the top level cells of a snapshot and where the particles of each type in each cell are stored
+struct HDF_Cell_Info {
+    ///number of cells along each dimension and in total
+    int dim[3];
+    Int_t ncells;
+    ///width of the cells along each dimension
+    double width[3];
+    ///centres [3*ncells]
+    vector<double> centre;
+    ///number of particles of each type in each cell and their offset within the file storing them
+    vector<long long> count[NHDFTYPE], offset[NHDFTYPE];
+    ///file storing the particles of each type in each cell
+    vector<int> file[NHDFTYPE];
+};
+
+///check whether an object exists, testing each level of the path in turn
+static inline
+int hdf_path_exists(H5File &Fhdf, const string &path)
+{
+    string subpath;
+    for (auto &part:tokenize(path,"/")) {
+        subpath+=(subpath.size()>0?"/":"")+part;
+        if (H5Lexists(Fhdf.getId(), subpath.c_str(), H5P_DEFAULT)<=0) return 0;
+    }
+    return 1;
+}
+
+///read the cell index of a snapshot from its first file, returning 0 if there is none that can be used to locate particles
+inline int HDF_get_cell_info(char *fname, int nfiles, int hdfnametype, HDF_Cell_Info &cells)
+{
+    char buf[2000];
+    if (nfiles>1) sprintf(buf,"%s.0.hdf5",fname);
+    else sprintf(buf,"%s.hdf5",fname);
+    H5File Fhdf;
+    HDF_Group_Names hdf_gnames(hdfnametype);
+    DataSet dataset;
+    int icells=0;
+    string counts,offsets,files;
+
+    try
+    {
+        Exception::dontPrint();
+        Fhdf.openFile(buf, H5F_ACC_RDONLY);
+        if (hdf_path_exists(Fhdf,"Cells/Meta-data") && hdf_path_exists(Fhdf,"Cells/Centres")) {
+            Group meta=Fhdf.openGroup("Cells/Meta-data");
+            meta.openAttribute("dimension").read(PredType::NATIVE_INT,cells.dim);
+            meta.openAttribute("size").read(PredType::NATIVE_DOUBLE,cells.width);
+            cells.ncells=(Int_t)cells.dim[0]*(Int_t)cells.dim[1]*(Int_t)cells.dim[2];
+            cells.centre.resize(3*cells.ncells);
+            dataset=Fhdf.openDataSet("Cells/Centres");
+            if (dataset.getSpace().getSimpleExtentNpoints()==3*cells.ncells) {
+                dataset.read(cells.centre.data(),PredType::NATIVE_DOUBLE);
+                icells=1;
+            }
+            for (int k=0;k<NHDFTYPE && icells;k++) {
+                counts="Cells/Counts/"+hdf_gnames.part_names[k];
+                //offsets within each file, older snapshots only list offsets within the snapshot, which are only of use for single files
+                offsets="Cells/OffsetsInFile/"+hdf_gnames.part_names[k];
+                if (!hdf_path_exists(Fhdf,offsets)) offsets="Cells/Offsets/"+hdf_gnames.part_names[k];
+                files="Cells/Files/"+hdf_gnames.part_names[k];
+                cells.count[k].assign(cells.ncells,0);
+                cells.offset[k].assign(cells.ncells,0);
+                cells.file[k].assign(cells.ncells,0);
+                if (!hdf_path_exists(Fhdf,counts)) continue;
+                if (!hdf_path_exists(Fhdf,offsets) || (nfiles>1 && !hdf_path_exists(Fhdf,files))) {icells=0;break;}
+                Fhdf.openDataSet(counts).read(cells.count[k].data(),PredType::NATIVE_LLONG);
+                Fhdf.openDataSet(offsets).read(cells.offset[k].data(),PredType::NATIVE_LLONG);
+                if (nfiles>1) Fhdf.openDataSet(files).read(cells.file[k].data(),PredType::NATIVE_INT);
+            }
+        }
+    }
+    catch(H5::Exception &error)
+    {
+        HDF5PrintError(error);
+        icells=0;
+    }
+    Fhdf.close();
+    return icells;
+}
+//@}
+
+///\name Prefetching of particle data
+///When particles are loaded by mpi read tasks, a prefetch thread reads chunks of \ref Options.inputbufsize particles into a ring
+///of \ref Options.inputnprefetchbuffers buffers while the chunks already read are converted to particles and distributed.
+///The prefetch thread is then the only thread making calls to the hdf library.
+//@{
+///Particle data of a single type in a chunk of a file. Values are read as double and ids as long long, leaving any
+///conversion from the type stored in the file to the hdf library.
+struct HDF_Part_Chunk {
+    ///hdf particle type and whether particles are baryons loaded for a separate baryon search
+    int k, ibaryon;
+    ///task to which all particles in the chunk belong when reading by cell, -1 otherwise
+    int task;
+    ///offset of the chunk within the particles of this type in the file and number of particles in the chunk
+    Int_t noffset, num;
+    vector<double> pos, vel, mass, u, sfr, zmet, tage;
+    vector<long long> id;
+
+    void SetChunk(const HDF_Part_Chunk &c) {
+        k=c.k; ibaryon=c.ibaryon; task=c.task; noffset=c.noffset; num=c.num;
+    }
+};
+
+///Ring of chunk buffers filled by the prefetch thread and emptied by the thread loading the particles
+typedef Stream_Ring<HDF_Part_Chunk> HDF_Chunk_Ring;
+//@}
+
 #endif
@@ -70,7 +70,7 @@ Int_t ReadHeader(Options &opt){
 
 ///Reads particle data
 ///To add a new interface simply alter this to include the appropriate user written call
-void ReadData(Options &opt, vector<Particle> &Part, const Int_t nbodies, Particle *&Pbaryons, Int_t nbaryons)
+void ReadData(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons)
 {
     InitEndian();
 #ifdef USEMPI
@@ -91,11 +91,209 @@ void ReadData(Options &opt, vector<Particle> &Part, const Int_t nbodies, Particl
 #ifdef USEXDR
     else if (opt.inputtype==IONCHILADA) ReadNchilada(opt,Part,nbodies, Pbaryons, nbaryons);
 #endif
+#ifndef USEMPI
+    if (opt.isubsample>1 || opt.zoomregion.iset) CompactReadParticles(opt, Part, nbodies, Pbaryons, nbaryons);
+#endif
+    if (opt.isubsample>1) SubsampleAdjust(opt, Part, nbodies, Pbaryons, nbaryons);
 #ifdef USEMPI
     MPIAdjustDomain(opt);
 #endif
 }
 
+/*! Without mpi the readers store fewer particles than the header counts used to allocate memory if the input is subsampled or only
+    the high resolution region of a zoom simulation is read, and return the number stored in nbodies and nbaryons. The baryons are
+    moved to directly follow the particles searched and the unused memory freed.
+*/
+void CompactReadParticles(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons)
+{
+    if (Pbaryons!=NULL) {
+        for (Int_t i=0;i<nbaryons;i++) Part[nbodies+i]=Pbaryons[i];
+        Part.resize(nbodies+nbaryons);
+        Part.shrink_to_fit();
+        Pbaryons=&(Part.data()[nbodies]);
+    }
+    else {
+        nbaryons=0;
+        Part.resize(nbodies);
+        Part.shrink_to_fit();
+    }
+}
+
+/*! Once a subsampled input has been read, the particles kept stand in for those dropped, so their masses are scaled up by
+    the subsampling factor and the linking lengths by its cube root, the mean interparticle spacing of the subsample.
+*/
+void SubsampleAdjust(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons)
+{
+    Double_t fac=opt.isubsample;
+    Int_t nlocal, nlocalbaryons;
+#ifndef USEMPI
+    nlocal=nbodies;
+    nlocalbaryons=(Pbaryons!=NULL)?nbaryons:0;
+#else
+    nlocal=Nlocal;
+    nlocalbaryons=(Pbaryons!=NULL)?Nlocalbaryon[0]:0;
+#endif
+    for (Int_t i=0;i<nlocal;i++) Part[i].SetMass(Part[i].GetMass()*fac);
+    for (Int_t i=0;i<nlocalbaryons;i++) Pbaryons[i].SetMass(Pbaryons[i].GetMass()*fac);
+    opt.MassValue*=fac;
+    opt.ellxscale*=pow(fac,1.0/3.0);
+    opt.uinfo.eps*=pow(fac,1.0/3.0);
+#ifdef USEMPI
+    if (ThisTask==0)
+#endif
+    cout<<"Input subsampled keeping 1 in "<<opt.isubsample<<" particles, "<<nlocal<<" particles and "<<nlocalbaryons<<" baryons stored locally"<<endl;
+}
+
+/*! For zoom simulations read with \ref Options.izoomregiononly, find the region occupied by the high resolution dark matter (see
+    \ref Zoom_Region) from the positions of these particles alone, so that the low resolution particles outside a buffer about the
+    region are skipped as the input is read. Along each axis the bins of a fine histogram holding particles are flagged and the
+    region spans all but the longest run of empty bins, so that a region straddling the periodic boundary is a single interval.
+    If cells are used, the positions are read a second time to flag the cells of a grid over the region holding particles, which
+    are then grown by the buffer. With mpi every task reads a share of the files and the flags are combined.
+    Only gadget and hdf input store the low resolution dark matter as separate particle types.
+*/
+void ZoomRegionFind(Options &opt)
+{
+    Zoom_Region &region=opt.zoomregion;
+    const int nbins=ZOOMREGIONNBINS;
+    double boxsize=0, xmin[3], xmax[3], buffer, maxwidth=0;
+    Int_t nhighres=0;
+    vector<unsigned char> ibin(3*nbins,0);
+    function<void(Options&, double&, function<void(const double*, Int_t)>)> readpositions;
+#ifndef USEMPI
+    int ThisTask=0;
+#endif
+
+    region=Zoom_Region();
+    if (!opt.izoomregiononly) return;
+    if (opt.inputtype==IOGADGET) readpositions=GadgetZoomRegionPositions;
+#ifdef USEHDF
+    else if (opt.inputtype==IOHDF) readpositions=HDFZoomRegionPositions;
+#endif
+    else {
+        if (ThisTask==0) cout<<"Only gadget and hdf input store the low resolution dark matter of zoom simulations as separate types, reading all particles"<<endl;
+        opt.izoomregiononly=0;
+        return;
+    }
+    double time1=MyGetTime();
+
+    //flag the bins along each axis holding high resolution particles, keeping their extent in case the input is not periodic
+    for (int k=0;k<3;k++) {xmin[k]=MAXVALUE;xmax[k]=-MAXVALUE;}
+    readpositions(opt,boxsize,[&](const double *pos, Int_t num) {
+        for (Int_t n=0;n<num;n++) for (int k=0;k<3;k++) {
+            if (pos[3*n+k]<xmin[k]) xmin[k]=pos[3*n+k];
+            if (pos[3*n+k]>xmax[k]) xmax[k]=pos[3*n+k];
+            if (boxsize>0) ibin[k*nbins+min(max((int)floor(pos[3*n+k]/boxsize*nbins),0),nbins-1)]=1;
+        }
+        nhighres+=num;
+    });
+#ifdef USEMPI
+    {
+        double dtemp, xtemp[3];
+        Int_t ntemp;
+        vector<unsigned char> ibintemp(3*nbins);
+        MPI_Allreduce(&boxsize,&dtemp,1,MPI_DOUBLE,MPI_MAX,MPI_COMM_WORLD);
+        boxsize=dtemp;
+        MPI_Allreduce(&nhighres,&ntemp,1,MPI_Int_t,MPI_SUM,MPI_COMM_WORLD);
+        nhighres=ntemp;
+        MPI_Allreduce(xmin,xtemp,3,MPI_DOUBLE,MPI_MIN,MPI_COMM_WORLD);
+        for (int k=0;k<3;k++) xmin[k]=xtemp[k];
+        MPI_Allreduce(xmax,xtemp,3,MPI_DOUBLE,MPI_MAX,MPI_COMM_WORLD);
+        for (int k=0;k<3;k++) xmax[k]=xtemp[k];
+        MPI_Allreduce(ibin.data(),ibintemp.data(),3*nbins,MPI_UNSIGNED_CHAR,MPI_MAX,MPI_COMM_WORLD);
+        ibin=ibintemp;
+    }
+#endif
+    if (nhighres==0) {
+        if (ThisTask==0) cout<<"Input holds no high resolution dark matter, reading all particles"<<endl;
+        opt.izoomregiononly=0;
+        return;
+    }
+
+    //the region along each axis starts after the longest run of empty bins, found by scanning the bins twice so that runs wrap
+    region.period=boxsize;
+    for (int k=0;k<3;k++) {
+        if (boxsize>0) {
+            unsigned char *b=&ibin[k*nbins];
+            int nempty=0, maxempty=0, iend=0;
+            for (int i=0;i<2*nbins;i++) {
+                if (b[i%nbins]) nempty=0;
+                else if (++nempty>maxempty && nempty<nbins) {maxempty=nempty;iend=i%nbins;}
+            }
+            if (maxempty==0) {region.xmin[k]=0;region.width[k]=boxsize;}
+            else {
+                region.xmin[k]=((iend+1)%nbins)*boxsize/nbins;
+                region.width[k]=(nbins-maxempty)*boxsize/nbins;
+            }
+        }
+        else {
+            region.xmin[k]=xmin[k];
+            region.width[k]=xmax[k]-xmin[k];
+        }
+        maxwidth=max(maxwidth,region.width[k]);
+    }
+    buffer=opt.zoomregionbuffer*maxwidth;
+    for (int k=0;k<3;k++) {
+        region.xmin[k]-=buffer;
+        region.width[k]+=2.0*buffer;
+        if (boxsize>0) {
+            if (region.width[k]>=boxsize) {region.xmin[k]=0;region.width[k]=boxsize;}
+            else if (region.xmin[k]<0) region.xmin[k]+=boxsize;
+        }
+    }
+
+    //flag the cells holding high resolution particles and grow them by the buffer one axis at a time
+    if (opt.zoomregionncells>0 && region.width[0]>0 && region.width[1]>0 && region.width[2]>0) {
+        int ncells=opt.zoomregionncells;
+        long long ncells3=(long long)ncells*ncells*ncells;
+        vector<unsigned char> icell(ncells3,0), igrown(ncells3);
+        region.ncells=ncells;
+        readpositions(opt,boxsize,[&](const double *pos, Int_t num) {
+            for (Int_t n=0;n<num;n++) {
+                long long index=region.CellIndex(pos[3*n],pos[3*n+1],pos[3*n+2]);
+                if (index>=0) icell[index]=1;
+            }
+        });
+#ifdef USEMPI
+        MPI_Allreduce(icell.data(),igrown.data(),ncells3,MPI_UNSIGNED_CHAR,MPI_MAX,MPI_COMM_WORLD);
+        icell=igrown;
+#endif
+        for (int k=0;k<3;k++) {
+            int nbuf=(int)ceil(buffer/(region.width[k]/ncells));
+            //along an axis spanning the whole periodic box the cells wrap
+            int iwrap=(boxsize>0 && region.width[k]>=boxsize);
+            long long stride=(k==0)?(long long)ncells*ncells:((k==1)?ncells:1);
+            if (nbuf==0) continue;
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for (long long index=0;index<ncells3;index++) {
+                int i=(index/stride)%ncells;
+                igrown[index]=0;
+                for (int d=-nbuf;d<=nbuf && igrown[index]==0;d++) {
+                    int j=i+d;
+                    if (iwrap) j=(j+ncells)%ncells;
+                    else if (j<0 || j>=ncells) continue;
+                    igrown[index]=icell[index+(j-i)*stride];
+                }
+            }
+            icell.swap(igrown);
+        }
+        region.cells.swap(icell);
+    }
+    region.iset=1;
+
+    if (ThisTask==0) {
+        long long nkept=0;
+        for (auto &c:region.cells) nkept+=c;
+        cout<<"Found the region occupied by the "<<nhighres<<" high resolution particles in "<<MyGetTime()-time1<<" s, only low resolution particles within ";
+        for (int k=0;k<3;k++) cout<<"["<<region.xmin[k]<<","<<region.xmin[k]+region.width[k]<<"] ";
+        cout<<"are read";
+        if (region.ncells>0) cout<<", in the "<<nkept<<" of "<<region.cells.size()<<" cells within "<<buffer<<" of the high resolution particles";
+        cout<<endl;
+    }
+}
+
 //@}
 
 ///\name Read STF data files
@@ -170,15 +368,390 @@ void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particl
 
 //@}
 
+/// \name Checkpoints of the search so that a run can be restarted from the last completed stage
+//@{
+
+///Set the name of the checkpoint file of a given stage
+void GetCheckpointFileName(Options &opt, int stage, char *fname)
+{
+#ifdef USEMPI
+    sprintf(fname,"%s.checkpoint.%d.%d",opt.outname,stage,ThisTask);
+#else
+    sprintf(fname,"%s.checkpoint.%d",opt.outname,stage);
+#endif
+}
+
+///Get index of a pointer to a group id stored in the structure hierarchy, where indices of pfofall are offset by npfof. NULL pointers or pointers to neither array are -1
+inline Int_t GetCheckpointGroupIndex(Int_t *p, Int_t *pfof, Int_t npfof, Int_t *pfofall, Int_t npfofall)
+{
+    if (p==NULL) return -1;
+    if (pfof!=NULL && p>=pfof && p<pfof+npfof) return p-pfof;
+    if (pfofall!=NULL && p>=pfofall && p<pfofall+npfofall) return npfof+(p-pfofall);
+    return -1;
+}
+
+///Get pointer to a group id from index stored in checkpoint
+inline Int_t *GetCheckpointGroupPointer(Int_t index, Int_t *pfof, Int_t npfof, Int_t *pfofall)
+{
+    if (index<0) return NULL;
+    if (index<npfof) return &pfof[index];
+    return &pfofall[index-npfof];
+}
+
+/*! Writes a checkpoint of a completed stage of the search (see \ref CHECKPOINTSTAGES). Each task writes the local particles,
+    group ids, the halo property data (which for inclusive halo masses contains the masses) and the structure hierarchy stored in \ref psldata.
+    The pointers of the hierarchy are stored as indices into the particle and group id arrays.
+    A file is first written to a temporary name and then renamed so a job killed while writing leaves the previous checkpoint intact.
+    Once all tasks have written the checkpoint of this stage, checkpoints of earlier stages are removed.
+*/
+void WriteCheckpoint(Options &opt, int stage, vector<Particle> &Part, Int_t nbodies, Particle *Pbaryons, Int_t nbaryons, Int_t ngroup, Int_t nhalos,
+    Int_t *pfof, Int_t npfofall, Int_t *pfofall, Int_t npdata, PropData *pdata)
+{
+    fstream Fout;
+    char fname[1000],fnametmp[1100];
+#ifndef USEMPI
+    int ThisTask=0,NProcs=1;
+#endif
+    CheckpointHeader header(stage,NProcs,ThisTask,GetCheckpointParticleTotal(opt,nbodies,nbaryons));
+    Int_t npart=Part.size(), nlevels=0, nentries, nseparatebaryons=0;
+    StrucLevelData *ppsldata;
+    vector<Int_t> levelinfo;
+    double time1=MyGetTime();
+
+    GetCheckpointFileName(opt,stage,fname);
+    sprintf(fnametmp,"%s.tmp",fname);
+    if (opt.iverbose) cout<<ThisTask<<" writing checkpoint "<<fname<<endl;
+    Fout.open(fnametmp,ios::out|ios::binary);
+    if (!Fout.is_open()) {
+        cerr<<ThisTask<<" could not open checkpoint file "<<fnametmp<<". Exiting"<<endl;
+#ifdef USEMPI
+        MPIStopProgressThread();
+        MPI_Abort(MPI_COMM_WORLD,9);
+#else
+        exit(9);
+#endif
+    }
+    Fout.write((char*)&header,sizeof(CheckpointHeader));
+    Fout.write((char*)&npart,sizeof(Int_t));
+    Fout.write((char*)&nbodies,sizeof(Int_t));
+    Fout.write((char*)&nbaryons,sizeof(Int_t));
+    Fout.write((char*)&ngroup,sizeof(Int_t));
+    Fout.write((char*)&nhalos,sizeof(Int_t));
+    //options that are set during the search
+    Fout.write((char*)&opt.MinSize,sizeof(opt.MinSize));
+    Fout.write((char*)&opt.HaloMinSize,sizeof(opt.HaloMinSize));
+    Fout.write((char*)&opt.Ncell,sizeof(opt.Ncell));
+    Fout.write((char*)&opt.num3dfof,sizeof(opt.num3dfof));
+    Fout.write((char*)&opt.HaloSigmaV,sizeof(opt.HaloSigmaV));
+    Fout.write((char*)&opt.HaloLocalSigmaV,sizeof(opt.HaloLocalSigmaV));
+    Fout.write((char*)&opt.HaloVelDispScale,sizeof(opt.HaloVelDispScale));
+    //particle, group and property data. Baryons not stored in the particle array (as is the case with mpi prior to the baryon search) are stored separately
+    if (Pbaryons!=NULL && (Pbaryons<Part.data() || Pbaryons>=Part.data()+npart)) nseparatebaryons=nbaryons;
+    Fout.write((char*)Part.data(),sizeof(Particle)*npart);
+    Fout.write((char*)&nseparatebaryons,sizeof(Int_t));
+    if (nseparatebaryons>0) Fout.write((char*)Pbaryons,sizeof(Particle)*nseparatebaryons);
+    Fout.write((char*)pfof,sizeof(Int_t)*nbodies);
+    Fout.write((char*)&npfofall,sizeof(Int_t));
+    if (npfofall>0) Fout.write((char*)pfofall,sizeof(Int_t)*npfofall);
+    Fout.write((char*)&npdata,sizeof(Int_t));
+    if (npdata>0) Fout.write((char*)pdata,sizeof(PropData)*npdata);
+    //structure hierarchy
+    ppsldata=psldata;
+    while (ppsldata!=NULL) {nlevels++;ppsldata=ppsldata->nextlevel;}
+    Fout.write((char*)&nlevels,sizeof(Int_t));
+    ppsldata=psldata;
+    while (ppsldata!=NULL) {
+        levelinfo.clear();
+        levelinfo.push_back(ppsldata->stype);
+        levelinfo.push_back(ppsldata->nsinlevel);
+        levelinfo.push_back(ppsldata->Pparenthead!=NULL);
+        for (Int_t i=1;i<=ppsldata->nsinlevel;i++) {
+            levelinfo.push_back(ppsldata->stypeinlevel[i]);
+            levelinfo.push_back((ppsldata->Phead[i]!=NULL && ppsldata->Phead[i]>=Part.data() && ppsldata->Phead[i]<Part.data()+npart)?ppsldata->Phead[i]-Part.data():-1);
+            if (ppsldata->Pparenthead!=NULL)
+            levelinfo.push_back((ppsldata->Pparenthead[i]!=NULL && ppsldata->Pparenthead[i]>=Part.data() && ppsldata->Pparenthead[i]<Part.data()+npart)?ppsldata->Pparenthead[i]-Part.data():-1);
+            levelinfo.push_back(GetCheckpointGroupIndex(ppsldata->gidhead[i],pfof,nbodies,pfofall,npfofall));
+            levelinfo.push_back(GetCheckpointGroupIndex(ppsldata->gidparenthead[i],pfof,nbodies,pfofall,npfofall));
+            levelinfo.push_back(GetCheckpointGroupIndex(ppsldata->giduberparenthead[i],pfof,nbodies,pfofall,npfofall));
+        }
+        nentries=levelinfo.size();
+        Fout.write((char*)&nentries,sizeof(Int_t));
+        Fout.write((char*)levelinfo.data(),sizeof(Int_t)*nentries);
+        ppsldata=ppsldata->nextlevel;
+    }
+    Fout.close();
+    if (Fout.fail() || rename(fnametmp,fname)!=0) {
+        cerr<<ThisTask<<" could not write checkpoint file "<<fname<<". Exiting"<<endl;
+#ifdef USEMPI
+        MPIStopProgressThread();
+        MPI_Abort(MPI_COMM_WORLD,9);
+#else
+        exit(9);
+#endif
+    }
+#ifdef USEMPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    //all tasks have completed this stage so earlier checkpoints are no longer needed
+    for (int i=CHECKPOINTFIELD;i<stage;i++) {
+        GetCheckpointFileName(opt,i,fname);
+        if (FileExists(fname)) remove(fname);
+    }
+    time1=MyGetTime()-time1;
+    cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to write checkpoint of stage "<<stage<<endl;
+}
+
+///Get the number of particles over all tasks, which does not change during the search and is stored in checkpoints
+long long GetCheckpointParticleTotal(Options &opt, Int_t nbodies, Int_t nbaryons)
+{
+    long long nlocal=nbodies, ntotal;
+    //when searching all particle types at once the baryons are among the nbodies particles
+    if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) nlocal+=nbaryons;
+#ifdef USEMPI
+    MPI_Allreduce(&nlocal,&ntotal,1,MPI_LONG_LONG,MPI_SUM,MPI_COMM_WORLD);
+#else
+    ntotal=nlocal;
+#endif
+    return ntotal;
+}
+
+///Check whether the checkpoint of a given stage exists for this task, returning 1 if it was written by a compatible run, 0 if there is none
+///and -1 if it was written with a different number of tasks, particle layout or number of particles, or cannot be read
+int CheckCheckpoint(Options &opt, int stage, long long ntotal)
+{
+    fstream Fin;
+    char fname[1000];
+#ifndef USEMPI
+    int ThisTask=0,NProcs=1;
+#endif
+    CheckpointHeader header(stage,NProcs,ThisTask,ntotal), fileheader;
+    GetCheckpointFileName(opt,stage,fname);
+    if (!FileExists(fname)) return 0;
+    Fin.open(fname,ios::in|ios::binary);
+    Fin.read((char*)&fileheader,sizeof(CheckpointHeader));
+    if (Fin.fail() || strncmp(header.magic,fileheader.magic,8)!=0) {
+        cerr<<ThisTask<<" checkpoint "<<fname<<" cannot be read or was written by another version"<<endl;
+        return -1;
+    }
+    Fin.close();
+    if (!header.Compatible(fileheader)) {
+        cerr<<ThisTask<<" checkpoint "<<fname<<" was written by task "<<fileheader.itask<<" of "<<fileheader.ntasks<<" for "<<fileheader.ntotal<<" particles";
+        cerr<<" of size "<<fileheader.particlesize<<" with layout flags "<<fileheader.particleflags;
+        cerr<<", this run is task "<<header.itask<<" of "<<header.ntasks<<" for "<<header.ntotal<<" particles";
+        cerr<<" of size "<<header.particlesize<<" with layout flags "<<header.particleflags<<endl;
+        return -1;
+    }
+    return 1;
+}
+
+///Get the last stage for which all tasks have a compatible checkpoint, returning \ref CHECKPOINTNONE if there is none.
+///Stops if any task has a checkpoint that does not match this run, as its particle data cannot be used
+int GetCheckpointStage(Options &opt, Int_t nbodies, Int_t nbaryons)
+{
+    int imask=0,iallmask,ibad=0,iallbad,icheck;
+    long long ntotal=GetCheckpointParticleTotal(opt,nbodies,nbaryons);
+    for (int stage=CHECKPOINTFIELD;stage<=CHECKPOINTNUMSTAGES;stage++) {
+        icheck=CheckCheckpoint(opt,stage,ntotal);
+        if (icheck==1) imask|=(1<<stage);
+        else if (icheck==-1) ibad=1;
+    }
+#ifdef USEMPI
+    MPI_Allreduce(&imask,&iallmask,1,MPI_INT,MPI_BAND,MPI_COMM_WORLD);
+    MPI_Allreduce(&ibad,&iallbad,1,MPI_INT,MPI_MAX,MPI_COMM_WORLD);
+#else
+    iallmask=imask;
+    iallbad=ibad;
+#endif
+    if (iallbad) {
+#ifdef USEMPI
+        if (ThisTask==0)
+#endif
+        cerr<<"Checkpoints do not match this run. Restart with the number of tasks, compile options and input that wrote them or remove them. Exiting"<<endl;
+#ifdef USEMPI
+        MPIStopProgressThread();
+        MPI_Abort(MPI_COMM_WORLD,9);
+#else
+        exit(9);
+#endif
+    }
+    for (int stage=CHECKPOINTNUMSTAGES;stage>=CHECKPOINTFIELD;stage--) if (iallmask&(1<<stage)) return stage;
+    return CHECKPOINTNONE;
+}
+
+/*! Reads a checkpoint written by \ref WriteCheckpoint, replacing the particle array and allocating the group id arrays, property data
+    and structure hierarchy \ref psldata. If baryons were stored separately from the particle array, Pbaryons is allocated, otherwise it
+    points to the baryons stored after the nbodies particles searched.
+*/
+void ReadCheckpoint(Options &opt, int stage, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons, Int_t &ngroup, Int_t &nhalos,
+    Int_t *&pfof, Int_t &npfofall, Int_t *&pfofall, Int_t &npdata, PropData *&pdata)
+{
+    fstream Fin;
+    char fname[1000];
+    CheckpointHeader header;
+    Int_t npart, nlevels, nentries, index, nseparatebaryons;
+    int ipparent;
+    StrucLevelData *ppsldata=NULL;
+    vector<Int_t> levelinfo;
+    double time1=MyGetTime();
+#ifndef USEMPI
+    int ThisTask=0;
+#endif
+
+    GetCheckpointFileName(opt,stage,fname);
+    cout<<ThisTask<<" reading checkpoint "<<fname<<endl;
+    Fin.open(fname,ios::in|ios::binary);
+    Fin.read((char*)&header,sizeof(CheckpointHeader));
+    Fin.read((char*)&npart,sizeof(Int_t));
+    Fin.read((char*)&nbodies,sizeof(Int_t));
+    Fin.read((char*)&nbaryons,sizeof(Int_t));
+    Fin.read((char*)&ngroup,sizeof(Int_t));
+    Fin.read((char*)&nhalos,sizeof(Int_t));
+    Fin.read((char*)&opt.MinSize,sizeof(opt.MinSize));
+    Fin.read((char*)&opt.HaloMinSize,sizeof(opt.HaloMinSize));
+    Fin.read((char*)&opt.Ncell,sizeof(opt.Ncell));
+    Fin.read((char*)&opt.num3dfof,sizeof(opt.num3dfof));
+    Fin.read((char*)&opt.HaloSigmaV,sizeof(opt.HaloSigmaV));
+    Fin.read((char*)&opt.HaloLocalSigmaV,sizeof(opt.HaloLocalSigmaV));
+    Fin.read((char*)&opt.HaloVelDispScale,sizeof(opt.HaloVelDispScale));
+    Part.resize(npart);
+    Fin.read((char*)Part.data(),sizeof(Particle)*npart);
+    Fin.read((char*)&nseparatebaryons,sizeof(Int_t));
+    if (nseparatebaryons>0) {
+        Pbaryons=new Particle[nseparatebaryons];
+        Fin.read((char*)Pbaryons,sizeof(Particle)*nseparatebaryons);
+    }
+    else if (nbaryons>0 && npart>=nbodies+nbaryons) Pbaryons=&Part.data()[nbodies];
+    else Pbaryons=NULL;
+    pfof=new Int_t[nbodies];
+    Fin.read((char*)pfof,sizeof(Int_t)*nbodies);
+    Fin.read((char*)&npfofall,sizeof(Int_t));
+    pfofall=NULL;
+    if (npfofall>0) {
+        pfofall=new Int_t[npfofall];
+        Fin.read((char*)pfofall,sizeof(Int_t)*npfofall);
+    }
+    Fin.read((char*)&npdata,sizeof(Int_t));
+    pdata=NULL;
+    if (npdata>0) {
+        pdata=new PropData[npdata];
+        Fin.read((char*)pdata,sizeof(PropData)*npdata);
+    }
+    if (psldata!=NULL) delete psldata;
+    psldata=NULL;
+    Fin.read((char*)&nlevels,sizeof(Int_t));
+    for (Int_t ilevel=0;ilevel<nlevels;ilevel++) {
+        Fin.read((char*)&nentries,sizeof(Int_t));
+        levelinfo.resize(nentries);
+        Fin.read((char*)levelinfo.data(),sizeof(Int_t)*nentries);
+        if (ilevel==0) ppsldata=psldata=new StrucLevelData();
+        else {ppsldata->nextlevel=new StrucLevelData();ppsldata=ppsldata->nextlevel;}
+        ppsldata->stype=levelinfo[0];
+        ipparent=levelinfo[2];
+        if (levelinfo[1]>0) {
+            ppsldata->Allocate(levelinfo[1]);
+            if (ipparent) ppsldata->Pparenthead=new Particle*[ppsldata->nsinlevel+1];
+        }
+        index=3;
+        for (Int_t i=1;i<=ppsldata->nsinlevel;i++) {
+            ppsldata->stypeinlevel[i]=levelinfo[index++];
+            ppsldata->Phead[i]=(levelinfo[index]>=0)?&Part[levelinfo[index]]:NULL;index++;
+            if (ipparent) {ppsldata->Pparenthead[i]=(levelinfo[index]>=0)?&Part[levelinfo[index]]:NULL;index++;}
+            ppsldata->gidhead[i]=GetCheckpointGroupPointer(levelinfo[index++],pfof,nbodies,pfofall);
+            ppsldata->gidparenthead[i]=GetCheckpointGroupPointer(levelinfo[index++],pfof,nbodies,pfofall);
+            ppsldata->giduberparenthead[i]=GetCheckpointGroupPointer(levelinfo[index++],pfof,nbodies,pfofall);
+        }
+    }
+    if (psldata==NULL) psldata=new StrucLevelData;
+    if (Fin.fail()) {
+        cerr<<ThisTask<<" error reading checkpoint file "<<fname<<". Exiting"<<endl;
+#ifdef USEMPI
+        MPIStopProgressThread();
+        MPI_Abort(MPI_COMM_WORLD,9);
+#else
+        exit(9);
+#endif
+    }
+    Fin.close();
+    time1=MyGetTime()-time1;
+    cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to read checkpoint of stage "<<stage<<endl;
+}
+
+//@}
+
 ///\name FOF outputs
 //@{
 
 /*! Writes a tipsy formatted fof.grp array file that contains the number of particles first then for each particle the group id of that particle
     group zero is untagged particles. \n
+    For MPI, particles no longer reside in input order. The particle ids of tipsy input are the positions of the particles in the file,
+    so the group ids are sorted by particle id and passed to task 0 one part of the file at a time, which writes the same single file.
+    The memory needed on task 0 is then similar to that of the local particles rather than the total number of particles.
+    The input order of other formats is not kept, so for them, or if \ref Options.iwritefof is 2, each thread writes its own file
+    (ie: parallel write) containing the total and local number of particles followed by the particle id and the global group id
+    of each local particle.
 */
-void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof){
+void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof, Particle *Part){
     fstream Fout;
     char fname[1000];
+#ifdef USEMPI
+    if (opt.iwritefof==2 || opt.inputtype!=IOTIPSY) {
+        if (ThisTask==0 && opt.iwritefof!=2) cout<<"Input order is only known for tipsy input, each task writes its own fof.grp file"<<endl;
+        sprintf(fname,"%s.fof.grp.%d",opt.outname,ThisTask);
+        cout<<"saving fof data to "<<fname<<endl;
+        Fout.open(fname,ios::out);
+        Fout<<Ntotal<<" "<<nbodies<<endl;
+        for (Int_t i=0;i<nbodies;i++) Fout<<Part[i].GetPID()<<" "<<((pfof[i]>0)?pfof[i]+mpi_ngroupoffset:0)<<endl;
+    }
+    else {
+        long long nt=0, nchunk, istart, iend;
+        Int_t i=0, nsendchunk, *nrecvchunk=NULL, *noffsetchunk=NULL;
+        vector<pair<long long,Int_t>> idgid(nbodies);
+        vector<long long> sendid, recvid;
+        vector<Int_t> sendgid, recvgid, gidchunk;
+        for (int k=0;k<NPARTTYPES;k++) nt+=opt.numpart[k];
+        for (Int_t j=0;j<nbodies;j++) idgid[j]=make_pair((long long)Part[j].GetPID(),(pfof[j]>0)?pfof[j]+mpi_ngroupoffset:0);
+        sort(idgid.begin(),idgid.end());
+        nchunk=max(nt/NProcs+1,1LL);
+        if (ThisTask==0) {
+            sprintf(fname,"%s.fof.grp",opt.outname);
+            cout<<"saving fof data to "<<fname<<endl;
+            Fout.open(fname,ios::out);
+            Fout<<nt<<endl;
+            nrecvchunk=new Int_t[NProcs];
+            noffsetchunk=new Int_t[NProcs];
+            gidchunk.resize(nchunk);
+        }
+        for (istart=0;istart<nt;istart+=nchunk) {
+            iend=min(istart+nchunk,nt);
+            sendid.clear();
+            sendgid.clear();
+            for (;i<nbodies && idgid[i].first<iend;i++) {
+                sendid.push_back(idgid[i].first);
+                sendgid.push_back(idgid[i].second);
+            }
+            nsendchunk=sendid.size();
+            MPI_Gather(&nsendchunk, 1, MPI_Int_t, nrecvchunk, 1, MPI_Int_t, 0, MPI_COMM_WORLD);
+            if (ThisTask==0) {
+                noffsetchunk[0]=0;
+                for (int k=1;k<NProcs;k++) noffsetchunk[k]=noffsetchunk[k-1]+nrecvchunk[k-1];
+                recvid.resize(noffsetchunk[NProcs-1]+nrecvchunk[NProcs-1]);
+                recvgid.resize(recvid.size());
+            }
+            MPI_Gatherv(sendid.data(), nsendchunk, MPI_LONG_LONG, recvid.data(), nrecvchunk, noffsetchunk, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+            MPI_Gatherv(sendgid.data(), nsendchunk, MPI_Int_t, recvgid.data(), nrecvchunk, noffsetchunk, MPI_Int_t, 0, MPI_COMM_WORLD);
+            if (ThisTask==0) {
+                //particles not searched, such as baryons in a dark matter search, are untagged
+                for (long long j=0;j<iend-istart;j++) gidchunk[j]=0;
+                for (size_t j=0;j<recvid.size();j++) gidchunk[recvid[j]-istart]=recvgid[j];
+                for (long long j=0;j<iend-istart;j++) Fout<<gidchunk[j]<<endl;
+            }
+        }
+        if (ThisTask==0) {
+            delete[] nrecvchunk;
+            delete[] noffsetchunk;
+        }
+    }
+#else
     sprintf(fname,"%s.fof.grp",opt.outname);
     cout<<"saving fof data to "<<fname<<endl;
     Fout.open(fname,ios::out);
@@ -210,6 +783,7 @@ void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof){
         for (Int_t i=0;i<opt.numpart[DARKTYPE];i++) Fout<<0<<endl;
         for (Int_t i=0;i<opt.numpart[STARTYPE];i++) Fout<<0<<endl;
     }
+#endif
     Fout.close();
     cout<<"Done"<<endl;
 }
@@ -233,9 +807,9 @@ void WritePGListIndex(Options &opt, const Int_t ngroups, const Int_t ng, Int_t *
     cout<<"saving fof data to "<<fname<<endl;
     Fout.open(fname,ios::out);
 #ifdef USEMPI
-    for (int j=0;j<NProcs;j++) ngtot+=mpi_ngroups[j];
+    ngtot=mpi_ngrouptotal;
     Fout<<ngtot<<" "<<ngroups<<endl;
-    for (int j=0;j<ThisTask;j++)noffset+=mpi_ngroups[j];
+    noffset=mpi_ngroupoffset;
 #else
     Fout<<ngroups<<" "<<ngroups<<endl;
 #endif
@@ -273,9 +847,9 @@ void WritePGList(Options &opt, const Int_t ngroups, const Int_t ng, Int_t *numin
     Fout.open(fname,ios::out);
 
 #ifdef USEMPI
-    for (int j=0;j<NProcs;j++) ngtot+=mpi_ngroups[j];
+    ngtot=mpi_ngrouptotal;
     Fout<<ngtot<<" "<<ngroups<<endl;
-    for (int j=0;j<ThisTask;j++)noffset+=mpi_ngroups[j];
+    noffset=mpi_ngroupoffset;
 #else
     Fout<<ngroups<<" "<<ngroups<<endl;
 #endif
@@ -359,7 +933,7 @@ void WriteGroupCatalog(Options &opt, const Int_t ngroups, Int_t *numingroup, Int
     ng=ngroups;
 
 #ifdef USEMPI
-    for (int j=0;j<NProcs;j++) ngtot+=mpi_ngroups[j];
+    ngtot=mpi_ngrouptotal;
 #else
     ngtot=ngroups+nadditional;//useful if outputing field halos
 #endif
@@ -475,8 +1049,7 @@ void WriteGroupCatalog(Options &opt, const Int_t ngroups, Int_t *numingroup, Int
         adios_err=adios_define_var(adios_grp_handle,datagroupnames.group[itemp].c_str(),"",datagroupnames.adiosgroupdatatype[itemp],"ng","ngtot","ngmpioffset");
         adios_err=adios_write(adios_file_handle,"ng",&ng);
         adios_err=adios_write(adios_file_handle,"ngtot",&ngtot);
-        Int_t mpioffset=0;
-        for (Int_t itask=0;itask<ThisTask;itask++)mpioffset+=mpi_ngroups[itask];
+        Int_t mpioffset=mpi_ngroupoffset;
         adios_err=adios_write(adios_file_handle,"ngmpioffset",&mpioffset);
         unsigned int *data=new unsigned int[ng];
         for (Int_t i=1;i<=ng;i++) data[i-1]=numingroup[i];
@@ -763,7 +1336,7 @@ void WriteGroupCatalog(Options &opt, const Int_t ngroups, Int_t *numingroup, Int
             adios_err=adios_write(adios_file_handle,"nids",&nids);
             adios_err=adios_write(adios_file_handle,"nidstot",&nidstot);
             Int_t mpioffset=0;
-            //for (Int_t itask=0;itask<ThisTask;itask++)mpioffset+=mpi_ngroups[itask];
+            //mpioffset=mpi_ngroupoffset;
             adios_err=adios_write(adios_file_handle,"nidsmpioffset",&mpioffset);
             long long *data=new long long[nids];
             for (Int_t i=0;i<nids;i++) data[i-1]=idval[i];
@@ -830,7 +1403,7 @@ void WriteGroupCatalog(Options &opt, const Int_t ngroups, Int_t *numingroup, Int
             adios_err=adios_write(adios_file_handle3,"nuids",&nuids);
             adios_err=adios_write(adios_file_handle3,"nuidstot",&nuidstot);
             Int_t mpioffset=0;
-            //for (Int_t itask=0;itask<ThisTask;itask++)mpioffset+=mpi_ngroups[itask];
+            //mpioffset=mpi_ngroupoffset;
             adios_err=adios_write(adios_file_handle3,"nidsmpioffset",&mpioffset);
             long long *data=new long long[nuids];
             for (Int_t i=0;i<nuids;i++) data[i-1]=idval[i];
@@ -1279,8 +1852,7 @@ void WriteSOCatalog(Options &opt, const Int_t ngroups, vector<Int_t> *SOpids){
         adios_err=adios_define_var(adios_grp_handle,datagroupnames.SO[itemp].c_str(),"",datagroupnames.adiosSOdatatype[itemp],"ng","ngtot","ngmpioffset");
         adios_err=adios_write(adios_file_handle,"ng",&ng);
         adios_err=adios_write(adios_file_handle,"ngtot",&ngtot);
-        Int_t mpioffset=0;
-        for (Int_t itask=0;itask<ThisTask;itask++)mpioffset+=mpi_ngroups[itask];
+        Int_t mpioffset=mpi_ngroupoffset;
         adios_err=adios_write(adios_file_handle,"ngmpioffset",&mpioffset);
         unsigned int *data=new unsigned int[ng];
         for (Int_t i=1;i<=ng;i++) data[i-1]=SOpids[i].size();
@@ -1414,7 +1986,7 @@ void WriteProperties(Options &opt, const Int_t ngroups, PropData *pdata){
     fstream Fout;
     char fname[1000];
     char buf[40];
-    long unsigned ngtot=0, noffset=0, ng=ngroups;
+    long unsigned ngtot=0, ng=ngroups;
 
     //if need to convert from physical back to comoving
     if (opt.icomoveunit) {
@@ -1446,8 +2018,7 @@ void WriteProperties(Options &opt, const Int_t ngroups, PropData *pdata){
 
 #ifdef USEMPI
     sprintf(fname,"%s.properties.%d",opt.outname,ThisTask);
-    for (int j=0;j<NProcs;j++) ngtot+=mpi_ngroups[j];
-    for (int j=0;j<ThisTask;j++)noffset+=mpi_ngroups[j];
+    ngtot=mpi_ngrouptotal;
 #else
     sprintf(fname,"%s.properties",opt.outname);
     int ThisTask=0,NProcs=1;
@@ -1954,7 +2525,7 @@ void WriteHierarchy(Options &opt, const Int_t &ngroups, const Int_t & nhierarchy
     fstream Fout;
     fstream Fout2;
     char fname[500],fname2[500];
-    unsigned long ng=ngroups,ngtot=0,noffset=0;
+    unsigned long ng=ngroups,ngtot=0;
 #ifdef USEHDF
     H5File Fhdf;
     H5std_string datasetname;
@@ -1987,8 +2558,7 @@ void WriteHierarchy(Options &opt, const Int_t &ngroups, const Int_t & nhierarchy
 
     //since the hierarchy file is appended to the catalog_groups files, no header written
 #ifdef USEMPI
-    for (int j=0;j<NProcs;j++) ngtot+=mpi_ngroups[j];
-    for (int j=0;j<ThisTask;j++)noffset+=mpi_ngroups[j];
+    ngtot=mpi_ngrouptotal;
 #else
     ngtot=ngroups;
 #endif
@@ -2566,8 +3136,8 @@ void WriteExtendedOutput (Options &opt, Int_t numgroups, Int_t nbodies, PropData
     int noffset = 0;
 
 #ifdef USEMPI
-    for (int j = 0; j < NProcs; j++) ngtot += mpi_ngroups[j];
-    for (int j = 0; j < ThisTask; j++) noffset += mpi_ngroups[j];
+    ngtot = mpi_ngrouptotal;
+    noffset = mpi_ngroupoffset;
 #else
     int ThisTask = 0;
     int NProcs = 1;
@@ -131,16 +131,93 @@ private(i,w,wsum,sv,vsv,fbg,vp,maxdist,vmweighted,isvweighted,tid,tempdenv)
 }
 
 
+/*! Histogram of the logarithmic density ratios (stored in the potential) used to characterise their distribution.
+    Particles are binned once into fine bins spanning the full range of values, each thread filling its own histogram which are then merged.
+    The coarser binnings used to find the most probable value and the widths of the distribution are built from these fine bins, the weights
+    of a fine bin being split between the coarse bins it overlaps in proportion to the overlap, so that no further passes over the particles are needed.
+*/
+struct DenVRatioHistogram
+{
+    Int_t nbins;
+    Double_t xmin, delta;
+    ///weights, square of weights and number of particles in each bin
+    vector<Double_t> w, w2;
+    vector<Int_t> num;
+
+    void Allocate(Int_t n, Double_t xmn, Double_t xmx) {
+        nbins=n;
+        xmin=xmn;
+        delta=(xmx-xmn)/(Double_t)nbins;
+        if (delta<=0) delta=1.0;
+        w.assign(nbins,0.);
+        w2.assign(nbins,0.);
+        num.assign(nbins,0);
+    }
+    void Add(Double_t x, Double_t wt) {
+        Int_t ir=(Int_t)((x-xmin)/delta);
+        if (ir<0) ir=0;
+        else if (ir>=nbins) ir=nbins-1;
+        w[ir]+=wt;
+        w2[ir]+=wt*wt;
+        num[ir]++;
+    }
+    void Merge(const DenVRatioHistogram &h) {
+        for (Int_t i=0;i<nbins;i++) {w[i]+=h.w[i];w2[i]+=h.w2[i];num[i]+=h.num[i];}
+    }
+    ///number of particles in [x0,x1), assuming particles are uniformly distributed within a bin
+    Double_t Count(Double_t x0, Double_t x1) const {
+        Double_t n=0, a, b;
+        Int_t ilo=max((Int_t)0,(Int_t)floor((x0-xmin)/delta)), ihi=min(nbins-1,(Int_t)floor((x1-xmin)/delta));
+        for (Int_t i=ilo;i<=ihi;i++) {
+            a=max(x0,xmin+i*delta);
+            b=min(x1,xmin+(i+1)*delta);
+            if (b>a) n+=num[i]*(b-a)/delta;
+        }
+        return n;
+    }
+    /*! rebin into nb bins of width deltar starting at x0, returning total weight. rbin and the optional w2bin must be zeroed.
+        The weight of a bin is split between the bins it overlaps assuming particles are uniformly distributed within the bin,
+        which avoids the aliasing that results from assigning whole bins when the bin widths are not commensurate.
+    */
+    Double_t Rebin(Double_t x0, Double_t deltar, Int_t nb, Double_t *rbin, Double_t *w2bin=NULL) const {
+        Double_t wtot=0, a, b, x1=x0+nb*deltar, lo, hi, frac;
+        Int_t jlo, jhi;
+        for (Int_t i=0;i<nbins;i++) {
+            if (num[i]==0) continue;
+            a=xmin+i*delta;
+            b=a+delta;
+            if (b<=x0 || a>=x1) continue;
+            jlo=max((Int_t)0,(Int_t)floor((a-x0)/deltar));
+            jhi=min(nb-1,(Int_t)floor((b-x0)/deltar));
+            for (Int_t j=jlo;j<=jhi;j++) {
+                lo=max(a,x0+j*deltar);
+                hi=min(b,x0+(j+1)*deltar);
+                if (hi<=lo) continue;
+                frac=(hi-lo)/delta;
+                rbin[j]+=w[i]*frac;
+                if (w2bin!=NULL) w2bin[j]+=w2[i]*frac;
+                wtot+=w[i]*frac;
+            }
+        }
+        return wtot;
+    }
+};
+
+/*! Determines the most probable value and the dispersion below and above it of the logarithmic density ratio distribution.
+    The particles are passed over twice, once to find the range and once to fill a \ref DenVRatioHistogram, the resolution of which scales with \f$ N^{1/3} \f$
+    between \ref DENVRATIOMINBINS and \ref DENVRATIOMAXBINS, so that it is finer than the binning used to estimate the distribution.
+*/
 void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *Part, Double_t &meanr,Double_t &sdlow,Double_t &sdhigh, int sublevel)
 {
     Int_t i,nbins,iprob,jprob;
-    Double_t mtot,mtotpeak,*rbin,deltar,maxprob, minprob,rmin,rmax;
+    Double_t mtot,mtotpeak,*rbin,*w2bin,deltar,maxprob, minprob,rmin,rmax;
     Double_t *xbin;
-    Double_t **omp_rbin;//, **omp_xbin;
-    int nthreads=1,tid;
     Double_t w;
-    Int_t ir;
+    Int_t nfine;
+    DenVRatioHistogram hist;
 #ifdef USEOPENMP
+    int nthreads=1,tid;
+    vector<DenVRatioHistogram> omp_hist;
 #pragma omp parallel 
     {
         if (omp_get_thread_num()==0) nthreads=omp_get_num_threads();
@@ -148,12 +225,6 @@ void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *
 #endif
     //to determine initial number of bins using modified Sturges' formula
     nbins = ceil(log10((Double_t)nbodies)/log10(2.0)+1)*4;
-    //rbin=new Double_t[nbins];
-    //xbin=new Double_t[nbins];
-    omp_rbin=new Double_t*[nthreads];
-    for (i=0;i<nthreads;i++) {
-        omp_rbin[i]=new Double_t[nbins];
-    }
 
     //deterrmine average, rmin,rmax and variance about mean
     rmin=rmax=Part[0].GetPotential();
@@ -193,70 +264,54 @@ private(i,tid)
     }
 #endif
 
-    //now bin data and find initial estimates for most probable value and the FWHM on either side of the most probable value
-    //deltar=(rmax-rmin)/(Double_t)nbins;
-    deltar=(4.0*fabs(rmin))/(Double_t)nbins;
-    rmin-=deltar*0.025;
-    deltar*=1.05;
-    //for (i=0;i<nbins;i++) rbin[i]=0;
-    for (int j=0;j<nthreads;j++) for (i=0;i<nbins;i++) omp_rbin[j][i]=0;
-    mtot=0;
+    //fill fine histogram spanning the full range of values
+    nfine=(Int_t)(DENVRATIOBINSFAC*pow((Double_t)nbodies,1./3.));
+    if (nfine<DENVRATIOMINBINS) nfine=DENVRATIOMINBINS;
+    else if (nfine>DENVRATIOMAXBINS) nfine=DENVRATIOMAXBINS;
+    hist.Allocate(nfine,rmin,rmax);
 #ifdef USEOPENMP
-    if (nbodies>ompperiodnum) {
-#pragma omp parallel default(shared) 
+    if (nbodies>ompperiodnum && nthreads>1) {
+    omp_hist.resize(nthreads);
+    for (int j=0;j<nthreads;j++) omp_hist[j].Allocate(nfine,rmin,rmax);
+#pragma omp parallel default(shared) \
+private(i,tid,w)
 {
-#pragma omp for private(i,tid,w,ir) reduction(+:mtot)
+#pragma omp for
     for (i=0;i<nbodies;i++) {
         tid=omp_get_thread_num();
-        ir=(Int_t)((Part[i].GetPotential()-rmin)/deltar);
-        //mass weighted
 #ifdef NOMASSWEIGHT
         w=1.0;
 #else
         w=Part[i].GetMass();
 #endif
-        if (ir<nbins) {
-            omp_rbin[tid][ir]+=w;
-            //rbin[ir]+=w;
-            mtot+=w;
-        }
+        omp_hist[tid].Add(Part[i].GetPotential(),w);
     }
 }
+    for (int j=0;j<nthreads;j++) hist.Merge(omp_hist[j]);
+    omp_hist.clear();
     }
     else {
-    for (i=0;i<nbodies;i++) {
-        tid=0;
-        ir=(Int_t)((Part[i].GetPotential()-rmin)/deltar);
-        //mass weighted
-#ifdef NOMASSWEIGHT
-        w=1.0;
-#else
-        w=Part[i].GetMass();
 #endif
-        if (ir<nbins) {
-            omp_rbin[tid][ir]+=w;
-            mtot+=w;
-        }
-    }
-    }
-#else
     for (i=0;i<nbodies;i++) {
-        tid=0;
-        ir=(Int_t)((Part[i].GetPotential()-rmin)/deltar);
-        //mass weighted
 #ifdef NOMASSWEIGHT
         w=1.0;
 #else
         w=Part[i].GetMass();
 #endif
-        if (ir<nbins) {
-            omp_rbin[tid][ir]+=w;
-            mtot+=w;
-        }
+        hist.Add(Part[i].GetPotential(),w);
+    }
+#ifdef USEOPENMP
     }
 #endif
-    for (int j=1;j<nthreads;j++) for (i=0;i<nbins;i++) omp_rbin[0][i]+=omp_rbin[j][i];
-    rbin=&omp_rbin[0][0];
+
+    //now bin data and find initial estimates for most probable value and the FWHM on either side of the most probable value
+    //deltar=(rmax-rmin)/(Double_t)nbins;
+    deltar=(4.0*fabs(rmin))/(Double_t)nbins;
+    rmin-=deltar*0.025;
+    deltar*=1.05;
+    rbin=new Double_t[nbins];
+    for (i=0;i<nbins;i++) rbin[i]=0;
+    mtot=hist.Rebin(rmin,deltar,nbins,rbin);
 
     maxprob=0.;
     for (i=0;i<nbins;i++) {
@@ -290,18 +345,18 @@ private(i,tid)
     //if object is small or bg search (ie sublevel==-1, then to keep statistics high, use preliminary determination of the variance and mean.
     if (nbodies<2*MINSUBSIZE) {
         if (opt.iverbose) printf("Using meanr=%e sdlow=%e sdhigh=%e\n",meanr,sdlow,sdhigh);
+        delete[] rbin;
         return;
     }
     //now rebin around most probable over sl in either direction to be used to estimate dispersion 
     //and gradually increase region till region encompases over 50% of the mass or particle numbers
     GMatrix W(nbins,nbins);
-    rbin=new Double_t[nbins];
+    w2bin=new Double_t[nbins];
     do {
         mtotpeak=0;
         rmin=(meanr-sl*sdlow);
         rmax=(meanr+sl*sdhigh);
-        int npeak=0;
-        for (i=0;i<nbodies;i++) if (Part[i].GetPotential()>=rmin&&Part[i].GetPotential()<rmax) npeak++;
+        Double_t npeak=hist.Count(rmin,rmax);
         //delete[] rbin;
         //delete[] xbin;
         //for (i=0;i<nthreads;i++) delete[] omp_rbin[i];
@@ -310,46 +365,18 @@ private(i,tid)
         deltar=3.5*sqrt(sdlow*sdlow+sdhigh*sdhigh)/pow(npeak,1./3.);
         nbins=ceil((rmax-rmin)/deltar+1);
         W=GMatrix(nbins,nbins);
-		delete[] rbin;
+        delete[] rbin;
+        delete[] w2bin;
         rbin=new Double_t[nbins];
-        //for (i=0;i<nthreads;i++) omp_rbin[i]=new Double_t[nbins];
-        //xbin=new Double_t[nbins];
-        for (i=0;i<nbins;i++)rbin[i]=0;
-        //for (int j=0;j<nthreads;j++) for (i=0;i<nbins;i++) omp_rbin[j][i]=0;
+        w2bin=new Double_t[nbins];
+        for (i=0;i<nbins;i++) rbin[i]=w2bin[i]=0;
+        mtotpeak=hist.Rebin(rmin,deltar,nbins,rbin,w2bin);
         for (int j=0;j<nbins;j++) for (int k=0;k<nbins;k++) W(j,k)=0.;
-/*#ifdef USEOPENMP
-#pragma omp parallel default(shared) 
-{
-#pragma omp for private(i) reduction(+ : mtotpeak)
-#endif
-*/
-        for (i=0;i<nbodies;i++) {
-//            int tid=0;
-//#ifdef USEOPENMP
-//            tid=omp_get_thread_num();
-//#endif
-            if (Part[i].GetPotential()>=rmin&&Part[i].GetPotential()<rmax) {
-                ir=(Int_t)((Part[i].GetPotential()-rmin)/deltar);
-#ifdef NOMASSWEIGHT
-                w=1.0;
-#else
-                w=Part[i].GetMass();
-#endif
-                rbin[ir]+=w;
-                W(ir,ir)+=w*w;
-                //omp_rbin[tid][ir]+=w;
-                mtotpeak+=w;
-            }
-        }
-/*#ifdef USEOPENMP
-}
-#endif*/
+        for (int j=0;j<nbins;j++) W(j,j)=w2bin[j];
         sl*=1.25;
     }while (mtotpeak/mtot<0.2);
+    delete[] w2bin;
     GMatrix covar(nbins,nbins);
-    //add bins together
-    //for (int j=1;j<nthreads;j++) for (i=0;i<nbins;i++) omp_rbin[0][i]+=omp_rbin[j][i];
-    //rbin=omp_rbin[0];
     xbin=new Double_t[nbins];
     maxprob=0.;
     minprob=MAXVALUE;
@@ -393,6 +420,8 @@ private(i,tid)
     //again, if number of particles is low (and so bin statisitics is poor) use initial estimate
     if (nbodies<16*MINSUBSIZE||sublevel==-1) {
         if (opt.iverbose) printf("Using meanr=%e sdlow=%e sdhigh=%e\n",meanr,sdlow,sdhigh);
+        delete[] xbin;
+        delete[] rbin;
         return;
     }
 
@@ -458,9 +487,6 @@ private(i,tid)
     //free memory
     delete[] xbin;
     delete[] rbin;
-    //rbin=NULL;
-    for (int j=0;j<nthreads;j++) delete[] omp_rbin[j];
-    delete[] omp_rbin;
 }
 
 /*! Calculates the normalized deviations from the mean of the dominated population. 
@@ -470,7 +496,7 @@ private(i,tid)
 */
 Int_t GetOutliersValues(Options &opt, const Int_t nbodies, Particle *Part, int sublevel)
 {
-    Int_t i,nsubset;
+    Int_t i,nsubset=0;
     int nthreads;
     Double_t temp, mtot=0.0;
 #ifndef USEMPI
@@ -7,160 +7,99 @@
 #include "stf.h"
 #include "swiftinterface.h"
 
-/*! Calculates the local velocity density function for each particle using a kernel technique
-    There are two approaches to getting this local quantity \n
-    1) From a large set of nearest physical neighbours use a smaller subset of nearest velocity neighbours \n
-    2) Or calculate phase space density and physical density and divide phase-space density by physical density. This is far more computationally expensive and may not enhance velocity clustering
-    and is just present for testing purposes.
-    \todo velocity density function is NOT mass weighted. Might want to alter this.
-    \todo there is a seg fault memory error when searching for NN in large sims using \em SINGLEPRECISION flag. I don't know why.
+#if defined(USEMPI) && !defined(HALOONLYDEN)
+/// \name Routines used to calculate the local velocity density across mpi domains
+//@{
+
+/*! Calculate the velocity density of particle i from its nearest neighbours on the local domain. The distance to the furthest neighbour is stored
+    in maxrdist and if the search region overlaps another mpi domain the density is instead set to -1, to be calculated by \ref GetVelocityDensityImported
+    once the neighbouring particles on other domains have been imported.
 */
-void GetVelocityDensity(Options &opt, const Int_t nbodies, Particle *Part, KDTree *tree)
+inline void GetVelocityDensityLocal(Options &opt, Particle *Part, KDTree *tree, Int_t i, Double_t *maxrdist, Int_t *nnids, Double_t *nnr2, Double_t *weight, PriorityQueue *pqv)
 {
-    Int_t i,j,k;
-    int nthreads;
-    int tid,id,pid,pid2,itreeflag=0;
+    Int_t id;
     Double_t v2;
-    Double_t time1,time2;
-#ifndef USEMPI
-    int ThisTask=0, NProcs=1;
+#ifdef STRUCDEN
+    //if strucden compile flag set then only calculate velocity density for particles in groups
+    if (Part[i].GetType()<=0) {maxrdist[i]=0.0;return;}
+    //if not searching all particles in FOF then also doing baryon search then just find nearest neighbours
+    if (!(opt.iBaryonSearch==1 && opt.partsearchtype==PSTALL)) tree->FindNearest(i,nnids,nnr2,opt.Nsearch);
+    //otherwise distinction must be made so that only base calculation on dark matter particles
+    else tree->FindNearestCriterion(i,FOFPositivetypes,NULL,nnids,nnr2,opt.Nsearch);
+#else
+    tree->FindNearest(i,nnids,nnr2,opt.Nsearch);
 #endif
-    ///\todo alter period so arbitrary dimensions
-    Double_t *period=NULL;
-    if (opt.p>0) {
-        period=new Double_t[3];
-        for (int j=0;j<3;j++) period[j]=opt.p;
-    }
-    time1=MyGetTime();
-    cout<<ThisTask<<": Get local velocity density"<<endl;
-    //only build tree if necessary
-    if (tree==NULL) {
-        itreeflag=1;
-        if (opt.iverbose) cout<<"Building Tree in (x) space to get local velocity density"<<endl;
-        tree=new KDTree(Part,nbodies,opt.Bsize,tree->TPHYS,tree->KEPAN,1000,0,0,0,period);
-    }
-    if (opt.iverbose) {
-        cout<<ThisTask<<" "<<"Using the following parameters to calculate velocity density using sph kernel: ";
-        cout<<ThisTask<<" "<<"(Nse,Nv)="<<opt.Nsearch<<","<<opt.Nvel<<endl;
-        cout<<ThisTask<<" "<<"Get velocity density using a subset of nearby physical or phase-space neighbours"<<endl;
-    }
-    //if using mpi run NN search store largest distance for each particle so that export list can be built.
-    //if calculating using only particles IN a structure,
-#ifndef HALOONLYDEN
-#ifdef USEMPI
-    Int_t nimport;
-    Double_t *maxrdist=new Double_t[nbodies];
-    Double_t *weight;
-    Int_t *nnids,*nnidsneighbours;
-    Double_t *nnr2, *nnr2neighbours;
-    PriorityQueue *pqx, *pqv;
-#ifndef USEOPENMP
-    nthreads=1;
+    //once NN set is found, store maxrdist and see if particle's search radius overlaps with another mpi domain
+    maxrdist[i]=sqrt(nnr2[opt.Nsearch-1]);
+#ifdef SWIFTINTERFACE
+    if (MPISearchForOverlapUsingMesh(libvelociraptorOpt,Part[i],maxrdist[i])!=0) {Part[i].SetDensity(-1.0);return;}
 #else
-#pragma omp parallel
-    {
-            if (omp_get_thread_num()==0) nthreads=omp_get_num_threads();
-    }
+    if (MPISearchForOverlap(Part[i],maxrdist[i])!=0) {Part[i].SetDensity(-1.0);return;}
 #endif
+    for (int j=0;j<opt.Nvel;j++) {
+        pqv->Push(-1, MAXVALUE);
+        weight[j]=1.0;
+    }
+    for (int j=0;j<opt.Nsearch;j++) {
+        v2=0;
+        id=nnids[j];
+        for (int k=0;k<3;k++) v2+=(Part[i].GetVelocity(k)-Part[id].GetVelocity(k))*(Part[i].GetVelocity(k)-Part[id].GetVelocity(k));
+        if (v2 < pqv->TopPriority()){
+            pqv->Pop();
+            pqv->Push(id, v2);
+        }
+    }
+    Part[i].SetDensity(tree->CalcSmoothLocalValue(opt.Nvel, pqv, weight));
+}
 
-    time2=MyGetTime();
-    //In loop determine if particles NN search radius overlaps another mpi threads domain.
-    //If not, then proceed as usually to determine velocity density.
-    //If so, do not calculate local velocity density and set its velocity density to -1 as a flag
+///apply \ref GetVelocityDensityLocal to particles list[start] to list[end-1], or particles start to end-1 if no list is given
+void GetVelocityDensityLocalList(Options &opt, Particle *Part, KDTree *tree, Double_t *maxrdist, Int_t start, Int_t end, Int_t *list)
+{
+    Int_t i;
+    Int_t *nnids;
+    Double_t *nnr2, *weight;
+    PriorityQueue *pqv;
 #ifdef USEOPENMP
 #pragma omp parallel default(shared) \
-private(i,j,k,tid,id,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,pqx,pqv)
+private(i,nnids,nnr2,weight,pqv)
 {
 #endif
     nnids=new Int_t[opt.Nsearch];
     nnr2=new Double_t[opt.Nsearch];
     weight=new Double_t[opt.Nvel];
-    pqx=new PriorityQueue(opt.Nsearch);
     pqv=new PriorityQueue(opt.Nvel);
 #ifdef USEOPENMP
 #pragma omp for schedule(dynamic)
 #endif
-    for (i=0;i<nbodies;i++) {
-        //if strucden compile flag set then only calculate velocity density for particles in groups
-#ifdef STRUCDEN
-        if (Part[i].GetType()>0) {
-        //if not searching all particles in FOF then also doing baryon search then just find nearest neighbours
-        if (!(opt.iBaryonSearch==1 && opt.partsearchtype==PSTALL)) tree->FindNearest(i,nnids,nnr2,opt.Nsearch);
-        //otherwise distinction must be made so that only base calculation on dark matter particles
-        else tree->FindNearestCriterion(i,FOFPositivetypes,NULL,nnids,nnr2,opt.Nsearch);
-#else
-        tree->FindNearest(i,nnids,nnr2,opt.Nsearch);
-#endif
-        //once NN set is found, store maxrdist and see if particle's search radius overlaps with another mpi domain
-        maxrdist[i]=sqrt(nnr2[opt.Nsearch-1]);
-#ifdef SWIFTINTERFACE
-        if (MPISearchForOverlapUsingMesh(libvelociraptorOpt,Part[i],maxrdist[i])==0) {
-#else
-        if (MPISearchForOverlap(Part[i],maxrdist[i])==0) {
-#endif
-            for (j=0;j<opt.Nvel;j++) {
-                pqv->Push(-1, MAXVALUE);
-                weight[j]=1.0;
-            }
-            for (j=0;j<opt.Nsearch;j++) {
-                v2=0;
-                id=nnids[j];
-                for (k=0;k<3;k++) v2+=(Part[i].GetVelocity(k)-Part[id].GetVelocity(k))*(Part[i].GetVelocity(k)-Part[id].GetVelocity(k));
-                if (v2 < pqv->TopPriority()){
-                    pqv->Pop();
-                    pqv->Push(id, v2);
-                }
-            }
-            Part[i].SetDensity(tree->CalcSmoothLocalValue(opt.Nvel, pqv, weight));
-        }
-        else Part[i].SetDensity(-1.0);
-#ifdef STRUCDEN
-        }
-        else maxrdist[i]=0.0;
-#endif
-    }
+    for (i=start;i<end;i++) GetVelocityDensityLocal(opt, Part, tree, (list==NULL)?i:list[i], maxrdist, nnids, nnr2, weight, pqv);
     delete[] nnids;
     delete[] nnr2;
     delete[] weight;
-    delete pqx;
     delete pqv;
 #ifdef USEOPENMP
 }
 #endif
-    if (opt.iverbose) cout<<ThisTask<<" finished local calculation in "<<MyGetTime()-time2<<endl;
-    time2=MyGetTime();
+}
 
-    //determines export AND import numbers
-#ifdef SWIFTINTERFACE
-    MPIGetNNExportNumUsingMesh(libvelociraptorOpt, nbodies, Part, maxrdist);
-#else
-    MPIGetNNExportNum(nbodies, Part, maxrdist);
-#endif
-    NNDataIn = new nndata_in[NExport];
-    NNDataGet = new nndata_in[NImport];
-    //build the exported particle list using NNData structures
-#ifdef SWIFTINTERFACE
-    MPIBuildParticleNNExportListUsingMesh(libvelociraptorOpt, nbodies, Part, maxrdist);
-#else
-    MPIBuildParticleNNExportList(nbodies, Part, maxrdist);
-#endif
-    MPIGetNNImportNum(nbodies, tree, Part);
-    PartDataIn = new Particle[NExport];
-    PartDataGet = new Particle[NImport];
-    MPI_Barrier(MPI_COMM_WORLD);
-    //run search on exported particles and determine which local particles need to be exported back (or imported)
-    nimport=MPIBuildParticleNNImportList(nbodies, tree, Part, (!(opt.iBaryonSearch==1 && opt.partsearchtype==PSTALL)));
+/*! Calculate the velocity density of the particles whose density is set to densityflag using both local particles and the nimport
+    particles imported from other mpi domains in Pimport
+*/
+void GetVelocityDensityImported(Options &opt, const Int_t nbodies, Particle *Part, KDTree *tree, Int_t nimport, Particle *Pimport, Double_t densityflag, Double_t *period)
+{
+    Int_t i,j,k,pid2;
+    Double_t v2;
+    Int_t *nnids,*nnidsneighbours;
+    Double_t *nnr2, *nnr2neighbours, *weight;
+    PriorityQueue *pqx, *pqv;
     int nimportsearch=opt.Nsearch;
     if (nimportsearch>nimport) nimportsearch=nimport;
-    if (opt.iverbose) cout<<ThisTask<<" Searching particles in other domains "<<nimport<<endl;
-    //now with imported particle list and local particle list can run proper NN search
     //first build neighbouring tree
     KDTree *treeneighbours=NULL;
-    if (nimport>0) treeneighbours=new KDTree(PartDataGet,nimport,1,tree->TPHYS,tree->KEPAN,100,0,0,0,period);
+    if (nimport>0) treeneighbours=new KDTree(Pimport,nimport,1,tree->TPHYS,tree->KEPAN,100,0,0,0,period);
     //then run search
 #ifdef USEOPENMP
 #pragma omp parallel default(shared) \
-private(i,j,k,tid,pid,pid2,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,pqx,pqv)
+private(i,j,k,pid2,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,pqx,pqv)
 {
 #endif
     nnids=new Int_t[opt.Nsearch];
@@ -177,13 +116,7 @@ private(i,j,k,tid,pid,pid2,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,p
 #ifdef STRUCDEN
         if (Part[i].GetType()>0) {
 #endif
-#ifdef USEOPENMP
-        tid=omp_get_thread_num();
-#else
-        tid=0;
-#endif
-        pid=Part[i].GetID();
-        if (Part[i].GetDensity()==-1) {
+        if (Part[i].GetDensity()==densityflag) {
             //search trees
 
             //if not searching all particles in FOF then also doing baryon search then just find nearest neighbours
@@ -201,11 +134,6 @@ private(i,j,k,tid,pid,pid2,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,p
             }
             //now search the export particle list and fill appropriately
             if (nimport>0) {
-                /*if (!(opt.iBaryonSearch==1 && opt.partsearchtype==PSTALL)) {
-                    Coordinate x(Part[i].GetPosition());
-                    treeneighbours->FindNearestPos(x,nnidsneighbours,nnr2neighbours,nimportsearch);
-                }
-                else treeneighbours->FindNearestCriterion(Part[i],FOFPositivetypes,NULL,nnidsneighbours,nnr2neighbours,nimportsearch);*/
                 Coordinate x(Part[i].GetPosition());
                 treeneighbours->FindNearestPos(x,nnidsneighbours,nnr2neighbours,nimportsearch);
                 for (j=0;j<nimportsearch;j++) {
@@ -227,7 +155,7 @@ private(i,j,k,tid,pid,pid2,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,p
                 }
                 else {
                     pid2=pqx->TopQueue()-nbodies;
-                    for (k=0;k<3;k++) v2+=(Part[i].GetVelocity(k)-PartDataGet[pid2].GetVelocity(k))*(Part[i].GetVelocity(k)-PartDataGet[pid2].GetVelocity(k));
+                    for (k=0;k<3;k++) v2+=(Part[i].GetVelocity(k)-Pimport[pid2].GetVelocity(k))*(Part[i].GetVelocity(k)-Pimport[pid2].GetVelocity(k));
                 }
                 if (v2 < pqv->TopPriority()){
                     pqv->Pop();
@@ -252,14 +180,201 @@ private(i,j,k,tid,pid,pid2,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,p
 #ifdef USEOPENMP
 }
 #endif
-    //free memory
-    if (itreeflag) delete tree;
     if (nimport>0) delete treeneighbours;
-    delete[] PartDataIn;
+}
+
+/*! Overlapped version of the mpi velocity density calculation, see \ref Options.impioverlap. Particles in a layer along the domain boundary,
+    whose width is the largest search radius of a sample of particles, are processed first. The particles whose search region overlaps another
+    domain are then exchanged with nonblocking communication while the particles in the interior of the domain are processed, polling the exchange
+    between blocks of particles. Interior particles whose search region turns out to be wider than the layer and overlap another domain are flagged
+    with a density of -2 and processed afterwards with a blocking exchange.
+*/
+void GetVelocityDensityOverlap(Options &opt, const Int_t nbodies, Particle *Part, KDTree *tree, Double_t *maxrdist, Double_t *period)
+{
+    const int nblocks=8;
+    Int_t i, nsample, ninterior, nimport, nlate=0, nlatetotal;
+    Double_t rlayer=0;
+    Int_t *nnids=new Int_t[opt.Nsearch];
+    Double_t *nnr2=new Double_t[opt.Nsearch];
+    int iallflag=(!(opt.iBaryonSearch==1 && opt.partsearchtype==PSTALL));
+    vector<Int_t> boundary, interior;
+    vector<partnndata_in> exportbuf, importbuf;
+    mpi_pending_exchange pending, pendinglate;
+    double time1=MyGetTime(), time2;
+
+    //estimate the width of the boundary layer from the search radii of a sample of particles
+    nsample=nbodies/1000+1;
+    for (i=0;i<nbodies;i+=nsample) {
+#ifdef STRUCDEN
+        if (Part[i].GetType()<=0) continue;
+#endif
+        tree->FindNearest(i,nnids,nnr2,opt.Nsearch);
+        rlayer=max(rlayer,(Double_t)sqrt(nnr2[opt.Nsearch-1]));
+    }
+    delete[] nnids;
+    delete[] nnr2;
+    for (i=0;i<nbodies;i++) {
+        maxrdist[i]=0;
+#ifdef STRUCDEN
+        if (Part[i].GetType()<=0) continue;
+#endif
+        if (MPISearchForOverlap(Part[i],rlayer)) boundary.push_back(i);
+        else interior.push_back(i);
+    }
+    ninterior=interior.size();
+    if (opt.iverbose) cout<<ThisTask<<" has "<<boundary.size()<<" particles within "<<rlayer<<" of other domains and "<<ninterior<<" interior particles"<<endl;
+
+    //process the boundary layer and start sending the particles whose search region overlaps other domains
+    GetVelocityDensityLocalList(opt, Part, tree, maxrdist, 0, boundary.size(), boundary.data());
+    time2=MyGetTime();
+    MPIGetNNExportNum(nbodies, Part, maxrdist);
+    MPIAddBlockingCommTime(pending, MyGetTime()-time2);
+    NNDataIn = new nndata_in[NExport];
+    NNDataGet = new nndata_in[NImport];
+    MPIStartParticleNNExport(nbodies, Part, maxrdist, pending);
+
+    //process the first half of the interior, then search the local particles with the imported search regions and send those found back
+    for (int iblock=0;iblock<nblocks;iblock++) {
+        GetVelocityDensityLocalList(opt, Part, tree, maxrdist, ninterior*iblock/(2*nblocks), ninterior*(iblock+1)/(2*nblocks), interior.data());
+        MPIPollExchange(pending);
+    }
+    MPIFinishExchange(pending);
+    nimport=MPIStartParticleNNImport(nbodies, tree, Part, iallflag, exportbuf, importbuf, pending);
+    PartDataGet = new Particle[nimport];
+
+    //process the rest of the interior and then the boundary particles
+    for (int iblock=nblocks;iblock<2*nblocks;iblock++) {
+        GetVelocityDensityLocalList(opt, Part, tree, maxrdist, ninterior*iblock/(2*nblocks), ninterior*(iblock+1)/(2*nblocks), interior.data());
+        MPIPollExchange(pending);
+    }
+    MPIFinishParticleNNImport(importbuf, pending);
+
+    //interior particles whose search region is wider than the layer overlap other domains but were not exported, so they are
+    //flagged and left for the second exchange rather than searched with imports that need not cover their search region
+    for (i=0;i<ninterior;i++) if (Part[interior[i]].GetDensity()==-1.0) {Part[interior[i]].SetDensity(-2.0);nlate++;}
+    if (opt.iverbose) cout<<ThisTask<<" finished local calculation, searching particles in other domains "<<nimport<<" in "<<MyGetTime()-time1<<endl;
+    GetVelocityDensityImported(opt, nbodies, Part, tree, nimport, PartDataGet, -1.0, period);
+    delete[] PartDataGet;
+    delete[] NNDataIn;
+    delete[] NNDataGet;
+
+    //only the flagged particles are exported in the second exchange
+    for (i=0;i<nbodies;i++) if (Part[i].GetDensity()!=-2.0) maxrdist[i]=0;
+    MPI_Allreduce(&nlate, &nlatetotal, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
+    if (nlatetotal>0) {
+        time2=MyGetTime();
+        MPIGetNNExportNum(nbodies, Part, maxrdist);
+        NNDataIn = new nndata_in[NExport];
+        NNDataGet = new nndata_in[NImport];
+        MPIBuildParticleNNExportList(nbodies, Part, maxrdist);
+        nimport=MPIStartParticleNNImport(nbodies, tree, Part, iallflag, exportbuf, importbuf, pendinglate);
+        PartDataGet = new Particle[nimport];
+        MPIFinishParticleNNImport(importbuf, pendinglate);
+        MPIAddBlockingCommTime(pending, MyGetTime()-time2);
+        GetVelocityDensityImported(opt, nbodies, Part, tree, nimport, PartDataGet, -2.0, period);
+        delete[] PartDataGet;
+        delete[] NNDataIn;
+        delete[] NNDataGet;
+        if (ThisTask==0) cout<<"Velocity density of "<<nlatetotal<<" particles outside the boundary layer needed a second exchange"<<endl;
+    }
+    MPIReportCommOverlap("local velocity density", pending);
+}
+//@}
+#endif
+
+/*! Calculates the local velocity density function for each particle using a kernel technique
+    There are two approaches to getting this local quantity \n
+    1) From a large set of nearest physical neighbours use a smaller subset of nearest velocity neighbours \n
+    2) Or calculate phase space density and physical density and divide phase-space density by physical density. This is far more computationally expensive and may not enhance velocity clustering
+    and is just present for testing purposes.
+    \todo velocity density function is NOT mass weighted. Might want to alter this.
+    \todo there is a seg fault memory error when searching for NN in large sims using \em SINGLEPRECISION flag. I don't know why.
+*/
+void GetVelocityDensity(Options &opt, const Int_t nbodies, Particle *Part, KDTree *tree)
+{
+    int itreeflag=0;
+    Double_t time1,time2;
+#if !defined(USEMPI) || defined(HALOONLYDEN)
+    Int_t i,j,k;
+    int nthreads;
+    int tid,id;
+    Double_t v2;
+#endif
+#ifndef USEMPI
+    int ThisTask=0, NProcs=1;
+#endif
+    ///\todo alter period so arbitrary dimensions
+    Double_t *period=NULL;
+    if (opt.p>0) {
+        period=new Double_t[3];
+        for (int j=0;j<3;j++) period[j]=opt.p;
+    }
+    time1=MyGetTime();
+    cout<<ThisTask<<": Get local velocity density"<<endl;
+    //only build tree if necessary
+    if (tree==NULL) {
+        itreeflag=1;
+        if (opt.iverbose) cout<<"Building Tree in (x) space to get local velocity density"<<endl;
+        tree=new KDTree(Part,nbodies,opt.Bsize,tree->TPHYS,tree->KEPAN,1000,0,0,0,period);
+    }
+    if (opt.iverbose) {
+        cout<<ThisTask<<" "<<"Using the following parameters to calculate velocity density using sph kernel: ";
+        cout<<ThisTask<<" "<<"(Nse,Nv)="<<opt.Nsearch<<","<<opt.Nvel<<endl;
+        cout<<ThisTask<<" "<<"Get velocity density using a subset of nearby physical or phase-space neighbours"<<endl;
+    }
+    //if using mpi run NN search store largest distance for each particle so that export list can be built.
+    //if calculating using only particles IN a structure,
+#ifndef HALOONLYDEN
+#ifdef USEMPI
+    Int_t nimport;
+    Double_t *maxrdist=new Double_t[nbodies];
+    int iallflag=(!(opt.iBaryonSearch==1 && opt.partsearchtype==PSTALL));
+    int ioverlap=(NProcs>1 && opt.impioverlap);
+#ifdef SWIFTINTERFACE
+    ioverlap=0;
+#endif
+    //if overlapping communication with computation, particles near the domain boundaries are processed first
+    if (ioverlap) GetVelocityDensityOverlap(opt, nbodies, Part, tree, maxrdist, period);
+    else {
+
+    time2=MyGetTime();
+    //In loop determine if particles NN search radius overlaps another mpi threads domain.
+    //If not, then proceed as usually to determine velocity density.
+    //If so, do not calculate local velocity density and set its velocity density to -1 as a flag
+    GetVelocityDensityLocalList(opt, Part, tree, maxrdist, 0, nbodies);
+    if (opt.iverbose) cout<<ThisTask<<" finished local calculation in "<<MyGetTime()-time2<<endl;
+    time2=MyGetTime();
+
+    //determines export AND import numbers
+#ifdef SWIFTINTERFACE
+    MPIGetNNExportNumUsingMesh(libvelociraptorOpt, nbodies, Part, maxrdist);
+#else
+    MPIGetNNExportNum(nbodies, Part, maxrdist);
+#endif
+    NNDataIn = new nndata_in[NExport];
+    NNDataGet = new nndata_in[NImport];
+    //build the exported particle list using NNData structures
+#ifdef SWIFTINTERFACE
+    MPIBuildParticleNNExportListUsingMesh(libvelociraptorOpt, nbodies, Part, maxrdist);
+#else
+    MPIBuildParticleNNExportList(nbodies, Part, maxrdist);
+#endif
+    MPIGetNNImportNum(nbodies, tree, Part);
+    PartDataGet = new Particle[NImport];
+    MPI_Barrier(MPI_COMM_WORLD);
+    //run search on exported particles and determine which local particles need to be exported back (or imported)
+    nimport=MPIBuildParticleNNImportList(nbodies, tree, Part, iallflag);
+    if (opt.iverbose) cout<<ThisTask<<" Searching particles in other domains "<<nimport<<endl;
+    //now with imported particle list and local particle list can run proper NN search
+    GetVelocityDensityImported(opt, nbodies, Part, tree, nimport, PartDataGet, -1.0, period);
+    //free memory
     delete[] PartDataGet;
     delete[] NNDataIn;
     delete[] NNDataGet;
     if(opt.iverbose) cout<<ThisTask<<" finished other domain search "<<MyGetTime()-time2<<endl;
+    }
+    if (itreeflag) delete tree;
+    delete[] maxrdist;
 #else
     //NO MPI invoked
 #ifndef USEOPENMP
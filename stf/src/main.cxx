@@ -27,8 +27,13 @@ int main(int argc,char **argv)
     //start MPI
 #ifdef USEOPENMP
     //if using hybrid then need to check that threads are available and use the correct initialization
+#ifdef MPITHREADMULTIPLE
+    //openmp threads post and complete their own exchanges and a progress thread may also call MPI routines
+    int required=MPI_THREAD_MULTIPLE;  // Required level of MPI threading support
+#else
     //Each thread will call MPI routines, but these calls will be coordinated to occur only one at a time within a process.
     int required=MPI_THREAD_FUNNELED;  // Required level of MPI threading support
+#endif
     int provided; // Provided level of MPI threading support
     MPI_Init_thread(&argc, &argv, required, &provided);
 #else
@@ -46,6 +51,7 @@ int main(int argc,char **argv)
         // Insufficient support, degrade to 1 thread and warn the user
         if (ThisTask == 0) cout << "Warning: This MPI implementation provides insufficient threading support. Required was " <<required<<" but provided was "<<provided<<endl;
         omp_set_num_threads(1);
+        MPIStopProgressThread();
         MPI_Finalize();
         exit(9);
     }
@@ -93,7 +99,6 @@ int main(int argc,char **argv)
     Int_t nbodies,nbaryons,ndark;
     vector<Particle> Part;
     Particle *Pbaryons;
-    KDTree *tree;
 
     //number in subset, number of grids used if iSingleHalo==0;
     Int_t nsubset, ngrid;
@@ -120,8 +125,11 @@ int main(int argc,char **argv)
 #ifdef USEMPI
     mpi_nlocal=new Int_t[NProcs];
     mpi_domain=new MPI_Domain[NProcs];
-    mpi_nsend=new Int_t[NProcs*NProcs];
-    mpi_ngroups=new Int_t[NProcs];
+    mpi_nsend=new Int_t[NProcs];
+    mpi_nrecv=new Int_t[NProcs];
+    MPIInitNodeTopology(opt);
+    MPIStartProgressThread(opt);
+    if (opt.impisfc && NProcs>1) mpi_sfc_level=MPISFCLEVEL;
     //store MinSize as when using mpi prior to stitching use min of 2;
     MinNumMPI=2;
     //if single halo, use minsize to initialize the old minimum number
@@ -164,6 +172,10 @@ int main(int argc,char **argv)
         if (opt.iBaryonSearch>0) cout<<"There are "<<nbaryons<<" baryon particles in total that require "<<nbaryons*sizeof(Particle)/1024./1024./1024.<<"GB of memory "<<endl;
     }
 
+    //for zoom simulations, find the high resolution region before any other particle data is read so that only the low resolution
+    //particles about it are read and, with mpi, the domains span it
+    ZoomRegionFind(opt);
+
     //note that for nonmpi particle array is a contiguous block of memory regardless of whether a separate baryon search is required
 #ifndef USEMPI
     Nlocal=nbodies;
@@ -182,26 +194,18 @@ int main(int argc,char **argv)
     //for the simple reason that the local number of particles changes to ensure large fof groups are local to an mpi domain
     //however, when reading data, it is much simplier to have a contiguous block of memory, sort that memory (if necessary)
     //and then split afterwards the dm particles and the baryons
-    if (NProcs==1) {Nlocal=Nmemlocal=nbodies;NExport=NImport=1;}
+    if (NProcs==1) {
+        Nlocal=Nmemlocal=nbodies;NExport=NImport=1;
+        if (opt.iBaryonSearch>0) Nlocalbaryon[0]=Nmemlocalbaryon=nbaryons;
+    }
     else {
-#ifdef MPIREDUCEMEM
-        //if allocating reasonable amounts of memory, use MPIREDUCEMEM
-        //this determines number of particles in the mpi domains
+        //determine the exact number of particles in the mpi domains so that no memory is allocated on the basis of an assumed
+        //load imbalance. Memory is grown when particles are exchanged using the counts exchanged beforehand.
+        //Counting reads the positions of the input, which gadget and hdf input keep for the particle read (MPI_single_pass_read),
+        //but other formats read twice
         MPINumInDomain(opt);
         cout<<ThisTask<<" There are "<<Nlocal<<" particles and have allocated enough memory for "<<Nmemlocal<<" requiring "<<Nmemlocal*sizeof(Particle)/1024./1024./1024.<<"GB of memory "<<endl;
         if (opt.iBaryonSearch>0) cout<<ThisTask<<"There are "<<Nlocalbaryon[0]<<" baryon particles and have allocated enough memory for "<<Nmemlocalbaryon<<" requiring "<<Nmemlocalbaryon*sizeof(Particle)/1024./1024./1024.<<"GB of memory "<<endl;
-#else
-        //otherwise just base on total number of particles * some factor and initialise the domains
-        MPIDomainExtent(opt);
-        MPIDomainDecomposition(opt);
-        Nlocal=nbodies/NProcs*MPIProcFac;
-        Nmemlocal=Nlocal;
-        Nlocalbaryon[0]=nbaryons/NProcs*MPIProcFac;
-        Nmemlocalbaryon=Nlocalbaryon[0];
-        NExport=NImport=Nlocal*MPIExportFac;
-        cout<<ThisTask<<" Have allocated enough memory for "<<Nmemlocal<<" requiring "<<Nmemlocal*sizeof(Particle)/1024./1024./1024.<<"GB of memory "<<endl;
-        if (opt.iBaryonSearch>0) cout<<" Have allocated enough memory for "<<Nmemlocalbaryon<<" baryons particles requiring "<<Nmemlocalbaryon*sizeof(Particle)/1024./1024./1024.<<"GB of memory "<<endl;
-#endif
     }
     cout<<ThisTask<<" will also require additional memory for FOF algorithms and substructure search. Largest mem needed for preliminary FOF search. Rough estimate is "<<Nlocal*(sizeof(Int_tree_t)*8)/1024./1024./1024.<<"GB of memory"<<endl;
     if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) {
@@ -220,16 +224,25 @@ int main(int argc,char **argv)
     if (ThisTask==0)
     cout<<"Loading ... "<<endl;
     ReadData(opt, Part, nbodies, Pbaryons, nbaryons);
-#ifdef USEMPI
+#ifndef USEMPI
+    //a subsampled input or the high resolution region of a zoom simulation stores fewer particles than in the header
+    Nlocal=nbodies;
+    if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) Nlocalbaryon[0]=nbaryons;
+#else
     //if mpi and want separate baryon search then once particles are loaded into contigous block of memory and sorted according to type order,
-    //allocate memory for baryons
+    //allocate memory for baryons. The baryons are copied from where they were read as, if the input is subsampled, the number of
+    //dark matter particles used to place them is only an upper bound
     if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) {
+        Particle *Pbaryonsread=Pbaryons;
         Pbaryons=new Particle[Nmemlocalbaryon];
         nbaryons=Nlocalbaryon[0];
 
-        for (Int_t i=0;i<Nlocalbaryon[0];i++) Pbaryons[i]=Part[i+Nlocal];
+        for (Int_t i=0;i<Nlocalbaryon[0];i++) Pbaryons[i]=Pbaryonsread[i];
         Part.resize(Nlocal);
     }
+    //move particles so that the space filling curve domains have similar amounts of work, otherwise just report the balance
+    if (mpi_sfc_level>0) MPISFCDomainDecomposition(opt, Part, Pbaryons, nbaryons);
+    else if (NProcs>1) MPIReportDomainImbalance("after loading", Nlocal+nbaryons);
 #endif
 
 #ifdef USEMPI
@@ -240,11 +253,12 @@ int main(int argc,char **argv)
 #ifdef USEMPI
     Ntotal=nbodies;
     nbodies=Nlocal;
-    NExport=NImport=Nlocal*MPIExportFac;
+    NExport=NImport=0;
     mpi_period=opt.p;
     MPI_Allgather(&nbodies, 1, MPI_Int_t, mpi_nlocal, 1, MPI_Int_t, MPI_COMM_WORLD);
     MPI_Allreduce(&nbodies, &Ntotal, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
     cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to load "<<Nlocal<<" of "<<Ntotal<<endl;
+    MPIReportMemoryUsage(opt, "loading");
 #else
     cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to load "<<nbodies<<endl;
 #endif
@@ -261,12 +275,24 @@ int main(int argc,char **argv)
     if (opt.smname!=NULL) sprintf(fname4,"%s",opt.smname);
 #endif
 
+    //if restarting, determine the last stage of the search for which all tasks have written a checkpoint
+    int icheckpointstage=CHECKPOINTNONE;
+    Int_t npfofall=0, npdata=0;
+    PropData *pdatacheckpoint=NULL;
+    if (opt.irestart) {
+        icheckpointstage=GetCheckpointStage(opt,nbodies,nbaryons);
+        if (ThisTask==0) {
+            if (icheckpointstage==CHECKPOINTNONE) cout<<"No checkpoint found, running full search"<<endl;
+            else cout<<"Restarting from checkpoint of stage "<<icheckpointstage<<endl;
+        }
+    }
+
     //read local velocity data or calculate it
     //(and if STRUCDEN flag or HALOONLYDEN is set then only calculate the velocity density function for objects within a structure
     //as found by SearchFullSet)
 #if defined (STRUCDEN) || defined (HALOONLYDEN)
 #else
-    if (opt.iSubSearch==1) {
+    if (opt.iSubSearch==1 && icheckpointstage==CHECKPOINTNONE) {
         time1=MyGetTime();
         if(FileExists(fname4)) ReadLocalVelocityDensity(opt, nbodies,Part);
         else  {
@@ -275,14 +301,38 @@ int main(int argc,char **argv)
         }
         time1=MyGetTime()-time1;
         cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to analyze/read local velocity density for "<<Nlocal<<" with "<<nthreads<<endl;
+#ifdef USEMPI
+        MPIReportMemoryUsage(opt, "local velocity density");
+#endif
     }
 #endif
 
     //here adjust Efrac to Omega_cdm/Omega_m from what it was before if baryonic search is separate
     if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) opt.uinfo.Eratio*=opt.Omega_cdm/opt.Omega_m;
 
+    //if restarting, replace the loaded particles with those of the checkpoint, along with the groups and structure hierarchy found so far
+    if (icheckpointstage!=CHECKPOINTNONE) {
+#ifdef USEMPI
+        if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) delete[] Pbaryons;
+#endif
+        ReadCheckpoint(opt,icheckpointstage,Part,nbodies,Pbaryons,nbaryons,ngroup,nhalos,pfof,npfofall,pfofall,npdata,pdatacheckpoint);
+        Nlocal=nbodies;
+        if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) Nlocalbaryon[0]=nbaryons;
+#ifdef USEMPI
+        Nmemlocal=Nlocal;
+        Nmemlocalbaryon=nbaryons;
+        NExport=NImport=0;
+        MPIUpdateGroupOffsets(ngroup);
+#endif
+        if (icheckpointstage<CHECKPOINTBARYON) pdatahalos=pdatacheckpoint;
+        else {
+            pdata=pdatacheckpoint;
+            if (opt.iBaryonSearch>0 && opt.partsearchtype==PSTDARK) pfofbaryons=&pfofall[nbodies];
+        }
+    }
+
     //From here can either search entire particle array for "Halos" or if a single halo is loaded, then can just search for substructure
-    if (!opt.iSingleHalo) {
+    if (!opt.iSingleHalo && icheckpointstage<CHECKPOINTFIELD) {
 #ifndef USEMPI
         time1=MyGetTime();
         pfof=SearchFullSet(opt,nbodies,Part,ngroup);
@@ -290,9 +340,6 @@ int main(int argc,char **argv)
         cout<<"TIME:: took "<<time1<<" to search "<<nbodies<<" with "<<nthreads<<endl;
 #else
         //nbodies=Ntotal;
-        ///\todo Communication Buffer size determination and allocation. For example, eventually need something like FoFDataIn = (struct fofdata_in *) CommBuffer;
-        ///At the moment just using NExport
-        NExport=Nlocal*MPIExportFac;
         //Now when MPI invoked this returns pfof after local linking and linking across and also reorders groups
         //according to size and localizes the particles belong to the same group to the same mpi thread.
         //after this is called Nlocal is adjusted to the local subset where groups are localized to a given mpi thread.
@@ -301,6 +348,7 @@ int main(int argc,char **argv)
         pfof=SearchFullSet(opt,Nlocal,Part,ngroup);
         time1=MyGetTime()-time1;
         cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to search "<<Nlocal<<" with "<<nthreads<<endl;
+        MPIReportMemoryUsage(opt, "field search");
         nbodies=Nlocal;
         nhalos=ngroup;
         //place barrier here to ensure all mpi threads have pfof for groups localized to their memory
@@ -324,8 +372,9 @@ int main(int argc,char **argv)
             for (Int_t i=0;i<nbodies;i++) Part[i].SetID(originalID[i]);
             delete[] originalID;
         }
+        if (opt.icheckpoint) WriteCheckpoint(opt,CHECKPOINTFIELD,Part,nbodies,Pbaryons,nbaryons,ngroup,nhalos,pfof,0,NULL,(opt.iInclusiveHalo?nhalos+1:0),pdatahalos);
     }
-    else {
+    else if (opt.iSingleHalo) {
         Coordinate *gvel;
         Matrix *gveldisp;
         GridCell *grid;
@@ -333,12 +382,9 @@ int main(int argc,char **argv)
         if (opt.iScaleLengths) ScaleLinkingLengths(opt,nbodies,Part.data(),cm,cmvel,Mtot);
         opt.Ncell=opt.Ncellfac*nbodies;
         //build grid using leaf nodes of tree (which is guaranteed to be adaptive and have maximum number of particles in cell of tree bucket size)
-        tree=InitializeTreeGrid(opt,nbodies,Part.data());
-        ngrid=tree->GetNumLeafNodes();
-        cout<<"Given "<<nbodies<<" particles, and max cell size of "<<opt.Ncell<<" there are "<<ngrid<<" leaf nodes or grid cells, with each node containing ~"<<nbodies/ngrid<<" particles"<<endl;
-        grid=new GridCell[ngrid];
         //note that after this system is back in original order as tree has been deleted.
-        FillTreeGrid(opt, nbodies, ngrid, tree, Part.data(), grid);
+        grid=BuildGrid(opt,nbodies,Part.data(),ngrid);
+        cout<<"Given "<<nbodies<<" particles, and max cell size of "<<opt.Ncell<<" there are "<<ngrid<<" leaf nodes or grid cells, with each node containing ~"<<nbodies/ngrid<<" particles"<<endl;
         //calculate cell quantities to get mean field
         gvel=GetCellVel(opt,nbodies,Part.data(),ngrid,grid);
         gveldisp=GetCellVelDisp(opt,nbodies,Part.data(),ngrid,grid,gvel);
@@ -363,9 +409,6 @@ int main(int argc,char **argv)
         pfof=SearchSubset(opt,nbodies,nbodies,Part.data(),ngroup);
 #else
         //nbodies=Ntotal;
-        ///\todo Communication Buffer size determination and allocation. For example, eventually need something like FoFDataIn = (struct fofdata_in *) CommBuffer;
-        ///At the moment just using NExport
-        NExport=Nlocal*MPIExportFac;
         mpi_foftask=MPISetTaskID(nbodies);
 
         //Now when MPI invoked this returns pfof after local linking and linking across and also reorders groups
@@ -377,23 +420,43 @@ int main(int argc,char **argv)
         MPI_Barrier(MPI_COMM_WORLD);
 #endif
     }
-    if (opt.iSubSearch) {
+    if (opt.iSubSearch && icheckpointstage<CHECKPOINTSUBSTRUCTURE) {
+#ifdef USEMPI
+        //move field structures so that the (superlinear) cost of the substructure search is shared evenly.
+        //structures in a 3DFOF/6DFOF hierarchy are left in place as the hierarchy has already been built
+        if (opt.impigrouprebalance && NProcs>1 && !opt.iSingleHalo) {
+            if (opt.iKeepFOF) {
+                if (ThisTask==0) cout<<"Not rebalancing field structures as the FOF hierarchy is kept"<<endl;
+            }
+            else {
+                nbodies=MPIGroupRebalance(opt, Part, nbodies, pfof, ngroup, pdatahalos);
+                nhalos=ngroup;
+            }
+        }
+#endif
         cout<<"Searching subset"<<endl;
         time1=MyGetTime();
         //if groups have been found (and localized to single MPI thread) then proceed to search for subsubstructures
         SearchSubSub(opt, nbodies, Part, pfof,ngroup,nhalos,pdatahalos);
         time1=MyGetTime()-time1;
         cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to search for substructures "<<Nlocal<<" with "<<nthreads<<endl;
+#ifdef USEMPI
+        if (NProcs>1) MPIReportTimeImbalance("substructure search", time1);
+        MPIReportMemoryUsage(opt, "substructure search");
+#endif
+        if (opt.icheckpoint && !opt.iSingleHalo) WriteCheckpoint(opt,CHECKPOINTSUBSTRUCTURE,Part,nbodies,Pbaryons,nbaryons,ngroup,nhalos,pfof,0,NULL,(opt.iInclusiveHalo?nhalos+1:0),pdatahalos);
     }
+    if (icheckpointstage<CHECKPOINTBARYON) {
     pdata=new PropData[ngroup+1];
     //if inclusive halo mass required
     if (opt.iInclusiveHalo && ngroup>0) {
         CopyMasses(nhalos,pdatahalos,pdata);
         delete[] pdatahalos;
     }
+    }
 
     //if only searching initially for dark matter groups, once found, search for associated baryonic structures if requried
-    if (opt.iBaryonSearch>0) {
+    if (opt.iBaryonSearch>0 && icheckpointstage<CHECKPOINTBARYON) {
         time1=MyGetTime();
         if (opt.partsearchtype==PSTDARK) {
             pfofall=SearchBaryons(opt, nbaryons, Pbaryons, nbodies, Part, pfof, ngroup,nhalos,opt.iseparatefiles,opt.iInclusiveHalo,pdata);
@@ -413,6 +476,13 @@ int main(int argc,char **argv)
         }
         time1=MyGetTime()-time1;
         cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to search baryons  with "<<nthreads<<endl;
+#ifdef USEMPI
+        MPIReportMemoryUsage(opt, "baryon search");
+#endif
+        if (opt.icheckpoint && !opt.iSingleHalo) {
+            if (opt.partsearchtype==PSTDARK) WriteCheckpoint(opt,CHECKPOINTBARYON,Part,nbodies,Pbaryons,nbaryons,ngroup,nhalos,pfof,nbodies+nbaryons,pfofall,ngroup+1,pdata);
+            else WriteCheckpoint(opt,CHECKPOINTBARYON,Part,nbodies,Pbaryons,nbaryons,ngroup,nhalos,pfof,0,NULL,ngroup+1,pdata);
+        }
     }
 
     //get mpi local hierarchy
@@ -447,6 +517,7 @@ int main(int argc,char **argv)
 #ifdef USEADIOS
         adios_finalize(ThisTask);
 #endif
+        MPIStopProgressThread();
         MPI_Finalize();
 #endif
         return 0;
@@ -455,15 +526,9 @@ int main(int argc,char **argv)
     //if want a simple tipsy still array listing particles group ids in input order
     if(opt.iwritefof) {
 #ifdef USEMPI
-        if (ThisTask==0) {
-            mpi_pfof=new Int_t[Ntotal];
-            //since pfof is a local subset, not all pfof values have been set, thus initialize them to zero.
-            for (Int_t i=0;i<Ntotal;i++) mpi_pfof[i]=0;
-        }
-        MPICollectFOF(Ntotal, pfof);
-        if (ThisTask==0) WriteFOF(opt,Ntotal,mpi_pfof);
+        WriteFOF(opt,Nlocal,pfof,Part.data());
 #else
-        WriteFOF(opt,nbodies,pfof);
+        WriteFOF(opt,nbodies,pfof,Part.data());
 #endif
     }
     numingroup=BuildNumInGroup(Nlocal, ngroup, pfof);
@@ -535,6 +600,8 @@ int main(int argc,char **argv)
     cout<<"TIME::"<<ThisTask<<" took "<<tottime<<" in all"<<endl;
 
 #ifdef USEMPI
+    MPIReportMemoryUsage(opt, "properties and output");
+    MPIStopProgressThread();
 #ifdef USEADIOS
     adios_finalize(ThisTask);
 #endif
@@ -74,6 +74,7 @@ void MPIDomainExtentGadget(Options &opt){
         header[i].Endian();
     }
     for (m=0;m<3;m++) {mpi_xlim[m][0]=0;mpi_xlim[m][1]=header[0].BoxSize;}
+    MPIZoomRegionExtent(opt);
     /*
     for (m=0;m<3;m++) {mpi_xlim[m][0]=MAXVALUE;mpi_xlim[m][1]=-MAXVALUE;}
     cout<<"Getting domain extent"<<endl;
@@ -510,6 +511,7 @@ void MPINumInDomainGadget(Options &opt)
     if (NProcs>1) {
     MPIDomainExtentGadget(opt);
     MPIInitialDomainDecomposition();
+    MPIZoomRegionDomainEdges(opt);
     MPIDomainDecompositionGadget(opt);
     Int_t i,j,k,n,m,temp,count,count2,pc,pc_new, Ntot,indark,ingas,instar;
     Int_t idval;
@@ -521,6 +523,7 @@ void MPINumInDomainGadget(Options &opt)
     char DATA[5];
     fstream *Fgad;
     struct gadget_header *header;
+    gadget_file_blocks gfile;
     Int_t Nlocalold=Nlocal;
     int *ireadfile,*ireadtask,*readtaskID;
     ireadtask=new int[NProcs];
@@ -558,19 +561,38 @@ void MPINumInDomainGadget(Options &opt)
             //endian indep call
             header[i].Endian();
 
-        #ifdef GADGET2FORMAT
-            Fgad[i].read((char*)&dummy, sizeof(dummy));
-            Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
-            Fgad[i].read((char*)&dummy, sizeof(dummy));
-            Fgad[i].read((char*)&dummy, sizeof(dummy));
-        #endif
-            Fgad[i].read((char*)&dummy, sizeof(dummy));
-            for(k=0;k<NGTYPE;k++)
+            Fgad[i].close();
+
+            //positions are decoded straight from the file's position block, see \ref gadget_file_blocks,
+            //and if the particle data is read in a single pass, they are kept along with the task of each particle
+            if (!gfile.Open(buf) || gfile.NumBlocks()<2) {cout<<"can't read positions from "<<buf<<endl;MPIStopProgressThread();MPI_Abort(MPI_COMM_WORLD,8);}
+            int icache=(mpi_readcache.size()>0);
+            if (icache) mpi_readcache[i].resize(NGTYPE);
+            for(k=0,count=0;k<NGTYPE;k++)
             {
-                for(n=0;n<header[i].npart[k];n++)
+                if (icache) {
+                    mpi_read_cache &cache=mpi_readcache[i][k];
+                    Int_t offset=count;
+                    cache.Allocate(header[i].npart[k]);
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
+#endif
+                    for(Int_t nn=0;nn<header[i].npart[k];nn++) {
+                        for (int kk=0;kk<3;kk++) cache.pos[3*nn+kk]=GadgetBlockValue<FLOAT>(gfile.Block(1),3*(offset+nn)+kk);
+                        //low resolution particles outside the high resolution region of a zoom simulation are not read and have no task
+                        if (!opt.zoomregion.Keep(k,cache.pos[3*nn],cache.pos[3*nn+1],cache.pos[3*nn+2])) cache.task[nn]=-1;
+                        else cache.task[nn]=MPIGetParticlesProcessor(cache.pos[3*nn],cache.pos[3*nn+1],cache.pos[3*nn+2]);
+                    }
+                }
+                for(n=0;n<header[i].npart[k];n++,count++)
                 {
-                    Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT)*3);
-                    ibuf=MPIGetParticlesProcessor(ctemp[0],ctemp[1],ctemp[2]);
+                    if (icache) ibuf=mpi_readcache[i][k].task[n];
+                    else {
+                        for (m=0;m<3;m++) ctemp[m]=GadgetBlockValue<FLOAT>(gfile.Block(1),3*count+m);
+                        if (!opt.zoomregion.Keep(k,ctemp[0],ctemp[1],ctemp[2])) ibuf=-1;
+                        else ibuf=MPIGetParticlesProcessor(ctemp[0],ctemp[1],ctemp[2]);
+                    }
+                    if (ibuf<0) continue;
                     if (opt.partsearchtype==PSTALL) {
                         Nbuf[ibuf]++;
                     }
@@ -596,7 +618,7 @@ void MPINumInDomainGadget(Options &opt)
                     }
                 }
             }
-            Fgad[i].close();
+            gfile.Close();
         }
     }
     //now having read number of particles, run all gather
@@ -95,6 +95,7 @@ void MPIDomainExtentHDF(Options &opt){
         }
         Fhdf.close();
         for (int i=0;i<3;i++) {mpi_xlim[i][0]=0;mpi_xlim[i][1]=hdf_header_info.BoxSize;}
+        MPIZoomRegionExtent(opt);
     }
     //There may be issues with particles exactly on the edge of a domain so before expanded limits by a small amount
     //now only done if a specific compile option passed
@@ -115,12 +116,119 @@ void MPIDomainExtentHDF(Options &opt){
     }
 }
 
+/*!
+    If the input indexes the particles in its top level cells (see \ref HDF_get_cell_info), each task reads the cells in its domain.
+    Regular domains are then rebuilt along cell boundaries, splitting the cells along the first axis into ranges holding similar numbers
+    of particles, each of these along the second axis and then along the third, so that no cell spans two domains. With a space
+    filling curve decomposition each cell is read by the task owning its centre, as particles are moved once domains are balanced.
+    Cells are not used when the cells are too coarse for the number of domains or with a separate baryon search.
+*/
 void MPIDomainDecompositionHDF(Options &opt){
-    Int_t i,j,k,n,m;
-    int Nsplit,isplit;
+    HDF_Cell_Info cells;
+    vector<mpi_read_cell> allcells;
+    mpi_read_cell readcell;
+    Int_t nallcells=0;
+    int icells=0;
 
+    mpi_ireadcells=0;
+    mpi_readcells.clear();
+    if (opt.impireadcells==0 || (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) || opt.zoomregion.iset) return;
     if (ThisTask==0) {
+        icells=HDF_get_cell_info(opt.fname, opt.num_files, opt.ihdfnameconvention, cells);
+        int ix=mpi_ideltax[0],iy=mpi_ideltax[1],iz=mpi_ideltax[2];
+        int axis[3]={ix,iy,iz};
+        if (icells && mpi_sfc_level==0) {
+            for (int m=0;m<3;m++) if (cells.dim[axis[m]]<mpi_nxsplit[axis[m]]) icells=0;
+            if (icells==0) cout<<"Top level cells of the input are too coarse for "<<NProcs<<" mpi domains, particles are read by file"<<endl;
+        }
+        if (icells && mpi_sfc_level==0) {
+            //index of each cell along each dimension and the number of particles it holds
+            vector<int> icell(3*cells.ncells);
+            vector<double> weight(cells.ncells,0);
+            for (Int_t n=0;n<cells.ncells;n++) {
+                for (int m=0;m<3;m++) icell[3*n+m]=min(cells.dim[m]-1,max(0,(int)floor(cells.centre[3*n+m]/cells.width[m])));
+                for (int k=0;k<NHDFTYPE;k++) weight[n]+=cells.count[k][n];
+            }
+            //split the range of cells [istart,iend) along axis into nsplit ranges holding similar numbers of particles
+            auto balancedcuts=[&](int m, int nsplit, int *istart, int *iend, vector<int> &cuts) {
+                int ncut=cells.dim[axis[m]];
+                vector<double> cum(ncut+1,0);
+                for (Int_t n=0;n<cells.ncells;n++) {
+                    int inside=1;
+                    for (int mm=0;mm<m;mm++) inside*=(icell[3*n+axis[mm]]>=istart[mm] && icell[3*n+axis[mm]]<iend[mm]);
+                    if (inside) cum[icell[3*n+axis[m]]+1]+=weight[n];
+                }
+                for (int c=0;c<ncut;c++) cum[c+1]+=cum[c];
+                cuts.resize(nsplit+1);
+                cuts[0]=0;cuts[nsplit]=ncut;
+                for (int s=1;s<nsplit;s++) {
+                    double target=cum[ncut]*s/(double)nsplit;
+                    int c=lower_bound(cum.begin(),cum.end(),target)-cum.begin();
+                    if (c>0 && target-cum[c-1]<cum[c]-target) c--;
+                    cuts[s]=min(max(c,cuts[s-1]+1),ncut-(nsplit-s));
+                }
+            };
+            auto setbounds=[&](int task, int m, vector<int> &cuts, int i) {
+                int a=axis[m];
+                mpi_domain[task].bnd[a][0]=(i==0)?mpi_xlim[a][0]:cuts[i]*cells.width[a];
+                mpi_domain[task].bnd[a][1]=(i==mpi_nxsplit[a]-1)?mpi_xlim[a][1]:cuts[i+1]*cells.width[a];
+            };
+            vector<int> cuts0,cuts1,cuts2;
+            int istart[3],iend[3],task;
+            balancedcuts(0,mpi_nxsplit[ix],istart,iend,cuts0);
+            for (int i=0;i<mpi_nxsplit[ix];i++) {
+                istart[0]=cuts0[i];iend[0]=cuts0[i+1];
+                balancedcuts(1,mpi_nxsplit[iy],istart,iend,cuts1);
+                for (int j=0;j<mpi_nxsplit[iy];j++) {
+                    istart[1]=cuts1[j];iend[1]=cuts1[j+1];
+                    balancedcuts(2,mpi_nxsplit[iz],istart,iend,cuts2);
+                    for (int k=0;k<mpi_nxsplit[iz];k++) {
+                        task=i+j*mpi_nxsplit[ix]+k*(mpi_nxsplit[ix]*mpi_nxsplit[iy]);
+                        setbounds(task,0,cuts0,i);
+                        setbounds(task,1,cuts1,j);
+                        setbounds(task,2,cuts2,k);
+                    }
+                }
+            }
+            cout<<"MPI Domains built from the "<<cells.dim[0]<<"x"<<cells.dim[1]<<"x"<<cells.dim[2]<<" top level cells of the input are: "<<endl;
+            for (int j=0;j<NProcs;j++) {
+                cout<<"ThisTask= "<<j<<" :: ";
+                cout.precision(10);for (int k=0;k<3;k++) cout<<k<<" "<<mpi_domain[j].bnd[k][0]<<" "<<mpi_domain[j].bnd[k][1]<<" | ";cout<<endl;
+            }
+        }
+        if (icells) {
+            for (Int_t n=0;n<cells.ncells;n++) {
+                readcell.task=MPIGetParticlesProcessor(cells.centre[3*n],cells.centre[3*n+1],cells.centre[3*n+2]);
+                for (int k=0;k<NHDFTYPE;k++) if (cells.count[k][n]>0) {
+                    readcell.ifile=cells.file[k][n];
+                    readcell.itype=k;
+                    readcell.offset=cells.offset[k][n];
+                    readcell.num=cells.count[k][n];
+                    allcells.push_back(readcell);
+                }
+            }
+            sort(allcells.begin(), allcells.end(), [](const mpi_read_cell &a, const mpi_read_cell &b) {
+                if (a.ifile!=b.ifile) return a.ifile<b.ifile;
+                if (a.itype!=b.itype) return a.itype<b.itype;
+                return a.offset<b.offset;
+            });
+            nallcells=allcells.size();
+        }
+    }
+    MPI_Bcast(&icells, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (icells==0) return;
+    if (mpi_sfc_level==0) MPI_Bcast(mpi_domain, NProcs*sizeof(MPI_Domain), MPI_BYTE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&nallcells, 1, MPI_Int_t, 0, MPI_COMM_WORLD);
+    allcells.resize(nallcells);
+    MPI_Bcast(allcells.data(), nallcells*sizeof(mpi_read_cell), MPI_BYTE, 0, MPI_COMM_WORLD);
+    //keep the cells of this task, joining cells stored one after the other so that they are read together
+    for (auto &c:allcells) if (c.task==ThisTask) {
+        if (mpi_readcells.size()>0 && mpi_readcells.back().ifile==c.ifile && mpi_readcells.back().itype==c.itype
+            && mpi_readcells.back().offset+mpi_readcells.back().num==c.offset) mpi_readcells.back().num+=c.num;
+        else mpi_readcells.push_back(c);
     }
+    mpi_ireadcells=1;
+    if (ThisTask==0) cout<<"Reading the "<<cells.ncells<<" top level cells of the input, each mpi process reading the cells in its domain"<<endl;
 }
 
 ///reads HDF file to determine number of particles in each MPIDomain
@@ -129,6 +237,7 @@ void MPINumInDomainHDF(Options &opt)
     if (NProcs>1) {
     MPIDomainExtentHDF(opt);
     MPIInitialDomainDecomposition();
+    MPIZoomRegionDomainEdges(opt);
     MPIDomainDecompositionHDF(opt);
 
     Int_t i,j,k,n,nchunk;
@@ -194,30 +303,34 @@ void MPINumInDomainHDF(Options &opt)
     ///Since Illustris contains an unused type of particles (2) and tracer particles (3) really not useful to iterate over all particle types in loops
     int nusetypes,nbusetypes;
     int usetypes[NHDFTYPE];
-    if (ireadtask[ThisTask]>=0) {
-        if (opt.partsearchtype==PSTALL) {
-            nusetypes=0;
-            //assume existance of dark matter and gas
-            usetypes[nusetypes++]=HDFGASTYPE;usetypes[nusetypes++]=HDFDMTYPE;
-            if (opt.iuseextradarkparticles) {
-                usetypes[nusetypes++]=HDFDM1TYPE;
-                usetypes[nusetypes++]=HDFDM2TYPE;
-        	}
-            if (opt.iusestarparticles) usetypes[nusetypes++]=HDFSTARTYPE;
-            if (opt.iusesinkparticles) usetypes[nusetypes++]=HDFBHTYPE;
-            if (opt.iusewindparticles) usetypes[nusetypes++]=HDFWINDTYPE;
-        }
-        else if (opt.partsearchtype==PSTDARK) {
-            nusetypes=1;usetypes[0]=HDFDMTYPE;
-            if (opt.iuseextradarkparticles) {
-                usetypes[nusetypes++]=HDFDM1TYPE;
-                usetypes[nusetypes++]=HDFDM2TYPE;
-            }
+    if (opt.partsearchtype==PSTALL) {
+        nusetypes=0;
+        //assume existance of dark matter and gas
+        usetypes[nusetypes++]=HDFGASTYPE;usetypes[nusetypes++]=HDFDMTYPE;
+        if (opt.iuseextradarkparticles) {
+            usetypes[nusetypes++]=HDFDM1TYPE;
+            usetypes[nusetypes++]=HDFDM2TYPE;
+    	}
+        if (opt.iusestarparticles) usetypes[nusetypes++]=HDFSTARTYPE;
+        if (opt.iusesinkparticles) usetypes[nusetypes++]=HDFBHTYPE;
+        if (opt.iusewindparticles) usetypes[nusetypes++]=HDFWINDTYPE;
+    }
+    else if (opt.partsearchtype==PSTDARK) {
+        nusetypes=1;usetypes[0]=HDFDMTYPE;
+        if (opt.iuseextradarkparticles) {
+            usetypes[nusetypes++]=HDFDM1TYPE;
+            usetypes[nusetypes++]=HDFDM2TYPE;
         }
-        else if (opt.partsearchtype==PSTGAS) {nusetypes=1;usetypes[0]=HDFGASTYPE;}
-        else if (opt.partsearchtype==PSTSTAR) {nusetypes=1;usetypes[0]=HDFSTARTYPE;}
-        else if (opt.partsearchtype==PSTBH) {nusetypes=1;usetypes[0]=HDFBHTYPE;}
+    }
+    else if (opt.partsearchtype==PSTGAS) {nusetypes=1;usetypes[0]=HDFGASTYPE;}
+    else if (opt.partsearchtype==PSTSTAR) {nusetypes=1;usetypes[0]=HDFSTARTYPE;}
+    else if (opt.partsearchtype==PSTBH) {nusetypes=1;usetypes[0]=HDFBHTYPE;}
 
+    //when reading by cell the number of particles in each domain is given by the cell counts
+    if (mpi_ireadcells) {
+        for (auto &c:mpi_readcells) for (j=0;j<nusetypes;j++) if (c.itype==usetypes[j]) Nbuf[ThisTask]+=c.num;
+    }
+    else if (ireadtask[ThisTask]>=0) {
         Fhdf=new H5File[opt.num_files];
         hdf_header_info=new HDF_Header[opt.num_files];
         headerdataspace=new DataSpace[opt.num_files];
@@ -264,8 +377,12 @@ void MPINumInDomainHDF(Options &opt)
             }
             if (floattype.getSize()==sizeof(float)) {HDFREALTYPE=PredType::NATIVE_FLOAT;realbuff=floatbuff;ifloat=1;}
             else {HDFREALTYPE=PredType::NATIVE_DOUBLE ;realbuff=doublebuff;ifloat=0;}
+            //if the particle data is read in a single pass, the positions and the task of each particle are kept
+            int icache=(mpi_readcache.size()>0);
+            if (icache) mpi_readcache[i].resize(NHDFTYPE);
             for (j=0;j<nusetypes;j++) {
                 k=usetypes[j];
+                if (icache) mpi_readcache[i][k].Allocate(hdf_header_info[i].npart[k]);
                 //data loaded into memory in chunks
                 if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
                 else nchunk=chunksize;
@@ -283,14 +400,30 @@ void MPINumInDomainHDF(Options &opt)
 
                     if (ifloat) {
                         for (int nn=0;nn<nchunk;nn++) {
-                            ibuf=MPIGetParticlesProcessor(floatbuff[nn*3],floatbuff[nn*3+1],floatbuff[nn*3+2]);
-                            Nbuf[ibuf]++;
+                            //low resolution particles outside the high resolution region of a zoom simulation are not read and have no task
+                            if (!opt.zoomregion.Keep(k,floatbuff[nn*3],floatbuff[nn*3+1],floatbuff[nn*3+2])) ibuf=-1;
+                            else {
+                                ibuf=MPIGetParticlesProcessor(floatbuff[nn*3],floatbuff[nn*3+1],floatbuff[nn*3+2]);
+                                Nbuf[ibuf]++;
+                            }
+                            if (icache) {
+                                for (int kk=0;kk<3;kk++) mpi_readcache[i][k].pos[3*(n+nn)+kk]=floatbuff[nn*3+kk];
+                                mpi_readcache[i][k].task[n+nn]=ibuf;
+                            }
                         }
                     }
                     else {
                         for (int nn=0;nn<nchunk;nn++) {
-                            ibuf=MPIGetParticlesProcessor(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
-                            Nbuf[ibuf]++;
+                            //low resolution particles outside the high resolution region of a zoom simulation are not read and have no task
+                            if (!opt.zoomregion.Keep(k,doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2])) ibuf=-1;
+                            else {
+                                ibuf=MPIGetParticlesProcessor(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
+                                Nbuf[ibuf]++;
+                            }
+                            if (icache) {
+                                for (int kk=0;kk<3;kk++) mpi_readcache[i][k].pos[3*(n+nn)+kk]=doublebuff[nn*3+kk];
+                                mpi_readcache[i][k].task[n+nn]=ibuf;
+                            }
                         }
                     }
                 }
@@ -84,6 +84,41 @@ void MPINumInDomainNchilada(Options &opt)
     for (j=0;j<NProcs;j++) Nbaryonbuf[j]=0;
 
     //now read position information to determine number of particles per processor
+    //the position files of the different particle types are independent so are read and decoded concurrently
+    if (ThisTask==0) {
+        Nchilada_Part_Names nchilada_part_name;
+        int nusetypes=0,usetypes[NNCHILADATYPE];
+        nchilada_dump fhpos[NNCHILADATYPE];
+        void *posdata[NNCHILADATYPE];
+        if (opt.partsearchtype==PSTALL) {
+            nusetypes=3;
+            usetypes[0]=NCHILADAGASTYPE;usetypes[1]=NCHILADADMTYPE;usetypes[2]=NCHILADASTARTYPE;
+        }
+        else if (opt.partsearchtype==PSTDARK) {nusetypes=1;usetypes[0]=NCHILADADMTYPE;}
+        else if (opt.partsearchtype==PSTGAS) {nusetypes=1;usetypes[0]=NCHILADAGASTYPE;}
+        else if (opt.partsearchtype==PSTSTAR) {nusetypes=1;usetypes[0]=NCHILADASTARTYPE;}
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(dynamic,1) if (nusetypes>1)
+#endif
+        for (int itype=0;itype<nusetypes;itype++)
+            posdata[itype]=readFieldData(string(opt.fname)+nchilada_part_name.part_names[usetypes[itype]]+string("pos"),fhpos[itype],3,0,0);
+        for (j=0;j<nusetypes;j++) {
+            //vector fields store each dimension followed by its min/max pair
+            nchunk=fhpos[j].nbodies+2;
+            for (i=0;i<fhpos[j].nbodies;i++) {
+                if (fhpos[j].code==float32) {
+                    float *xfloat=(float*)posdata[j];
+                    ibuf=MPIGetParticlesProcessor(xfloat[i],xfloat[i+nchunk],xfloat[i+2*nchunk]);
+                }
+                else {
+                    double *xdouble=(double*)posdata[j];
+                    ibuf=MPIGetParticlesProcessor(xdouble[i],xdouble[i+nchunk],xdouble[i+2*nchunk]);
+                }
+                Nbuf[ibuf]++;
+            }
+            freeField(fhpos[j],posdata[j]);
+        }
+    }
 
     //now having read number of particles, run all gather
     Int_t mpi_nlocal[NProcs];
@@ -111,10 +111,8 @@ void MPINumInDomainRAMSES(Options &opt)
         Int_t i,j,k,n,m,temp,Ntot,indark,ingas,instar;
         int idim,ivar,igrid;
         Int_t idval;
-        int   typeval;
         Int_t Nlocalold=Nlocal;
-        RAMSESFLOAT xtemp[3], ageval;
-        Double_t mtemp;
+        RAMSESFLOAT xtemp[3];
         MPI_Status status;
         Int_t Nlocalbuf,ibuf=0,*Nbuf, *Nbaryonbuf;
         int *ngridlevel,*ngridbound,*ngridfile;
@@ -123,7 +121,7 @@ void MPINumInDomainRAMSES(Options &opt)
         char buf[2000],buf1[2000],buf2[2000];
         string stringbuf,orderingstring;
         fstream Finfo;
-        fstream *Fpart, *Fpartmass, *Fpartage, *Famr, *Fhydro;
+        fstream *Famr, *Fhydro;
         fstream  Framses;
         RAMSES_Header *header;
         int intbuff[NRAMSESTYPE];
@@ -131,11 +129,8 @@ void MPINumInDomainRAMSES(Options &opt)
         Int_t count2,bcount2;
         int dummy,byteoffset;
         Int_t chunksize = opt.inputbufsize, nchunk;
-        RAMSESFLOAT *xtempchunk, *mtempchunk, *agetempchunk;
+        RAMSESFLOAT *xtempchunk;
         int *icellchunk;
-        Fpart      = new fstream[opt.num_files];
-        Fpartmass  = new fstream[opt.num_files];
-        Fpartage   = new fstream[opt.num_files];
         Famr       = new fstream[opt.num_files];
         Fhydro     = new fstream[opt.num_files];
         header     = new RAMSES_Header[opt.num_files];
@@ -187,58 +182,30 @@ void MPINumInDomainRAMSES(Options &opt)
 
         if (ireadtask[ThisTask]>=0) {
             if (opt.partsearchtype!=PSTGAS) {
-                for (int i = 0, count2 = 0; i < opt.num_files; i++) if (ireadfile[i]){
-                    sprintf(buf1,"%s/part_%s.out%05d",opt.fname,opt.ramsessnapname,i+1);
-                    sprintf(buf2,"%s/part_%s.out",opt.fname,opt.ramsessnapname);
-                    if (FileExists(buf1)) sprintf(buf,"%s",buf1);
-                    else if (FileExists(buf2)) sprintf(buf,"%s",buf2);
-                    Fpart[i].open      (buf, ios::binary|ios::in);
-                    Fpartmass[i].open  (buf, ios::binary|ios::in);
-                    Fpartage[i].open   (buf, ios::binary|ios::in);
-                    //skip header information in each file save for number in the file
-                    //@{
-                    byteoffset = 0;
-                    // ncpus
-                    byteoffset += RAMSES_fortran_skip(Fpart[i], 1);
-                    // ndims
-                    byteoffset += RAMSES_fortran_read(Fpart[i],header[i].ndim);
-                    //store number of particles locally in file
-                    byteoffset += RAMSES_fortran_read(Fpart[i],header[i].npartlocal);
-                    // skip local seeds, nstartot, mstartot, mstarlost, nsink
-                    byteoffset += RAMSES_fortran_skip(Fpart[i], 5);
-                    // byteoffset now stores size of header offset for particles
-                    Fpartmass[i].seekg  (byteoffset,ios::cur);
-                    Fpartage[i].seekg   (byteoffset,ios::cur);
-
-                    //skip positions
-                    for(idim = 0; idim < header[i].ndim; idim++)
-                    {
-                          RAMSES_fortran_skip (Fpartmass[i]);
-                          RAMSES_fortran_skip (Fpartage[i]);
-                    }
-                    //skip velocities
-                    for(idim=0;idim<header[i].ndim;idim++)
-                    {
-                        RAMSES_fortran_skip(Fpartmass[i]);
-                        RAMSES_fortran_skip(Fpartage[i]);
-                    }
-                    //skip mass
-                    RAMSES_fortran_skip(Fpartage[i]);
-                    //skip ids;
-                    RAMSES_fortran_skip(Fpartage[i]);
-                    //skip levels
-                    RAMSES_fortran_skip(Fpartage[i]);
-                    //data loaded into memory in chunks
-                    chunksize    = nchunk = header[i].npartlocal;
-                    xtempchunk   = new RAMSESFLOAT  [3*chunksize];
-                    mtempchunk   = new RAMSESFLOAT  [chunksize];
-                    agetempchunk = new RAMSESFLOAT  [chunksize];
+                //files are read and decoded concurrently, each thread counting particles in its own buffers
+                int ireaderror=0;
+#ifdef USEOPENMP
+#pragma omp parallel reduction(+:ireaderror,nghost,ndark,nstar)
+#endif
+                {
+                vector<Int_t> Nthreadbuf(NProcs,0), Nthreadbaryonbuf(NProcs,0);
+                RAMSES_Part_Data pdata;
+                char fbuf[2000];
+#ifdef USEOPENMP
+#pragma omp for schedule(dynamic,1) nowait
+#endif
+                for (int i = 0; i < opt.num_files; i++) if (ireadfile[i]){
+                    sprintf(fbuf,"%s/part_%s.out%05d",opt.fname,opt.ramsessnapname,i+1);
+                    if (!FileExists(fbuf)) sprintf(fbuf,"%s/part_%s.out",opt.fname,opt.ramsessnapname);
                     //now load position data, mass data, and age data
-                    for(idim = 0; idim < header[i].ndim; idim++)RAMSES_fortran_read(Fpart[i], &xtempchunk[idim*nchunk]);
-                    RAMSES_fortran_read(Fpartmass[i],  mtempchunk);
-                    RAMSES_fortran_read(Fpartage[i],   agetempchunk);
+                    if (!RAMSES_read_part_file(fbuf,pdata,RAMSESPARTPOS|RAMSESPARTMASS|RAMSESPARTAGE)) {ireaderror++;continue;}
+                    Int_t nchunk=pdata.npartlocal;
+                    RAMSESFLOAT *xtempchunk=pdata.x.data(), *mtempchunk=pdata.mass.data(), *agetempchunk=pdata.age.data();
+                    RAMSESFLOAT xtemp[3];
+                    Double_t mtemp;
+                    int typeval, ibuf;
 
-                    for (int nn = 0; nn < nchunk; nn++)
+                    for (Int_t nn = 0; nn < nchunk; nn++)
                     {
                         //this should be a ghost star particle
                         if (fabs((mtempchunk[nn]-dmp_mass)/dmp_mass) > 1e-5 && (agetempchunk[nn] == 0.0)) nghost++;
@@ -248,7 +215,6 @@ void MPINumInDomainRAMSES(Options &opt)
                             xtemp[1] = xtempchunk[nn+nchunk];
                             xtemp[2] = xtempchunk[nn+2*nchunk];
                             mtemp = mtempchunk[nn];
-                            ageval = agetempchunk[nn];
 
                             if (fabs(mtemp-dmp_mass)/dmp_mass<1e-5)
                             {
@@ -265,49 +231,29 @@ void MPINumInDomainRAMSES(Options &opt)
                             ibuf = MPIGetParticlesProcessor(xtemp[0],xtemp[1],xtemp[2]);
                             /// Count total number of DM particles, Baryons, etc
                             //@{
-                            if (opt.partsearchtype == PSTALL)
+                            if (opt.partsearchtype == PSTALL) Nthreadbuf[ibuf]++;
+                            else if (opt.partsearchtype == PSTDARK)
                             {
-                            Nbuf[ibuf]++;
-                            count2++;
+                                if (typeval == DARKTYPE) Nthreadbuf[ibuf]++;
+                                else if (opt.iBaryonSearch) Nthreadbaryonbuf[ibuf]++;
                             }
-                            else
+                            else if (opt.partsearchtype == PSTSTAR)
                             {
-                                if (opt.partsearchtype == PSTDARK)
-                                {
-                                    if (typeval == DARKTYPE)
-                                    {
-                                        Nbuf[ibuf]++;
-                                        count2++;
-                                    }
-                                    else
-                                    {
-                                        if (opt.iBaryonSearch)
-                                        {
-                                            Nbaryonbuf[ibuf]++;
-                                        }
-                                    }
-                                }
-                                else
-                                {
-                                    if (opt.partsearchtype == PSTSTAR)
-                                    {
-                                        if (typeval == STARTYPE)
-                                        {
-                                            Nbuf[ibuf]++;
-                                            count2++;
-                                        }
-                                    }
-                                }
+                                if (typeval == STARTYPE) Nthreadbuf[ibuf]++;
                             }
+                            //@}
                         }
                     }
-                    delete[] xtempchunk;
-                    delete[] mtempchunk;
-                    delete[] agetempchunk;
-
-                    Fpart[i].close();
-                    Fpartmass[i].close();
-                    Fpartage[i].close();
+                }
+#ifdef USEOPENMP
+#pragma omp critical
+#endif
+                for (int j=0;j<NProcs;j++) {Nbuf[j]+=Nthreadbuf[j];Nbaryonbuf[j]+=Nthreadbaryonbuf[j];}
+                }
+                if (ireaderror) {
+                    cerr<<ThisTask<<" could not read "<<ireaderror<<" ramses particle files"<<endl;
+                    MPIStopProgressThread();
+                    MPI_Abort(MPI_COMM_WORLD,9);
                 }
             }
 
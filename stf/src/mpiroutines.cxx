@@ -10,6 +10,12 @@
 //-- For MPI
 
 #include "stf.h"
+#include <sys/resource.h>
+#if defined(USEOPENMP) && defined(MPITHREADMULTIPLE)
+#include <thread>
+#include <atomic>
+#include <chrono>
+#endif
 
 #ifdef SWIFTINTERFACE
 #include "swiftinterface.h"
@@ -44,6 +50,29 @@ using namespace Swift;
     once have that initial splitting just load data then start shifting data around.
 */
 
+///high resolution region of a zoom simulation whose extent the domains span, set by \ref MPIZoomRegionExtent on the task decomposing
+static Zoom_Region mpi_zoomregion;
+
+///whether the high resolution region wraps about the periodic boundary along an axis, leaving the box along it mostly empty
+static inline int MPIZoomRegionWraps(int k){
+    return (mpi_zoomregion.iset && mpi_zoomregion.period>0 && mpi_zoomregion.xmin[k]+mpi_zoomregion.width[k]>mpi_zoomregion.period);
+}
+
+///upper edge of the i-th of nsplit domains along an axis, the domains splitting the extent evenly. Where the high resolution region
+///wraps, the domains are shared between its pieces below and above the boundary in proportion to their widths and the domains on
+///either side of the empty part of the box meet in its middle, so that none is left without particles
+static Double_t MPIDomainSplitValue(int k, int i, int nsplit){
+    if (MPIZoomRegionWraps(k) && nsplit>1) {
+        double period=mpi_zoomregion.period, xmin=mpi_zoomregion.xmin[k];
+        double wupper=period-xmin, wlower=mpi_zoomregion.width[k]-wupper;
+        int nupper=min(max((int)round(nsplit*wupper/mpi_zoomregion.width[k]),1),nsplit-1), nlower=nsplit-nupper;
+        if (i+1<nlower) return wlower*(i+1)/nlower;
+        else if (i+1==nlower) return 0.5*(wlower+xmin);
+        else return xmin+wupper*(i+1-nlower)/nupper;
+    }
+    return mpi_xlim[k][0]+(mpi_xlim[k][1]-mpi_xlim[k][0])*(Double_t)(i+1)/(Double_t)nsplit;
+}
+
 ///determine the initial domains, ie: bisection distance mpi_dxsplit, which is used to determien what processor a particle is assigned to
 ///here the domains are constructured in data units
 void MPIInitialDomainDecomposition(){
@@ -53,6 +82,10 @@ void MPIInitialDomainDecomposition(){
     Double_t diffsplit;
     int b,a;
 
+    if (mpi_sfc_level>0) {
+        MPISFCInitialDomainDecomposition();
+        return;
+    }
     if (ThisTask==0) {
         //first split need not be simply having the dimension but determine
         //number of splits to have Nprocs=a*2^b, where a and b are integers
@@ -67,6 +100,8 @@ void MPIInitialDomainDecomposition(){
         }
         Nsplit=b+1;
         mpi_ideltax[0]=0;mpi_ideltax[1]=1;mpi_ideltax[2]=2;
+        //split least along the axes where the high resolution region of a zoom simulation wraps
+        stable_partition(mpi_ideltax,mpi_ideltax+3,[](int m){return !MPIZoomRegionWraps(m);});
         isplit=0;
         for (j=0;j<3;j++) mpi_nxsplit[j]=0;
         for (j=0;j<Nsplit;j++) {
@@ -75,7 +110,7 @@ void MPIInitialDomainDecomposition(){
         }
         for (j=0;j<3;j++) mpi_nxsplit[j]=pow(2.0,mpi_nxsplit[j]);
         //and adjust first dimension
-        mpi_nxsplit[0]=mpi_nxsplit[0]/2*a;
+        mpi_nxsplit[mpi_ideltax[0]]=mpi_nxsplit[mpi_ideltax[0]]/2*a;
 
         //for all the cells along the boundary of axis with the third split axis (smallest variance)
         //set the domain limits to the sims limits
@@ -112,7 +147,7 @@ void MPIInitialDomainDecomposition(){
         Double_t bndval[3],binsum[3],lastbin;
         start[0]=start[1]=start[2]=0;
         for (i=0;i<mpi_nxsplit[ix];i++) {
-            bndval[0]=(mpi_xlim[ix][1]-mpi_xlim[ix][0])*(Double_t)(i+1)/(Double_t)mpi_nxsplit[ix];
+            bndval[0]=MPIDomainSplitValue(ix,i,mpi_nxsplit[ix]);
             if(i<mpi_nxsplit[ix]-1) {
             for (j=0;j<mpi_nxsplit[iy];j++) {
                 for (k=0;k<mpi_nxsplit[iz];k++) {
@@ -128,7 +163,7 @@ void MPIInitialDomainDecomposition(){
             //now for secondary splitting
             if (mpi_nxsplit[iy]>1)
             for (j=0;j<mpi_nxsplit[iy];j++) {
-                bndval[1]=(mpi_xlim[iy][1]-mpi_xlim[iy][0])*(Double_t)(j+1)/(Double_t)mpi_nxsplit[iy];
+                bndval[1]=MPIDomainSplitValue(iy,j,mpi_nxsplit[iy]);
                 if(j<mpi_nxsplit[iy]-1) {
                 for (k=0;k<mpi_nxsplit[iz];k++) {
                     mpitasknum=i+j*mpi_nxsplit[ix]+k*(mpi_nxsplit[ix]*mpi_nxsplit[iy]);
@@ -139,7 +174,7 @@ void MPIInitialDomainDecomposition(){
                 }
                 if (mpi_nxsplit[iz]>1)
                 for (k=0;k<mpi_nxsplit[iz];k++) {
-                    bndval[2]=(mpi_xlim[iz][1]-mpi_xlim[iz][0])*(Double_t)(k+1)/(Double_t)mpi_nxsplit[iz];
+                    bndval[2]=MPIDomainSplitValue(iz,k,mpi_nxsplit[iz]);
                     if (k<mpi_nxsplit[iz]-1){
                     mpitasknum=i+j*mpi_nxsplit[ix]+k*(mpi_nxsplit[ix]*mpi_nxsplit[iy]);
                     mpi_domain[mpitasknum].bnd[iz][1]=bndval[2];
@@ -171,7 +206,10 @@ void MPINumInDomain(Options &opt)
     return;
     }
     int nsnapread=opt.nsnapread;
-    opt.nsnapread=min(NProcs,opt.num_files);
+    //positions kept for the particle data read are only useful if the same tasks read the same files, otherwise use as many tasks as possible
+    mpi_readcache.clear();
+    if (opt.impisinglepassread && (opt.inputtype==IOGADGET || opt.inputtype==IOHDF)) mpi_readcache.resize(opt.num_files);
+    else opt.nsnapread=min(NProcs,opt.num_files);
     if(opt.inputtype==IOTIPSY) MPINumInDomainTipsy(opt);
     else if (opt.inputtype==IOGADGET) MPINumInDomainGadget(opt);
     else if (opt.inputtype==IORAMSES) MPINumInDomainRAMSES(opt);
@@ -179,9 +217,9 @@ void MPINumInDomain(Options &opt)
     else if (opt.inputtype==IOHDF) MPINumInDomainHDF(opt);
 #endif
     opt.nsnapread=nsnapread;
-    //adjust the memory allocated to allow some buffer room.
-    Nmemlocal=Nlocal*(1.0+opt.mpipartfac);
-    if (opt.iBaryonSearch) Nmemlocalbaryon=Nlocalbaryon[0]*(1.0+opt.mpipartfac);
+    //allocate exactly what is needed, particle storage is grown when particles are exchanged between mpi threads
+    Nmemlocal=Nlocal;
+    if (opt.iBaryonSearch) Nmemlocalbaryon=Nlocalbaryon[0];
 
 }
 
@@ -206,18 +244,53 @@ void MPIDomainDecomposition(Options &opt)
 #endif
 }
 
+/*! For zoom simulations read with \ref Options.izoomregiononly, decompose the high resolution region rather than the whole box,
+    along the axes where the region does not wrap about the periodic boundary. Along the others the domains are placed over the
+    two pieces of the region (see \ref MPIDomainSplitValue). Only called by task 0 and only for regular domains, a space filling
+    curve decomposition already balancing the domains by the particles they hold.
+*/
+void MPIZoomRegionExtent(Options &opt)
+{
+    Zoom_Region &region=opt.zoomregion;
+    if (!region.iset || mpi_sfc_level>0 || region.period<=0) return;
+    mpi_zoomregion=region;
+    for (int k=0;k<3;k++) if (region.xmin[k]+region.width[k]<=region.period) {
+        mpi_xlim[k][0]=region.xmin[k];
+        mpi_xlim[k][1]=region.xmin[k]+region.width[k];
+    }
+    cout<<"MPI domains span the high resolution region "<<mpi_xlim[0][0]<<" "<<mpi_xlim[0][1]<<" | "<<mpi_xlim[1][0]<<" "<<mpi_xlim[1][1]<<" | "<<mpi_xlim[2][0]<<" "<<mpi_xlim[2][1]<<endl;
+}
+
+///extend the domains on the edges of the high resolution region to the edges of the box, so that the particles that are kept
+///outside the region, such as gas or stars, still belong to a domain
+void MPIZoomRegionDomainEdges(Options &opt)
+{
+    Zoom_Region &region=opt.zoomregion;
+    if (!region.iset || mpi_sfc_level>0 || region.period<=0) return;
+    for (int k=0;k<3;k++) if (region.xmin[k]+region.width[k]<=region.period) {
+        for (int j=0;j<NProcs;j++) {
+            if (mpi_domain[j].bnd[k][0]<=region.xmin[k]) mpi_domain[j].bnd[k][0]=0;
+            if (mpi_domain[j].bnd[k][1]>=region.xmin[k]+region.width[k]) mpi_domain[j].bnd[k][1]=region.period;
+        }
+    }
+}
+
 ///adjust the domain boundaries to code units
 void MPIAdjustDomain(Options opt){
     Double_t aadjust, lscale;
     if (opt.comove) aadjust=1.0;
     else aadjust=opt.a;
     lscale=opt.L/opt.h*aadjust;
+    //tipsy lengths are not in little h units
+    if (opt.inputtype==IOTIPSY) lscale=opt.L*aadjust;
     for (int j=0;j<NProcs;j++) for (int k=0;k<3;k++) {mpi_domain[j].bnd[k][0]*=lscale;mpi_domain[j].bnd[k][1]*=lscale;}
+    if (mpi_sfc_level>0) for (int k=0;k<3;k++) {mpi_sfc_xmin[k]*=lscale;mpi_sfc_icellwidth[k]/=lscale;}
 }
 
 ///given a position and a mpi thread domain information, determine which processor a particle is assigned to
 int MPIGetParticlesProcessor(Double_t x,Double_t y, Double_t z){
     if (NProcs==1) return 0;
+    if (mpi_sfc_level>0) return MPISFCGetTask(MPISFCGetKey(x,y,z));
     for (int j=0;j<NProcs;j++){
         if( (mpi_domain[j].bnd[0][0]<=x) && (mpi_domain[j].bnd[0][1]>=x)&&
             (mpi_domain[j].bnd[1][0]<=y) && (mpi_domain[j].bnd[1][1]>=y)&&
@@ -225,6 +298,7 @@ int MPIGetParticlesProcessor(Double_t x,Double_t y, Double_t z){
             return j;
     }
     cerr<<ThisTask<<" has particle outside the mpi domains of every process ("<<x<<","<<y<<","<<z<<")"<<endl;
+    MPIStopProgressThread();
     MPI_Abort(MPI_COMM_WORLD,9);
 }
 
@@ -253,6 +327,716 @@ void MPIAddParticletoAppropriateBuffer(const int &ibuf, Int_t ibufindex, int *&i
 
 //@}
 
+/// \name Sparse exchange of communication counts
+//@{
+/*! Determine how much each task will receive from every other task given how much it sends, without an all-to-all exchange.
+    Searches across domains only involve the tasks whose domains neighbour that of this one, so rather than every task sending
+    (and receiving) NProcs counts, each task only sends nonzero counts with synchronous sends and receives whatever arrives
+    until all tasks have completed their sends, which is detected with a nonblocking barrier. This is the nonblocking consensus
+    (NBX) algorithm of Hoefler, Siebert & Lumsdaine (2010, PPoPP 45, 159). Tasks that send nothing to this one have nrecv[j]=0.
+    \param nsend number of items this task sends to task j
+    \param nrecv on return, number of items this task receives from task j
+*/
+void MPISparseCounts(const Int_t *nsend, Int_t *nrecv)
+{
+    //consecutive exchanges alternate tags so that counts of the next exchange can not be mistaken for counts of this one
+    static int iround=0;
+    int tag=(iround++%2==0)?TAG_COUNT_A:TAG_COUNT_B;
+    vector<MPI_Request> rqst;
+    MPI_Request barrierrqst;
+    MPI_Status status;
+    int flag, ibarrier=0, idone=0;
+    Int_t count;
+
+    for (int j=0;j<NProcs;j++) nrecv[j]=0;
+    nrecv[ThisTask]=nsend[ThisTask];
+    for (int j=0;j<NProcs;j++) {
+        if (j==ThisTask || nsend[j]==0) continue;
+        rqst.push_back(MPI_REQUEST_NULL);
+        MPI_Issend(&nsend[j], 1, MPI_Int_t, j, tag, MPI_COMM_WORLD, &rqst.back());
+    }
+    while (!idone) {
+        MPI_Iprobe(MPI_ANY_SOURCE, tag, MPI_COMM_WORLD, &flag, &status);
+        if (flag) {
+            MPI_Recv(&count, 1, MPI_Int_t, status.MPI_SOURCE, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            nrecv[status.MPI_SOURCE]=count;
+        }
+        if (ibarrier) MPI_Test(&barrierrqst, &idone, MPI_STATUS_IGNORE);
+        else {
+            //synchronous sends complete only once matched, so once all have, this task's counts have been received
+            MPI_Testall(rqst.size(), rqst.data(), &flag, MPI_STATUSES_IGNORE);
+            if (flag) {
+                MPI_Ibarrier(MPI_COMM_WORLD, &barrierrqst);
+                ibarrier=1;
+            }
+        }
+    }
+}
+
+///store the number of items sent by this task to every other task in \ref mpi_nsend and determine the number it will receive, stored in \ref mpi_nrecv
+void MPIExchangeCounts(const Int_t *nsend_local)
+{
+    for (int j=0;j<NProcs;j++) mpi_nsend[j]=nsend_local[j];
+    MPISparseCounts(mpi_nsend, mpi_nrecv);
+}
+//@}
+
+///exchange blocks of byte copyable data between every pair of tasks of a communicator, where the data sent to (received from) task j starts
+///at the sum of the counts of the preceding tasks in sendbuf (recvbuf). Messages are split into chunks so that no single message exceeds
+///\ref LOCAL_MAX_MSGSIZE. If a derived datatype describing T is given, only the fields it contains are sent, otherwise the data is sent as bytes.
+///The block of a task to itself is not copied
+template<class T> void MPIExchangeBlocksComm(T *sendbuf, const Int_t *nsend, T *recvbuf, const Int_t *nrecv, int tag, MPI_Datatype datatype, MPI_Comm comm)
+{
+    int commrank, commsize;
+    MPI_Comm_rank(comm, &commrank);
+    MPI_Comm_size(comm, &commsize);
+    Int_t maxchunksize=LOCAL_MAX_MSGSIZE/sizeof(T), sendoffset=0, recvoffset=0;
+    int unitsize=(datatype==MPI_BYTE)?sizeof(T):1;
+    Int_t noffset_export[commsize], noffset_import[commsize];
+    MPI_Status status;
+    for (int j=0;j<commsize;j++) {
+        noffset_export[j]=sendoffset;sendoffset+=nsend[j];
+        noffset_import[j]=recvoffset;recvoffset+=nrecv[j];
+    }
+    for (int j=0;j<commsize;j++) {
+        if (j==commrank || (nsend[j]==0 && nrecv[j]==0)) continue;
+        Int_t cursend, currecv;
+        sendoffset=recvoffset=0;
+        do {
+            cursend=min(maxchunksize,nsend[j]-sendoffset);
+            currecv=min(maxchunksize,nrecv[j]-recvoffset);
+            MPI_Sendrecv(&sendbuf[noffset_export[j]+sendoffset], cursend*unitsize, datatype, j, tag,
+                &recvbuf[noffset_import[j]+recvoffset], currecv*unitsize, datatype, j, tag,
+                comm, &status);
+            sendoffset+=cursend;
+            recvoffset+=currecv;
+        } while (sendoffset<nsend[j] || recvoffset<nrecv[j]);
+    }
+}
+
+/// \name Hierarchical communication
+/// On nodes running many tasks, exchanges between every pair of tasks are dominated by the number of small messages crossing the network.
+/// In hierarchical mode, tasks on the same node copy data directly from one another through an mpi-3 shared memory window, and the data
+/// a node sends to another is gathered by the first task of the node (its leader), sent as one message to the leader of the destination
+/// node and distributed there. Whole items of type T are moved, so derived datatypes only describing part of T are not used.
+//@{
+///determine which tasks share a node and set up the node and leader communicators. Hierarchical mode is only enabled if requested
+///and some node runs more than one task
+void MPIInitNodeTopology(Options &opt)
+{
+    int nodeindex, maxnodesize;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, ThisTask, MPI_INFO_NULL, &mpi_comm_node);
+    MPI_Comm_rank(mpi_comm_node, &mpi_node_rank);
+    MPI_Comm_size(mpi_comm_node, &mpi_node_size);
+    MPI_Comm_split(MPI_COMM_WORLD, (mpi_node_rank==0)?0:MPI_UNDEFINED, ThisTask, &mpi_comm_leaders);
+    if (mpi_node_rank==0) {
+        MPI_Comm_rank(mpi_comm_leaders, &nodeindex);
+        MPI_Comm_size(mpi_comm_leaders, &mpi_nnodes);
+    }
+    MPI_Bcast(&nodeindex, 1, MPI_INT, 0, mpi_comm_node);
+    MPI_Bcast(&mpi_nnodes, 1, MPI_INT, 0, mpi_comm_node);
+    mpi_task_node=new int[NProcs];
+    mpi_task_noderank=new int[NProcs];
+    MPI_Allgather(&nodeindex, 1, MPI_INT, mpi_task_node, 1, MPI_INT, MPI_COMM_WORLD);
+    MPI_Allgather(&mpi_node_rank, 1, MPI_INT, mpi_task_noderank, 1, MPI_INT, MPI_COMM_WORLD);
+    MPI_Allreduce(&mpi_node_size, &maxnodesize, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    mpi_ihierarchical=(opt.impihierarchical && maxnodesize>1);
+    if (ThisTask==0 && opt.impihierarchical) {
+        cout<<"Running on "<<mpi_nnodes<<" nodes with at most "<<maxnodesize<<" tasks per node"<<endl;
+        if (mpi_ihierarchical==0) cout<<"Each node runs a single task, so hierarchical communication is not used"<<endl;
+    }
+}
+
+///exchange blocks laid out as in \ref MPIExchangeBlocks in two levels, see \ref MPIInitNodeTopology
+template<class T> void MPIExchangeBlocksHierarchical(T *sendbuf, const Int_t *nsend, T *recvbuf, const Int_t *nrecv, int tag)
+{
+    Int_t noffset_export[NProcs], noffset_import[NProcs], sendoffset=0, recvoffset=0;
+    int mynode=mpi_task_node[ThisTask];
+    for (int j=0;j<NProcs;j++) {
+        noffset_export[j]=sendoffset;sendoffset+=nsend[j];
+        noffset_import[j]=recvoffset;recvoffset+=nrecv[j];
+    }
+
+    //tasks on this node: each places the blocks it sends to the others in its segment of a shared window, from which they copy them
+    {
+        vector<Int_t> segoffset(mpi_node_size,0), peeroffset(mpi_node_size,0);
+        Int_t nshared=0;
+        for (int j=0;j<NProcs;j++) if (j!=ThisTask && mpi_task_node[j]==mynode) {
+            segoffset[mpi_task_noderank[j]]=nshared;
+            nshared+=nsend[j];
+        }
+        T *segment, *peersegment;
+        MPI_Aint segsize;
+        int dispunit;
+        MPI_Win win;
+        MPI_Win_allocate_shared(max(nshared,(Int_t)1)*sizeof(T), sizeof(T), MPI_INFO_NULL, mpi_comm_node, &segment, &win);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+        for (int j=0;j<NProcs;j++) if (j!=ThisTask && mpi_task_node[j]==mynode && nsend[j]>0)
+            memcpy((void*)&segment[segoffset[mpi_task_noderank[j]]], &sendbuf[noffset_export[j]], nsend[j]*sizeof(T));
+        //where the block for this task starts in the segment of every other task on the node
+        MPI_Alltoall(segoffset.data(), 1, MPI_Int_t, peeroffset.data(), 1, MPI_Int_t, mpi_comm_node);
+        MPI_Win_sync(win);
+        MPI_Barrier(mpi_comm_node);
+        MPI_Win_sync(win);
+        for (int j=0;j<NProcs;j++) if (j!=ThisTask && mpi_task_node[j]==mynode && nrecv[j]>0) {
+            MPI_Win_shared_query(win, mpi_task_noderank[j], &segsize, &dispunit, &peersegment);
+            memcpy((void*)&recvbuf[noffset_import[j]], &peersegment[peeroffset[mpi_task_noderank[j]]], nrecv[j]*sizeof(T));
+        }
+        //segments must not be freed while other tasks still read them
+        MPI_Barrier(mpi_comm_node);
+        MPI_Win_unlock_all(win);
+        MPI_Win_free(&win);
+    }
+    if (mpi_nnodes==1) return;
+
+    //gather the (destination, count) pairs and data this task sends to other nodes on the leader of the node
+    vector<Int_t> pairs;
+    vector<T> remotedata;
+    for (int j=0;j<NProcs;j++) if (mpi_task_node[j]!=mynode && nsend[j]>0) {
+        pairs.push_back(j);
+        pairs.push_back(nsend[j]);
+        remotedata.insert(remotedata.end(), &sendbuf[noffset_export[j]], &sendbuf[noffset_export[j]]+nsend[j]);
+    }
+    Int_t npairs=pairs.size();
+    vector<Int_t> nodenpairs(mpi_node_size,0), nodendata(mpi_node_size,0), nodesend(mpi_node_size,0);
+    MPI_Gather(&npairs, 1, MPI_Int_t, nodenpairs.data(), 1, MPI_Int_t, 0, mpi_comm_node);
+    vector<Int_t> nodepairs;
+    vector<T> nodedata;
+    if (mpi_node_rank==0) {
+        Int_t ntotpairs=0;
+        for (auto &n:nodenpairs) ntotpairs+=n;
+        nodepairs.resize(ntotpairs);
+        copy(pairs.begin(), pairs.end(), nodepairs.begin());
+    }
+    nodesend[0]=npairs;
+    MPIExchangeBlocksComm(pairs.data(), nodesend.data(), nodepairs.data(), nodenpairs.data(), tag, MPI_BYTE, mpi_comm_node);
+    if (mpi_node_rank==0) {
+        Int_t ntotdata=0, ipair=0;
+        for (int r=0;r<mpi_node_size;r++) {
+            for (Int_t i=0;i<nodenpairs[r];i+=2) nodendata[r]+=nodepairs[ipair+i+1];
+            ipair+=nodenpairs[r];
+            ntotdata+=nodendata[r];
+        }
+        nodedata.resize(ntotdata);
+        copy(remotedata.begin(), remotedata.end(), nodedata.begin());
+    }
+    nodesend[0]=remotedata.size();
+    MPIExchangeBlocksComm(remotedata.data(), nodesend.data(), nodedata.data(), nodendata.data(), tag, MPI_BYTE, mpi_comm_node);
+    vector<T>().swap(remotedata);
+
+    //leaders pack one message per destination node holding (source, destination, count) triples followed by the data, exchange them
+    //and then send every task on their node the data it receives from other nodes, ordered by source task
+    vector<Int_t> localnrecv(mpi_node_size,0);
+    vector<T> localdata;
+    if (mpi_node_rank==0) {
+        vector<vector<Int_t>> header(mpi_nnodes);
+        vector<vector<T>> body(mpi_nnodes);
+        Int_t ipair=0, idata=0;
+        for (int r=0;r<mpi_node_size;r++) {
+            int src=-1;
+            for (int j=0;j<NProcs;j++) if (mpi_task_node[j]==mynode && mpi_task_noderank[j]==r) src=j;
+            for (Int_t i=0;i<nodenpairs[r];i+=2) {
+                Int_t dest=nodepairs[ipair+i], count=nodepairs[ipair+i+1];
+                int destnode=mpi_task_node[dest];
+                header[destnode].push_back(src);
+                header[destnode].push_back(dest);
+                header[destnode].push_back(count);
+                body[destnode].insert(body[destnode].end(), &nodedata[idata], &nodedata[idata]+count);
+                idata+=count;
+            }
+            ipair+=nodenpairs[r];
+        }
+        vector<Int_t>().swap(nodepairs);
+        vector<T>().swap(nodedata);
+        vector<Int_t> nbytesend(mpi_nnodes,0), nbytesrecv(mpi_nnodes,0);
+        for (int n=0;n<mpi_nnodes;n++) if (header[n].size()>0)
+            nbytesend[n]=sizeof(Int_t)*(1+header[n].size())+sizeof(T)*body[n].size();
+        MPI_Alltoall(nbytesend.data(), 1, MPI_Int_t, nbytesrecv.data(), 1, MPI_Int_t, mpi_comm_leaders);
+        Int_t nbytesendtot=0, nbytesrecvtot=0;
+        for (int n=0;n<mpi_nnodes;n++) {nbytesendtot+=nbytesend[n];nbytesrecvtot+=nbytesrecv[n];}
+        vector<char> msgsend(nbytesendtot), msgrecv(nbytesrecvtot);
+        char *p=msgsend.data();
+        for (int n=0;n<mpi_nnodes;n++) if (nbytesend[n]>0) {
+            Int_t ntriples=header[n].size()/3;
+            memcpy(p, &ntriples, sizeof(Int_t)); p+=sizeof(Int_t);
+            memcpy(p, header[n].data(), sizeof(Int_t)*header[n].size()); p+=sizeof(Int_t)*header[n].size();
+            memcpy(p, (void*)body[n].data(), sizeof(T)*body[n].size()); p+=sizeof(T)*body[n].size();
+            vector<Int_t>().swap(header[n]);
+            vector<T>().swap(body[n]);
+        }
+        MPIExchangeBlocksComm(msgsend.data(), nbytesend.data(), msgrecv.data(), nbytesrecv.data(), tag, MPI_BYTE, mpi_comm_leaders);
+        vector<char>().swap(msgsend);
+
+        //locate the block of every (source, destination) pair in the received messages and order them by destination then source
+        struct block {Int_t src, dest, count; char *data;};
+        vector<block> blocks;
+        p=msgrecv.data();
+        for (int n=0;n<mpi_nnodes;n++) if (nbytesrecv[n]>0) {
+            Int_t ntriples;
+            memcpy(&ntriples, p, sizeof(Int_t));
+            char *triples=p+sizeof(Int_t), *data=triples+3*sizeof(Int_t)*ntriples;
+            for (Int_t i=0;i<ntriples;i++) {
+                block b;
+                memcpy(&b.src, triples+(3*i)*sizeof(Int_t), sizeof(Int_t));
+                memcpy(&b.dest, triples+(3*i+1)*sizeof(Int_t), sizeof(Int_t));
+                memcpy(&b.count, triples+(3*i+2)*sizeof(Int_t), sizeof(Int_t));
+                b.data=data;
+                data+=b.count*sizeof(T);
+                blocks.push_back(b);
+            }
+            p+=nbytesrecv[n];
+        }
+        sort(blocks.begin(), blocks.end(), [](const block &a, const block &b){return (a.dest<b.dest) || (a.dest==b.dest && a.src<b.src);});
+        Int_t ntot=0;
+        for (auto &b:blocks) {localnrecv[mpi_task_noderank[b.dest]]+=b.count;ntot+=b.count;}
+        localdata.resize(ntot);
+        idata=0;
+        for (auto &b:blocks) {memcpy((void*)&localdata[idata], b.data, b.count*sizeof(T));idata+=b.count;}
+    }
+    vector<T> importdata;
+    Int_t nimport=0;
+    for (int j=0;j<NProcs;j++) if (mpi_task_node[j]!=mynode) nimport+=nrecv[j];
+    vector<Int_t> nodenrecv(mpi_node_size,0);
+    nodenrecv[0]=nimport;
+    if (mpi_node_rank==0) importdata.assign(localdata.begin(), localdata.begin()+localnrecv[0]);
+    else importdata.resize(nimport);
+    MPIExchangeBlocksComm(localdata.data(), localnrecv.data(), importdata.data(), nodenrecv.data(), tag, MPI_BYTE, mpi_comm_node);
+    vector<T>().swap(localdata);
+    Int_t iimport=0;
+    for (int j=0;j<NProcs;j++) if (mpi_task_node[j]!=mynode && nrecv[j]>0) {
+        memcpy((void*)&recvbuf[noffset_import[j]], &importdata[iimport], nrecv[j]*sizeof(T));
+        iimport+=nrecv[j];
+    }
+}
+//@}
+
+///exchange blocks of byte copyable data between every pair of tasks, where the data sent to (received from) task j starts at the sum of the
+///counts of the preceding tasks in sendbuf (recvbuf). If a derived datatype describing T is given, only the fields it contains are sent,
+///otherwise the data is sent as bytes. In hierarchical mode, whole items are moved as described in \ref MPIExchangeBlocksHierarchical
+template<class T> void MPIExchangeBlocks(T *sendbuf, const Int_t *nsend, T *recvbuf, const Int_t *nrecv, int tag, MPI_Datatype datatype=MPI_BYTE)
+{
+    if (mpi_ihierarchical) MPIExchangeBlocksHierarchical(sendbuf, nsend, recvbuf, nrecv, tag);
+    else MPIExchangeBlocksComm(sendbuf, nsend, recvbuf, nrecv, tag, datatype, MPI_COMM_WORLD);
+}
+
+/// \name Nonblocking exchanges overlapped with local computation
+/// An exchange is started, local work that does not depend on it is done, calling \ref MPIPollExchange between blocks of work
+/// (which also lets the mpi library progress the transfer), and then it is completed. The communication time of an exchange runs from
+/// its start till it is first seen to be complete, so the time hidden behind local work is resolved only to the polling interval.
+//@{
+///post nonblocking sends and receives of blocks of data laid out as in \ref MPIExchangeBlocks. The counts are copied into pending but
+///the buffers must not be touched till \ref MPIFinishExchange
+template<class T> void MPIStartExchangeBlocks(T *sendbuf, const Int_t *nsend, T *recvbuf, const Int_t *nrecv, int tag, mpi_pending_exchange &pending, MPI_Datatype datatype=MPI_BYTE)
+{
+    Int_t maxchunksize=LOCAL_MAX_MSGSIZE/sizeof(T), sendoffset=0, recvoffset=0, cursize;
+    int unitsize=(datatype==MPI_BYTE)?sizeof(T):1;
+    pending.tstart=MyGetTime();
+    pending.nsend.assign(nsend,nsend+NProcs);
+    pending.nrecv.assign(nrecv,nrecv+NProcs);
+    pending.rqst.clear();
+    for (int j=0;j<NProcs;j++) {
+        if (j!=ThisTask) {
+            //chunks between a pair of tasks share a tag as messages are not overtaken
+            for (Int_t offset=0;offset<nrecv[j];offset+=cursize) {
+                cursize=min(maxchunksize,nrecv[j]-offset);
+                pending.rqst.push_back(MPI_REQUEST_NULL);
+                MPI_Irecv(&recvbuf[recvoffset+offset], cursize*unitsize, datatype, j, tag, MPI_COMM_WORLD, &pending.rqst.back());
+            }
+            for (Int_t offset=0;offset<nsend[j];offset+=cursize) {
+                cursize=min(maxchunksize,nsend[j]-offset);
+                pending.rqst.push_back(MPI_REQUEST_NULL);
+                MPI_Isend(&sendbuf[sendoffset+offset], cursize*unitsize, datatype, j, tag, MPI_COMM_WORLD, &pending.rqst.back());
+            }
+        }
+        sendoffset+=nsend[j];
+        recvoffset+=nrecv[j];
+    }
+    pending.iactive=1;
+    pending.tcomplete=-1;
+    pending.tposted=MyGetTime();
+}
+
+///test if a pending exchange has completed, noting the time it was first seen to be complete
+void MPIPollExchange(mpi_pending_exchange &pending)
+{
+    int flag;
+    if (pending.iactive==0 || pending.tcomplete>=0) return;
+    MPI_Testall(pending.rqst.size(), pending.rqst.data(), &flag, MPI_STATUSES_IGNORE);
+    if (flag) pending.tcomplete=MyGetTime();
+}
+
+///complete a pending exchange, accumulating its communication time and the time this task spent posting requests and waiting for them
+void MPIFinishExchange(mpi_pending_exchange &pending)
+{
+    double twait=0;
+    if (pending.iactive==0) return;
+    MPIPollExchange(pending);
+    if (pending.tcomplete<0) {
+        twait=MyGetTime();
+        MPI_Waitall(pending.rqst.size(), pending.rqst.data(), MPI_STATUSES_IGNORE);
+        pending.tcomplete=MyGetTime();
+        twait=pending.tcomplete-twait;
+    }
+    pending.tcomm+=pending.tcomplete-pending.tstart;
+    pending.texposed+=pending.tposted-pending.tstart+twait;
+    pending.rqst.clear();
+    pending.iactive=0;
+}
+
+///add the time taken by blocking communication done as part of an overlapped stage, all of which is exposed
+void MPIAddBlockingCommTime(mpi_pending_exchange &pending, double time)
+{
+    pending.tcomm+=time;
+    pending.texposed+=time;
+}
+
+///report the mean and maximum communication time per task of an overlapped stage and the fraction of it hidden behind local work
+void MPIReportCommOverlap(const char *stage, mpi_pending_exchange &pending)
+{
+    double local[2]={pending.tcomm,pending.texposed}, tsum[2], tmax[2];
+    MPI_Allreduce(local, tsum, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(local, tmax, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    if (ThisTask==0 && tsum[0]>0) {
+        cout<<"Communication in "<<stage<<" took "<<tsum[0]/NProcs<<" (mean) "<<tmax[0]<<" (max) per task, ";
+        cout<<"of which "<<(tsum[0]-tsum[1])/NProcs<<" ("<<(1.0-tsum[1]/tsum[0])*100.0<<"%) was hidden behind local work, ";
+        cout<<"exposed "<<tsum[1]/NProcs<<" (mean) "<<tmax[1]<<" (max)"<<endl;
+    }
+}
+//@}
+
+/// \name Progress thread
+/// Many mpi libraries only move the data of nonblocking exchanges while the calling task is inside an mpi call, so transfers started
+/// before local work may only progress when that work polls them. A progress thread calls into the library every \ref MPIPROGRESSINTERVAL
+/// microseconds, probing a duplicate of the world communicator on which no messages are sent, which requires MPI_THREAD_MULTIPLE.
+//@{
+#if defined(USEOPENMP) && defined(MPITHREADMULTIPLE)
+static std::thread mpi_progress_thread;
+static std::atomic<int> mpi_progress_active(0);
+static MPI_Comm mpi_comm_progress=MPI_COMM_NULL;
+#endif
+
+void MPIStartProgressThread(Options &opt)
+{
+    if (opt.impiprogressthread==0) return;
+#if defined(USEOPENMP) && defined(MPITHREADMULTIPLE)
+    MPI_Comm_dup(MPI_COMM_WORLD, &mpi_comm_progress);
+    mpi_progress_active=1;
+    mpi_progress_thread=std::thread([](){
+        int flag;
+        while (mpi_progress_active) {
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, mpi_comm_progress, &flag, MPI_STATUS_IGNORE);
+            std::this_thread::sleep_for(std::chrono::microseconds(MPIPROGRESSINTERVAL));
+        }
+    });
+    if (ThisTask==0) cout<<"Running a thread to progress mpi communication on each task"<<endl;
+#else
+    if (ThisTask==0) cout<<"Warning: MPI_progress_thread requires compilation with OpenMP and MPITHREADMULTIPLE, no progress thread is run"<<endl;
+#endif
+}
+
+///Stops and joins the thread, so that no thread is inside the library when it is finalized or aborted. Must be called before
+///every MPI_Finalize and MPI_Abort, and does nothing if no thread is running. Aborts can be raised by a single task, so the
+///duplicate communicator, whose release is collective, is left for MPI_Finalize.
+void MPIStopProgressThread()
+{
+#if defined(USEOPENMP) && defined(MPITHREADMULTIPLE)
+    if (mpi_progress_active==0) return;
+    mpi_progress_active=0;
+    mpi_progress_thread.join();
+#endif
+}
+//@}
+
+/// \name Derived datatypes of the compact particle records
+/// Each is built and committed on first use. Only the listed fields are sent, so padding is not, and the
+/// extent is resized to that of the structure so that arrays of records can be sent directly.
+//@{
+MPI_Datatype MPIBuildRecordType(int nfields, int *blocklengths, MPI_Aint *displacements, MPI_Datatype *types, MPI_Aint extent){
+    MPI_Datatype tmptype, recordtype;
+    MPI_Type_create_struct(nfields, blocklengths, displacements, types, &tmptype);
+    MPI_Type_create_resized(tmptype, 0, extent, &recordtype);
+    MPI_Type_commit(&recordtype);
+    MPI_Type_free(&tmptype);
+    return recordtype;
+}
+MPI_Datatype MPIRecordType(partposdata_in *){
+    static MPI_Datatype recordtype=MPI_DATATYPE_NULL;
+    if (recordtype==MPI_DATATYPE_NULL) {
+        int blocklengths[3]={3,1,1};
+        MPI_Aint displacements[3]={offsetof(partposdata_in,Pos),offsetof(partposdata_in,ID),offsetof(partposdata_in,Type)};
+        MPI_Datatype types[3]={MPI_Real_t,MPI_Int_t,MPI_INT};
+        recordtype=MPIBuildRecordType(3,blocklengths,displacements,types,sizeof(partposdata_in));
+    }
+    return recordtype;
+}
+MPI_Datatype MPIRecordType(partphasedata_in *){
+    static MPI_Datatype recordtype=MPI_DATATYPE_NULL;
+    if (recordtype==MPI_DATATYPE_NULL) {
+        int blocklengths[6]={3,3,1,1,1,1};
+        MPI_Aint displacements[6]={offsetof(partphasedata_in,Pos),offsetof(partphasedata_in,Vel),offsetof(partphasedata_in,Mass),
+            offsetof(partphasedata_in,Potential),offsetof(partphasedata_in,ID),offsetof(partphasedata_in,Type)};
+        MPI_Datatype types[6]={MPI_Real_t,MPI_Real_t,MPI_Real_t,MPI_Real_t,MPI_Int_t,MPI_INT};
+        recordtype=MPIBuildRecordType(6,blocklengths,displacements,types,sizeof(partphasedata_in));
+    }
+    return recordtype;
+}
+MPI_Datatype MPIRecordType(partnndata_in *){
+    static MPI_Datatype recordtype=MPI_DATATYPE_NULL;
+    if (recordtype==MPI_DATATYPE_NULL) {
+        int blocklengths[2]={3,3};
+        MPI_Aint displacements[2]={offsetof(partnndata_in,Pos),offsetof(partnndata_in,Vel)};
+        MPI_Datatype types[2]={MPI_Real_t,MPI_Real_t};
+        recordtype=MPIBuildRecordType(2,blocklengths,displacements,types,sizeof(partnndata_in));
+    }
+    return recordtype;
+}
+MPI_Datatype MPIRecordType(partsodata_in *){
+    static MPI_Datatype recordtype=MPI_DATATYPE_NULL;
+    if (recordtype==MPI_DATATYPE_NULL) {
+        int blocklengths[3]={3,1,1};
+        MPI_Aint displacements[3]={offsetof(partsodata_in,Pos),offsetof(partsodata_in,Mass),offsetof(partsodata_in,PID)};
+        MPI_Datatype types[3]={MPI_Real_t,MPI_Real_t,MPI_Int_t};
+        recordtype=MPIBuildRecordType(3,blocklengths,displacements,types,sizeof(partsodata_in));
+    }
+    return recordtype;
+}
+
+///pack the particles listed in the sorted FoFDataIn export list into compact records and exchange them,
+///so that imported record i corresponds to FoFDataGet[i]
+template<class T> void MPIExchangeExportRecords(Particle *Part, vector<T> &importbuf, int tag)
+{
+    Int_t nsend_local[NProcs], nrecv_local[NProcs], nexport=0, nimport=0;
+    for (int j=0;j<NProcs;j++) {
+        nsend_local[j]=mpi_nsend[j];
+        nrecv_local[j]=mpi_nrecv[j];
+        if (j!=ThisTask) {nexport+=nsend_local[j];nimport+=nrecv_local[j];}
+    }
+    vector<T> exportbuf(nexport);
+    for (Int_t i=0;i<nexport;i++) exportbuf[i].Set(Part[FoFDataIn[i].Index]);
+    importbuf.resize(nimport);
+    MPIExchangeBlocks(exportbuf.data(), nsend_local, importbuf.data(), nrecv_local, tag, MPIRecordType(exportbuf.data()));
+}
+//@}
+
+/// \name Space filling curve domain decomposition
+/*!
+    Here the volume spanned by mpi_xlim is covered by a mesh of 2^\ref MPISFCLEVEL cells per dimension and the cells are ordered along
+    a Peano-Hilbert curve. Each task owns a contiguous range of keys, so any number of tasks can be used and the domains remain compact.
+    Particles are initially read into key ranges of equal length. Once loaded, the number of particles in every cell is summed across all tasks
+    and the splitters are chosen so that each task has a similar amount of estimated work, after which particles are moved to their new task.
+    The bounding box of each key range is stored in \ref mpi_domain so that box based tests remain valid (if conservative).
+*/
+//@{
+
+///Peano-Hilbert key of a mesh cell, based on the transpose algorithm of Skilling (2004, AIP Conf. Proc. 707, 381)
+unsigned int MPISFCKey(unsigned int ix, unsigned int iy, unsigned int iz){
+    unsigned int x[3]={ix,iy,iz}, m=1u<<(mpi_sfc_level-1), p, q, t, key=0;
+    //inverse undo of the excess work
+    for (q=m;q>1;q>>=1) {
+        p=q-1;
+        for (int i=0;i<3;i++) {
+            if (x[i]&q) x[0]^=p;
+            else {t=(x[0]^x[i])&p;x[0]^=t;x[i]^=t;}
+        }
+    }
+    //gray encode
+    for (int i=1;i<3;i++) x[i]^=x[i-1];
+    t=0;
+    for (q=m;q>1;q>>=1) if (x[2]&q) t^=q-1;
+    for (int i=0;i<3;i++) x[i]^=t;
+    //interleave the transposed bits
+    for (int b=mpi_sfc_level-1;b>=0;b--) for (int i=0;i<3;i++) key=(key<<1)|((x[i]>>b)&1u);
+    return key;
+}
+
+///key of the mesh cell containing a position, positions outside the mesh are placed in the nearest edge cell
+unsigned int MPISFCGetKey(Double_t x, Double_t y, Double_t z){
+    int ncell=1<<mpi_sfc_level, icell[3];
+    Double_t pos[3]={x,y,z};
+    for (int k=0;k<3;k++) {
+        icell[k]=(int)floor((pos[k]-mpi_sfc_xmin[k])*mpi_sfc_icellwidth[k]);
+        if (icell[k]<0) icell[k]=0;
+        else if (icell[k]>=ncell) icell[k]=ncell-1;
+    }
+    return MPISFCKey(icell[0],icell[1],icell[2]);
+}
+
+///task whose key range contains a key
+int MPISFCGetTask(unsigned int key){
+    return (int)(upper_bound(mpi_sfc_splitters+1,mpi_sfc_splitters+NProcs,key)-(mpi_sfc_splitters+1));
+}
+
+///set the bounding box of every domain from the cells in its key range. Tasks with an empty range are given an inverted box that overlaps nothing
+void MPISFCSetDomainBounds(){
+    int ncell=1<<mpi_sfc_level, task;
+    vector<int> imin(NProcs*3,ncell), imax(NProcs*3,-1);
+    for (int ix=0;ix<ncell;ix++) for (int iy=0;iy<ncell;iy++) for (int iz=0;iz<ncell;iz++) {
+        int icell[3]={ix,iy,iz};
+        task=MPISFCGetTask(MPISFCKey(ix,iy,iz));
+        for (int k=0;k<3;k++) {
+            if (icell[k]<imin[task*3+k]) {
+                imin[task*3+k]=icell[k];
+            }
+            if (icell[k]>imax[task*3+k]) {
+                imax[task*3+k]=icell[k];
+            }
+        }
+    }
+    for (int j=0;j<NProcs;j++) for (int k=0;k<3;k++) {
+        if (imax[j*3+k]<0) {mpi_domain[j].bnd[k][0]=MAXVALUE;mpi_domain[j].bnd[k][1]=-MAXVALUE;continue;}
+        mpi_domain[j].bnd[k][0]=mpi_sfc_xmin[k]+imin[j*3+k]/mpi_sfc_icellwidth[k];
+        mpi_domain[j].bnd[k][1]=mpi_sfc_xmin[k]+(imax[j*3+k]+1)/mpi_sfc_icellwidth[k];
+    }
+}
+
+///initial space filling curve decomposition, where every task is given a key range of equal length
+void MPISFCInitialDomainDecomposition(){
+    unsigned int ncells=1u<<(3*mpi_sfc_level);
+    if (mpi_sfc_splitters==NULL) mpi_sfc_splitters=new unsigned int[NProcs+1];
+    if (ThisTask==0) {
+        for (int k=0;k<3;k++) {
+            mpi_sfc_xmin[k]=mpi_xlim[k][0];
+            mpi_sfc_icellwidth[k]=(Double_t)(1<<mpi_sfc_level)/(mpi_xlim[k][1]-mpi_xlim[k][0]);
+        }
+        for (int j=0;j<=NProcs;j++) mpi_sfc_splitters[j]=(unsigned int)((unsigned long long)ncells*j/NProcs);
+        MPISFCSetDomainBounds();
+        cout<<"Initial MPI Domains are ranges of a Peano-Hilbert curve on a "<<(1<<mpi_sfc_level)<<"^3 mesh with bounding boxes: "<<endl;
+        for (int j=0;j<NProcs;j++) {
+            cout<<"ThisTask= "<<j<<" :: keys "<<mpi_sfc_splitters[j]<<" "<<mpi_sfc_splitters[j+1]<<" :: ";
+            cout.precision(10);for (int k=0;k<3;k++) cout<<k<<" "<<mpi_domain[j].bnd[k][0]<<" "<<mpi_domain[j].bnd[k][1]<<" | ";cout<<endl;
+        }
+    }
+    MPI_Bcast(mpi_sfc_xmin, 3, MPI_Real_t, 0, MPI_COMM_WORLD);
+    MPI_Bcast(mpi_sfc_icellwidth, 3, MPI_Real_t, 0, MPI_COMM_WORLD);
+    MPI_Bcast(mpi_sfc_splitters, NProcs+1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(mpi_domain, NProcs*sizeof(MPI_Domain), MPI_BYTE, 0, MPI_COMM_WORLD);
+}
+
+///move the first nlocal particles of Part to the task owning their key, received particles are appended to the local ones
+void MPISFCExchangeParticles(vector<Particle> &Part, Int_t &nlocal, vector<unsigned int> &keys){
+    Int_t nsend_local[NProcs],nrecv_local[NProcs],noffset_export[NProcs],nbuffer[NProcs];
+    Int_t nexport=0,nimport=0,nkeep=0;
+    int task;
+    vector<int> dest(nlocal);
+    vector<Particle> Psend;
+
+    for (int j=0;j<NProcs;j++) nsend_local[j]=nbuffer[j]=0;
+    for (Int_t i=0;i<nlocal;i++) {
+        dest[i]=MPISFCGetTask(keys[i]);
+        if (dest[i]!=ThisTask) nsend_local[dest[i]]++;
+    }
+    MPIExchangeCounts(nsend_local);
+    for (int j=0;j<NProcs;j++){
+        nrecv_local[j]=mpi_nrecv[j];
+        nimport+=nrecv_local[j];
+        nexport+=nsend_local[j];
+    }
+    noffset_export[0]=0;
+    for (int j=1;j<NProcs;j++) noffset_export[j]=noffset_export[j-1]+nsend_local[j-1];
+    //copy exported particles to the send buffer and compact the local ones
+    Psend.resize(nexport);
+    for (Int_t i=0;i<nlocal;i++) {
+        task=dest[i];
+        if (task!=ThisTask) Psend[noffset_export[task]+nbuffer[task]++]=Part[i];
+        else Part[nkeep++]=Part[i];
+    }
+    dest.clear();
+    Part.resize(nkeep+nimport);
+    MPIExchangeBlocks(Psend.data(), nsend_local, &Part.data()[nkeep], nrecv_local, TAG_IO_A);
+    nlocal=nkeep+nimport;
+}
+
+/*!
+    Rebalance the space filling curve decomposition using the loaded particles. The cost of a cell is estimated as
+    \f$ n_c\left[1+\ln(1+n_c/\bar{n})\right] \f$, where \f$ \bar{n} \f$ is the mean number of particles in occupied cells, since
+    neighbour searches in dense cells require more work per particle. Splitters are placed where the cumulative work along the curve
+    crosses multiples of the total work divided by the number of tasks, particles are exchanged and the resulting imbalance is reported.
+*/
+void MPISFCDomainDecomposition(Options &opt, vector<Particle> &Part, Particle *&Pbaryons, Int_t &nbaryons){
+    if (mpi_sfc_level==0 || NProcs==1) return;
+    unsigned int ncells=1u<<(3*mpi_sfc_level);
+    Int_t nlocal=Nlocal, noccupied=0, ntot=0;
+    double time1=MyGetTime(), nmean, worktot=0, worklocal=0, cumwork=0;
+    vector<unsigned int> keys(nlocal), baryonkeys(nbaryons);
+    vector<unsigned long long> cellnumlocal(ncells,0), cellnum(ncells);
+    vector<double> cellwork(ncells,0);
+
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static) if (nlocal>ompsearchnum)
+#endif
+    for (Int_t i=0;i<nlocal;i++) keys[i]=MPISFCGetKey(Part[i].GetPosition(0),Part[i].GetPosition(1),Part[i].GetPosition(2));
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static) if (nbaryons>ompsearchnum)
+#endif
+    for (Int_t i=0;i<nbaryons;i++) baryonkeys[i]=MPISFCGetKey(Pbaryons[i].GetPosition(0),Pbaryons[i].GetPosition(1),Pbaryons[i].GetPosition(2));
+    for (Int_t i=0;i<nlocal;i++) cellnumlocal[keys[i]]++;
+    for (Int_t i=0;i<nbaryons;i++) cellnumlocal[baryonkeys[i]]++;
+    MPI_Allreduce(cellnumlocal.data(), cellnum.data(), ncells, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    cellnumlocal.clear();
+    cellnumlocal.shrink_to_fit();
+
+    for (unsigned int i=0;i<ncells;i++) if (cellnum[i]>0) {noccupied++;ntot+=cellnum[i];}
+    nmean=(double)ntot/(double)max(noccupied,(Int_t)1);
+    for (unsigned int i=0;i<ncells;i++) if (cellnum[i]>0) {
+        cellwork[i]=cellnum[i]*(1.0+log(1.0+cellnum[i]/nmean));
+        worktot+=cellwork[i];
+    }
+    //work of the current decomposition
+    for (Int_t i=0;i<nlocal;i++) worklocal+=cellwork[keys[i]]/cellnum[keys[i]];
+    for (Int_t i=0;i<nbaryons;i++) worklocal+=cellwork[baryonkeys[i]]/cellnum[baryonkeys[i]];
+    MPIReportDomainImbalance("before rebalancing", nlocal+nbaryons, worklocal/worktot*NProcs);
+
+    //new splitters, identical on all tasks as they are based on the reduced cell counts
+    mpi_sfc_splitters[0]=0;
+    int task=1;
+    for (unsigned int i=0;i<ncells && task<NProcs;i++) {
+        cumwork+=cellwork[i];
+        while (task<NProcs && cumwork>=worktot*(double)task/(double)NProcs) mpi_sfc_splitters[task++]=i+1;
+    }
+    while (task<NProcs) mpi_sfc_splitters[task++]=ncells;
+    mpi_sfc_splitters[NProcs]=ncells;
+    worklocal=0;
+    for (unsigned int i=mpi_sfc_splitters[ThisTask];i<mpi_sfc_splitters[ThisTask+1];i++) worklocal+=cellwork[i];
+    cellwork.clear();
+    cellnum.clear();
+    MPISFCSetDomainBounds();
+
+    MPISFCExchangeParticles(Part, nlocal, keys);
+    Nlocal=Nmemlocal=nlocal;
+    //every task must take part in the baryon exchange if baryons are held separately
+    if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) {
+        vector<Particle> Pbaryonsvec(Pbaryons,Pbaryons+nbaryons);
+        MPISFCExchangeParticles(Pbaryonsvec, nbaryons, baryonkeys);
+        if (Pbaryons!=NULL) delete[] Pbaryons;
+        Nlocalbaryon[0]=Nmemlocalbaryon=nbaryons;
+        Pbaryons=new Particle[max(nbaryons,(Int_t)1)];
+        for (Int_t i=0;i<nbaryons;i++) Pbaryons[i]=Pbaryonsvec[i];
+    }
+    MPIReportDomainImbalance("after rebalancing", Nlocal+nbaryons, worklocal/worktot*NProcs);
+    if (ThisTask==0) cout<<"TIME::"<<ThisTask<<" took "<<MyGetTime()-time1<<" to rebalance the space filling curve decomposition"<<endl;
+}
+
+///report the number of particles and (if known, ie: >=0) estimated work relative to the mean of every task along with the maximum imbalance
+void MPIReportDomainImbalance(const char *stage, Int_t nlocal, Double_t relwork){
+    Int_t nmax, nmin, ntot;
+    Double_t workmax, workmin;
+    MPI_Allreduce(&nlocal, &nmax, 1, MPI_Int_t, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(&nlocal, &nmin, 1, MPI_Int_t, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(&nlocal, &ntot, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(&relwork, &workmax, 1, MPI_Real_t, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(&relwork, &workmin, 1, MPI_Real_t, MPI_MIN, MPI_COMM_WORLD);
+    Double_t nmean=(Double_t)ntot/(Double_t)NProcs;
+    cout<<ThisTask<<" has "<<nlocal<<" particles ("<<nlocal/nmean<<" of mean)";
+    if (relwork>=0) cout<<" and estimated work "<<relwork<<" of mean";
+    cout<<" "<<stage<<endl;
+    if (ThisTask==0) {
+        cout<<"MPI load imbalance "<<stage<<" :: particles max/mean="<<nmax/nmean<<" min/mean="<<nmin/nmean;
+        if (workmin>=0) cout<<" :: estimated work max/mean="<<workmax<<" min/mean="<<workmin;
+        cout<<endl;
+    }
+}
+//@}
+
 /// \name routines which check to see if some search region overlaps with local mpi domain
 //@{
 ///search if some region is in the local mpi domain
@@ -280,6 +1064,54 @@ int MPIInDomain(Double_t xsearch[3][2], Double_t bnd[3][2]){
     }
 }
 
+///check whether any mesh cell in a search region (without periodic images) lies in the key range of a task
+int MPISFCSearchInDomain(Double_t xsearch[3][2], int task){
+    int ncell=1<<mpi_sfc_level, istart[3], iend[3];
+    unsigned int keymin=mpi_sfc_splitters[task], keymax=mpi_sfc_splitters[task+1], key;
+    Int_t nsearchcells=1;
+    if (keymin==keymax) return 0;
+    for (int k=0;k<3;k++) {
+        istart[k]=(int)floor((xsearch[k][0]-mpi_sfc_xmin[k])*mpi_sfc_icellwidth[k]);
+        iend[k]=(int)floor((xsearch[k][1]-mpi_sfc_xmin[k])*mpi_sfc_icellwidth[k]);
+        if (iend[k]<0 || istart[k]>=ncell) return 0;
+        istart[k]=max(istart[k],0);
+        iend[k]=min(iend[k],ncell-1);
+        nsearchcells*=(Int_t)(iend[k]-istart[k]+1);
+    }
+    //large regions are only tested against the bounding box
+    if (nsearchcells>MPISFCMAXSEARCHCELLS) return 1;
+    for (int ix=istart[0];ix<=iend[0];ix++) for (int iy=istart[1];iy<=iend[1];iy++) for (int iz=istart[2];iz<=iend[2];iz++) {
+        key=MPISFCKey(ix,iy,iz);
+        if (key>=keymin && key<keymax) return 1;
+    }
+    return 0;
+}
+
+///search if some region is in the domain of a given task. For space filling curve domains the bounding box is checked first
+///followed by the cells of the region and its periodic images
+int MPIInDomain(Double_t xsearch[3][2], int task){
+    if (NProcs==1) return 1;
+    if (mpi_sfc_level==0) return MPIInDomain(xsearch,mpi_domain[task].bnd);
+    if (!MPIInDomain(xsearch,mpi_domain[task].bnd)) return 0;
+    Double_t xsearchp[3][2], shift[3][3], xmax;
+    int nshift[3];
+    for (int k=0;k<3;k++) {
+        nshift[k]=0;
+        shift[k][nshift[k]++]=0;
+        if (mpi_period==0) continue;
+        xmax=mpi_sfc_xmin[k]+(1<<mpi_sfc_level)/mpi_sfc_icellwidth[k];
+        if (xsearch[k][0]<mpi_sfc_xmin[k]) shift[k][nshift[k]++]=mpi_period;
+        if (xsearch[k][1]>xmax) shift[k][nshift[k]++]=-mpi_period;
+    }
+    for (int i=0;i<nshift[0];i++) for (int j=0;j<nshift[1];j++) for (int l=0;l<nshift[2];l++) {
+        xsearchp[0][0]=xsearch[0][0]+shift[0][i];xsearchp[0][1]=xsearch[0][1]+shift[0][i];
+        xsearchp[1][0]=xsearch[1][0]+shift[1][j];xsearchp[1][1]=xsearch[1][1]+shift[1][j];
+        xsearchp[2][0]=xsearch[2][0]+shift[2][l];xsearchp[2][1]=xsearch[2][1]+shift[2][l];
+        if (MPISFCSearchInDomain(xsearchp,task)) return 1;
+    }
+    return 0;
+}
+
 ///\todo clean up memory allocation in these functions, no need to keep allocating xsearch,xsearchp,numoverlap,etc
 /// Determine if a particle needs to be exported to another mpi domain based on a physical search radius
 int MPISearchForOverlap(Particle &Part, Double_t &rdist){
@@ -294,6 +1126,10 @@ int MPISearchForOverlap(Double_t xsearch[3][2]){
     int indomain;
     int j,k;
 
+    if (mpi_sfc_level>0) {
+        for (j=0;j<NProcs;j++) if (j!=ThisTask) numoverlap+=MPIInDomain(xsearch,j);
+        return numoverlap;
+    }
     for (j=0;j<NProcs;j++) {
         if (j!=ThisTask) {
             //determine if search region is not outside of this processors domain
@@ -767,6 +1603,9 @@ void MPIReceiveParticlesFromReadThreads(Options &opt, Particle *&Pbuf, Particle
         //index type separated
         for (i=0;i<Nlocal;i++) Part[i].SetID(i);
         for (i=0;i<Nlocalbaryon[0];i++) Part[i+Nlocal].SetID(i+Nlocal);
+        //if the input is subsampled, fewer dark matter particles are received than were allocated for, so move the baryons
+        //to where the read tasks store them. Pbaryons never precedes Part[Nlocal] so copy from the end
+        if (Pbaryons!=&Part[Nlocal]) for (i=Nlocalbaryon[0]-1;i>=0;i--) Pbaryons[i]=Part[i+Nlocal];
     }
 }
 
@@ -801,9 +1640,9 @@ void MPISendParticlesBetweenReadThreads(Options &opt, Particle *&Pbuf, Particle
             //if ibuf>0 and now at recvTask=0, then next time, cycle
             if (ibuf>0 && recvTask==0) icycle=1;
             //if sendtask!=recvtask, and information needs to be sent, send information
-            if (sendTask!=recvTask && (mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)) {
-                nsend=mpi_nsend[ThisTask * NProcs + recvTask];
-                nrecv=mpi_nsend[recvTask * NProcs + ThisTask];
+            if (sendTask!=recvTask && (mpi_nsend[recvTask] > 0 || mpi_nrecv[recvTask] > 0)) {
+                nsend=mpi_nsend[recvTask];
+                nrecv=mpi_nrecv[recvTask];
                 //calculate how many send/recvs are needed
                 nsendchunks=ceil((double)nsend/(double)maxchunksize);
                 nrecvchunks=ceil((double)nrecv/(double)maxchunksize);
@@ -830,8 +1669,8 @@ void MPISendParticlesBetweenReadThreads(Options &opt, Particle *&Pbuf, Particle
             }
             //if separate baryon search, send baryons too
             if (opt.iBaryonSearch && opt.partsearchtype!=PSTALL) {
-                nsend=mpi_nsend_baryon[ThisTask * NProcs + recvTask];
-                nrecv=mpi_nsend_baryon[recvTask * NProcs + ThisTask];
+                nsend=mpi_nsend_baryon[recvTask];
+                nrecv=mpi_nsend_baryon[NProcs+recvTask];
                 //calculate how many send/recvs are needed
                 nsendchunks=ceil((double)nsend/(double)maxchunksize);
                 nrecvchunks=ceil((double)nrecv/(double)maxchunksize);
@@ -847,7 +1686,7 @@ void MPISendParticlesBetweenReadThreads(Options &opt, Particle *&Pbuf, Particle
                     currecvchunksize=min(maxchunksize,nrecv-recvoffset);
                     //blocking point-to-point send and receive. Here must determine the appropriate offset point in the local export buffer
                     //for sending data and also the local appropriate offset in the local the receive buffer for information sent from the local receiving buffer
-                    MPI_Sendrecv(&Pbuf[nreadoffset[ireadtask[recvTask]]+mpi_nsend[ThisTask * NProcs + recvTask]+sendoffset],sizeof(Particle)*cursendchunksize, MPI_BYTE, recvTask, TAG_IO_B+isendrecv,
+                    MPI_Sendrecv(&Pbuf[nreadoffset[ireadtask[recvTask]]+mpi_nsend[recvTask]+sendoffset],sizeof(Particle)*cursendchunksize, MPI_BYTE, recvTask, TAG_IO_B+isendrecv,
                         &Pbaryons[Nlocalbaryon[0]],sizeof(Particle)*currecvchunksize, MPI_BYTE, recvTask, TAG_IO_B+isendrecv,
                                 MPI_COMM_WORLD, &status);
                     Nlocalbaryon[0]+=currecvchunksize;
@@ -963,7 +1802,7 @@ void MPIGetExportNum(const Int_t nbodies, Particle *Part, Double_t rdist){
         for (j=0;j<NProcs;j++) {
             if (j!=ThisTask) {
                 //determine if search region is not outside of this processors domain
-                if(MPIInDomain(xsearch,mpi_domain[j].bnd))
+                if(MPIInDomain(xsearch,j))
                 {
                     nexport++;
                     nsend_local[j]++;
@@ -971,10 +1810,10 @@ void MPIGetExportNum(const Int_t nbodies, Particle *Part, Double_t rdist){
             }
         }
     }
-    NExport=nexport;//*(1.0+MPIExportFac);
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    NExport=nexport;
+    MPIExchangeCounts(nsend_local);
     NImport=0;
-    for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)NImport+=mpi_nrecv[j];
 }
 
 #ifdef SWIFTINTERFACE
@@ -1025,10 +1864,10 @@ void MPIGetExportNumUsingMesh(Options &opt, const Int_t nbodies, Particle *Part,
             }
         }
     }
-    NExport=nexport;//*(1.0+MPIExportFac);
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    NExport=nexport;
+    MPIExchangeCounts(nsend_local);
     NImport=0;
-    for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)NImport+=mpi_nrecv[j];
 }
 #endif
 
@@ -1053,7 +1892,7 @@ void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfo
         for (j=0;j<NProcs;j++) {
             if (j!=ThisTask) {
                 //determine if search region is not outside of this processors domain
-                if(MPIInDomain(xsearch,mpi_domain[j].bnd))
+                if(MPIInDomain(xsearch,j))
                 {
                     //FoFDataIn[nexport].Part=Part[i];
                     FoFDataIn[nexport].Index = i;
@@ -1070,26 +1909,25 @@ void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfo
     if (nexport>0) {
     //sort the export data such that all particles to be passed to thread j are together in ascending thread number
     qsort(FoFDataIn, nexport, sizeof(struct fofdata_in), fof_export_cmp);
-    for (i=0;i<nexport;i++) PartDataIn[i] = Part[FoFDataIn[i].Index];
     }
     //then store the offset in the export particle data for the jth Task in order to send data.
     for(j = 1, noffset[0] = 0; j < NProcs; j++) noffset[j]=noffset[j-1] + nsend_local[j-1];
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-    NImport=0;for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    MPIExchangeCounts(nsend_local);
+    NImport=0;for (j=0;j<NProcs;j++)NImport+=mpi_nrecv[j];
     //now send the data.
-    for (j=0;j<NProcs;j++)nimport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)nimport+=mpi_nrecv[j];
 
     //check if buffer that needs to be send is too large and must be sent in chunks
     int bufferFlag = 1;
-    long int maxNumPart = LOCAL_MAX_MSGSIZE / (long int) sizeof(Particle);
+    long int maxNumPart = LOCAL_MAX_MSGSIZE / (long int) sizeof(struct fofdata_in);
     for (j = 0; j < NProcs; j++)
     {
         if (j != ThisTask)
         {
             sendTask = ThisTask;
             recvTask = j;
-            if (mpi_nsend[ThisTask+recvTask*NProcs] >= maxNumPart || nsend_local[recvTask] >= maxNumPart ) bufferFlag++;
+            if (mpi_nrecv[recvTask] >= maxNumPart || nsend_local[recvTask] >= maxNumPart ) bufferFlag++;
         }
     }
     //if buffer is too large, split sends
@@ -1106,15 +1944,10 @@ void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfo
             numBuffersToRecv[j] = 0;
             if (nsend_local[j] > 0)
             numBuffersToSend[j] = (nsend_local[j]/numPartInBuffer) + 1;
+            //number of incoming buffers follows from the counts already exchanged, no need for an all-pairs handshake
+            if (mpi_nrecv[j] > 0)
+            numBuffersToRecv[j] = (mpi_nrecv[j]/numPartInBuffer) + 1;
         }
-        for (int i = 1; i < NProcs; i++)
-        {
-            int src = (ThisTask + NProcs - i) % NProcs;
-            int dst = (ThisTask + i) % NProcs;
-            MPI_Isend (&numBuffersToSend[dst], 1, MPI_INT, dst, 0, MPI_COMM_WORLD, &rqst);
-            MPI_Recv  (&numBuffersToRecv[src], 1, MPI_INT, src, 0, MPI_COMM_WORLD, &status);
-        }
-        MPI_Barrier (MPI_COMM_WORLD);
         //find max to be transfer, allows appropriate tagging of messages
         for (int i=0;i<NProcs;i++) if (numBuffersToRecv[i]>maxnbufferslocal) maxnbufferslocal=numBuffersToRecv[i];
         for (int i=0;i<NProcs;i++) if (numBuffersToSend[i]>maxnbufferslocal) maxnbufferslocal=numBuffersToSend[i];
@@ -1128,7 +1961,7 @@ void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfo
             nbuffer[src] = 0;
             int buffOffset = 0;
 
-            for (int jj = 0; jj < src; jj++)  nbuffer[src] += mpi_nsend[ThisTask + jj*NProcs];
+            for (int jj = 0; jj < src; jj++)  nbuffer[src] += mpi_nrecv[jj];
 
             // Send Buffers
             for (int jj = 0; jj < numBuffersToSend[dst]-1; jj++)
@@ -1136,8 +1969,6 @@ void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfo
                 MPI_Isend (&size, 1, MPI_Int_t, dst, (int)(jj+1), MPI_COMM_WORLD, &rqst);
                 MPI_Isend (&FoFDataIn[noffset[dst] + buffOffset], sizeof(struct fofdata_in)*size,
                             MPI_BYTE, dst, (int)(TAG_FOF_A*maxnbuffers+jj+1), MPI_COMM_WORLD, &rqst);
-                MPI_Isend (&PartDataIn[noffset[dst] + buffOffset], sizeof(Particle)*size,
-                            MPI_BYTE, dst, (int)(TAG_FOF_B*maxnbuffers*3+jj+1), MPI_COMM_WORLD, &rqst);
                 buffOffset += size;
             }
             size = nsend_local[dst] % numPartInBuffer;
@@ -1146,8 +1977,6 @@ void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfo
                 MPI_Isend (&size, 1, MPI_Int_t, dst, (int)(numBuffersToSend[dst]), MPI_COMM_WORLD, &rqst);
                 MPI_Isend (&FoFDataIn[noffset[dst] + buffOffset], sizeof(struct fofdata_in)*size,
                             MPI_BYTE, dst, (int)(TAG_FOF_A*maxnbuffers+numBuffersToSend[dst]), MPI_COMM_WORLD, &rqst);
-                MPI_Isend (&PartDataIn[noffset[dst] + buffOffset], sizeof(Particle)*size,
-                            MPI_BYTE, dst, (int)(TAG_FOF_B*maxnbuffers*3+numBuffersToSend[dst]), MPI_COMM_WORLD, &rqst);
             }
             // Receive Buffers
             buffOffset = 0;
@@ -1157,8 +1986,6 @@ void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfo
                 MPI_Recv (&numInBuffer, 1, MPI_Int_t, src, (int)(jj+1), MPI_COMM_WORLD, &status);
                 MPI_Recv (&FoFDataGet[nbuffer[src] + buffOffset], sizeof(struct fofdata_in)*numInBuffer,
                             MPI_BYTE, src, (int)(TAG_FOF_A*maxnbuffers+jj+1), MPI_COMM_WORLD, &status);
-                MPI_Recv (&PartDataGet[nbuffer[src] + buffOffset], sizeof(Particle)*numInBuffer,
-                            MPI_BYTE, src, (int)(TAG_FOF_B*maxnbuffers*3+jj+1), MPI_COMM_WORLD, &status);
                 buffOffset += numInBuffer;
             }
         }
@@ -1173,24 +2000,18 @@ void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfo
                     sendTask = ThisTask;
                     recvTask = j;//ThisTask^j;//bitwise XOR ensures that recvTask cycles around sendTask
                     nbuffer[recvTask]=0;
-                    for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nsend[ThisTask+k*NProcs];//offset on local receiving buffer
-                    if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
+                    for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nrecv[k];//offset on local receiving buffer
+                    if(mpi_nsend[recvTask] > 0 || mpi_nrecv[recvTask] > 0)
                     {
                         //blocking point-to-point send and receive. Here must determine the appropriate offset point in the local export buffer
                         //for sending data and also the local appropriate offset in the local the receive buffer for information sent from the local receiving buffer
-                        //first send FOF data and then particle data
+                        //only the FOF data is sent here, the particle records needed by the search are sent by MPIExchangeExportRecords
                         MPI_Sendrecv(&FoFDataIn[noffset[recvTask]],
                             nsend_local[recvTask] * sizeof(struct fofdata_in), MPI_BYTE,
                             recvTask, TAG_FOF_A,
                             &FoFDataGet[nbuffer[recvTask]],
-                            mpi_nsend[ThisTask+recvTask * NProcs] * sizeof(struct fofdata_in),
+                            mpi_nrecv[recvTask] * sizeof(struct fofdata_in),
                             MPI_BYTE, recvTask, TAG_FOF_A, MPI_COMM_WORLD, &status);
-                        MPI_Sendrecv(&PartDataIn[noffset[recvTask]],
-                            nsend_local[recvTask] * sizeof(Particle), MPI_BYTE,
-                            recvTask, TAG_FOF_B,
-                            &PartDataGet[nbuffer[recvTask]],
-                            mpi_nsend[ThisTask+recvTask * NProcs] * sizeof(Particle),
-                            MPI_BYTE, recvTask, TAG_FOF_B, MPI_COMM_WORLD, &status);
                     }
                 }
             }
@@ -1198,6 +2019,77 @@ void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfo
     }
 }
 
+/*! Overlapped counterpart of \ref MPIGetExportNum and \ref MPIBuildParticleExportList. Which particles have a linking region that overlaps
+    another domain depends only on their positions, so these are found before the local fof search and their positions are sent with
+    nonblocking communication while the search runs. Allocates FoFDataIn and FoFDataGet, which are completed by \ref MPIFinishParticleExport
+    once the local group ids are known.
+*/
+void MPIStartParticleExport(const Int_t nbodies, Particle *Part, Double_t rdist, vector<partposdata_in> &exportbuf, vector<partposdata_in> &importbuf, mpi_pending_exchange &pending){
+    Int_t nsend_local[NProcs];
+    Double_t xsearch[3][2];
+    vector<Int_t> exportindex;
+    vector<int> exporttask;
+    double time1;
+
+    for (int j=0;j<NProcs;j++) nsend_local[j]=0;
+    for (Int_t i=0;i<nbodies;i++) {
+        for (int k=0;k<3;k++) {xsearch[k][0]=Part[i].GetPosition(k)-rdist;xsearch[k][1]=Part[i].GetPosition(k)+rdist;}
+        for (int j=0;j<NProcs;j++) {
+            if (j!=ThisTask && MPIInDomain(xsearch,j)) {
+                exportindex.push_back(i);
+                exporttask.push_back(j);
+                nsend_local[j]++;
+            }
+        }
+    }
+    time1=MyGetTime();
+    MPIExchangeCounts(nsend_local);
+    MPIAddBlockingCommTime(pending, MyGetTime()-time1);
+    NExport=exportindex.size();
+    NImport=0;
+    for (int j=0;j<NProcs;j++) NImport+=mpi_nrecv[j];
+    FoFDataIn=new fofdata_in[NExport];
+    FoFDataGet=new fofdata_in[NImport];
+    for (Int_t i=0;i<NExport;i++) {
+        FoFDataIn[i].Index=exportindex[i];
+        FoFDataIn[i].Task=exporttask[i];
+        FoFDataIn[i].iGroupTask=ThisTask;
+    }
+    if (NExport>0) qsort(FoFDataIn, NExport, sizeof(struct fofdata_in), fof_export_cmp);
+    exportbuf.resize(NExport);
+    importbuf.resize(NImport);
+    for (Int_t i=0;i<NExport;i++) exportbuf[i].Set(Part[FoFDataIn[i].Index]);
+    MPIStartExchangeBlocks(exportbuf.data(), mpi_nsend, importbuf.data(), mpi_nrecv, TAG_FOF_B, pending, MPIRecordType(exportbuf.data()));
+}
+
+/*! Complete the exchange started by \ref MPIStartParticleExport once the local fof search has found the (mpi adjusted) group ids and send
+    the group id of every exported particle. Only the group id and group task of FoFDataGet are set, which is all that is needed to link
+    the imported particles with \ref MPILinkAcrossUnionFind.
+*/
+void MPIFinishParticleExport(Particle *Part, Int_t *pfof, Int_tree_t *Len, mpi_pending_exchange &pending){
+    vector<Int_t> exportgid(NExport), importgid(NImport);
+    Int_t nimport=0;
+    double time1;
+    for (Int_t i=0;i<NExport;i++) {
+        FoFDataIn[i].iGroup=pfof[Part[FoFDataIn[i].Index].GetID()];
+        FoFDataIn[i].iLen=Len[FoFDataIn[i].Index];
+        exportgid[i]=FoFDataIn[i].iGroup;
+    }
+    MPIFinishExchange(pending);
+    time1=MyGetTime();
+    MPIExchangeBlocks(exportgid.data(), pending.nsend.data(), importgid.data(), pending.nrecv.data(), TAG_FOF_C);
+    MPIAddBlockingCommTime(pending, MyGetTime()-time1);
+    for (int j=0;j<NProcs;j++) {
+        if (j==ThisTask) continue;
+        for (Int_t i=nimport;i<nimport+pending.nrecv[j];i++) {
+            FoFDataGet[i].iGroup=importgid[i];
+            FoFDataGet[i].iGroupTask=j;
+            FoFDataGet[i].Task=ThisTask;
+        }
+        nimport+=pending.nrecv[j];
+    }
+}
+
 /*! Similar to \ref MPIBuildParticleExportList but uses mesh of swift to determine when mpi's to search
 */
 #ifdef SWIFTINTERFACE
@@ -1246,26 +2138,25 @@ void MPIBuildParticleExportListUsingMesh(Options &opt, const Int_t nbodies, Part
     if (nexport>0) {
     //sort the export data such that all particles to be passed to thread j are together in ascending thread number
     qsort(FoFDataIn, nexport, sizeof(struct fofdata_in), fof_export_cmp);
-    for (i=0;i<nexport;i++) PartDataIn[i] = Part[FoFDataIn[i].Index];
     }
     //then store the offset in the export particle data for the jth Task in order to send data.
     for(j = 1, noffset[0] = 0; j < NProcs; j++) noffset[j]=noffset[j-1] + nsend_local[j-1];
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-    NImport=0;for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    MPIExchangeCounts(nsend_local);
+    NImport=0;for (j=0;j<NProcs;j++)NImport+=mpi_nrecv[j];
     //now send the data.
-    for (j=0;j<NProcs;j++)nimport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)nimport+=mpi_nrecv[j];
 
     //check if buffer that needs to be send is too large and must be sent in chunks
     int bufferFlag = 1;
-    long int maxNumPart = LOCAL_MAX_MSGSIZE / (long int) sizeof(Particle);
+    long int maxNumPart = LOCAL_MAX_MSGSIZE / (long int) sizeof(struct fofdata_in);
     for (j = 0; j < NProcs; j++)
     {
         if (j != ThisTask)
         {
             sendTask = ThisTask;
             recvTask = j;
-            if (mpi_nsend[ThisTask+recvTask*NProcs] >= maxNumPart || nsend_local[recvTask] >= maxNumPart ) bufferFlag++;
+            if (mpi_nrecv[recvTask] >= maxNumPart || nsend_local[recvTask] >= maxNumPart ) bufferFlag++;
         }
     }
     //if buffer is too large, split sends
@@ -1282,15 +2173,10 @@ void MPIBuildParticleExportListUsingMesh(Options &opt, const Int_t nbodies, Part
             numBuffersToRecv[j] = 0;
             if (nsend_local[j] > 0)
             numBuffersToSend[j] = (nsend_local[j]/numPartInBuffer) + 1;
+            //number of incoming buffers follows from the counts already exchanged, no need for an all-pairs handshake
+            if (mpi_nrecv[j] > 0)
+            numBuffersToRecv[j] = (mpi_nrecv[j]/numPartInBuffer) + 1;
         }
-        for (int i = 1; i < NProcs; i++)
-        {
-            int src = (ThisTask + NProcs - i) % NProcs;
-            int dst = (ThisTask + i) % NProcs;
-            MPI_Isend (&numBuffersToSend[dst], 1, MPI_INT, dst, 0, MPI_COMM_WORLD, &rqst);
-            MPI_Recv  (&numBuffersToRecv[src], 1, MPI_INT, src, 0, MPI_COMM_WORLD, &status);
-        }
-        MPI_Barrier (MPI_COMM_WORLD);
         //find max to be transfer, allows appropriate tagging of messages
         for (int i=0;i<NProcs;i++) if (numBuffersToRecv[i]>maxnbufferslocal) maxnbufferslocal=numBuffersToRecv[i];
         for (int i=0;i<NProcs;i++) if (numBuffersToSend[i]>maxnbufferslocal) maxnbufferslocal=numBuffersToSend[i];
@@ -1304,7 +2190,7 @@ void MPIBuildParticleExportListUsingMesh(Options &opt, const Int_t nbodies, Part
             nbuffer[src] = 0;
             int buffOffset = 0;
 
-            for (int jj = 0; jj < src; jj++)  nbuffer[src] += mpi_nsend[ThisTask + jj*NProcs];
+            for (int jj = 0; jj < src; jj++)  nbuffer[src] += mpi_nrecv[jj];
 
             // Send Buffers
             for (int jj = 0; jj < numBuffersToSend[dst]-1; jj++)
@@ -1312,8 +2198,6 @@ void MPIBuildParticleExportListUsingMesh(Options &opt, const Int_t nbodies, Part
                 MPI_Isend (&size, 1, MPI_Int_t, dst, (int)(jj+1), MPI_COMM_WORLD, &rqst);
                 MPI_Isend (&FoFDataIn[noffset[dst] + buffOffset], sizeof(struct fofdata_in)*size,
                             MPI_BYTE, dst, (int)(TAG_FOF_A*maxnbuffers+jj+1), MPI_COMM_WORLD, &rqst);
-                MPI_Isend (&PartDataIn[noffset[dst] + buffOffset], sizeof(Particle)*size,
-                            MPI_BYTE, dst, (int)(TAG_FOF_B*maxnbuffers*3+jj+1), MPI_COMM_WORLD, &rqst);
                 buffOffset += size;
             }
             size = nsend_local[dst] % numPartInBuffer;
@@ -1322,8 +2206,6 @@ void MPIBuildParticleExportListUsingMesh(Options &opt, const Int_t nbodies, Part
                 MPI_Isend (&size, 1, MPI_Int_t, dst, (int)(numBuffersToSend[dst]), MPI_COMM_WORLD, &rqst);
                 MPI_Isend (&FoFDataIn[noffset[dst] + buffOffset], sizeof(struct fofdata_in)*size,
                             MPI_BYTE, dst, (int)(TAG_FOF_A*maxnbuffers+numBuffersToSend[dst]), MPI_COMM_WORLD, &rqst);
-                MPI_Isend (&PartDataIn[noffset[dst] + buffOffset], sizeof(Particle)*size,
-                            MPI_BYTE, dst, (int)(TAG_FOF_B*maxnbuffers*3+numBuffersToSend[dst]), MPI_COMM_WORLD, &rqst);
             }
             // Receive Buffers
             buffOffset = 0;
@@ -1333,8 +2215,6 @@ void MPIBuildParticleExportListUsingMesh(Options &opt, const Int_t nbodies, Part
                 MPI_Recv (&numInBuffer, 1, MPI_Int_t, src, (int)(jj+1), MPI_COMM_WORLD, &status);
                 MPI_Recv (&FoFDataGet[nbuffer[src] + buffOffset], sizeof(struct fofdata_in)*numInBuffer,
                             MPI_BYTE, src, (int)(TAG_FOF_A*maxnbuffers+jj+1), MPI_COMM_WORLD, &status);
-                MPI_Recv (&PartDataGet[nbuffer[src] + buffOffset], sizeof(Particle)*numInBuffer,
-                            MPI_BYTE, src, (int)(TAG_FOF_B*maxnbuffers*3+jj+1), MPI_COMM_WORLD, &status);
                 buffOffset += numInBuffer;
             }
         }
@@ -1349,24 +2229,18 @@ void MPIBuildParticleExportListUsingMesh(Options &opt, const Int_t nbodies, Part
                     sendTask = ThisTask;
                     recvTask = j;//ThisTask^j;//bitwise XOR ensures that recvTask cycles around sendTask
                     nbuffer[recvTask]=0;
-                    for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nsend[ThisTask+k*NProcs];//offset on local receiving buffer
-                    if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
+                    for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nrecv[k];//offset on local receiving buffer
+                    if(mpi_nsend[recvTask] > 0 || mpi_nrecv[recvTask] > 0)
                     {
                         //blocking point-to-point send and receive. Here must determine the appropriate offset point in the local export buffer
                         //for sending data and also the local appropriate offset in the local the receive buffer for information sent from the local receiving buffer
-                        //first send FOF data and then particle data
+                        //only the FOF data is sent here, the particle records needed by the search are sent by MPIExchangeExportRecords
                         MPI_Sendrecv(&FoFDataIn[noffset[recvTask]],
                             nsend_local[recvTask] * sizeof(struct fofdata_in), MPI_BYTE,
                             recvTask, TAG_FOF_A,
                             &FoFDataGet[nbuffer[recvTask]],
-                            mpi_nsend[ThisTask+recvTask * NProcs] * sizeof(struct fofdata_in),
+                            mpi_nrecv[recvTask] * sizeof(struct fofdata_in),
                             MPI_BYTE, recvTask, TAG_FOF_A, MPI_COMM_WORLD, &status);
-                        MPI_Sendrecv(&PartDataIn[noffset[recvTask]],
-                            nsend_local[recvTask] * sizeof(Particle), MPI_BYTE,
-                            recvTask, TAG_FOF_B,
-                            &PartDataGet[nbuffer[recvTask]],
-                            mpi_nsend[ThisTask+recvTask * NProcs] * sizeof(Particle),
-                            MPI_BYTE, recvTask, TAG_FOF_B, MPI_COMM_WORLD, &status);
                     }
                 }
             }
@@ -1401,7 +2275,7 @@ void MPIGetNNExportNum(const Int_t nbodies, Particle *Part, Double_t *rdist){
         for (j=0;j<NProcs;j++) {
             if (j!=ThisTask) {
                 //determine if search region is not outside of this processors domain
-                if(MPIInDomain(xsearch,mpi_domain[j].bnd))
+                if(MPIInDomain(xsearch,j))
                 {
                     nexport++;
                     nsend_local[j]++;
@@ -1412,10 +2286,10 @@ void MPIGetNNExportNum(const Int_t nbodies, Particle *Part, Double_t *rdist){
     }
 #endif
     }
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    MPIExchangeCounts(nsend_local);
     NImport=0;
-    for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)NImport+=mpi_nrecv[j];
     NExport=nexport;
 }
 
@@ -1464,10 +2338,10 @@ void MPIGetNNExportNumUsingMesh(Options &opt, const Int_t nbodies, Particle *Par
     }
 #endif
     }
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    MPIExchangeCounts(nsend_local);
     NImport=0;
-    for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)NImport+=mpi_nrecv[j];
     NExport=nexport;
 }
 #endif
@@ -1475,16 +2349,19 @@ void MPIGetNNExportNumUsingMesh(Options &opt, const Int_t nbodies, Particle *Par
 /*! like \ref MPIBuildParticleExportList but each particle has a different distance stored in rdist used to find nearest neighbours
 */
 void MPIBuildParticleNNExportList(const Int_t nbodies, Particle *Part, Double_t *rdist){
-    Int_t i, j,nthreads,nexport=0,nimport=0;
-    Int_t nsend_local[NProcs],noffset[NProcs],nbuffer[NProcs];
+    mpi_pending_exchange pending;
+    MPIStartParticleNNExport(nbodies, Part, rdist, pending);
+    MPIFinishExchange(pending);
+}
+
+/*! Nonblocking part of \ref MPIBuildParticleNNExportList, which determines the particles whose search region overlaps other domains,
+    exchanges the counts and posts the sends and receives of the NNDataIn data, completed by \ref MPIFinishExchange.
+*/
+void MPIStartParticleNNExport(const Int_t nbodies, Particle *Part, Double_t *rdist, mpi_pending_exchange &pending){
+    Int_t i, j,nexport=0;
+    Int_t nsend_local[NProcs];
     Double_t xsearch[3][2];
-    MPI_Status status;
-    int indomain;
-    int sendTask,recvTask;
-    int maxchunksize=2147483648/NProcs/sizeof(nndata_in);
-    int nsend,nrecv,nsendchunks,nrecvchunks,numsendrecv;
-    int sendoffset,recvoffset;
-    int cursendchunksize,currecvchunksize;
+    double time1;
 
     ///\todo would like to add openmp to this code. In particular, loop over nbodies but issue is nexport.
     ///This would either require making a FoFDataIn[nthreads][NExport] structure so that each omp thread
@@ -1502,7 +2379,7 @@ void MPIBuildParticleNNExportList(const Int_t nbodies, Particle *Part, Double_t
         for (j=0;j<NProcs;j++) {
             if (j!=ThisTask) {
                 //determine if search region is not outside of this processors domain
-                if(MPIInDomain(xsearch,mpi_domain[j].bnd))
+                if(MPIInDomain(xsearch,j))
                 {
                     //NNDataIn[nexport].Index=i;
                     NNDataIn[nexport].ToTask=j;
@@ -1525,60 +2402,11 @@ void MPIBuildParticleNNExportList(const Int_t nbodies, Particle *Part, Double_t
     //sort the export data such that all particles to be passed to thread j are together in ascending thread number
     if (nexport>0) qsort(NNDataIn, nexport, sizeof(struct nndata_in), nn_export_cmp);
 
-    //then store the offset in the export particle data for the jth Task in order to send data.
-    for(j = 1, noffset[0] = 0; j < NProcs; j++) noffset[j]=noffset[j-1] + nsend_local[j-1];
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-    //now send the data.
-    ///\todo In determination of particle export, eventually need to place a check for the communication buffer so that if exported number
-    ///is larger than the size of the buffer, iterate over the number exported
-    //if either sending or receiving then run this process
-    for (j=0;j<NProcs;j++)nimport+=mpi_nsend[ThisTask+j*NProcs];
-    if (nexport>0||nimport>0) {
-    for(j=0;j<NProcs;j++)//for(j=1;j<NProcs;j++)
-    {
-        if (j!=ThisTask)
-        {
-            sendTask = ThisTask;
-            recvTask = j;//ThisTask^j;
-            nbuffer[recvTask]=0;
-            for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nsend[ThisTask+k*NProcs];//offset on local receiving buffer
-            if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
-            {
-                //send info in loops to minimize memory footprint
-                cursendchunksize=currecvchunksize=maxchunksize;
-                nsendchunks=ceil(mpi_nsend[recvTask+ThisTask*NProcs]/(Double_t)maxchunksize);
-                nrecvchunks=ceil(mpi_nsend[ThisTask+recvTask*NProcs]/(Double_t)maxchunksize);
-                if (cursendchunksize>mpi_nsend[recvTask+ThisTask*NProcs]) {
-                    nsendchunks=1;
-                    cursendchunksize=mpi_nsend[recvTask+ThisTask*NProcs];
-                }
-                if (currecvchunksize>mpi_nsend[ThisTask+recvTask*NProcs]) {
-                    nrecvchunks=1;
-                    currecvchunksize=mpi_nsend[ThisTask+recvTask*NProcs];
-                }
-                numsendrecv=max(nsendchunks,nrecvchunks);
-                sendoffset=recvoffset=0;
-                for (auto ichunk=0;ichunk<numsendrecv;ichunk++)
-                {
-                    //blocking point-to-point send and receive. Here must determine the appropriate offset point in the local export buffer
-                    //for sending data and also the local appropriate offset in the local the receive buffer for information sent from the local receiving buffer
-                    MPI_Sendrecv(&NNDataIn[noffset[recvTask]+sendoffset],
-                        cursendchunksize * sizeof(struct nndata_in), MPI_BYTE,
-                        recvTask, TAG_NN_A+ichunk,
-                        &NNDataGet[nbuffer[recvTask]+recvoffset],
-                        currecvchunksize * sizeof(struct nndata_in),
-                        MPI_BYTE, recvTask, TAG_NN_A+ichunk, MPI_COMM_WORLD, &status);
-                    sendoffset+=cursendchunksize;
-                    recvoffset+=currecvchunksize;
-                    if (cursendchunksize>mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset)cursendchunksize=mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset;
-                    if (currecvchunksize>mpi_nsend[ThisTask+recvTask * NProcs]-sendoffset)currecvchunksize=mpi_nsend[ThisTask+recvTask * NProcs]-recvoffset;
-                }
-            }
-        }
-    }
-    }
-    MPI_Barrier(MPI_COMM_WORLD);
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    time1=MyGetTime();
+    MPIExchangeCounts(nsend_local);
+    MPIAddBlockingCommTime(pending, MyGetTime()-time1);
+    MPIStartExchangeBlocks(NNDataIn, mpi_nsend, NNDataGet, mpi_nrecv, TAG_NN_A, pending);
 }
 /*! like \ref MPIBuildParticleExportList but each particle has a different distance stored in rdist used to find nearest neighbours
 */
@@ -1642,13 +2470,13 @@ void MPIBuildParticleNNExportListUsingMesh(Options &opt, const Int_t nbodies, Pa
 
     //then store the offset in the export particle data for the jth Task in order to send data.
     for(j = 1, noffset[0] = 0; j < NProcs; j++) noffset[j]=noffset[j-1] + nsend_local[j-1];
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    MPIExchangeCounts(nsend_local);
     //now send the data.
     ///\todo In determination of particle export, eventually need to place a check for the communication buffer so that if exported number
     ///is larger than the size of the buffer, iterate over the number exported
     //if either sending or receiving then run this process
-    for (j=0;j<NProcs;j++)nimport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)nimport+=mpi_nrecv[j];
     if (nexport>0||nimport>0) {
     for(j=0;j<NProcs;j++)//for(j=1;j<NProcs;j++)
     {
@@ -1657,8 +2485,8 @@ void MPIBuildParticleNNExportListUsingMesh(Options &opt, const Int_t nbodies, Pa
             sendTask = ThisTask;
             recvTask = j;//ThisTask^j;
             nbuffer[recvTask]=0;
-            for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nsend[ThisTask+k*NProcs];//offset on local receiving buffer
-            if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
+            for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nrecv[k];//offset on local receiving buffer
+            if(mpi_nsend[recvTask] > 0 || mpi_nrecv[recvTask] > 0)
             {
                 //blocking point-to-point send and receive. Here must determine the appropriate offset point in the local export buffer
                 //for sending data and also the local appropriate offset in the local the receive buffer for information sent from the local receiving buffer
@@ -1666,7 +2494,7 @@ void MPIBuildParticleNNExportListUsingMesh(Options &opt, const Int_t nbodies, Pa
                     nsend_local[recvTask] * sizeof(struct nndata_in), MPI_BYTE,
                     recvTask, TAG_NN_A,
                     &NNDataGet[nbuffer[recvTask]],
-                    mpi_nsend[ThisTask+recvTask * NProcs] * sizeof(struct nndata_in),
+                    mpi_nrecv[recvTask] * sizeof(struct nndata_in),
                     MPI_BYTE, recvTask, TAG_NN_A, MPI_COMM_WORLD, &status);
             }
         }
@@ -1682,7 +2510,7 @@ void MPIBuildParticleNNExportListUsingMesh(Options &opt, const Int_t nbodies, Pa
 void MPIGetNNImportNum(const Int_t nbodies, KDTree *tree, Particle *Part){
     Int_t i, j,nthreads,nexport=0,ncount;
     Int_t nsend_local[NProcs],noffset[NProcs],nbuffer[NProcs];
-    Int_t oldnsend[NProcs*NProcs];
+    Int_t oldnsend[NProcs],oldnrecv[NProcs];
     Double_t xsearch[3][2];
     Int_t *nn=new Int_t[nbodies];
     Double_t *nnr2=new Double_t[nbodies];
@@ -1698,7 +2526,7 @@ void MPIGetNNImportNum(const Int_t nbodies, KDTree *tree, Particle *Part){
     for(j=0;j<NProcs;j++)
     {
         nbuffer[j]=0;
-        for (int k=0;k<j;k++)nbuffer[j]+=mpi_nsend[ThisTask+k*NProcs];//offset on "receiver" end
+        for (int k=0;k<j;k++)nbuffer[j]+=mpi_nrecv[k];//offset on "receiver" end
     }
 
     for (j=0;j<NProcs;j++) nsend_local[j]=0;
@@ -1706,7 +2534,7 @@ void MPIGetNNImportNum(const Int_t nbodies, KDTree *tree, Particle *Part){
         for (i=0;i<nbodies;i++) nn[i]=-1;
         if (j!=ThisTask) {
             //search local list and tag all local particles that need to be exported back (or imported) to the exported particles thread
-            for (i=nbuffer[j];i<nbuffer[j]+mpi_nsend[ThisTask+j*NProcs];i++) {
+            for (i=nbuffer[j];i<nbuffer[j]+mpi_nrecv[j];i++) {
                 tree->SearchBallPos(NNDataGet[i].Pos, NNDataGet[i].R2, j, nn, nnr2);
             }
             for (i=0;i<nbodies;i++) {
@@ -1720,40 +2548,38 @@ void MPIGetNNImportNum(const Int_t nbodies, KDTree *tree, Particle *Part){
         }
     }
     //must store old mpi nsend for accessing NNDataGet properly.
-    for (j=0;j<NProcs;j++) for (int k=0;k<NProcs;k++) oldnsend[k+j*NProcs]=mpi_nsend[k+j*NProcs];
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    for (j=0;j<NProcs;j++) {oldnsend[j]=mpi_nsend[j];oldnrecv[j]=mpi_nrecv[j];}
+    MPIExchangeCounts(nsend_local);
     NImport=0;
-    for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)NImport+=mpi_nrecv[j];
     NExport=nexport;
-    for (j=0;j<NProcs;j++) for (int k=0;k<NProcs;k++) mpi_nsend[k+j*NProcs]=oldnsend[k+j*NProcs];
+    for (j=0;j<NProcs;j++) {mpi_nsend[j]=oldnsend[j];mpi_nrecv[j]=oldnrecv[j];}
 }
 
 /*! Mirror to \ref MPIBuildParticleNNExportList, use exported particles, run ball search to find all local particles that need to be
     imported back to exported particle's thread so that a proper NN search can be made.
 */
 Int_t MPIBuildParticleNNImportList(const Int_t nbodies, KDTree *tree, Particle *Part, int iallflag){
-    Int_t i, j,nthreads,nexport=0,ncount;
-    Int_t nsend_local[NProcs],noffset[NProcs],nbuffer[NProcs];
-    Double_t xsearch[3][2];
+    mpi_pending_exchange pending;
+    vector<partnndata_in> exportbuf, importbuf;
+    Int_t ncount=MPIStartParticleNNImport(nbodies, tree, Part, iallflag, exportbuf, importbuf, pending);
+    MPIFinishParticleNNImport(importbuf, pending);
+    return ncount;
+}
+
+/*! Nonblocking part of \ref MPIBuildParticleNNImportList, which searches the local particles with the imported NNDataGet and posts
+    the sends and receives of the phase-space records of the particles found. Returns the number of particles that will be received.
+*/
+Int_t MPIStartParticleNNImport(const Int_t nbodies, KDTree *tree, Particle *Part, int iallflag, vector<partnndata_in> &exportbuf, vector<partnndata_in> &importbuf, mpi_pending_exchange &pending){
+    Int_t i, j,ncount;
+    Int_t nsend_local[NProcs],nbuffer[NProcs];
     Int_t *nn=new Int_t[nbodies];
     Double_t *nnr2=new Double_t[nbodies];
-    nthreads=1;
-    int sendTask,recvTask;
-    int maxchunksize=2147483648/NProcs/sizeof(Particle);
-    int nsend,nrecv,nsendchunks,nrecvchunks,numsendrecv;
-    int sendoffset,recvoffset;
-    int cursendchunksize,currecvchunksize;
-    MPI_Status status;
-#ifdef USEOPENMP
-#pragma omp parallel
-    {
-            if (omp_get_thread_num()==0) nthreads=omp_get_num_threads();
-    }
-#endif
+    double time1;
     for(j=0;j<NProcs;j++)
     {
         nbuffer[j]=0;
-        for (int k=0;k<j;k++)nbuffer[j]+=mpi_nsend[ThisTask+k*NProcs];//offset on "receiver" end
+        for (int k=0;k<j;k++)nbuffer[j]+=mpi_nrecv[k];//offset on "receiver" end
     }
 
     for (j=0;j<NProcs;j++) nsend_local[j]=0;
@@ -1770,7 +2596,7 @@ private(i)
 #endif
         if (j!=ThisTask) {
             //search local list and tag all local particles that need to be exported back (or imported) to the exported particles thread
-            for (i=nbuffer[j];i<nbuffer[j]+mpi_nsend[ThisTask+j*NProcs];i++) {
+            for (i=nbuffer[j];i<nbuffer[j]+mpi_nrecv[j];i++) {
                 tree->SearchBallPos(NNDataGet[i].Pos, NNDataGet[i].R2, j, nn, nnr2);
             }
             //if not spliting search so that only calculated velocity density function based on dark matter particles
@@ -1779,11 +2605,8 @@ private(i)
             if (iallflag) {
             for (i=0;i<nbodies;i++) {
                 if (nn[i]!=-1) {
-                    for (int k=0;k<3;k++) {
-                        PartDataIn[nexport].SetPosition(k,Part[i].GetPosition(k));
-                        PartDataIn[nexport].SetVelocity(k,Part[i].GetVelocity(k));
-                    }
-                    nexport++;
+                    exportbuf.emplace_back();
+                    exportbuf.back().Set(Part[i]);
                     nsend_local[j]++;
                 }
             }
@@ -1797,72 +2620,34 @@ private(i)
                 if (nn[i]!=-1 && Part[i].GetType()==DARKTYPE)
 #endif
                 {
-                    for (int k=0;k<3;k++) {
-                        PartDataIn[nexport].SetPosition(k,Part[i].GetPosition(k));
-                        PartDataIn[nexport].SetVelocity(k,Part[i].GetVelocity(k));
-                    }
-                    nexport++;
+                    exportbuf.emplace_back();
+                    exportbuf.back().Set(Part[i]);
                     nsend_local[j]++;
                 }
             }
             }
         }
     }
-    //sort the export data such that all particles to be passed to thread j are together in ascending thread number
-    //qsort(NNDataReturn, nexport, sizeof(struct nndata_in), nn_export_cmp);
-
-    //then store the offset in the export particle data for the jth Task in order to send data.
-    for(j = 1, noffset[0] = 0; j < NProcs; j++) noffset[j]=noffset[j-1] + nsend_local[j-1];
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-    //now send the data.
-    for(j=0;j<NProcs;j++)
-    {
-        if (j!=ThisTask)
-        {
-            sendTask = ThisTask;
-            recvTask = j;
-            nbuffer[recvTask]=0;
-            for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nsend[ThisTask+k*NProcs];//offset on local receiving buffer
-
-            if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
-            {
-                //send info in loops to minimize memory footprint
-                cursendchunksize=currecvchunksize=maxchunksize;
-                nsendchunks=ceil(mpi_nsend[recvTask+ThisTask*NProcs]/(Double_t)maxchunksize);
-                nrecvchunks=ceil(mpi_nsend[ThisTask+recvTask*NProcs]/(Double_t)maxchunksize);
-                if (cursendchunksize>mpi_nsend[recvTask+ThisTask*NProcs]) {
-                    nsendchunks=1;
-                    cursendchunksize=mpi_nsend[recvTask+ThisTask*NProcs];
-                }
-                if (currecvchunksize>mpi_nsend[ThisTask+recvTask*NProcs]) {
-                    nrecvchunks=1;
-                    currecvchunksize=mpi_nsend[ThisTask+recvTask*NProcs];
-                }
-                numsendrecv=max(nsendchunks,nrecvchunks);
-                sendoffset=recvoffset=0;
-                for (auto ichunk=0;ichunk<numsendrecv;ichunk++)
-                {
-                    //blocking point-to-point send and receive. Here must determine the appropriate offset point in the local export buffer
-                    //for sending data and also the local appropriate offset in the local the receive buffer for information sent from the local receiving buffer
-                    MPI_Sendrecv(&PartDataIn[noffset[recvTask]+sendoffset],
-                        cursendchunksize * sizeof(Particle), MPI_BYTE,
-                        recvTask, TAG_NN_B+ichunk,
-                        &PartDataGet[nbuffer[recvTask]+recvoffset],
-                        currecvchunksize * sizeof(Particle),
-                        MPI_BYTE, recvTask, TAG_NN_B+ichunk, MPI_COMM_WORLD, &status);
-                    sendoffset+=cursendchunksize;
-                    recvoffset+=currecvchunksize;
-                    if (cursendchunksize>mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset)cursendchunksize=mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset;
-                    if (currecvchunksize>mpi_nsend[ThisTask+recvTask * NProcs]-sendoffset)currecvchunksize=mpi_nsend[ThisTask+recvTask * NProcs]-recvoffset;
-                }
-            }
-        }
-    }
-    ncount=0;for (int k=0;k<NProcs;k++)ncount+=mpi_nsend[ThisTask+k*NProcs];
+    delete[] nn;
+    delete[] nnr2;
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    time1=MyGetTime();
+    MPIExchangeCounts(nsend_local);
+    MPIAddBlockingCommTime(pending, MyGetTime()-time1);
+    ncount=0;
+    for (j=0;j<NProcs;j++) ncount+=mpi_nrecv[j];
+    importbuf.resize(ncount);
+    MPIStartExchangeBlocks(exportbuf.data(), mpi_nsend, importbuf.data(), mpi_nrecv, TAG_NN_B, pending, MPIRecordType(exportbuf.data()));
     return ncount;
 }
 
+///complete the exchange started by \ref MPIStartParticleNNImport and unpack the records into PartDataGet
+void MPIFinishParticleNNImport(vector<partnndata_in> &importbuf, mpi_pending_exchange &pending){
+    MPIFinishExchange(pending);
+    Int_t nimport=importbuf.size();
+    for (Int_t i=0;i<nimport;i++) PartDataGet[i]=importbuf[i].GetParticle();
+}
+
 /*! similar \ref MPIGetExportNum but number based on halo properties to see if any
 */
 vector<bool> MPIGetHaloSearchExportNum(const Int_t ngroup, PropData *&pdata, vector<Double_t> &rdist)
@@ -1889,7 +2674,7 @@ vector<bool> MPIGetHaloSearchExportNum(const Int_t ngroup, PropData *&pdata, vec
         for (j=0;j<NProcs;j++) {
             if (j!=ThisTask) {
                 //determine if search region is not outside of this processors domain
-                if(MPIInDomain(xsearch,mpi_domain[j].bnd))
+                if(MPIInDomain(xsearch,j))
                 {
                     nexport++;
                     nsend_local[j]++;
@@ -1898,10 +2683,10 @@ vector<bool> MPIGetHaloSearchExportNum(const Int_t ngroup, PropData *&pdata, vec
             }
         }
     }
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    MPIExchangeCounts(nsend_local);
     NImport=0;
-    for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)NImport+=mpi_nrecv[j];
     NExport=nexport;
     return halooverlap;
 }
@@ -1934,7 +2719,7 @@ void MPIBuildHaloSearchExportList(const Int_t ngroup, PropData *&pdata, vector<D
         for (j=0;j<NProcs;j++) {
             if (j!=ThisTask) {
                 //determine if search region is not outside of this processors domain
-                if(MPIInDomain(xsearch,mpi_domain[j].bnd))
+                if(MPIInDomain(xsearch,j))
                 {
                     //NNDataIn[nexport].Index=i;
                     NNDataIn[nexport].ToTask=j;
@@ -1955,11 +2740,11 @@ void MPIBuildHaloSearchExportList(const Int_t ngroup, PropData *&pdata, vector<D
 
     //then store the offset in the export data for the jth Task in order to send data.
     for(j = 1, noffset[0] = 0; j < NProcs; j++) noffset[j]=noffset[j-1] + nsend_local[j-1];
-    //and then gather the number of items to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    MPIExchangeCounts(nsend_local);
     //now send the data.
 
-    for (j=0;j<NProcs;j++)nimport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)nimport+=mpi_nrecv[j];
     //if task neither sends or receives, do nothing
     if (nexport==0&&nimport==0) return;
     for(j=0;j<NProcs;j++)
@@ -1969,20 +2754,20 @@ void MPIBuildHaloSearchExportList(const Int_t ngroup, PropData *&pdata, vector<D
             sendTask = ThisTask;
             recvTask = j;
             nbuffer[recvTask]=0;
-            for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nsend[ThisTask+k*NProcs];//offset on local receiving buffer
-            if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
+            for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nrecv[k];//offset on local receiving buffer
+            if(mpi_nsend[recvTask] > 0 || mpi_nrecv[recvTask] > 0)
             {
                 //send info in loops to minimize memory footprint
                 cursendchunksize=currecvchunksize=maxchunksize;
-                nsendchunks=ceil(mpi_nsend[recvTask+ThisTask*NProcs]/(Double_t)maxchunksize);
-                nrecvchunks=ceil(mpi_nsend[ThisTask+recvTask*NProcs]/(Double_t)maxchunksize);
-                if (cursendchunksize>mpi_nsend[recvTask+ThisTask*NProcs]) {
+                nsendchunks=ceil(mpi_nsend[recvTask]/(Double_t)maxchunksize);
+                nrecvchunks=ceil(mpi_nrecv[recvTask]/(Double_t)maxchunksize);
+                if (cursendchunksize>mpi_nsend[recvTask]) {
                     nsendchunks=1;
-                    cursendchunksize=mpi_nsend[recvTask+ThisTask*NProcs];
+                    cursendchunksize=mpi_nsend[recvTask];
                 }
-                if (currecvchunksize>mpi_nsend[ThisTask+recvTask*NProcs]) {
+                if (currecvchunksize>mpi_nrecv[recvTask]) {
                     nrecvchunks=1;
-                    currecvchunksize=mpi_nsend[ThisTask+recvTask*NProcs];
+                    currecvchunksize=mpi_nrecv[recvTask];
                 }
                 numsendrecv=max(nsendchunks,nrecvchunks);
                 sendoffset=recvoffset=0;
@@ -1998,165 +2783,125 @@ void MPIBuildHaloSearchExportList(const Int_t ngroup, PropData *&pdata, vector<D
                         MPI_BYTE, recvTask, TAG_NN_A+ichunk, MPI_COMM_WORLD, &status);
                     sendoffset+=cursendchunksize;
                     recvoffset+=currecvchunksize;
-                    if (cursendchunksize>mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset)cursendchunksize=mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset;
-                    if (currecvchunksize>mpi_nsend[ThisTask+recvTask * NProcs]-sendoffset)currecvchunksize=mpi_nsend[ThisTask+recvTask * NProcs]-recvoffset;
+                    if (cursendchunksize>mpi_nsend[recvTask]-sendoffset)cursendchunksize=mpi_nsend[recvTask]-sendoffset;
+                    if (currecvchunksize>mpi_nrecv[recvTask]-sendoffset)currecvchunksize=mpi_nrecv[recvTask]-recvoffset;
                 }
             }
         }
     }
 }
 
-/*! Mirror to \ref MPIGetHaloSearchExportNum, use exported positions, run ball search to find number of all local particles that need to be
-    imported back to exported positions's thread so that a proper search can be made.
+/*! Mirror to \ref MPIBuildHaloSearchExportList, use exported halo positions, run ball search to find all local particles that need to be
+    imported back to the exporting thread so that a proper search can be made, and store them in PartDataGet, which is allocated here.
+    The number of particles returned to each task is only known once its searches are done, so it is exchanged along with the particles.
+    When compiled with MPITHREADMULTIPLE, each openmp thread searches the positions sent by a task and posts its own sends to it as soon
+    as they are done, while the threads that have no searches left receive the particles sent back by other tasks.
 */
-void MPIGetHaloSearchImportNum(const Int_t nbodies, KDTree *tree, Particle *Part)
-{
-    Int_t i, j,nthreads,nexport=0,ncount;
-    Int_t nsend_local[NProcs],noffset[NProcs],nbuffer[NProcs];
-    Int_t oldnsend[NProcs*NProcs];
-    Double_t xsearch[3][2];
-    Int_t *nn=new Int_t[nbodies];
-    Double_t *nnr2=new Double_t[nbodies];
-    nthreads=1;
-    Int_t sendTask,recvTask;
-    MPI_Status status;
-#ifdef USEOPENMP
-#pragma omp parallel
-    {
-            if (omp_get_thread_num()==0) nthreads=omp_get_num_threads();
-    }
-#endif
+Int_t MPIBuildHaloSearchImportList(const Int_t nbodies, KDTree *tree, Particle *Part){
+    Int_t i, j, ncount;
+    Int_t nbuffer[NProcs];
     for(j=0;j<NProcs;j++)
     {
         nbuffer[j]=0;
-        for (int k=0;k<j;k++)nbuffer[j]+=mpi_nsend[ThisTask+k*NProcs];//offset on "receiver" end
+        for (int k=0;k<j;k++)nbuffer[j]+=mpi_nrecv[k];//offset on "receiver" end
     }
-    for (j=0;j<NProcs;j++) nsend_local[j]=0;
+#if defined(USEOPENMP) && defined(MPITHREADMULTIPLE)
+    //particles go back to the tasks that sent halo positions to this one and come from the tasks this one sent positions to
+    vector<int> sendtasks, recvtasks;
     for (j=0;j<NProcs;j++) {
-        for (i=0;i<nbodies;i++) nn[i]=-1;
         if (j==ThisTask) continue;
-        if (mpi_nsend[ThisTask+j*NProcs]==0) continue;
-            //search local list and tag all local particles that need to be exported back (or imported) to the exported particles thread
-            for (i=nbuffer[j];i<nbuffer[j]+mpi_nsend[ThisTask+j*NProcs];i++) {
-                tree->SearchBallPos(NNDataGet[i].Pos, NNDataGet[i].R2, j, nn, nnr2);
-            }
-            for (i=0;i<nbodies;i++) {
-                if (nn[i]!=-1) {
-                    nexport++;
-                    nsend_local[j]++;
-                }
-            }
-        
+        if (mpi_nrecv[j]>0) sendtasks.push_back(j);
+        if (mpi_nsend[j]>0) recvtasks.push_back(j);
     }
-    //must store old mpi nsend for accessing NNDataGet properly.
-    for (j=0;j<NProcs;j++) for (int k=0;k<NProcs;k++) oldnsend[k+j*NProcs]=mpi_nsend[k+j*NProcs];
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-    NImport=0;
-    for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
-    NExport=nexport;
-    for (j=0;j<NProcs;j++) for (int k=0;k<NProcs;k++) mpi_nsend[k+j*NProcs]=oldnsend[k+j*NProcs];
-}
-/*! Mirror to \ref MPIBuildHaloSearchExportList, use exported particles, run ball search to find all local particles that need to be
-    imported back to exported particle's thread so that a proper NN search can be made.
-*/
-Int_t MPIBuildHaloSearchImportList(const Int_t nbodies, KDTree *tree, Particle *Part){
-    Int_t i, j,nthreads,nexport=0,ncount;
-    Int_t nsend_local[NProcs],noffset[NProcs],nbuffer[NProcs];
-    Double_t xsearch[3][2];
+    int nsendtasks=sendtasks.size(), nrecvtasks=recvtasks.size();
+    vector<vector<partsodata_in>> exportbuf(NProcs), importbuf(NProcs);
+    vector<Int_t> nexport(NProcs,0), nimport(NProcs,0);
+    vector<MPI_Request> countrqst(NProcs,MPI_REQUEST_NULL);
+    vector<mpi_pending_exchange> sendpending(NProcs), recvpending(NProcs);
+    //the record type is built on first use, so do so before threads use it
+    MPI_Datatype datatype=MPIRecordType((partsodata_in*)NULL);
+#pragma omp parallel default(shared) private(i,j)
+{
     Int_t *nn=new Int_t[nbodies];
     Double_t *nnr2=new Double_t[nbodies];
-    nthreads=1;
-    int sendTask,recvTask;
-    int maxchunksize=2147483648/NProcs/sizeof(Particle);
-    int nsend,nrecv,nsendchunks,nrecvchunks,numsendrecv;
-    int sendoffset,recvoffset;
-    int cursendchunksize,currecvchunksize;
-    MPI_Status status;
-#ifdef USEOPENMP
-#pragma omp parallel
-    {
-            if (omp_get_thread_num()==0) nthreads=omp_get_num_threads();
+    vector<Int_t> nsend_task(NProcs,0), nrecv_task(NProcs,0);
+    #pragma omp for schedule(dynamic) nowait
+    for (int itask=0;itask<nsendtasks;itask++) {
+        j=sendtasks[itask];
+        for (i=0;i<nbodies;i++) nn[i]=-1;
+        for (i=nbuffer[j];i<nbuffer[j]+mpi_nrecv[j];i++) tree->SearchBallPos(NNDataGet[i].Pos, NNDataGet[i].R2, j, nn, nnr2);
+        for (i=0;i<nbodies;i++) {
+            if (nn[i]!=-1) {
+                exportbuf[j].emplace_back();
+                exportbuf[j].back().Set(Part[i]);
+            }
+        }
+        nexport[j]=exportbuf[j].size();
+        MPI_Isend(&nexport[j], 1, MPI_Int_t, j, TAG_NN_B, MPI_COMM_WORLD, &countrqst[j]);
+        nsend_task[j]=nexport[j];
+        MPIStartExchangeBlocks(exportbuf[j].data(), nsend_task.data(), (partsodata_in*)NULL, nrecv_task.data(), TAG_NN_B, sendpending[j], datatype);
+        nsend_task[j]=0;
     }
-#endif
-    for(j=0;j<NProcs;j++)
-    {
-        nbuffer[j]=0;
-        for (int k=0;k<j;k++)nbuffer[j]+=mpi_nsend[ThisTask+k*NProcs];//offset on "receiver" end
+    //blocks till the particles of one task arrive, but sends are posted by threads that still have searches to do
+    #pragma omp for schedule(dynamic) nowait
+    for (int itask=0;itask<nrecvtasks;itask++) {
+        j=recvtasks[itask];
+        MPI_Recv(&nimport[j], 1, MPI_Int_t, j, TAG_NN_B, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        importbuf[j].resize(nimport[j]);
+        nrecv_task[j]=nimport[j];
+        MPIStartExchangeBlocks((partsodata_in*)NULL, nsend_task.data(), importbuf[j].data(), nrecv_task.data(), TAG_NN_B, recvpending[j], datatype);
+        MPIFinishExchange(recvpending[j]);
+        nrecv_task[j]=0;
     }
-
+    delete[] nn;
+    delete[] nnr2;
+}
+    for (auto &task:sendtasks) {
+        MPI_Wait(&countrqst[task], MPI_STATUS_IGNORE);
+        MPIFinishExchange(sendpending[task]);
+    }
+    NExport=NImport=0;
+    for (j=0;j<NProcs;j++) {NExport+=nexport[j];NImport+=nimport[j];}
+    PartDataGet = new Particle[NImport+1];
+    ncount=0;
+    for (j=0;j<NProcs;j++) for (auto &p:importbuf[j]) PartDataGet[ncount++]=p.GetParticle();
+#else
+    Int_t nsend_local[NProcs],nrecv_local[NProcs];
+    Int_t *nn=new Int_t[nbodies];
+    Double_t *nnr2=new Double_t[nbodies];
+    vector<partsodata_in> exportbuf, importbuf;
     for (j=0;j<NProcs;j++) nsend_local[j]=0;
     for (j=0;j<NProcs;j++) {
             for (i=0;i<nbodies;i++) nn[i]=-1;
         if (j==ThisTask) continue;
-        if (mpi_nsend[ThisTask+j*NProcs]==0) continue;
+        if (mpi_nrecv[j]==0) continue;
             //search local list and tag all local particles that need to be exported back (or imported) to the exported particles thread
-            for (i=nbuffer[j];i<nbuffer[j]+mpi_nsend[ThisTask+j*NProcs];i++) {
+            for (i=nbuffer[j];i<nbuffer[j]+mpi_nrecv[j];i++) {
                 tree->SearchBallPos(NNDataGet[i].Pos, NNDataGet[i].R2, j, nn, nnr2);
             }
             for (i=0;i<nbodies;i++) {
                 if (nn[i]!=-1) {
-                    for (int k=0;k<3;k++) {
-                        PartDataIn[nexport].SetPosition(k,Part[i].GetPosition(k));
-                        PartDataIn[nexport].SetVelocity(k,Part[i].GetVelocity(k));
-                    }
-                    nexport++;
+                    exportbuf.emplace_back();
+                    exportbuf.back().Set(Part[i]);
                     nsend_local[j]++;
                 }
             }
     }
-    //sort the export data such that all particles to be passed to thread j are together in ascending thread number
-    //qsort(NNDataReturn, nexport, sizeof(struct nndata_in), nn_export_cmp);
-
-    //then store the offset in the export particle data for the jth Task in order to send data.
-    for(j = 1, noffset[0] = 0; j < NProcs; j++) noffset[j]=noffset[j-1] + nsend_local[j-1];
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-    //now send the data.
-    for(j=0;j<NProcs;j++)
-    {
-        if (j!=ThisTask)
-        {
-            sendTask = ThisTask;
-            recvTask = j;
-            nbuffer[recvTask]=0;
-            for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nsend[ThisTask+k*NProcs];//offset on local receiving buffer
-
-            if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
-            {
-                //send info in loops to minimize memory footprint
-                cursendchunksize=currecvchunksize=maxchunksize;
-                nsendchunks=ceil(mpi_nsend[recvTask+ThisTask*NProcs]/(Double_t)maxchunksize);
-                nrecvchunks=ceil(mpi_nsend[ThisTask+recvTask*NProcs]/(Double_t)maxchunksize);
-                if (cursendchunksize>mpi_nsend[recvTask+ThisTask*NProcs]) {
-                    nsendchunks=1;
-                    cursendchunksize=mpi_nsend[recvTask+ThisTask*NProcs];
-                }
-                if (currecvchunksize>mpi_nsend[ThisTask+recvTask*NProcs]) {
-                    nrecvchunks=1;
-                    currecvchunksize=mpi_nsend[ThisTask+recvTask*NProcs];
-                }
-                numsendrecv=max(nsendchunks,nrecvchunks);
-                sendoffset=recvoffset=0;
-                for (auto ichunk=0;ichunk<numsendrecv;ichunk++)
-                {
-                    //blocking point-to-point send and receive. Here must determine the appropriate offset point in the local export buffer
-                    //for sending data and also the local appropriate offset in the local the receive buffer for information sent from the local receiving buffer
-                    MPI_Sendrecv(&PartDataIn[noffset[recvTask]+sendoffset],
-                        cursendchunksize * sizeof(Particle), MPI_BYTE,
-                        recvTask, TAG_NN_B+ichunk,
-                        &PartDataGet[nbuffer[recvTask]+recvoffset],
-                        currecvchunksize * sizeof(Particle),
-                        MPI_BYTE, recvTask, TAG_NN_B+ichunk, MPI_COMM_WORLD, &status);
-                    sendoffset+=cursendchunksize;
-                    recvoffset+=currecvchunksize;
-                    if (cursendchunksize>mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset)cursendchunksize=mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset;
-                    if (currecvchunksize>mpi_nsend[ThisTask+recvTask * NProcs]-sendoffset)currecvchunksize=mpi_nsend[ThisTask+recvTask * NProcs]-recvoffset;
-                }
-            }
-        }
-    }
-    ncount=0;for (int k=0;k<NProcs;k++)ncount+=mpi_nsend[ThisTask+k*NProcs];
-    return ncount;
+    delete[] nn;
+    delete[] nnr2;
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    MPIExchangeCounts(nsend_local);
+    ncount=0;
+    for (j=0;j<NProcs;j++) {nrecv_local[j]=mpi_nrecv[j];ncount+=nrecv_local[j];}
+    NExport=exportbuf.size();
+    NImport=ncount;
+    //now send the position, mass and id records needed for spherical overdensity calculations and unpack them into the imported particle array
+    importbuf.resize(ncount);
+    MPIExchangeBlocks(exportbuf.data(), nsend_local, importbuf.data(), nrecv_local, TAG_NN_B, MPIRecordType(exportbuf.data()));
+    PartDataGet = new Particle[ncount+1];
+    for (i=0;i<ncount;i++) PartDataGet[i]=importbuf[i].GetParticle();
+#endif
+    return NImport;
 }
 
 
@@ -2185,7 +2930,7 @@ void MPIBuildParticleExportBaryonSearchList(const Int_t nbodies, Particle *Part,
         for (j=0;j<NProcs;j++) {
             if (j!=ThisTask) {
                 //determine if search region is not outside of this processors domain
-                if(MPIInDomain(xsearch,mpi_domain[j].bnd))
+                if(MPIInDomain(xsearch,j))
                 {
                     //FoFDataIn[nexport].Part=Part[i];
                     FoFDataIn[nexport].Index = i;
@@ -2202,17 +2947,16 @@ void MPIBuildParticleExportBaryonSearchList(const Int_t nbodies, Particle *Part,
     if (nexport>0) {
     //sort the export data such that all particles to be passed to thread j are together in ascending thread number
     qsort(FoFDataIn, nexport, sizeof(struct fofdata_in), fof_export_cmp);
-    for (i=0;i<nexport;i++) PartDataIn[i] = Part[FoFDataIn[i].Index];
     }
     //then store the offset in the export particle data for the jth Task in order to send data.
     for(j = 1, noffset[0] = 0; j < NProcs; j++) noffset[j]=noffset[j-1] + nsend_local[j-1];
-    //and then gather the number of particles to be sent from mpi thread m to mpi thread n in the mpi_nsend[NProcs*NProcs] array via [n+m*NProcs]
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-    NImport=0;for (j=0;j<NProcs;j++)NImport+=mpi_nsend[ThisTask+j*NProcs];
+    //and then exchange the number of particles to be sent to and received from the tasks that communicate with this one
+    MPIExchangeCounts(nsend_local);
+    NImport=0;for (j=0;j<NProcs;j++)NImport+=mpi_nrecv[j];
     //now send the data.
     ///\todo In determination of particle export for FOF routines, eventually need to place a check for the communication buffer so that if exported number
     ///is larger than the size of the buffer, iterate over the number exported
-    for (j=0;j<NProcs;j++)nimport+=mpi_nsend[ThisTask+j*NProcs];
+    for (j=0;j<NProcs;j++)nimport+=mpi_nrecv[j];
     if (nexport>0||nimport>0) {
         for(j=0;j<NProcs;j++)
         {
@@ -2221,21 +2965,21 @@ void MPIBuildParticleExportBaryonSearchList(const Int_t nbodies, Particle *Part,
                 sendTask = ThisTask;
                 recvTask = j;
                 nbuffer[recvTask]=0;
-                for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nsend[ThisTask+k*NProcs];//offset on local receiving buffer
+                for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nrecv[k];//offset on local receiving buffer
 
-                if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
+                if(mpi_nsend[recvTask] > 0 || mpi_nrecv[recvTask] > 0)
                 {
                     //send info in loops to minimize memory footprint
                     cursendchunksize=currecvchunksize=maxchunksize;
-                    nsendchunks=ceil(mpi_nsend[recvTask+ThisTask*NProcs]/(Double_t)maxchunksize);
-                    nrecvchunks=ceil(mpi_nsend[ThisTask+recvTask*NProcs]/(Double_t)maxchunksize);
-                    if (cursendchunksize>mpi_nsend[recvTask+ThisTask*NProcs]) {
+                    nsendchunks=ceil(mpi_nsend[recvTask]/(Double_t)maxchunksize);
+                    nrecvchunks=ceil(mpi_nrecv[recvTask]/(Double_t)maxchunksize);
+                    if (cursendchunksize>mpi_nsend[recvTask]) {
                         nsendchunks=1;
-                        cursendchunksize=mpi_nsend[recvTask+ThisTask*NProcs];
+                        cursendchunksize=mpi_nsend[recvTask];
                     }
-                    if (currecvchunksize>mpi_nsend[ThisTask+recvTask*NProcs]) {
+                    if (currecvchunksize>mpi_nrecv[recvTask]) {
                         nrecvchunks=1;
-                        currecvchunksize=mpi_nsend[ThisTask+recvTask*NProcs];
+                        currecvchunksize=mpi_nrecv[recvTask];
                     }
                     numsendrecv=max(nsendchunks,nrecvchunks);
                     sendoffset=recvoffset=0;
@@ -2249,21 +2993,23 @@ void MPIBuildParticleExportBaryonSearchList(const Int_t nbodies, Particle *Part,
                             &FoFDataGet[nbuffer[recvTask]+recvoffset],
                             currecvchunksize * sizeof(struct fofdata_in),
                             MPI_BYTE, recvTask, TAG_FOF_A+ichunk, MPI_COMM_WORLD, &status);
-                        MPI_Sendrecv(&PartDataIn[noffset[recvTask]+sendoffset],
-                            cursendchunksize * sizeof(Particle), MPI_BYTE,
-                            recvTask, TAG_FOF_B+ichunk,
-                            &PartDataGet[nbuffer[recvTask]+recvoffset],
-                            currecvchunksize * sizeof(Particle),
-                            MPI_BYTE, recvTask, TAG_FOF_B+ichunk, MPI_COMM_WORLD, &status);
                         sendoffset+=cursendchunksize;
                         recvoffset+=currecvchunksize;
-                        if (cursendchunksize>mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset)cursendchunksize=mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset;
-                        if (currecvchunksize>mpi_nsend[ThisTask+recvTask * NProcs]-sendoffset)currecvchunksize=mpi_nsend[ThisTask+recvTask * NProcs]-recvoffset;
+                        if (cursendchunksize>mpi_nsend[recvTask]-sendoffset)cursendchunksize=mpi_nsend[recvTask]-sendoffset;
+                        if (currecvchunksize>mpi_nrecv[recvTask]-sendoffset)currecvchunksize=mpi_nrecv[recvTask]-recvoffset;
                     }
                 }
             }
         }
     }
+    //then send the phase-space information of the exported particles and unpack it so that the imported particles can be placed in a tree.
+    //the id of an imported particle is its index in the import list so that its group information can be found in FoFDataGet
+    vector<partphasedata_in> importbuf;
+    MPIExchangeExportRecords(Part, importbuf, TAG_FOF_B);
+    for (i=0;i<nimport;i++) {
+        PartDataGet[i]=importbuf[i].GetParticle();
+        PartDataGet[i].SetID(i);
+    }
 }
 
 //@}
@@ -2277,265 +3023,303 @@ short_mpi_t* MPISetTaskID(const Int_t nbodies){
     return foftask;
 }
 
-///Offset pfof array based so that local group numbers do not overlap
-///\todo alter to that this now ranks threads so that group ids are larger if thread has more particles. This ensures that mpi threads
-///send particles to thread with the fewest particles when linking across mpi domains during a FOF search
+///Offset pfof array based so that local group numbers do not overlap. The offset is the number of particles on all previous threads,
+///found with an exclusive prefix sum so that no thread needs the particle numbers of every other thread, and uses the current number
+///of particles rather than the number at load time so that ids remain unique once particles have moved between threads
 void MPIAdjustLocalGroupIDs(const Int_t nbodies, Int_t *pfof){
-    PriorityQueue *pq=new PriorityQueue(NProcs);
-    for (int j=0;j<NProcs;j++) pq->Push(j,mpi_nlocal[j]);
-    Int_t rankorder[NProcs];
-    for (int j=0;j<NProcs;j++) {rankorder[NProcs-1-j]=pq->TopQueue();pq->Pop();}
-    Int_t offset=0;
-    for (int j=0;j<NProcs;j++){if(rankorder[j]==ThisTask) break; offset+=mpi_nlocal[rankorder[j]];}
-    //Int_t offset=nbodies*ThisTask;
+    Int_t offset=0,nlocal=nbodies;
+    MPI_Exscan(&nlocal,&offset,1,MPI_Int_t,MPI_SUM,MPI_COMM_WORLD);
+    //the result of an exclusive scan is undefined on the first task
+    if (ThisTask==0) offset=0;
+    MPI_Allreduce(&nlocal,&mpi_maxgid,1,MPI_Int_t,MPI_SUM,MPI_COMM_WORLD);
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static) if (nbodies>ompsearchnum)
+#endif
     for (Int_t i=0;i<nbodies;i++) if (pfof[i]>0) pfof[i]+=offset;
-    mpi_maxgid=0;
-    for (int j=0;j<NProcs;j++){mpi_maxgid+=mpi_nlocal[rankorder[j]];}
-    mpi_gidoffset=0;
-    for (int j=0;j<NProcs;j++){if(rankorder[j]==ThisTask) break; mpi_gidoffset+=mpi_ngroups[rankorder[j]];}
-}
-
-//My idea is this for doing the stiching. First generate export list of particle data and another seperate data structure for the FOF data
-//Next, when examining local search using export particles (since iGroup=0 is unlinked) if a export particle current iGroup is larger
-//Then adjust the local particle and all members of its group so long as its group is NOT group zero. Calculate the number of new links
-//and determine the total number of new links across all mpi threads.
-//If that number is not zero, then groups have been found that are across processor domains.
-//One has to iterate the check across the domains till no more new links have been found. That is must update the export particles Group ids
-//then begin the check anew.
-
-//Couple of key things to think about are, one I really shouldn't have to run the check again to find the particles that meet the conditions across
-//threads since that has NOT changed. must figure out a way to store relevant particles. Otherwise, continuously checking, seems a waste of cpu cycles.
-//second I must pass along head, tail, next, and length information, maybe by using a plist structure so that it is easy to alter the particles locally to new group id
-//Also must determine optimal way of setting which processor the group should end up on. Best way might be to use the length of the group locally since
-//that would minimize the broadcasts.
-
-/*! Particles that have been marked for export may have had their fof information updated so need to update this info
-*/
-void MPIUpdateExportList(const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_tree_t *&Len){
-    Int_t i, j,nthreads,nexport;
-    Int_t nsend_local[NProcs],noffset[NProcs],nbuffer[NProcs];
-    int sendTask,recvTask;
-    int maxchunksize=2147483648/NProcs/sizeof(fofdata_in);
-    int nsend,nrecv,nsendchunks,nrecvchunks,numsendrecv;
-    int sendoffset,recvoffset;
-    int cursendchunksize,currecvchunksize;
-    MPI_Status status;
+    mpi_gidoffset=mpi_ngroupoffset;
+}
 
-    nexport=0;
-    for (j=0;j<NProcs;j++) {nexport+=mpi_nsend[j+ThisTask*NProcs];nsend_local[j]=mpi_nsend[j+ThisTask*NProcs];}
-    for(j = 1, noffset[0] = 0; j < NProcs; j++) noffset[j]=noffset[j-1] + nsend_local[j-1];
-    for (i=0;i<nexport;i++) {
-        FoFDataIn[i].iGroup = pfof[Part[FoFDataIn[i].Index].GetID()];
-        FoFDataIn[i].iGroupTask=mpi_foftask[Part[FoFDataIn[i].Index].GetID()];
-        FoFDataIn[i].iLen=Len[FoFDataIn[i].Index];
+//The stitching of groups across mpi domains is done with a distributed union-find. Every local group, and every ungrouped particle
+//that links to a particle on another domain, is a node labelled by its group id and owned by the task on which its particles reside.
+//The owner stores the parent of the node. The particles that overlap another domain are exported once and the links (edges) between
+//nodes are found locally. Roots are then merged by hooking every root onto the smallest root it is linked to followed by pointer jumping
+//till every node points directly to its root. Each hooking round at least halves the number of roots in a group and each jump halves
+//the depth of the tree, so the number of communication rounds grows logarithmically with the number of domains spanned by a group
+//and not with the length of the chain of links. The final group id is the smallest id in the group and the task owning that id is
+//the task to which the group is sent in \ref MPIGroupExchange.
+
+///edge between two union-find nodes (group ids) and the tasks owning them
+struct mpi_link_edge {
+    Int_t gid[2];
+    int task[2];
+};
+
+///union-find node, also used to request the parent of a node or propose a new parent
+struct mpi_link_node {
+    Int_t gid, parent;
+    int ptask;
+};
+
+///get the local union-find node, adding it as its own root if it is not yet present
+inline mpi_link_node &MPILinkGetNode(unordered_map<Int_t, mpi_link_node> &table, Int_t gid){
+    auto it=table.find(gid);
+    if (it==table.end()) it=table.emplace(gid, mpi_link_node{gid,gid,ThisTask}).first;
+    return it->second;
+}
+
+///offset of the ids of ungrouped particles on every task, which lie above all group ids
+vector<Int_t> MPILinkSingleOffsets(const Int_t nbodies, Int_t *pfof){
+    Int_t maxgid=0, gmaxgid, offset=0;
+    vector<Int_t> offsets(NProcs);
+    for (Int_t i=0;i<nbodies;i++) if (pfof[i]>maxgid) maxgid=pfof[i];
+    MPI_Allreduce(&maxgid, &gmaxgid, 1, MPI_Int_t, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Exscan(&nbodies, &offset, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
+    if (ThisTask==0) offset=0;
+    offset+=gmaxgid+1;
+    MPI_Allgather(&offset, 1, MPI_Int_t, offsets.data(), 1, MPI_Int_t, MPI_COMM_WORLD);
+    return offsets;
+}
+
+/*! Send union-find nodes to the tasks that own them. If ihook, the owner sets the parent of the node to the proposed parent if it is smaller,
+    otherwise the owner replies with the current parent of the node, which is stored in place.
+*/
+void MPILinkExchangeNodes(vector<mpi_link_node> &nodes, const vector<int> &owner, unordered_map<Int_t, mpi_link_node> &table, bool ihook){
+    Int_t n=nodes.size(), nexport=0, nimport=0;
+    Int_t nsend_local[NProcs], nrecv_local[NProcs], noffset[NProcs];
+    for (int j=0;j<NProcs;j++) nsend_local[j]=0;
+    for (Int_t i=0;i<n;i++) if (owner[i]!=ThisTask) nsend_local[owner[i]]++;
+    MPISparseCounts(nsend_local, nrecv_local);
+    for (int j=0;j<NProcs;j++) {noffset[j]=nexport;nexport+=nsend_local[j];nimport+=nrecv_local[j];}
+    vector<Int_t> sendindex(nexport);
+    vector<mpi_link_node> sendbuf(nexport), recvbuf(nimport);
+    for (Int_t i=0;i<n;i++) if (owner[i]!=ThisTask) {
+        sendindex[noffset[owner[i]]]=i;
+        sendbuf[noffset[owner[i]]++]=nodes[i];
     }
-    for(j=0;j<NProcs;j++)
-    {
-        if (j!=ThisTask)
-        {
-            sendTask = ThisTask;
-            recvTask = j;
-            nbuffer[recvTask]=0;
-            for (int k=0;k<recvTask;k++)nbuffer[recvTask]+=mpi_nsend[ThisTask+k*NProcs];//offset on local receiving buffer
+    MPIExchangeBlocks(sendbuf.data(), nsend_local, recvbuf.data(), nrecv_local, TAG_FOF_F);
+    if (ihook) {
+        for (auto &node:recvbuf) {
+            mpi_link_node &root=MPILinkGetNode(table,node.gid);
+            if (node.parent<root.parent) {root.parent=node.parent;root.ptask=node.ptask;}
+        }
+        for (Int_t i=0;i<n;i++) if (owner[i]==ThisTask) {
+            mpi_link_node &root=MPILinkGetNode(table,nodes[i].gid);
+            if (nodes[i].parent<root.parent) {root.parent=nodes[i].parent;root.ptask=nodes[i].ptask;}
+        }
+        return;
+    }
+    for (auto &node:recvbuf) node=MPILinkGetNode(table,node.gid);
+    for (Int_t i=0;i<n;i++) if (owner[i]==ThisTask) nodes[i]=MPILinkGetNode(table,nodes[i].gid);
+    MPIExchangeBlocks(recvbuf.data(), nrecv_local, sendbuf.data(), nsend_local, TAG_FOF_F);
+    for (Int_t i=0;i<nexport;i++) nodes[sendindex[i]]=sendbuf[i];
+}
 
-            if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
-            {
-                //send info in loops to minimize memory footprint
-                cursendchunksize=currecvchunksize=maxchunksize;
-                nsendchunks=ceil(mpi_nsend[recvTask+ThisTask*NProcs]/(Double_t)maxchunksize);
-                nrecvchunks=ceil(mpi_nsend[ThisTask+recvTask*NProcs]/(Double_t)maxchunksize);
-                if (cursendchunksize>mpi_nsend[recvTask+ThisTask*NProcs]) {
-                    nsendchunks=1;
-                    cursendchunksize=mpi_nsend[recvTask+ThisTask*NProcs];
-                }
-                if (currecvchunksize>mpi_nsend[ThisTask+recvTask*NProcs]) {
-                    nrecvchunks=1;
-                    currecvchunksize=mpi_nsend[ThisTask+recvTask*NProcs];
-                }
-                numsendrecv=max(nsendchunks,nrecvchunks);
-                sendoffset=recvoffset=0;
-                for (auto ichunk=0;ichunk<numsendrecv;ichunk++)
-                {
-                    //blocking point-to-point send and receive. Here must determine the appropriate offset point in the local export buffer
-                    //for sending data and also the local appropriate offset in the local the receive buffer for information sent from the local receiving buffer
-                    MPI_Sendrecv(&FoFDataIn[noffset[recvTask]+sendoffset],
-                        cursendchunksize * sizeof(struct fofdata_in), MPI_BYTE,
-                        recvTask, TAG_FOF_A+ichunk,
-                        &FoFDataGet[nbuffer[recvTask]+recvoffset],
-                        currecvchunksize * sizeof(struct fofdata_in),
-                        MPI_BYTE, recvTask, TAG_FOF_A+ichunk, MPI_COMM_WORLD, &status);
-                    sendoffset+=cursendchunksize;
-                    recvoffset+=currecvchunksize;
-                    if (cursendchunksize>mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset)cursendchunksize=mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset;
-                    if (currecvchunksize>mpi_nsend[ThisTask+recvTask * NProcs]-sendoffset)currecvchunksize=mpi_nsend[ThisTask+recvTask * NProcs]-recvoffset;
-                }
-            }
+/*! Given the edges found between local and imported nodes, resolve the groups with the distributed union-find and update the group id
+    and group task of local particles. Returns the number of local particles whose group id has changed.
+*/
+Int_t MPIResolveLinksUnionFind(const Int_t nbodies, Particle *Part, Int_t *&pfof, vector<mpi_link_edge> &edges, Int_t singleoffset){
+    unordered_map<Int_t, mpi_link_node> table;
+    vector<mpi_link_node> nodes;
+    vector<int> owner;
+    vector<Int_t> active;
+    Int_t nedges, nedgestotal, nchanged, nchangedtotal, nlinks=0;
+    int nrounds=0, njumps=0;
+    double time1=MyGetTime();
+
+    auto edgecmp=[](const mpi_link_edge &a, const mpi_link_edge &b){
+        return (a.gid[0]<b.gid[0] || (a.gid[0]==b.gid[0] && a.gid[1]<b.gid[1]));
+    };
+    auto edgeeq=[](const mpi_link_edge &a, const mpi_link_edge &b){
+        return (a.gid[0]==b.gid[0] && a.gid[1]==b.gid[1]);
+    };
+    do {
+        //find the current root of both ends of every edge
+        nodes.resize(2*edges.size());
+        owner.resize(2*edges.size());
+        for (size_t i=0;i<edges.size();i++) for (int k=0;k<2;k++) {
+            nodes[2*i+k].gid=edges[i].gid[k];
+            owner[2*i+k]=edges[i].task[k];
+        }
+        MPILinkExchangeNodes(nodes, owner, table, false);
+        //replace edges by edges between roots, removing those that lie within a single group
+        nedges=0;
+        for (size_t i=0;i<edges.size();i++) {
+            int k=(nodes[2*i].parent>nodes[2*i+1].parent);
+            if (nodes[2*i].parent==nodes[2*i+1].parent) continue;
+            edges[nedges].gid[0]=nodes[2*i+k].parent;edges[nedges].task[0]=nodes[2*i+k].ptask;
+            edges[nedges].gid[1]=nodes[2*i+1-k].parent;edges[nedges].task[1]=nodes[2*i+1-k].ptask;
+            nedges++;
         }
+        edges.resize(nedges);
+        sort(edges.begin(), edges.end(), edgecmp);
+        edges.erase(unique(edges.begin(), edges.end(), edgeeq), edges.end());
+        nedges=edges.size();
+        MPI_Allreduce(&nedges, &nedgestotal, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
+        if (nedgestotal==0) break;
+        nrounds++;
+
+        //hook the larger root of each edge onto the smaller, the owner keeping the smallest proposed root
+        nodes.resize(nedges);
+        owner.resize(nedges);
+        for (Int_t i=0;i<nedges;i++) {
+            nodes[i].gid=edges[i].gid[1];
+            nodes[i].parent=edges[i].gid[0];
+            nodes[i].ptask=edges[i].task[0];
+            owner[i]=edges[i].task[1];
+        }
+        MPILinkExchangeNodes(nodes, owner, table, true);
+
+        //pointer jumping till every local node points to a root
+        active.clear();
+        for (auto &entry:table) if (entry.second.parent!=entry.first) active.push_back(entry.first);
+        do {
+            nodes.resize(active.size());
+            owner.resize(active.size());
+            for (size_t i=0;i<active.size();i++) {
+                mpi_link_node &node=table[active[i]];
+                nodes[i].gid=node.parent;
+                owner[i]=node.ptask;
+            }
+            MPILinkExchangeNodes(nodes, owner, table, false);
+            nchanged=0;
+            for (size_t i=0;i<active.size();i++) {
+                mpi_link_node &node=table[active[i]];
+                if (nodes[i].parent==node.parent) continue;
+                node.parent=nodes[i].parent;
+                node.ptask=nodes[i].ptask;
+                active[nchanged++]=active[i];
+            }
+            active.resize(nchanged);
+            MPI_Allreduce(&nchanged, &nchangedtotal, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
+            njumps++;
+        } while (nchangedtotal>0);
+    } while (nedgestotal>0);
+
+    //update local particles to the id and task of the root of their group
+    for (Int_t i=0;i<nbodies;i++) {
+        Int_t id=Part[i].GetID();
+        Int_t gid=(pfof[id]>0)?pfof[id]:singleoffset+id;
+        auto it=table.find(gid);
+        if (it==table.end() || (it->second.parent==pfof[id])) continue;
+        pfof[id]=it->second.parent;
+        mpi_foftask[id]=it->second.ptask;
+        nlinks++;
     }
+    if (ThisTask==0) cout<<ThisTask<<": linked groups across MPI domains using "<<nrounds<<" union-find rounds and "<<njumps<<" pointer jumping steps in "<<MyGetTime()-time1<<endl;
+    return nlinks;
 }
 
-/*! This routine searches the local particle list using the positions of the exported particles to see if any local particles
-    met the linking criterion and any other FOF criteria of said exported particle. If that is the case, then the group id of the local particle
-    and all other particles that belong to the same group are adjusted if the group id of the exported particle is smaller. This routine returns
-    the number of links found between the local particles and all other exported particles from all other mpi domains.
-    \todo need to update lengths if strucden flag used to limit particles for which real velocity density calculated
+/*! This routine searches the local particle list using the positions of the exported particles to find links between local particles and particles
+    on other mpi domains, which are then resolved using \ref MPIResolveLinksUnionFind. Returns the number of local particles whose group has changed.
 */
-Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2){
-    Int_t i,j,k;
-    Int_t links=0;
-    Int_t nbuffer[NProcs];
+Int_t MPILinkAcrossUnionFind(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Double_t rdist2, vector<partposdata_in> *imported){
+    vector<Int_t> singleoffsets=MPILinkSingleOffsets(nbodies, pfof);
+    vector<mpi_link_edge> edges;
+    vector<partposdata_in> exchanged;
     Int_t *nn=new Int_t[nbodies];
-    Int_t nt,ss,oldlen;
+    Int_t nt, id, gid;
     Coordinate x;
-    for (i=0;i<NImport;i++) {
-        for (j=0;j<3;j++) x[j]=PartDataGet[i].GetPosition(j);
-        //find all particles within a search radius of the imported particle
+    mpi_link_edge edge;
+    //positions of the exported particles may already have been received, see \ref MPIStartParticleExport
+    if (imported==NULL) {
+        MPIExchangeExportRecords(Part, exchanged, TAG_FOF_B);
+        imported=&exchanged;
+    }
+    vector<partposdata_in> &importbuf=*imported;
+    Int_t nimport=importbuf.size();
+    for (Int_t i=0;i<nimport;i++) {
+        for (int j=0;j<3;j++) x[j]=importbuf[i].Pos[j];
         nt=tree->SearchBallPosTagged(x, rdist2, nn);
+        if (nt==0) continue;
+        edge.task[0]=FoFDataGet[i].iGroupTask;
+        edge.gid[0]=(FoFDataGet[i].iGroup>0)?FoFDataGet[i].iGroup:singleoffsets[edge.task[0]]+importbuf[i].ID;
+        edge.task[1]=ThisTask;
+        //neighbours usually belong to the same group so only store a link if it differs from the previous one
+        edge.gid[1]=0;
         for (Int_t ii=0;ii<nt;ii++) {
-            k=nn[ii];
-            //if the imported particle does not belong to a group
-            if (FoFDataGet[i].iGroup==0)
-            {
-                //if the current local particle's group head is zero and the exported particle group is zero
-                //update the local particle's group id and the task to which it belongs
-                //then one should link it and to make global decision base whether this task handles
-                //the change on the PID of the particle
-                if (pfof[Part[Head[k]].GetID()]==0&&Part[Head[k]].GetPID() > PartDataGet[i].GetPID()) {
-                    pfof[Part[k].GetID()]=mpi_maxgid+mpi_gidoffset;///some unique identifier based on this task
-                    mpi_gidoffset++;//increase unique identifier
-                    Len[k]=1;
-                    mpi_foftask[Part[k].GetID()]=FoFDataGet[i].iGroupTask;
-                    links++;
-                }
-                //if the local particle does belong to a group, let the task from which the imported particle came from
-                //handle the change
-            }
-            //if imported particle has already been linked
-            else {
-                //check to see if local particle has already been linked
-                if (pfof[Part[Head[k]].GetID()]>0)  {
-                    //as iGroups and pfof have been rank ordered globally
-                    //proceed to link local particle to imported particle if
-                    //its group id is larger
-                    if(pfof[Part[Head[k]].GetID()] > FoFDataGet[i].iGroup) {
-                        ss = Head[k];
-                        oldlen=Len[k];
-                        do{
-                            pfof[Part[ss].GetID()]=FoFDataGet[i].iGroup;
-                            mpi_foftask[Part[ss].GetID()]=FoFDataGet[i].iGroupTask;
-                            Len[ss]=FoFDataGet[i].iLen+oldlen;
-                        }while((ss = Next[ss]) >= 0);
-                        FoFDataGet[i].iLen+=oldlen;
-                        ss = Head[k];
-                        links++;
-                    }
-                    //otherwise, let the task from which this imported particle came from
-                    //handle the change
-                }
-                //if not in local group, add the particle to the imported particles group
-                else {
-                    pfof[Part[k].GetID()]=FoFDataGet[i].iGroup;
-                    Len[k]=FoFDataGet[i].iLen;
-                    mpi_foftask[Part[k].GetID()]=FoFDataGet[i].iGroupTask;
-                    FoFDataGet[i].iLen+=1;
-                    links++;
-                }
-            }
+            id=Part[nn[ii]].GetID();
+            gid=(pfof[id]>0)?pfof[id]:singleoffsets[ThisTask]+id;
+            if (gid==edge.gid[1]) continue;
+            edge.gid[1]=gid;
+            edges.push_back(edge);
         }
     }
-    return links;
+    delete[] nn;
+    return MPIResolveLinksUnionFind(nbodies, Part, pfof, edges, singleoffsets[ThisTask]);
 }
+
 ///link particles belonging to the same group across mpi domains using comparison function
-Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2, FOFcompfunc &cmp, Double_t *params){
-    Int_t i,j,k;
-    Int_t links=0;
-    Int_t nbuffer[NProcs];
+Int_t MPILinkAcrossUnionFind(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Double_t rdist2, FOFcompfunc &cmp, Double_t *params){
+    vector<Int_t> singleoffsets=MPILinkSingleOffsets(nbodies, pfof);
+    vector<mpi_link_edge> edges;
+    vector<partphasedata_in> importbuf;
     Int_t *nn=new Int_t[nbodies];
-    Int_t nt;
-    for (i=0;i<NImport;i++) {
-        nt=tree->SearchCriterionTagged(PartDataGet[i], cmp, params, nn);
+    Int_t nt, id, gid;
+    Particle p;
+    mpi_link_edge edge;
+    MPIExchangeExportRecords(Part, importbuf, TAG_FOF_B);
+    Int_t nimport=importbuf.size();
+    for (Int_t i=0;i<nimport;i++) {
+        p=importbuf[i].GetParticle();
+        nt=tree->SearchCriterionTagged(p, cmp, params, nn);
+        if (nt==0) continue;
+        edge.task[0]=FoFDataGet[i].iGroupTask;
+        edge.gid[0]=(FoFDataGet[i].iGroup>0)?FoFDataGet[i].iGroup:singleoffsets[edge.task[0]]+importbuf[i].ID;
+        edge.task[1]=ThisTask;
+        //neighbours usually belong to the same group so only store a link if it differs from the previous one
+        edge.gid[1]=0;
         for (Int_t ii=0;ii<nt;ii++) {
-            k=nn[ii];
-            if (FoFDataGet[i].iGroup==0)
-            {
-                if (pfof[Part[Head[k]].GetID()]==0&&Part[Head[k]].GetPID() > PartDataGet[i].GetPID()) {
-                    pfof[Part[k].GetID()]=mpi_maxgid+mpi_gidoffset;///some unique identifier based on this task
-                    mpi_gidoffset++;//increase unique identifier
-                    Len[k]=1;
-                    mpi_foftask[Part[k].GetID()]=FoFDataGet[i].iGroupTask;
-                    links++;
-                }
-            }
-            else {
-            if (pfof[Part[Head[k]].GetID()]>0)  {
-                if(pfof[Part[Head[k]].GetID()] > FoFDataGet[i].iGroup) {
-                    Int_t ss = Head[k];
-                    do{
-                        pfof[Part[ss].GetID()]=FoFDataGet[i].iGroup;
-                        mpi_foftask[Part[ss].GetID()]=FoFDataGet[i].iGroupTask;
-                        Len[ss]=FoFDataGet[i].iLen;
-                    }while((ss = Next[ss]) >= 0);
-                    ss = Head[k];
-                    links++;
-                }
-            }
-            else {
-                pfof[Part[k].GetID()]=FoFDataGet[i].iGroup;
-                Len[k]=FoFDataGet[i].iLen;
-                mpi_foftask[Part[k].GetID()]=FoFDataGet[i].iGroupTask;
-                links++;
-            }
-            }
+            id=Part[nn[ii]].GetID();
+            gid=(pfof[id]>0)?pfof[id]:singleoffsets[ThisTask]+id;
+            if (gid==edge.gid[1]) continue;
+            edge.gid[1]=gid;
+            edges.push_back(edge);
         }
     }
-    return links;
+    delete[] nn;
+    return MPIResolveLinksUnionFind(nbodies, Part, pfof, edges, singleoffsets[ThisTask]);
 }
 
-///link particles belonging to the same group across mpi domains given a type check function
-Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2, FOFcheckfunc &check, Double_t *params){
-    Int_t i,j,k;
-    Int_t links=0;
-    Int_t nbuffer[NProcs];
+///link particles belonging to the same group across mpi domains given a type check function. Only imported particles in groups are linked and
+///links to local particles already in a group require both particles to pass the check
+Int_t MPILinkAcrossUnionFind(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Double_t rdist2, FOFcheckfunc &check, Double_t *params, vector<partposdata_in> *imported){
+    vector<Int_t> singleoffsets=MPILinkSingleOffsets(nbodies, pfof);
+    vector<mpi_link_edge> edges;
+    vector<partposdata_in> exchanged;
     Int_t *nn=new Int_t[nbodies];
-    Int_t nt;
-    bool iflag;
+    Int_t nt, id, gid;
     Coordinate x;
-    for (i=0;i<NImport;i++) {
-        //if exported particle not in a group, do nothing
-        if (FoFDataGet[i].iGroup==0) continue;
-        for (j=0;j<3;j++) x[j]=PartDataGet[i].GetPosition(j);
+    Particle p;
+    mpi_link_edge edge;
+    if (imported==NULL) {
+        MPIExchangeExportRecords(Part, exchanged, TAG_FOF_B);
+        imported=&exchanged;
+    }
+    vector<partposdata_in> &importbuf=*imported;
+    Int_t nimport=importbuf.size();
+    for (Int_t i=0;i<nimport;i++) {
+        //if exported particle not in a group or not of the appropriate type, do nothing
+        p=importbuf[i].GetParticle();
+        if (FoFDataGet[i].iGroup==0 || check(p,params)!=0) continue;
+        for (int j=0;j<3;j++) x[j]=importbuf[i].Pos[j];
         nt=tree->SearchBallPosTagged(x, rdist2, nn);
+        edge.task[0]=FoFDataGet[i].iGroupTask;
+        edge.gid[0]=FoFDataGet[i].iGroup;
+        edge.task[1]=ThisTask;
+        edge.gid[1]=0;
         for (Int_t ii=0;ii<nt;ii++) {
-            k=nn[ii];
-            //check that at least on of the particles meets the type criterion
-            if (check(Part[k],params)!=0 && check(PartDataGet[i],params)!=0) continue;
-            //if local particle in a group
-            if (pfof[Part[Head[k]].GetID()]>0)  {
-                //only change if both particles are appropriate type and group ids indicate local needs to be exported
-                if (!(check(Part[k],params)==0 && check(PartDataGet[i],params)==0)) continue;
-                if(pfof[Part[Head[k]].GetID()] > FoFDataGet[i].iGroup) {
-                    Int_t ss = Head[k];
-                    do{
-                        pfof[Part[ss].GetID()]=FoFDataGet[i].iGroup;
-                        mpi_foftask[Part[ss].GetID()]=FoFDataGet[i].iGroupTask;
-                        Len[ss]=FoFDataGet[i].iLen;
-                    }while((ss = Next[ss]) >= 0);
-                    ss = Head[k];
-                    links++;
-                }
-            }
-            //if local particle not in a group and export is appropriate type, link
-            else {
-                if (check(PartDataGet[i],params)!=0) continue;
-                pfof[Part[k].GetID()]=FoFDataGet[i].iGroup;
-                Len[k]=FoFDataGet[i].iLen;
-                mpi_foftask[Part[k].GetID()]=FoFDataGet[i].iGroupTask;
-                links++;
-            }
+            id=Part[nn[ii]].GetID();
+            if (pfof[id]>0 && check(Part[nn[ii]],params)!=0) continue;
+            gid=(pfof[id]>0)?pfof[id]:singleoffsets[ThisTask]+id;
+            if (gid==edge.gid[1]) continue;
+            edge.gid[1]=gid;
+            edges.push_back(edge);
         }
     }
-    return links;
+    delete[] nn;
+    return MPIResolveLinksUnionFind(nbodies, Part, pfof, edges, singleoffsets[ThisTask]);
 }
+
 /*!
     Group particles belong to a group to a particular mpi thread so that locally easy to determine
     the maximum group size and reoder the group ids according to descending group size.
@@ -2561,11 +3345,11 @@ Int_t MPIGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof){
         if (mpi_foftask[i]!=ThisTask)
             nsend_local[mpi_foftask[i]]++;
     }
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    MPIExchangeCounts(nsend_local);
     nexport=nimport=0;
     for (j=0;j<NProcs;j++){
-        nimport+=mpi_nsend[ThisTask+j*NProcs];
-        nexport+=mpi_nsend[j+ThisTask*NProcs];
+        nimport+=mpi_nrecv[j];
+        nexport+=mpi_nsend[j];
     }
     //declare array for local storage of the appropriate size
     nlocal=nbodies-nexport+nimport;
@@ -2598,11 +3382,11 @@ Int_t MPIGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof){
     //determine offsets in arrays so that data contiguous with regards to processors for broadcasting
     //offset on transmitter end
     noffset_export[0]=0;
-    for (j=1;j<NProcs;j++) noffset_export[j]=noffset_export[j-1]+mpi_nsend[(j-1)+ThisTask*NProcs];
+    for (j=1;j<NProcs;j++) noffset_export[j]=noffset_export[j-1]+mpi_nsend[j-1];
     //offset on receiver end
     for (j=0;j<NProcs;j++) {
         noffset_import[j]=0;
-        if (j!=ThisTask) for (int k=0;k<j;k++)noffset_import[j]+=mpi_nsend[ThisTask+k*NProcs];
+        if (j!=ThisTask) for (int k=0;k<j;k++)noffset_import[j]+=mpi_nrecv[k];
     }
     for (j=0;j<NProcs;j++) nbuffer[j]=0;
     for (i=nbodies-nexport;i<nbodies;i++) {
@@ -2629,19 +3413,19 @@ Int_t MPIGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof){
             sendTask = ThisTask;
             recvTask = j;
 
-            if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
+            if(mpi_nsend[recvTask] > 0 || mpi_nrecv[recvTask] > 0)
             {
                 //send info in loops to minimize memory footprint
                 cursendchunksize=currecvchunksize=maxchunksize;
-                nsendchunks=ceil(mpi_nsend[recvTask+ThisTask*NProcs]/(Double_t)maxchunksize);
-                nrecvchunks=ceil(mpi_nsend[ThisTask+recvTask*NProcs]/(Double_t)maxchunksize);
-                if (cursendchunksize>mpi_nsend[recvTask+ThisTask*NProcs]) {
+                nsendchunks=ceil(mpi_nsend[recvTask]/(Double_t)maxchunksize);
+                nrecvchunks=ceil(mpi_nrecv[recvTask]/(Double_t)maxchunksize);
+                if (cursendchunksize>mpi_nsend[recvTask]) {
                     nsendchunks=1;
-                    cursendchunksize=mpi_nsend[recvTask+ThisTask*NProcs];
+                    cursendchunksize=mpi_nsend[recvTask];
                 }
-                if (currecvchunksize>mpi_nsend[ThisTask+recvTask*NProcs]) {
+                if (currecvchunksize>mpi_nrecv[recvTask]) {
                     nrecvchunks=1;
-                    currecvchunksize=mpi_nsend[ThisTask+recvTask*NProcs];
+                    currecvchunksize=mpi_nrecv[recvTask];
                 }
                 numsendrecv=max(nsendchunks,nrecvchunks);
                 sendoffset=recvoffset=0;
@@ -2655,8 +3439,8 @@ Int_t MPIGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof){
                         MPI_BYTE, recvTask, TAG_FOF_C+ichunk, MPI_COMM_WORLD, &status);
                     sendoffset+=cursendchunksize;
                     recvoffset+=currecvchunksize;
-                    if (cursendchunksize>mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset)cursendchunksize=mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset;
-                    if (currecvchunksize>mpi_nsend[ThisTask+recvTask * NProcs]-sendoffset)currecvchunksize=mpi_nsend[ThisTask+recvTask * NProcs]-recvoffset;
+                    if (cursendchunksize>mpi_nsend[recvTask]-sendoffset)cursendchunksize=mpi_nsend[recvTask]-sendoffset;
+                    if (currecvchunksize>mpi_nrecv[recvTask]-sendoffset)currecvchunksize=mpi_nrecv[recvTask]-recvoffset;
                 }
             }
         }
@@ -2687,11 +3471,11 @@ Int_t MPIBaryonGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof){
         if (mpi_foftask[i]!=ThisTask)
             nsend_local[mpi_foftask[i]]++;
     }
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    MPIExchangeCounts(nsend_local);
     nexport=nimport=0;
     for (j=0;j<NProcs;j++){
-        nimport+=mpi_nsend[ThisTask+j*NProcs];
-        nexport+=mpi_nsend[j+ThisTask*NProcs];
+        nimport+=mpi_nrecv[j];
+        nexport+=mpi_nsend[j];
     }
     //declare array for local storage of the appropriate size
     nlocal=nbodies-nexport+nimport;
@@ -2747,12 +3531,12 @@ Int_t MPIBaryonGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof){
     //determine offsets in arrays so that data contiguous with regards to processors for broadcasting
     //offset on transmitter end
     noffset_export[0]=0;
-    for (j=1;j<NProcs;j++) noffset_export[j]=noffset_export[j-1]+mpi_nsend[(j-1)+ThisTask*NProcs];
+    for (j=1;j<NProcs;j++) noffset_export[j]=noffset_export[j-1]+mpi_nsend[j-1];
     //offset on receiver end
     for (j=0;j<NProcs;j++) {
         if (nlocal<Nlocalbaryon[0]) noffset_import[j]=0;
         else noffset_import[j]=nbodies-nexport;
-        if (j!=ThisTask) for (int k=0;k<j;k++)noffset_import[j]+=mpi_nsend[ThisTask+k*NProcs];
+        if (j!=ThisTask) for (int k=0;k<j;k++)noffset_import[j]+=mpi_nrecv[k];
     }
     for (j=0;j<NProcs;j++) nbuffer[j]=0;
     for (i=nbodies-nexport;i<nbodies;i++) {
@@ -2774,19 +3558,19 @@ Int_t MPIBaryonGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof){
             sendTask = ThisTask;
             recvTask = j;
 
-            if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
+            if(mpi_nsend[recvTask] > 0 || mpi_nrecv[recvTask] > 0)
             {
                 //send info in loops to minimize memory footprint
                 cursendchunksize=currecvchunksize=maxchunksize;
-                nsendchunks=ceil(mpi_nsend[recvTask+ThisTask*NProcs]/(Double_t)maxchunksize);
-                nrecvchunks=ceil(mpi_nsend[ThisTask+recvTask*NProcs]/(Double_t)maxchunksize);
-                if (cursendchunksize>mpi_nsend[recvTask+ThisTask*NProcs]) {
+                nsendchunks=ceil(mpi_nsend[recvTask]/(Double_t)maxchunksize);
+                nrecvchunks=ceil(mpi_nrecv[recvTask]/(Double_t)maxchunksize);
+                if (cursendchunksize>mpi_nsend[recvTask]) {
                     nsendchunks=1;
-                    cursendchunksize=mpi_nsend[recvTask+ThisTask*NProcs];
+                    cursendchunksize=mpi_nsend[recvTask];
                 }
-                if (currecvchunksize>mpi_nsend[ThisTask+recvTask*NProcs]) {
+                if (currecvchunksize>mpi_nrecv[recvTask]) {
                     nrecvchunks=1;
-                    currecvchunksize=mpi_nsend[ThisTask+recvTask*NProcs];
+                    currecvchunksize=mpi_nrecv[recvTask];
                 }
                 numsendrecv=max(nsendchunks,nrecvchunks);
                 sendoffset=recvoffset=0;
@@ -2800,8 +3584,8 @@ Int_t MPIBaryonGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof){
                         MPI_BYTE, recvTask, TAG_FOF_C+ichunk, MPI_COMM_WORLD, &status);
                     sendoffset+=cursendchunksize;
                     recvoffset+=currecvchunksize;
-                    if (cursendchunksize>mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset)cursendchunksize=mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset;
-                    if (currecvchunksize>mpi_nsend[ThisTask+recvTask * NProcs]-sendoffset)currecvchunksize=mpi_nsend[ThisTask+recvTask * NProcs]-recvoffset;
+                    if (cursendchunksize>mpi_nsend[recvTask]-sendoffset)cursendchunksize=mpi_nsend[recvTask]-sendoffset;
+                    if (currecvchunksize>mpi_nrecv[recvTask]-sendoffset)currecvchunksize=mpi_nrecv[recvTask]-recvoffset;
                 }
             }
         }
@@ -2833,6 +3617,11 @@ Int_t MPICompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_t
         }
         if (Part[i].GetID()==0) break;
     }
+    //if all particles are in groups the last group is not followed by an untagged particle
+    if (i==nbodies && nbodies>0 && Part[start].GetID()!=0) {
+        if ((i-start)<minsize) for (Int_t j=start;j<i;j++) Part[j].SetID(0);
+        else ngroups++;
+    }
     //again resort to move untagged particles to the end.
     qsort(Part,nbodies,sizeof(Particle),IDCompare);
     //now adjust pfof and ids.
@@ -2850,6 +3639,12 @@ Int_t MPICompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_t
         }
         if (pfof[i]==0) break;
     }
+    if (i==nbodies && nbodies>0 && pfof[start]!=0) {
+        numingroup[ngroups]=i-start;
+        plist[ngroups]=new Int_t[numingroup[ngroups]];
+        for (Int_t j=start,count=0;j<i;j++) plist[ngroups][count++]=j;
+        ngroups++;
+    }
     ngroups--;
 
     //reorder groups ids according to size
@@ -2857,8 +3652,8 @@ Int_t MPICompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_t
     for (i=1;i<=ngroups;i++) delete[] plist[i];
     delete[] plist;
     delete[] numingroup;
-    //broadcast number of groups so that ids can be properly offset
-    MPI_Allgather(&ngroups, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
+    //determine the offset of the group ids of this task and the total number of groups so that ids can be properly offset
+    MPIUpdateGroupOffsets(ngroups);
     if(FoFGroupDataLocal!=NULL) delete[] FoFGroupDataLocal;
     if(FoFGroupDataExport!=NULL) delete[] FoFGroupDataExport;
     return ngroups;
@@ -2874,7 +3669,7 @@ Int_t MPIBaryonCompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof,
     //if minimizing memory load when using mpi (by adding extra routines to determine memory required)
     //first check to see if local memory is enough to contained expected number of particles
     //if local mem is enough, copy data from the FoFGroupDataLocal
-    if(Nmemlocalbaryon>nbodies) {
+    if(Nmemlocalbaryon>=nbodies) {
         for (i=Noldlocal;i<nbodies;i++) {
             Part[i]=FoFGroupDataLocal[i-Noldlocal].p;
             Part[i].SetID(-FoFGroupDataLocal[i-Noldlocal].iGroup);
@@ -2891,6 +3686,11 @@ Int_t MPIBaryonCompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof,
             }
             if (Part[i].GetID()==0) break;
         }
+        //if all particles are in groups the last group is not followed by an untagged particle
+        if (i==nbodies && nbodies>0 && Part[start].GetID()!=0) {
+            if ((i-start)<minsize) for (Int_t j=start;j<i;j++) Part[j].SetID(0);
+            else ngroups++;
+        }
 
         //again resort to move untagged particles to the end.
         qsort(Part,nbodies,sizeof(Particle),IDCompare);
@@ -2909,6 +3709,12 @@ Int_t MPIBaryonCompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof,
             }
             if (pfof[i]==0) break;
         }
+        if (i==nbodies && nbodies>0 && pfof[start]!=0) {
+            numingroup[ngroups]=i-start;
+            plist[ngroups]=new Int_t[numingroup[ngroups]];
+            for (Int_t j=start,count=0;j<i;j++) plist[ngroups][count++]=j;
+            ngroups++;
+        }
         ngroups--;
     }
     else {
@@ -2925,6 +3731,11 @@ Int_t MPIBaryonCompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof,
             }
             if (FoFGroupDataLocal[i].iGroup==0) break;
         }
+        //if all particles are in groups the last group is not followed by an untagged particle
+        if (i==nbodies && nbodies>0 && FoFGroupDataLocal[start].iGroup!=0) {
+            if ((i-start)<minsize) for (Int_t j=start;j<i;j++) FoFGroupDataLocal[j].iGroup=0;
+            else ngroups++;
+        }
         //now sort again which will put particles group then id order, and determine size of groups and their current group id;
         qsort(FoFGroupDataLocal, nbodies, sizeof(struct fofid_in), fof_id_cmp);
         numingroup=new Int_t[ngroups+1];
@@ -2940,6 +3751,12 @@ Int_t MPIBaryonCompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof,
             }
             if (FoFGroupDataLocal[i].iGroup==0) break;
         }
+        if (i==nbodies && nbodies>0 && FoFGroupDataLocal[start].iGroup!=0) {
+            numingroup[ngroups]=i-start;
+            plist[ngroups]=new Int_t[numingroup[ngroups]];
+            for (Int_t j=start,count=0;j<i;j++) plist[ngroups][count++]=j;
+            ngroups++;
+        }
         ngroups--;
         for (i=0;i<nbodies;i++) pfof[i]=FoFGroupDataLocal[i].iGroup;
         //and store the particles global ids
@@ -2954,8 +3771,8 @@ Int_t MPIBaryonCompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof,
     delete[] plist;
     delete[] numingroup;
 
-    //broadcast number of groups so that ids can be properly offset
-    MPI_Allgather(&ngroups, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
+    //determine the offset of the group ids of this task and the total number of groups so that ids can be properly offset
+    MPIUpdateGroupOffsets(ngroups);
     if(FoFGroupDataLocal!=NULL) delete[] FoFGroupDataLocal;
     if(FoFGroupDataExport!=NULL) delete[] FoFGroupDataExport;
     return ngroups;
@@ -2972,7 +3789,20 @@ Int_t MPISearchBaryons(const Int_t nbaryons, Particle *&Pbaryons, Int_t *&pfofba
     FOFcompfunc fofcmp=FOF6d;
     Int_t *nnID;
     Double_t *dist2;
+    Int_t ii, nsearchbaryons, *searchorder;
     if (NImport>0) {
+    //only baryons within the search length of an imported particle need to be searched, so flag grid cells near imported particles
+    //and search the baryons in these cells in spatial order
+    BaryonSearchGrid searchgrid;
+    Coordinate *pcentre=new Coordinate[NImport];
+    Double_t *pradius=new Double_t[NImport];
+    for (i=0;i<NImport;i++) {pcentre[i]=Coordinate(PartDataGet[i].GetPosition());pradius[i]=0;}
+    BuildBaryonSearchGrid(NImport,pcentre,pradius,sqrt(param[6]),period,searchgrid);
+    delete[] pcentre;
+    delete[] pradius;
+    searchorder=new Int_t[nbaryons+1];
+    nsearchbaryons=GetBaryonSearchOrder(searchgrid,nbaryons,Pbaryons,searchorder);
+    searchgrid.flag.clear();
     //now dark matter particles associated with a group existing on another mpi domain are local and can be searched.
     KDTree *mpitree=new KDTree(PartDataGet,NImport,nsearch/2,mpitree->TPHYS,mpitree->KEPAN,100,0,0,0,period);
     if (nsearch>NImport) nsearch=NImport;
@@ -2982,15 +3812,16 @@ private(i,j,k,tid,p1,pindex,x1,D2,dval,rval,nnID,dist2)
 {
     nnID=new Int_t[nsearch];
     dist2=new Double_t[nsearch];
-#pragma omp for reduction(+:nexport)
+#pragma omp for schedule(dynamic,BARYONSEARCHBLOCK)
 #endif
-    for (i=0;i<nbaryons;i++)
+    for (ii=0;ii<nsearchbaryons;ii++)
     {
 #ifdef USEOPENMP
         tid=omp_get_thread_num();
 #else
         tid=0;
 #endif
+        i=searchorder[ii];
         p1=Pbaryons[i];
         x1=Coordinate(p1.GetPosition());
         rval=MAXVALUE;
@@ -3013,14 +3844,17 @@ private(i,j,k,tid,p1,pindex,x1,D2,dval,rval,nnID,dist2)
             }
         }
         }
-        nexport+=(mpi_foftask[i]!=ThisTask);
     }
     delete[] nnID;
     delete[] dist2;
 #ifdef USEOPENMP
 }
 #endif
+    delete[] searchorder;
+    delete mpitree;
+    cout<<ThisTask<<" baryon search of imported particles skips "<<nbaryons-nsearchbaryons<<" of "<<nbaryons<<" baryons"<<endl;
     }
+    for (i=0;i<nbaryons;i++) nexport+=(mpi_foftask[i]!=ThisTask);
     return nexport;
 }
 
@@ -3046,11 +3880,11 @@ Int_t MPIBaryonExchange(const Int_t nbaryons, Particle *Pbaryons, Int_t *pfofbar
         if (mpi_foftask[i]!=ThisTask)
             nsend_local[mpi_foftask[i]]++;
     }
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    MPIExchangeCounts(nsend_local);
     nexport=nimport=0;
     for (j=0;j<NProcs;j++){
-        nimport+=mpi_nsend[ThisTask+j*NProcs];
-        nexport+=mpi_nsend[j+ThisTask*NProcs];
+        nimport+=mpi_nrecv[j];
+        nexport+=mpi_nsend[j];
     }
     //declare array for local storage of the appropriate size
     nlocal=nbaryons-nexport+nimport;
@@ -3106,11 +3940,11 @@ Int_t MPIBaryonExchange(const Int_t nbaryons, Particle *Pbaryons, Int_t *pfofbar
     //determine offsets in arrays so that data contiguous with regards to processors for broadcasting
     //offset on transmitter end
     noffset_export[0]=0;
-    for (j=1;j<NProcs;j++) noffset_export[j]=noffset_export[j-1]+mpi_nsend[(j-1)+ThisTask*NProcs];
+    for (j=1;j<NProcs;j++) noffset_export[j]=noffset_export[j-1]+mpi_nsend[j-1];
     for (j=0;j<NProcs;j++) {
         if (nlocal<Nmemlocal) noffset_import[j]=0;
         else noffset_import[j]=nbaryons-nexport;
-        if (j!=ThisTask) for (int k=0;k<j;k++)noffset_import[j]+=mpi_nsend[ThisTask+k*NProcs];
+        if (j!=ThisTask) for (int k=0;k<j;k++)noffset_import[j]+=mpi_nrecv[k];
     }
     for (j=0;j<NProcs;j++) nbuffer[j]=0;
     for (i=nbaryons-nexport;i<nbaryons;i++) {
@@ -3132,19 +3966,19 @@ Int_t MPIBaryonExchange(const Int_t nbaryons, Particle *Pbaryons, Int_t *pfofbar
             sendTask = ThisTask;
             recvTask = j;
 
-            if(mpi_nsend[ThisTask * NProcs + recvTask] > 0 || mpi_nsend[recvTask * NProcs + ThisTask] > 0)
+            if(mpi_nsend[recvTask] > 0 || mpi_nrecv[recvTask] > 0)
             {
                 //send info in loops to minimize memory footprint
                 cursendchunksize=currecvchunksize=maxchunksize;
-                nsendchunks=ceil(mpi_nsend[recvTask+ThisTask*NProcs]/(Double_t)maxchunksize);
-                nrecvchunks=ceil(mpi_nsend[ThisTask+recvTask*NProcs]/(Double_t)maxchunksize);
-                if (cursendchunksize>mpi_nsend[recvTask+ThisTask*NProcs]) {
+                nsendchunks=ceil(mpi_nsend[recvTask]/(Double_t)maxchunksize);
+                nrecvchunks=ceil(mpi_nrecv[recvTask]/(Double_t)maxchunksize);
+                if (cursendchunksize>mpi_nsend[recvTask]) {
                     nsendchunks=1;
-                    cursendchunksize=mpi_nsend[recvTask+ThisTask*NProcs];
+                    cursendchunksize=mpi_nsend[recvTask];
                 }
-                if (currecvchunksize>mpi_nsend[ThisTask+recvTask*NProcs]) {
+                if (currecvchunksize>mpi_nrecv[recvTask]) {
                     nrecvchunks=1;
-                    currecvchunksize=mpi_nsend[ThisTask+recvTask*NProcs];
+                    currecvchunksize=mpi_nrecv[recvTask];
                 }
                 numsendrecv=max(nsendchunks,nrecvchunks);
                 sendoffset=recvoffset=0;
@@ -3158,8 +3992,8 @@ Int_t MPIBaryonExchange(const Int_t nbaryons, Particle *Pbaryons, Int_t *pfofbar
                         MPI_BYTE, recvTask, TAG_FOF_C+ichunk, MPI_COMM_WORLD, &status);
                     sendoffset+=cursendchunksize;
                     recvoffset+=currecvchunksize;
-                    if (cursendchunksize>mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset)cursendchunksize=mpi_nsend[recvTask+ThisTask * NProcs]-sendoffset;
-                    if (currecvchunksize>mpi_nsend[ThisTask+recvTask * NProcs]-sendoffset)currecvchunksize=mpi_nsend[ThisTask+recvTask * NProcs]-recvoffset;
+                    if (cursendchunksize>mpi_nsend[recvTask]-sendoffset)cursendchunksize=mpi_nsend[recvTask]-sendoffset;
+                    if (currecvchunksize>mpi_nrecv[recvTask]-sendoffset)currecvchunksize=mpi_nrecv[recvTask]-recvoffset;
                 }
             }
         }
@@ -3170,62 +4004,270 @@ Int_t MPIBaryonExchange(const Int_t nbaryons, Particle *Pbaryons, Int_t *pfofbar
 //@}
 
 
-/// \name FOF routines related to modifying group ids
+/// \name MPI work balancing of field structures
 //@{
 
-///This alters the group ids by an offset determined by the number of groups on all previous mpi threads so that the group
-///has a unique group id. Prior to this, group ids are determined locally.
-inline void MPIAdjustGroupIDs(const Int_t nbodies,Int_t *pfof) {
-    Int_t noffset=0;
-    for (int j=0;j<ThisTask;j++)noffset+=mpi_ngroups[j];
-    for (Int_t i=0;i<nbodies;i++) if (pfof[i]>0) pfof[i]+=noffset;
+///estimated cost of searching a field structure of n particles for substructure and unbinding it. The search scales as n ln n
+///while unbinding scales as n^2 for structures with at most \ref UNBINDNUM particles (direct summation) and as n ln n above (tree potential),
+///normalised so that the two unbinding estimates agree at \ref UNBINDNUM
+inline double MPIGroupCost(Int_t n){
+    double lnn=log((double)n+1.0);
+    if (n<=UNBINDNUM) return n*lnn+(double)n*(double)n;
+    return n*lnn*(1.0+(double)UNBINDNUM/log((double)UNBINDNUM+1.0));
 }
 
-///Collect FOF from all
-void MPICollectFOF(const Int_t nbodies, Int_t *&pfof){
-    Int_t sendTask,recvTask;
-    MPI_Status status;
-    //if using mpi, offset the pfof so that group ids are no unique, before just local to thread
-    MPIAdjustGroupIDs(Nlocal,pfof);
-    //now send the data from all MPI threads to thread zero
-    //first must send how much data is local to a processor
-    Int_t nsend_local[NProcs];
-    for (int i=0;i<NProcs;i++) nsend_local[i]=0;
-    if (ThisTask!=0)nsend_local[0]=Nlocal;
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-    recvTask=0;
-    //next copy task zero pfof into global mpi_pfof to the appropriate indices
-    if (ThisTask==0) {
-        for (Int_t i=0;i<Nlocal;i++) mpi_pfof[mpi_indexlist[i]]=pfof[i];
+///structure that can be moved between tasks
+struct mpi_group_cost {
+    double cost;
+    Int_t gid;
+    int task;
+};
+
+/*!
+    Greedy (longest processing time first) redistribution of field structures prior to the substructure search so that the estimated cost
+    (see \ref MPIGroupCost) is similar on all tasks. Structures costing less than \ref MPIGROUPBALANCEFAC of the mean cost per task stay put.
+    The remaining ones are shared with all tasks, sorted by decreasing cost and kept on their task if it stays below the mean cost, otherwise
+    placed on the task with the lowest cost. Particles (and inclusive halo properties if present) of moved structures are exchanged, group ids are
+    reordered by size and particles are ordered as after \ref MPICompileGroups. Returns the new local number of particles.
+*/
+Int_t MPIGroupRebalance(Options &opt, vector<Particle> &Part, const Int_t nbodies, Int_t *&pfof, Int_t &ngroup, PropData *&pdata)
+{
+    Int_t *numingroup=NULL, **pglist=NULL, *newpfof;
+    Int_t nsend_local[NProcs], nrecv_local[NProcs], ngsend_local[NProcs], ngrecv_local[NProcs], noffset[NProcs], ngoffset[NProcs];
+    Int_t nexport=0, nimport=0, ngexport=0, ngimport=0, nkeep=0, nlocal, ngroupall, ngroupnew, nmove=0;
+    double localcost=0, fixedcost=0, meancost, maxbefore=0, maxafter=0, time1=MyGetTime();
+    vector<double> cost(ngroup+1), taskcost(NProcs), loadbefore;
+    vector<mpi_group_cost> movable, allmovable;
+    vector<int> nmovable(NProcs), nmovablebytes(NProcs), displs(NProcs), groupdest(ngroup+1,ThisTask);
+    int imovable, ihalodata=(opt.iInclusiveHalo>0);
+
+    if (ngroup>0) numingroup=BuildNumInGroup(nbodies, ngroup, pfof);
+    for (Int_t i=1;i<=ngroup;i++) {cost[i]=MPIGroupCost(numingroup[i]);localcost+=cost[i];}
+    MPI_Allreduce(&localcost, &meancost, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    meancost/=(double)NProcs;
+    if (meancost==0) {
+        if (numingroup!=NULL) delete[] numingroup;
+        return nbodies;
+    }
+    for (Int_t i=1;i<=ngroup;i++) {
+        if (cost[i]>=MPIGROUPBALANCEFAC*meancost) movable.push_back({cost[i],i,ThisTask});
+        else fixedcost+=cost[i];
+    }
+    //share the movable structures and the cost of those that stay put with all tasks
+    MPI_Allgather(&fixedcost, 1, MPI_DOUBLE, taskcost.data(), 1, MPI_DOUBLE, MPI_COMM_WORLD);
+    imovable=movable.size();
+    MPI_Allgather(&imovable, 1, MPI_INT, nmovable.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    imovable=0;
+    for (int j=0;j<NProcs;j++) {nmovablebytes[j]=nmovable[j]*sizeof(mpi_group_cost);displs[j]=imovable*sizeof(mpi_group_cost);imovable+=nmovable[j];}
+    allmovable.resize(imovable);
+    MPI_Allgatherv(movable.data(), movable.size()*sizeof(mpi_group_cost), MPI_BYTE, allmovable.data(), nmovablebytes.data(), displs.data(), MPI_BYTE, MPI_COMM_WORLD);
+    movable.clear();
+
+    //greedy assignment, identical on all tasks
+    loadbefore=taskcost;
+    for (auto &g:allmovable) loadbefore[g.task]+=g.cost;
+    sort(allmovable.begin(), allmovable.end(), [](const mpi_group_cost &a, const mpi_group_cost &b) {
+        if (a.cost!=b.cost) return a.cost>b.cost;
+        if (a.task!=b.task) return a.task<b.task;
+        return a.gid<b.gid;
+    });
+    set<pair<double,int> > loads;
+    for (int j=0;j<NProcs;j++) loads.insert(make_pair(taskcost[j],j));
+    for (auto &g:allmovable) {
+        int dest=g.task;
+        if (taskcost[dest]+g.cost>meancost) dest=loads.begin()->second;
+        loads.erase(make_pair(taskcost[dest],dest));
+        taskcost[dest]+=g.cost;
+        loads.insert(make_pair(taskcost[dest],dest));
+        if (dest!=g.task) nmove++;
+        if (g.task==ThisTask) groupdest[g.gid]=dest;
     }
-    //then for each processor copy their values into local pfof and mpi_indexlist
-    //note mpi_idlist contains id values whereas indexlist contains the index order of how particles were loaded
-    //this requires determining the largest size needed
+    for (int j=0;j<NProcs;j++) {maxbefore=max(maxbefore,loadbefore[j]);maxafter=max(maxafter,taskcost[j]);}
+    maxbefore/=meancost;maxafter/=meancost;
     if (ThisTask==0) {
-        Int_t maxnlocal=0;
-        for(int j=1;j<NProcs;j++) if (maxnlocal<mpi_nsend[j*NProcs]) maxnlocal=mpi_nsend[j*NProcs];
-        delete[] pfof;
-        delete[] mpi_indexlist;
-        pfof=new Int_t[maxnlocal];
-        mpi_indexlist=new Int_t[maxnlocal];
+        cout<<"Predicted substructure search imbalance (max/mean estimated cost) is "<<maxbefore;
+        if (nmove>0 && maxafter<maxbefore) cout<<", moving "<<nmove<<" of "<<allmovable.size()<<" large structures reduces it to "<<maxafter<<endl;
+        else cout<<", no structures moved"<<endl;
     }
-    MPI_Barrier(MPI_COMM_WORLD);
-    //now for each mpi task, copy appropriate data to mpi thread 0 local buffers
-    for(int j=1;j<NProcs;j++)
-    {
-        sendTask=j;
-        recvTask=0;
-        if (ThisTask==sendTask) {
-            MPI_Ssend(pfof, Nlocal , MPI_Int_t,0, TAG_FOF_D, MPI_COMM_WORLD);
-            MPI_Ssend(mpi_indexlist, Nlocal , MPI_Int_t,0, TAG_FOF_E, MPI_COMM_WORLD);
+    allmovable.clear();
+    if (nmove==0 || maxafter>=maxbefore) {
+        if (numingroup!=NULL) delete[] numingroup;
+        return nbodies;
+    }
+
+    //export particles (and halo data) of moved structures, ordered by destination then local group id
+    for (int j=0;j<NProcs;j++) nsend_local[j]=ngsend_local[j]=0;
+    for (Int_t i=1;i<=ngroup;i++) if (groupdest[i]!=ThisTask) {nsend_local[groupdest[i]]+=numingroup[i];ngsend_local[groupdest[i]]++;}
+    MPISparseCounts(nsend_local, nrecv_local);
+    MPISparseCounts(ngsend_local, ngrecv_local);
+    for (int j=0;j<NProcs;j++) {
+        noffset[j]=nexport;nexport+=nsend_local[j];nimport+=nrecv_local[j];
+        ngoffset[j]=ngexport;ngexport+=ngsend_local[j];ngimport+=ngrecv_local[j];
+    }
+    vector<fofid_in> exportbuf(nexport), importbuf(nimport);
+    vector<PropData> pdataexport, pdataimport;
+    if (ihalodata) {pdataexport.resize(ngexport);pdataimport.resize(ngimport);}
+    if (ngroup>0) pglist=BuildPGList(nbodies, ngroup, numingroup, pfof);
+    for (Int_t i=1;i<=ngroup;i++) {
+        int dest=groupdest[i];
+        if (dest==ThisTask) continue;
+        for (Int_t j=0;j<numingroup[i];j++) {
+            fofid_in &e=exportbuf[noffset[dest]++];
+            e.p=Part[pglist[i][j]];
+            e.iGroup=i;
+            e.Task=ThisTask;
+            e.Index=pglist[i][j];
+            e.ID=Part[pglist[i][j]].GetPID();
         }
-        if(ThisTask==0) {
-            MPI_Recv(pfof, mpi_nsend[sendTask*NProcs], MPI_Int_t, sendTask, TAG_FOF_D, MPI_COMM_WORLD, &status);
-            MPI_Recv(mpi_indexlist, mpi_nsend[sendTask*NProcs], MPI_Int_t, sendTask, TAG_FOF_E, MPI_COMM_WORLD, &status);
-            for (Int_t i=0;i<mpi_nsend[sendTask*NProcs];i++) mpi_pfof[mpi_indexlist[i]]=pfof[i];
+        if (ihalodata) pdataexport[ngoffset[dest]++]=pdata[i];
+    }
+    for (Int_t i=1;i<=ngroup;i++) delete[] pglist[i];
+    if (pglist!=NULL) delete[] pglist;
+    if (numingroup!=NULL) delete[] numingroup;
+    MPIExchangeBlocks(exportbuf.data(), nsend_local, importbuf.data(), nrecv_local, TAG_FOF_D);
+    if (ihalodata) MPIExchangeBlocks(pdataexport.data(), ngsend_local, pdataimport.data(), ngrecv_local, TAG_FOF_E);
+    exportbuf.clear();
+    pdataexport.clear();
+
+    //keep local particles of structures that stay and append imported ones, which are given ids after the local ones
+    //in order of arrival, which matches the order of the imported halo data
+    nlocal=nbodies-nexport+nimport;
+    newpfof=new Int_t[nlocal];
+    for (Int_t i=0;i<nbodies;i++) {
+        if (pfof[i]>0 && groupdest[pfof[i]]!=ThisTask) continue;
+        newpfof[nkeep]=pfof[i];
+        Part[nkeep++]=Part[i];
+    }
+    Part.resize(nlocal);
+    ngroupall=ngroup;
+    for (Int_t i=0;i<nimport;i++) {
+        if (i==0 || importbuf[i].Task!=importbuf[i-1].Task || importbuf[i].iGroup!=importbuf[i-1].iGroup) ngroupall++;
+        Part[nkeep+i]=importbuf[i].p;
+        newpfof[nkeep+i]=ngroupall;
+    }
+    importbuf.clear();
+    delete[] pfof;
+    pfof=newpfof;
+    if (ihalodata) {
+        PropData *pdatanew=new PropData[ngroupall+1];
+        for (Int_t i=1;i<=ngroup;i++) pdatanew[i]=pdata[i];
+        for (Int_t i=0;i<ngimport;i++) pdatanew[ngroup+1+i]=pdataimport[i];
+        delete[] pdata;
+        pdata=pdatanew;
+    }
+    pdataimport.clear();
+
+    //reorder group ids by size, skipping the structures that have been moved
+    ngroupnew=0;
+    numingroup=BuildNumInGroup(nlocal, ngroupall, pfof);
+    for (Int_t i=1;i<=ngroupall;i++) ngroupnew+=(numingroup[i]>0);
+    pglist=BuildPGList(nlocal, ngroupall, numingroup, pfof);
+    if (ihalodata) ReorderGroupIDsAndHaloDatabyValue(ngroupall, ngroupnew, numingroup, pfof, pglist, numingroup, pdata);
+    else ReorderGroupIDs(ngroupall, ngroupnew, numingroup, pfof, pglist);
+    for (Int_t i=1;i<=ngroupall;i++) delete[] pglist[i];
+    delete[] pglist;
+    delete[] numingroup;
+    //order particles by group id with untagged particles at the end, using the id to store the sort value
+    for (Int_t i=0;i<nlocal;i++) Part[i].SetID((pfof[i]>0)?pfof[i]:ngroupnew+1);
+    qsort(Part.data(),nlocal,sizeof(Particle),IDCompare);
+    for (Int_t i=0;i<nlocal;i++) {pfof[i]=(Part[i].GetID()<=ngroupnew)*Part[i].GetID();Part[i].SetID(i);}
+
+    ngroup=ngroupnew;
+    Nlocal=Nmemlocal=nlocal;
+    MPIUpdateGroupOffsets(ngroup);
+
+    //the field level of the hierarchy points into the old pfof and Part arrays, so rebuild it
+    delete psldata;
+    psldata=new StrucLevelData;
+    psldata->Allocate(ngroup);
+    psldata->Initialize();
+    for (Int_t i=0;i<nlocal;i++) {
+        if (pfof[i]>0 && psldata->gidhead[pfof[i]]==NULL) {
+            psldata->gidhead[pfof[i]]=&pfof[i];
+            psldata->Phead[pfof[i]]=&Part[i];
+            psldata->gidparenthead[pfof[i]]=&pfof[i];
+            psldata->giduberparenthead[pfof[i]]=&pfof[i];
+            psldata->stypeinlevel[pfof[i]]=HALOSTYPE;
         }
-        MPI_Barrier(MPI_COMM_WORLD);
     }
+    psldata->stype=HALOSTYPE;
+    if (ThisTask==0) cout<<"TIME::"<<ThisTask<<" took "<<MyGetTime()-time1<<" to rebalance field structures"<<endl;
+    return nlocal;
+}
+
+///report the spread across tasks of the time taken by some stage
+void MPIReportTimeImbalance(const char *stage, double time)
+{
+    double tmax, tmin, tsum;
+    MPI_Allreduce(&time, &tmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(&time, &tmin, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(&time, &tsum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    if (ThisTask==0 && tsum>0) cout<<"Achieved "<<stage<<" imbalance (max/mean time) is "<<tmax/(tsum/NProcs)<<", min/mean "<<tmin/(tsum/NProcs)<<endl;
+}
+
+///Get the current and peak resident memory of this process in bytes from /proc/self/status. Where that is not available,
+///the peak is the maximum resident size from getrusage, which is not reset between stages
+void MPIGetMemoryUsage(double &current, double &peak)
+{
+    string line;
+    current=peak=-1;
+    ifstream Fin("/proc/self/status");
+    while (getline(Fin,line)) {
+        if (line.compare(0,6,"VmRSS:")==0) current=atof(line.c_str()+6)*1024.0;
+        else if (line.compare(0,6,"VmHWM:")==0) peak=atof(line.c_str()+6)*1024.0;
+    }
+    if (peak<0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF,&usage);
+        peak=usage.ru_maxrss*1024.0;
+        if (current<0) current=peak;
+    }
+}
+
+///report the spread across tasks of the high-water mark of the memory used since the previous report, with a line per task
+///if the verbosity is above 1, then reset the high-water mark so that the next report only covers the next stage. Where the
+///reset is not available the later reports give the peak since the start of the run
+void MPIReportMemoryUsage(Options &opt, const char *stage)
+{
+    double current, peak, peakmax, peakmin, peaksum, currentmax;
+    double GB=1024.0*1024.0*1024.0;
+    int ireset, iresetall;
+    static int inoreset=0;
+    MPIGetMemoryUsage(current,peak);
+    MPI_Reduce(&peak, &peakmax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&peak, &peakmin, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&peak, &peaksum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&current, &currentmax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (opt.iverbose>1) cout<<"MEM::"<<ThisTask<<" peak of "<<peak/GB<<"GB during "<<stage<<", now using "<<current/GB<<"GB"<<endl;
+    if (ThisTask==0) cout<<"Memory high-water mark during "<<stage<<" :: max="<<peakmax/GB<<"GB mean="<<peaksum/NProcs/GB<<"GB min="<<peakmin/GB<<"GB, max in use after "<<currentmax/GB<<"GB"<<endl;
+    if (inoreset) return;
+    //writing 5 to clear_refs resets the peak resident size to the current one (linux 4.0 and later), older kernels reject the write
+    ofstream Fout("/proc/self/clear_refs");
+    ireset=Fout.is_open();
+    if (ireset) {
+        Fout<<"5"<<endl;
+        ireset=Fout.good();
+    }
+    MPI_Allreduce(&ireset, &iresetall, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (!iresetall) {
+        inoreset=1;
+        if (ThisTask==0) cout<<"Cannot reset the memory high-water mark, later reports give the peak since the start of the run"<<endl;
+    }
+}
+//@}
+
+/// \name FOF routines related to modifying group ids
+//@{
+
+///Sets the number of groups on all previous mpi threads, \ref mpi_ngroupoffset, using an exclusive prefix sum and the total number
+///of groups, \ref mpi_ngrouptotal, so that group ids can be made unique without any thread storing the number of groups of every thread
+void MPIUpdateGroupOffsets(const Int_t ngroups){
+    Int_t nlocal=ngroups;
+    mpi_ngroupoffset=0;
+    MPI_Exscan(&nlocal,&mpi_ngroupoffset,1,MPI_Int_t,MPI_SUM,MPI_COMM_WORLD);
+    //the result of an exclusive scan is undefined on the first task
+    if (ThisTask==0) mpi_ngroupoffset=0;
+    MPI_Allreduce(&nlocal,&mpi_ngrouptotal,1,MPI_Int_t,MPI_SUM,MPI_COMM_WORLD);
 }
 //@}
 
@@ -3240,9 +4282,9 @@ void MPIBuildGridData(const Int_t ngrid, GridCell *grid, Coordinate *gvel, Matri
     MPI_Status status;
 
     for (j=0;j<NProcs;j++) nsend_local[j]=Ngridlocal;
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    MPIExchangeCounts(nsend_local);
     noffset[0]=0;
-    for (j=1;j<NProcs;j++) noffset[j]=noffset[j]+mpi_nsend[ThisTask+j*NProcs];
+    for (j=1;j<NProcs;j++) noffset[j]=noffset[j-1]+mpi_nrecv[j-1];
     for (i=0;i<Ngridlocal;i++) {
         for (j=0;j<3;j++) mpi_grid[noffset[ThisTask]+i].xm[j]=grid[i].xm[j];
         mpi_gvel[noffset[ThisTask]+i]=gvel[i];
@@ -3260,19 +4302,19 @@ void MPIBuildGridData(const Int_t ngrid, GridCell *grid, Coordinate *gvel, Matri
                 Ngridlocal* sizeof(struct GridCell), MPI_BYTE,
                 recvTask, TAG_GRID_A,
                 &mpi_grid[noffset[recvTask]],
-                mpi_nsend[ThisTask+recvTask * NProcs] * sizeof(struct GridCell),
+                mpi_nrecv[recvTask] * sizeof(struct GridCell),
                 MPI_BYTE, recvTask, TAG_GRID_A, MPI_COMM_WORLD, &status);
             MPI_Sendrecv(gvel,
                 Ngridlocal* sizeof(struct Coordinate), MPI_BYTE,
                 recvTask, TAG_GRID_B,
                 &mpi_gvel[noffset[recvTask]],
-                mpi_nsend[ThisTask+recvTask * NProcs] * sizeof(struct Coordinate),
+                mpi_nrecv[recvTask] * sizeof(struct Coordinate),
                 MPI_BYTE, recvTask, TAG_GRID_B, MPI_COMM_WORLD, &status);
             MPI_Sendrecv(gveldisp,
                 Ngridlocal* sizeof(struct Matrix), MPI_BYTE,
                 recvTask, TAG_GRID_C,
                 &mpi_gveldisp[noffset[recvTask]],
-                mpi_nsend[ThisTask+recvTask * NProcs] * sizeof(struct Matrix),
+                mpi_nrecv[recvTask] * sizeof(struct Matrix),
                 MPI_BYTE, recvTask, TAG_GRID_C, MPI_COMM_WORLD, &status);
         }
     }
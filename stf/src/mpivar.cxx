@@ -25,16 +25,27 @@ Double_t mpi_xlim[3][2],mpi_dxsplit[3];
 int mpi_nxsplit[3],mpi_ideltax[3];
 Double_t mpi_period;
 MPI_Domain *mpi_domain;
-Int_t *mpi_nlocal,*mpi_nsend,*mpi_idlist;
+int mpi_sfc_level=0;
+Double_t mpi_sfc_xmin[3], mpi_sfc_icellwidth[3];
+unsigned int *mpi_sfc_splitters=NULL;
+int mpi_ihierarchical=0;
+MPI_Comm mpi_comm_node=MPI_COMM_NULL, mpi_comm_leaders=MPI_COMM_NULL;
+int mpi_node_rank=0, mpi_node_size=1, mpi_nnodes=1;
+int *mpi_task_node=NULL, *mpi_task_noderank=NULL;
+vector<vector<mpi_read_cache> > mpi_readcache;
+int mpi_ireadcells=0;
+vector<mpi_read_cell> mpi_readcells;
+Int_t *mpi_nlocal,*mpi_nsend,*mpi_nrecv,*mpi_idlist;
 short_mpi_t *mpi_foftask;
-Int_t *mpi_ngroups, *mpi_pfof, *mpi_indexlist;
+Int_t mpi_ngroupoffset, mpi_ngrouptotal;
+Int_t *mpi_indexlist;
 int *mpi_part_send_domain;
 
 Int_t mpi_maxgid,mpi_gidoffset;
 fofdata_in *FoFDataIn, *FoFDataGet;
 fofid_in *FoFGroupDataLocal, *FoFGroupDataExport;
 nndata_in *NNDataIn, *NNDataGet;
-Particle *PartDataIn, *PartDataGet;
+Particle *PartDataGet;
 Particle *mpi_Part1=NULL, *mpi_Part2=NULL;
 
 Int_t MinNumMPI,MinNumOld;
@@ -53,12 +53,16 @@ using namespace NBody;
 #define MPIPartBufSize 100000
 ///size of largest MPI chunck in bytes that can be sent in one go (here set by MPI count argument, which is max int)
 #define LOCAL_MAX_MSGSIZE 2147483647L
-///Nlocal maximum initially set to nbodies/NProc*MPProcFac, represents maximum load imbalance
-#define MPIProcFac 1.0
-///maximum export factor used to allocate temporary export particle arrays, thus in any given step (except io) where
-///particles are sent from one MPI thread to another, assume at most this factor of particle will need to be sent
-#define MPIExportFac 0
 #define MAXNNEXPORT 32
+///refinement level of the top level mesh used by the space filling curve decomposition, ie: 2^level cells per dimension
+#define MPISFCLEVEL 7
+///maximum number of mesh cells checked explicitly when testing if a search region overlaps a space filling curve domain,
+///larger regions are conservatively assumed to overlap if they overlap the domain's bounding box
+#define MPISFCMAXSEARCHCELLS 4096
+///interval in microseconds between the calls a progress thread makes into the mpi library, see \ref MPIStartProgressThread
+#define MPIPROGRESSINTERVAL 50
+///field structures whose estimated cost is below this fraction of the mean cost per mpi process are not moved when rebalancing
+#define MPIGROUPBALANCEFAC 0.001
 
 ///define a type to store the maxium number of mpi tasks
 #ifdef HUGEMPI
@@ -103,6 +107,10 @@ typedef short short_mpi_t;
 #define TAG_NN_A 20
 #define TAG_NN_B 21
 
+///flag for sparse exchange of communication counts, alternating between consecutive exchanges
+#define TAG_COUNT_A 40
+#define TAG_COUNT_B 41
+
 ///flag for Grid data exchange
 #define TAG_GRID_A 31
 #define TAG_GRID_B 31
@@ -130,15 +138,65 @@ extern Double_t mpi_period;
 extern struct MPI_Domain {
     Double_t bnd[3][2];
 } *mpi_domain;
+///refinement level of the space filling curve mesh, 0 if domains are the regular boxes in \ref mpi_domain
+extern int mpi_sfc_level;
+///lower corner and inverse cell width of the space filling curve mesh
+extern Double_t mpi_sfc_xmin[3], mpi_sfc_icellwidth[3];
+///Peano-Hilbert key splitters, task j owns the cells with keys in [mpi_sfc_splitters[j],mpi_sfc_splitters[j+1])
+extern unsigned int *mpi_sfc_splitters;
 ///
 //@}
 
+/// \name node topology used by hierarchical communication, see \ref MPIInitNodeTopology
+//@{
+///whether exchanges go through shared memory on a node and are aggregated per pair of nodes
+extern int mpi_ihierarchical;
+///communicator of the tasks sharing memory on this node, and of the first task on every node, which is MPI_COMM_NULL on other tasks
+extern MPI_Comm mpi_comm_node, mpi_comm_leaders;
+///rank of this task in its node communicator, number of tasks on this node and number of nodes
+extern int mpi_node_rank, mpi_node_size, mpi_nnodes;
+///arrays [NProcs] of the node of every task, numbered by the rank of its first task in \ref mpi_comm_leaders, and of its rank on that node
+extern int *mpi_task_node, *mpi_task_noderank;
+//@}
+
+/// \name positions kept by reading tasks between counting the particles in each domain and reading the particle data, see \ref MPINumInDomain
+//@{
+///positions of the particles of one type in one input file, in file order and at the precision of the input, and the mpi task each belongs to
+struct mpi_read_cache
+{
+    vector<double> pos;
+    vector<short_mpi_t> task;
+    void Allocate(Int_t n){pos.resize(3*n);task.resize(n);}
+    Int_t Num(){return task.size();}
+};
+///caches [file][type] filled by the files this task reads, empty if positions are not kept
+extern vector<vector<mpi_read_cache> > mpi_readcache;
+//@}
+
+/// \name particles read by cell, when the input indexes where the particles of each of its top level cells are stored, as SWIFT
+/// snapshots do. Each task then reads the cells assigned to it rather than particles being read by read tasks and sent to their domains
+//@{
+///the particles of one type in one cell, stored contiguously in an input file, and the mpi task they are loaded by
+struct mpi_read_cell
+{
+    int ifile, itype, task;
+    Int_t offset, num;
+};
+///set if the input is read by cell
+extern int mpi_ireadcells;
+///the cells read by this task, ordered by file, type and offset
+extern vector<mpi_read_cell> mpi_readcells;
+//@}
+
 /// \name for mpi FOF search
 //@{
 ///array that stores number of particles
 extern Int_t *mpi_nlocal;
-///Array which is [NProcs*NProcs] that stores number of particles to be exported in FOF search from processor i to j via [i+NProcs*j]
+///Array which is [NProcs] that stores number of particles to be exported from this processor to processor j in the current exchange
 extern Int_t *mpi_nsend;
+///Array which is [NProcs] that stores number of particles to be imported by this processor from processor j in the current exchange.
+///Only the tasks that actually communicate exchange counts, see \ref MPISparseCounts
+extern Int_t *mpi_nrecv;
 ///local array that stores a particles global id;
 extern Int_t *mpi_idlist;
 ///local array that stores a particles global index list of input file(s);
@@ -146,10 +204,9 @@ extern Int_t *mpi_idlist;
 extern Int_t *mpi_indexlist;
 ///local array that stores the thread to which a particle's fof group belongs
 extern short_mpi_t *mpi_foftask;
-///array that stores number of groups, need for properly setting Ids and broadcasting data
-extern Int_t *mpi_ngroups;
-///array that is used by task zero to collect the group ids of every particle so that it can be written to a file.
-extern Int_t *mpi_pfof;
+///number of groups on all previous threads, used to offset local group ids so that they are unique, and the total number of groups
+///across all threads, see \ref MPIUpdateGroupOffsets
+extern Int_t mpi_ngroupoffset, mpi_ngrouptotal;
 ///array that is used to indicate particle must be sent across an mpi_domain, stores the mpi thread num particle is to be sent to
 ///\todo issue is that particles can be sent to more than one mpi thread so have to store Nlocal*NProcs which can be too large
 ///since the idea is to use GETNUMEXPORT to reduce mem costs
@@ -168,8 +225,8 @@ extern struct fofdata_in
     Int_t Task;
 }
 *FoFDataIn, *FoFDataGet;
-///Particle arrays used for transmitting data between mpi threads
-extern Particle *PartDataIn, *PartDataGet;
+///Particle array storing particles imported from other mpi threads, unpacked from the compact records below so that they can be placed in a tree
+extern Particle *PartDataGet;
 ///Particle arrays that allow allocation of memory need when deallocating local particle arrays that then need to be reassigned
 extern Particle *mpi_Part1,*mpi_Part2;
 
@@ -194,6 +251,75 @@ extern struct nndata_in
 *NNDataIn, *NNDataGet;
 //extern Particle *NNPartReturn, *NNPartReturnLocal;
 
+/// \name Compact particle records
+/// Searches across mpi domains only read a few quantities of the exported particles, so rather than full particles, which also carry
+/// hydro, star, black hole and extended fof information, these records are sent, each described by an mpi derived datatype
+/// (see \ref MPIRecordType). Full particles are only sent when particles change domain, as in \ref MPIGroupExchange.
+//@{
+///position, index and type, used to link particles across domains in the 3d fof search
+struct partposdata_in
+{
+    Double_t Pos[3];
+    Int_t ID;
+    int Type;
+    void Set(Particle &p){
+        for (int k=0;k<3;k++) Pos[k]=p.GetPosition(k);
+        ID=p.GetID();Type=p.GetType();
+    }
+    Particle GetParticle() const {return Particle(0,Pos[0],Pos[1],Pos[2],0,0,0,ID,Type);}
+};
+///phase-space coordinates, mass, potential (which phase-space searches can use to store a particle's outlier value), index and type,
+///used to link particles across domains in phase-space fof searches and in the baryon search
+struct partphasedata_in
+{
+    Double_t Pos[3], Vel[3];
+    Double_t Mass, Potential;
+    Int_t ID;
+    int Type;
+    void Set(Particle &p){
+        for (int k=0;k<3;k++) {Pos[k]=p.GetPosition(k);Vel[k]=p.GetVelocity(k);}
+        Mass=p.GetMass();Potential=p.GetPotential();ID=p.GetID();Type=p.GetType();
+    }
+    Particle GetParticle() const {return Particle(Mass,Pos[0],Pos[1],Pos[2],Vel[0],Vel[1],Vel[2],ID,Type,0,Potential);}
+};
+///phase-space coordinates, used to find the nearest neighbours of particles near domain boundaries when calculating the local velocity density
+struct partnndata_in
+{
+    Double_t Pos[3], Vel[3];
+    void Set(Particle &p){
+        for (int k=0;k<3;k++) {Pos[k]=p.GetPosition(k);Vel[k]=p.GetVelocity(k);}
+    }
+    Particle GetParticle() const {return Particle(0,Pos[0],Pos[1],Pos[2],Vel[0],Vel[1],Vel[2]);}
+};
+///position, mass and particle id, used to calculate spherical overdensity quantities of halos that overlap other domains
+struct partsodata_in
+{
+    Double_t Pos[3];
+    Double_t Mass;
+    Int_t PID;
+    void Set(Particle &p){
+        for (int k=0;k<3;k++) Pos[k]=p.GetPosition(k);
+        Mass=p.GetMass();PID=p.GetPID();
+    }
+    Particle GetParticle() const {return Particle(Mass,Pos[0],Pos[1],Pos[2],0,0,0,0,0,0,0,PID);}
+};
+//@}
+
+///state of a nonblocking exchange started before some local work and completed after it (see \ref MPIStartExchangeBlocks),
+///along with the times used to report how much of the communication was hidden behind the local work
+struct mpi_pending_exchange
+{
+    vector<MPI_Request> rqst;
+    ///number of items sent to and received from every task
+    vector<Int_t> nsend, nrecv;
+    ///time the current exchange was started, the time its requests were posted and the time it was first seen to be complete
+    double tstart, tposted, tcomplete;
+    ///accumulated time from starting exchanges to their completion and the part of it this task spent blocked in mpi calls
+    double tcomm, texposed;
+    int iactive;
+    mpi_pending_exchange(){tcomm=texposed=0;iactive=0;}
+};
+
 ///For transmitting grid data
 //@{
 extern struct GridCell *mpi_grid;
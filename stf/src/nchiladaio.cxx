@@ -167,6 +167,7 @@ void *readFieldData(FILE *&infile, nchilada_dump &fh, unsigned int dim, u_int64_
         message="Couldn't read header from file!";
         cout<<message<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,9);
 #else
         exit(9);
@@ -178,6 +179,7 @@ void *readFieldData(FILE *&infile, nchilada_dump &fh, unsigned int dim, u_int64_
         message="This file does not appear to be a field file (magic number doesn't match).";
         cout<<message<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,9);
 #else
         exit(9);
@@ -189,25 +191,35 @@ void *readFieldData(FILE *&infile, nchilada_dump &fh, unsigned int dim, u_int64_
         message="Wrong dimension of positions.";
         cout<<message<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,9);
 #else
         exit(9);
 #endif
     }
 
-    void* data = readField(fh, &xdrs, numParticles, startParticle);
+    //rather than decoding value by value through the xdr stream, read the rest of the file in one go and decode it in bulk
+    long istart=xdr_getpos(&xdrs), iend;
+    xdr_destroy(&xdrs);
+    fseek(infile,0,SEEK_END);
+    iend=ftell(infile);
+    fseek(infile,istart,SEEK_SET);
+    vector<char> payload(max(iend-istart,0L));
+    void* data = 0;
+    if (fread(payload.data(),1,payload.size(),infile)==payload.size())
+        data = readField(fh, payload.data(), payload.size(), numParticles);
 
     if(data == 0) {
         //throw XDRException("Had problems reading in the field");
         message="Had problems reading in the field";
         cout<<message<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,9);
 #else
         exit(9);
 #endif
     }
-    xdr_destroy(&xdrs);
     return data;
 }
 
@@ -222,6 +234,7 @@ void *readFieldData(const string filename, nchilada_dump &fh, unsigned int dim,
         message += filename;
         cout<<message<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,9);
 #else
         exit(9);
@@ -251,6 +264,7 @@ Int_t ncGetCount(string filename)
         //throw XDRException("Couldn't read header from file!");
         cout<<"Couldn't read header from file!"<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,9);
 #else
         exit(9);
@@ -260,6 +274,7 @@ Int_t ncGetCount(string filename)
         //throw XDRException("Wrong dimension.");
         cout<<"Wrong dimension!"<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,9);
 #else
         exit(9);
@@ -308,6 +323,7 @@ Int_t Nchilada_get_nbodies(char *fname, int ptype, Options &opt)
     if (nbodies==0) {
         cout<<"Error. Zero particles of type "<<opt.partsearchtype<<" found. Either 0 nor can't find file"<<filename<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,9);
 #else
         exit(9);
@@ -317,7 +333,7 @@ Int_t Nchilada_get_nbodies(char *fname, int ptype, Options &opt)
 }
 
 ///reads an nchilada formatted file.
-void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons)
+void ReadNchilada(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons)
 {
     Int_t i,j,k,n,nchunk;
     u_int64_t numParticles=nbodies,startParticle=0;
@@ -349,6 +365,7 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
     nchilada_dump fhpos,fhvel,fhmass,fhid,fhgasu,fhgasz,fhgassfr,fhstartage,fhstarz;
     void *posdata,*veldata,*massdata,*iddata,*gasudata,*gaszdata,*gassfrdata,*startagedata,*starzdata;
     Double_t tageval;
+    long long idval;
     int *intbuff;
     long long *longbuff;
     unsigned int *uintbuff;
@@ -359,6 +376,12 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
     double *posdoublebuff,*veldoublebuff,*massdoublebuff;
     double *gasudoublebuff,*gassfrdoublebuff,*gaszdoublebuff;
     double *starzdoublebuff,*startagedoublebuff;
+    //field files of the current type that are read concurrently
+    int nfields,dimfield[NCHILADANUMFIELDS];
+    FILE *ffield[NCHILADANUMFIELDS];
+    nchilada_dump *fhfield[NCHILADANUMFIELDS];
+    void **datafield[NCHILADANUMFIELDS];
+    Int_t nstride;
 
     if (opt.partsearchtype==PSTALL) {
         //lets assume there are dm/stars/gas.
@@ -409,7 +432,7 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
     int *irecv, sendTask,recvTask,irecvflag, *mpi_irecvflag;
     MPI_Request *mpi_request;
     Int_t *mpi_nsend_baryon;
-    if (opt.iBaryonSearch) mpi_nsend_baryon=new Int_t[NProcs*NProcs];
+    if (opt.iBaryonSearch && opt.partsearchtype!=PSTALL) mpi_nsend_baryon=new Int_t[2*NProcs];
 
     //extra blocks to store info
     /*
@@ -479,6 +502,7 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
         fpos[j]=fopen((string(opt.fname)+ nchilada_part_name.part_names[usetypes[j]]+string("pos")).c_str(), "rb");
         fvel[j]=fopen((string(opt.fname)+ nchilada_part_name.part_names[usetypes[j]]+string("vel")).c_str(), "rb");
         fmass[j]=fopen((string(opt.fname)+ nchilada_part_name.part_names[usetypes[j]]+string("mass")).c_str(), "rb");
+        fid[j]=fopen((string(opt.fname)+ nchilada_part_name.part_names[usetypes[j]]+string("iord")).c_str(), "rb");
     }
 #ifdef GASON
     if (opt.partsearchtype==PSTALL || (opt.partsearchtype==PSTDARK && opt.iBaryonSearch>=1) || opt.partsearchtype==PSTGAS) {
@@ -491,69 +515,101 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
 #endif
 #if defined(STARON) || defined(BHON)
     if (opt.partsearchtype==PSTALL || (opt.partsearchtype==PSTDARK && opt.iBaryonSearch>=1) || opt.partsearchtype==PSTGAS) {
-        fstartage=fopen((string(opt.fname)+ nchilada_part_name.part_names[NCHILADASTARTYPE]+string("U")).c_str(), "rb");
+        fstartage=fopen((string(opt.fname)+ nchilada_part_name.part_names[NCHILADASTARTYPE]+string("timeform")).c_str(), "rb");
         fstarz=fopen((string(opt.fname)+ nchilada_part_name.part_names[NCHILADASTARTYPE]+string("Z")).c_str(), "rb");
     }
 #endif
-    //will need to think how best to read stuff in chunks
-
+    //the field files of a type are independent of one another, so they are read and decoded concurrently
+    count=0;
     for (j=0;j<nusetypes;j++) {
         k=usetypes[j];
-        posdata=readFieldData(fpos[j],fhpos, 3, numParticles,startParticle);
+        nfields=0;
+        posdata=veldata=massdata=iddata=gasudata=gaszdata=gassfrdata=startagedata=starzdata=NULL;
+        ffield[nfields]=fpos[j];fhfield[nfields]=&fhpos;datafield[nfields]=&posdata;dimfield[nfields++]=3;
+        ffield[nfields]=fvel[j];fhfield[nfields]=&fhvel;datafield[nfields]=&veldata;dimfield[nfields++]=3;
+        ffield[nfields]=fmass[j];fhfield[nfields]=&fhmass;datafield[nfields]=&massdata;dimfield[nfields++]=1;
+        ffield[nfields]=fid[j];fhfield[nfields]=&fhid;datafield[nfields]=&iddata;dimfield[nfields++]=1;
+#ifdef GASON
+        if (k==NCHILADAGASTYPE) {
+            ffield[nfields]=fgasu;fhfield[nfields]=&fhgasu;datafield[nfields]=&gasudata;dimfield[nfields++]=1;
+#ifdef STARON
+            ffield[nfields]=fgasz;fhfield[nfields]=&fhgasz;datafield[nfields]=&gaszdata;dimfield[nfields++]=1;
+            ffield[nfields]=fgassfr;fhfield[nfields]=&fhgassfr;datafield[nfields]=&gassfrdata;dimfield[nfields++]=1;
+#endif
+        }
+#endif
+#ifdef STARON
+        if (k==NCHILADASTARTYPE) {
+            ffield[nfields]=fstarz;fhfield[nfields]=&fhstarz;datafield[nfields]=&starzdata;dimfield[nfields++]=1;
+            ffield[nfields]=fstartage;fhfield[nfields]=&fhstartage;datafield[nfields]=&startagedata;dimfield[nfields++]=1;
+        }
+#endif
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(dynamic,1) if (nfields>1)
+#endif
+        for (int ifield=0;ifield<nfields;ifield++)
+            *datafield[ifield]=readFieldData(ffield[ifield],*fhfield[ifield],dimfield[ifield],0,startParticle);
+
         if (fhpos.code==float32) posfloatbuff=(float*)posdata;
         else posdoublebuff=(double*)posdata;
-        veldata=readFieldData(fvel[j],fhvel, 3, numParticles,startParticle);
         if (fhvel.code==float32) velfloatbuff=(float*)veldata;
         else veldoublebuff=(double*)veldata;
-        massdata=readFieldData(fmass[j],fhmass, 1, numParticles,startParticle);
         if (fhmass.code==float32) massfloatbuff=(float*)massdata;
         else massdoublebuff=(double*)massdata;
-        iddata=readFieldData(fid[j],fhid, 1, numParticles,startParticle);
         if (fhid.code==int32) intbuff=(int*)iddata;
         else if(fhid.code==int64) longbuff=(long long*)iddata;
         else if(fhid.code==uint32) uintbuff=(unsigned int*)iddata;
         else if (fhid.code==uint64) ulongbuff=(unsigned long long*)iddata;
 #ifdef GASON
-        gasudata=readFieldData(fgasu,fhgasu, 1, numParticles,startParticle);
-        if (fhgasu.code==float32) gasufloatbuff=(float*)gasudata;
-        else gasudoublebuff=(double*)gasudata;
+        if (gasudata!=NULL) {
+            if (fhgasu.code==float32) gasufloatbuff=(float*)gasudata;
+            else gasudoublebuff=(double*)gasudata;
+        }
 #ifdef STARON
-        if (usetypes[j]==NCHILADAGASTYPE) {
-            gaszdata=readFieldData(fgasz,fhgasz, 1, numParticles,startParticle);
+        if (gaszdata!=NULL) {
             if (fhgasz.code==float32) gaszfloatbuff=(float*)gaszdata;
             else gaszdoublebuff=(double*)gaszdata;
-            gassfrdata=readFieldData(fgassfr,fhgassfr, 1, numParticles,startParticle);
             if (fhgassfr.code==float32) gassfrfloatbuff=(float*)gassfrdata;
             else gassfrdoublebuff=(double*)gassfrdata;
         }
 #endif
 #endif
 #ifdef STARON
-        if (usetypes[j]==NCHILADASTARTYPE) {
-            starzdata=readFieldData(fstarz,fhstarz, 1, numParticles,startParticle);
+        if (starzdata!=NULL) {
             if (fhstarz.code==float32) starzfloatbuff=(float*)starzdata;
             else starzdoublebuff=(double*)starzdata;
-            startagedata=readFieldData(fstartage,fhstartage, 1, numParticles,startParticle);
             if (fhstartage.code==float32) startagefloatbuff=(float*)startagedata;
             else startagedoublebuff=(double*)startagedata;
         }
 #endif
+        //vector fields store each dimension followed by its min/max pair
+        nstride=fhpos.nbodies+2;
         for (i=0;i<fhpos.nbodies;i++) {
+            //particles not kept when subsampling are skipped before any of their data is stored
+            if (opt.isubsample>1) {
+                if (fhid.code==int32) idval=intbuff[i];
+                else if (fhid.code==uint32) idval=uintbuff[i];
+                else if (fhid.code==int64) idval=longbuff[i];
+                else idval=ulongbuff[i];
+                if (!SubsampleKeep(opt,idval)) continue;
+            }
 #ifdef USEMPI
-            if (fhpos.code==float32) ibuf=MPIGetParticlesProcessor(posfloatbuff[i],posfloatbuff[i+nbodies],posfloatbuff[i+nbodies*2]);
-            else ibuf=MPIGetParticlesProcessor(posdoublebuff[i],posdoublebuff[i+nbodies],posdoublebuff[i+nbodies*2]);
+            if (fhpos.code==float32) ibuf=MPIGetParticlesProcessor(posfloatbuff[i],posfloatbuff[i+nstride],posfloatbuff[i+nstride*2]);
+            else ibuf=MPIGetParticlesProcessor(posdoublebuff[i],posdoublebuff[i+nstride],posdoublebuff[i+nstride*2]);
             if (fhpos.code==float32) {
-                Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPosition(posfloatbuff[i],posfloatbuff[i+nbodies],posfloatbuff[i+nbodies*2]);
-                Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetVelocity(velfloatbuff[i],velfloatbuff[i+nbodies],velfloatbuff[i+nbodies*2]);
+                Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPosition(posfloatbuff[i],posfloatbuff[i+nstride],posfloatbuff[i+nstride*2]);
+                Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetVelocity(velfloatbuff[i],velfloatbuff[i+nstride],velfloatbuff[i+nstride*2]);
                 Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetMass(massfloatbuff[i]);
             }
             else {
-                Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPosition(posdoublebuff[i],posdoublebuff[i+nbodies],posdoublebuff[i+nbodies*2]);
-                Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetVelocity(veldoublebuff[i],veldoublebuff[i+nbodies],veldoublebuff[i+nbodies*2]);
+                Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPosition(posdoublebuff[i],posdoublebuff[i+nstride],posdoublebuff[i+nstride*2]);
+                Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetVelocity(veldoublebuff[i],veldoublebuff[i+nstride],veldoublebuff[i+nstride*2]);
                 Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetMass(massdoublebuff[i]);
             }
-            if (fhid.code==uint32) Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPID(intbuff[i]);
-            else Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPID(longbuff[i]);
+            if (fhid.code==int32) Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPID(intbuff[i]);
+            else if (fhid.code==uint32) Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPID(uintbuff[i]);
+            else if (fhid.code==int64) Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPID(longbuff[i]);
+            else Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetPID(ulongbuff[i]);
             Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetID(i);
             if (k==NCHILADAGASTYPE) Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetType(GASTYPE);
             else if (k==NCHILADADMTYPE) Pbuf[ibuf*BufSize+Nbuf[ibuf]].SetType(DARKTYPE);
@@ -613,39 +669,41 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
 //start of non mpi section
 #else
             if (fhpos.code==float32) {
-                Part[i].SetPosition(posfloatbuff[i],posfloatbuff[i+nbodies],posfloatbuff[i+nbodies*2]);
-                Part[i].SetVelocity(velfloatbuff[i],velfloatbuff[i+nbodies],velfloatbuff[i+nbodies*2]);
-                Part[i].SetMass(massfloatbuff[i]);
+                Part[count].SetPosition(posfloatbuff[i],posfloatbuff[i+nstride],posfloatbuff[i+nstride*2]);
+                Part[count].SetVelocity(velfloatbuff[i],velfloatbuff[i+nstride],velfloatbuff[i+nstride*2]);
+                Part[count].SetMass(massfloatbuff[i]);
             }
             else {
-                Part[i].SetPosition(posdoublebuff[i],posdoublebuff[i+nbodies],posdoublebuff[i+nbodies*2]);
-                Part[i].SetVelocity(veldoublebuff[i],veldoublebuff[i+nbodies],veldoublebuff[i+nbodies*2]);
-                Part[i].SetMass(massdoublebuff[i]);
+                Part[count].SetPosition(posdoublebuff[i],posdoublebuff[i+nstride],posdoublebuff[i+nstride*2]);
+                Part[count].SetVelocity(veldoublebuff[i],veldoublebuff[i+nstride],veldoublebuff[i+nstride*2]);
+                Part[count].SetMass(massdoublebuff[i]);
             }
-            if (fhid.code==uint32) Part[i].SetPID(intbuff[i]);
-            else Part[i].SetPID(longbuff[i]);
-            Part[i].SetID(i);
-            if (k==NCHILADAGASTYPE) Part[i].SetType(GASTYPE);
-            else if (k==NCHILADADMTYPE) Part[i].SetType(DARKTYPE);
+            if (fhid.code==int32) Part[count].SetPID(intbuff[i]);
+            else if (fhid.code==uint32) Part[count].SetPID(uintbuff[i]);
+            else if (fhid.code==int64) Part[count].SetPID(longbuff[i]);
+            else Part[count].SetPID(ulongbuff[i]);
+            Part[count].SetID(count);
+            if (k==NCHILADAGASTYPE) Part[count].SetType(GASTYPE);
+            else if (k==NCHILADADMTYPE) Part[count].SetType(DARKTYPE);
             else if (k==NCHILADASTARTYPE) {
 #ifdef BHON
                 if (fhstartage.code==float32) tageval=startagefloatbuff[i];
                 else tageval=startagedoublebuff[i];
-                if (tageval>0) Part[i].SetType(STARTYPE);
-                else Part[i].SetType(BHTYPE);
+                if (tageval>0) Part[count].SetType(STARTYPE);
+                else Part[count].SetType(BHTYPE);
 #else
-                Part[i].SetType(STARTYPE);
+                Part[count].SetType(STARTYPE);
 #endif
             }
 #ifdef GASON
             if (k==NCHILADAGASTYPE) {
-                if (fhgasu.code==float32) Part[i].SetU(gasufloatbuff[i]);
-                else Part[i].SetU(gasudoublebuff[i]);
+                if (fhgasu.code==float32) Part[count].SetU(gasufloatbuff[i]);
+                else Part[count].SetU(gasudoublebuff[i]);
 #ifdef STARON
-                if (fhgassfr.code==float32) Part[i].SetSFR(gassfrfloatbuff[i]);
-                else Part[i].SetSFR(gassfrdoublebuff[i]);
-                if (fhgasz.code==float32) Part[i].SetZmet(gaszfloatbuff[i]);
-                else Part[i].SetZmet(gaszdoublebuff[i]);
+                if (fhgassfr.code==float32) Part[count].SetSFR(gassfrfloatbuff[i]);
+                else Part[count].SetSFR(gassfrdoublebuff[i]);
+                if (fhgasz.code==float32) Part[count].SetZmet(gaszfloatbuff[i]);
+                else Part[count].SetZmet(gaszdoublebuff[i]);
 #endif
             }
 #endif
@@ -656,20 +714,27 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
 #ifdef BHON
                 if (tageval<0) tageval*=-1;
 #endif
-                if (fhstarz.code==float32) Part[i].SetZmet(starzfloatbuff[i]);
-                else Part[i].SetZmet(starzdoublebuff[i]);
-                Part[i].SetTage(tageval);
+                if (fhstarz.code==float32) Part[count].SetZmet(starzfloatbuff[i]);
+                else Part[count].SetZmet(starzdoublebuff[i]);
+                Part[count].SetTage(tageval);
             }
 #endif
 #endif
 //end of mpi ifdef
+            count++;
         }//end of loop over particles
+        for (int ifield=0;ifield<nfields;ifield++) freeField(*fhfield[ifield],*datafield[ifield]);
     }//end of loop over particle types
+#ifndef USEMPI
+    //number stored is smaller than that in the header if the input is subsampled
+    if (opt.isubsample>1) nbodies=count;
+#endif
     //close files
     for (j=0;j<nusetypes;j++) {
         fclose(fpos[j]);
         fclose(fvel[j]);
         fclose(fmass[j]);
+        fclose(fid[j]);
     }
 #ifdef GASON
     if (opt.partsearchtype==PSTALL || (opt.partsearchtype==PSTDARK && opt.iBaryonSearch>=1) || opt.partsearchtype==PSTGAS) {
@@ -711,14 +776,14 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
             }
         }
         //gather all the items that must be sent.
-        MPI_Allgather(Nbuf, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+        MPIExchangeCounts(Nbuf);
         //if separate baryon search then sort the Pbuf array so that it is separated by type
         if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
             if (ThisTask<opt.nsnapread) {
-            for(ibuf = 0; ibuf < opt.nsnapread; ibuf++) if (mpi_nsend[ThisTask * NProcs + ibuf] > 0)
+            for(ibuf = 0; ibuf < opt.nsnapread; ibuf++) if (mpi_nsend[ibuf] > 0)
             {
                 Nbuf[ibuf]=0;
-                for (i=0;i<mpi_nsend[ThisTask * NProcs + ibuf];i++) {
+                for (i=0;i<mpi_nsend[ibuf];i++) {
                     k=Pbuf[nreadoffset[ibuf]+i].GetType();
                     if (!(k==GASTYPE||k==STARTYPE||k==BHTYPE)) Pbuf[nreadoffset[ibuf]+i].SetID(0);
                     else {
@@ -728,22 +793,24 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
                         Nbuf[ibuf]++;
                     }
                 }
-                qsort(&Pbuf[nreadoffset[ibuf]],mpi_nsend[ThisTask*NProcs+ibuf], sizeof(Particle), IDCompare);
+                qsort(&Pbuf[nreadoffset[ibuf]],mpi_nsend[ibuf], sizeof(Particle), IDCompare);
             }
             }
-            MPI_Allgather(Nbuf, NProcs, MPI_Int_t, mpi_nsend_baryon, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-            for (ibuf=0;ibuf<NProcs*NProcs;ibuf++) mpi_nsend[ibuf]-=mpi_nsend_baryon[ibuf];
+            //baryon counts sent to each task are stored first, followed by those received from each task
+            for (ibuf=0;ibuf<NProcs;ibuf++) mpi_nsend_baryon[ibuf]=Nbuf[ibuf];
+            MPISparseCounts(mpi_nsend_baryon, &mpi_nsend_baryon[NProcs]);
+            for (ibuf=0;ibuf<NProcs;ibuf++) {mpi_nsend[ibuf]-=mpi_nsend_baryon[ibuf];mpi_nrecv[ibuf]-=mpi_nsend_baryon[NProcs+ibuf];}
         }
         //and then send all the data between the read threads
         MPISendParticlesBetweenReadThreads(opt, Pbuf, Part.data(), nreadoffset, ireadtask, readtaskID, Pbaryons, mpi_nsend_baryon);
         if (ireadtask[ThisTask]>=0) {
             delete[] Pbuf;
-            if (opt.iBaryonSearch && opt.partsearchtype!=PSTALL) delete[] mpi_nsend_baryon;
             //set IDS
             for (i=0;i<Nlocal;i++) Part[i].SetID(i);
             if (opt.iBaryonSearch) for (i=0;i<Nlocalbaryon[0];i++) Pbaryons[i].SetID(i+Nlocal);
         }//end of read tasks
     }
+    if (opt.iBaryonSearch && opt.partsearchtype!=PSTALL) delete[] mpi_nsend_baryon;
 #endif
 
     ///if gas found and Omega_b not set correctly (ie: ==0), assumes that
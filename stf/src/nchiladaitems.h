@@ -20,6 +20,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <assert.h>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
 
 #include "endianutils.h"
 #include <rpc/types.h>
@@ -27,6 +30,8 @@
 #include "tipsy_structs.h"
 
 #define NCHILADAMAXDIM 3
+///maximum number of field files read for a single particle type
+#define NCHILADANUMFIELDS 9
 
 ///number of particle types
 #define NNCHILADATYPE 4
@@ -139,143 +144,119 @@ inline bool_t xdr_template(XDR* xdrs, struct nchilada_dump* h) {
 //@}
 
 
-/*! Allocate for and read in a field from an XDR stream.  You need to have
- read the header already.  The min/max pair are put at the end of the array.
- */
-template <typename T> inline T* readField(XDR* xdrs, const u_int64_t N, const u_int64_t startParticle = 0) {
-    T* data = new T[N + 2];
-    //put min/max at the end
-    if(!xdr_template(xdrs, data + N) || !xdr_template(xdrs, data + N + 1)) {
-        delete[] data;
-        return 0;
-    }
-    if(data[N] == data[N + 1]) {
-        //if all elements are the same, just copy the value into the array
-        for(u_int64_t i = 0; i < N; ++i)
-            data[i] = data[N];
-    }
-    else {
-        ///\todo correct the offseting need for very large arrays
-        /*
-        ///add the offset from the nchilada header
-        off_t offset = sizeof(struct nchilada_dump)
-            + (startParticle + 2) * TypeHandling::Type2Dimensions<T>::dimensions * mySizeof(TypeHandling::Type2Code<T>::code);
-// XXX NASTY kludge to get around 4 byte limit of xdr functions
-#define __BILLION 1000000000
-        fseek((FILE *)xdrs->x_private, 0, 0);
-        while(offset > __BILLION) {
-            offset -= __BILLION;
-            fseek((FILE *)xdrs->x_private, __BILLION,SEEK_CUR);
-        }
-        if(fseek((FILE *)xdrs->x_private, offset, SEEK_CUR) != 0) {
-            cerr << "readField seek failed: " << offset << endl;
-            delete[] data;
-            return 0;
-        }
-#if 0
-        if(!xdr_setpos(xdrs, sizeof(struct nchilada_dump) + (startParticle + 2) * TypeHandling::Type2Dimensions<T>::dimensions * mySizeof(TypeHandling::Type2Code<T>::code))) {
-            delete[] data;
-            return 0;
-        }
-#endif
-        */
-        for(u_int64_t i = 0; i < N; ++i) {
-            if(!xdr_template(xdrs, data + i)) {
-                delete[] data;
-                return 0;
-            }
-        }
+/*!\name Bulk XDR decoding
+ XDR stores every value big endian in words of at least four bytes. Rather than
+ decoding a field one value at a time through the stream, the whole payload is read
+ at once and decoded here. The word used for each type mirrors the xdr_template
+ overloads above (note xdr_long and xdr_u_long use four byte words).
+*/
+//@{
+template<typename T> struct NCXDRWord {typedef int32_t type;};
+template<> struct NCXDRWord<unsigned char> {typedef uint32_t type;};
+template<> struct NCXDRWord<unsigned short> {typedef uint32_t type;};
+template<> struct NCXDRWord<unsigned int> {typedef uint32_t type;};
+template<> struct NCXDRWord<unsigned long> {typedef uint32_t type;};
+template<> struct NCXDRWord<float> {typedef float type;};
+template<> struct NCXDRWord<double> {typedef double type;};
+
+///decode n contiguous xdr values, swapping the whole block at once
+template<typename T> inline void xdr_decode_block(const char *buf, T *val, const u_int64_t n) {
+    typedef typename NCXDRWord<T>::type W;
+    W *w;
+    vector<W> wbuf;
+    if (std::is_same<T,W>::value) w=(W*)val;
+    else {wbuf.resize(n);w=wbuf.data();}
+    memcpy(w,buf,n*sizeof(W));
+    if (!BigEndianSystem) {
+        if (sizeof(W)==4) ByteSwap4Array(w,n);
+        else ByteSwap8Array(w,n);
     }
-    return data;
+    if (!std::is_same<T,W>::value) for (u_int64_t i=0;i<n;i++) val[i]=(T)w[i];
 }
-template <typename T> inline T* readField3D(XDR* xdrs, const u_int64_t N, const u_int64_t startParticle = 0) {
-    T* data = new T[3*(N + 2)];
-    //put min/max at the end
-    Int_t ioffset;
-    for (int idim=0;idim<3;idim++) {
+//@}
+
+/*! Allocate for and decode a field from the payload that follows the field header.
+ Each dimension stores a min/max pair followed by the values, which are only present if min!=max.
+ The min/max pairs are put at the end of each dimension's section of the array.
+ Returns 0 if the payload is too short.
+ */
+template <typename T> inline T* readField(const char *buf, const u_int64_t nbytes, const unsigned int dimensions, const u_int64_t N) {
+    typedef typename NCXDRWord<T>::type W;
+    T* data = new T[dimensions*(N + 2)];
+    u_int64_t offset=0, ioffset;
+    for (unsigned int idim=0;idim<dimensions;idim++) {
         ioffset=idim*(N+2);
-        if(!xdr_template(xdrs, data + N+ioffset) || !xdr_template(xdrs, data + N + 1+ioffset)) {
+        if (offset+2*sizeof(W)>nbytes) {
             delete[] data;
             return 0;
         }
+        xdr_decode_block(buf+offset, data+N+ioffset, 2);
+        offset+=2*sizeof(W);
         if(data[N+ioffset] == data[N + 1+ioffset]) {
             //if all elements are the same, just copy the value into the array
             for(u_int64_t i = 0; i < N; ++i)
                 data[i+ioffset] = data[N+ioffset];
         }
         else {
-            /*
-            off_t offset = FieldHeader::sizeBytes
-                + (startParticle + 2) * TypeHandling::Type2Dimensions<T>::dimensions * mySizeof(TypeHandling::Type2Code<T>::code);
-// XXX NASTY kludge to get around 4 byte limit of xdr functions
-#define __BILLION 1000000000
-            fseek((FILE *)xdrs->x_private, 0, 0);
-            while(offset > __BILLION) {
-                offset -= __BILLION;
-                fseek((FILE *)xdrs->x_private, __BILLION,SEEK_CUR);
-            }
-            if(fseek((FILE *)xdrs->x_private, offset, SEEK_CUR) != 0) {
-                cerr << "readField seek failed: " << offset << endl;
+            if (offset+N*sizeof(W)>nbytes) {
                 delete[] data;
                 return 0;
             }
-#if 0
-            if(!xdr_setpos(xdrs, FieldHeader::sizeBytes + (startParticle + 2) * TypeHandling::Type2Dimensions<T>::dimensions * mySizeof(TypeHandling::Type2Code<T>::code))) {
-                delete[] data;
-                return 0;
-            }
-#endif
-            */
-            for(u_int64_t i = 0; i < N; ++i) {
-                if(!xdr_template(xdrs, data + i+ioffset)) {
-                    delete[] data;
-                    return 0;
-                }
-            }
+            xdr_decode_block(buf+offset, data+ioffset, N);
+            offset+=N*sizeof(W);
         }
     }
     return data;
 }
 
-template <typename T>
-inline void* readField(XDR* xdrs, const unsigned int dimensions, const u_int64_t N, const u_int64_t startParticle = 0) {
-    if(dimensions == 3) {
-        return readField3D<T>(xdrs, N, startParticle+N);
-    }
-    else return readField<T>(xdrs, N, startParticle);
-}
-
-/** Given the type code in the header, reads in the correct type of data.
+/** Given the type code in the header, decodes the correct type of data.
  */
-inline void* readField(const struct nchilada_dump& fh, XDR* xdrs, u_int64_t numParticles = 0, const u_int64_t startParticle = 0) {
+inline void* readField(const struct nchilada_dump& fh, const char *buf, const u_int64_t nbytes, u_int64_t numParticles = 0) {
     if(fh.ndim != 1 && fh.ndim != 3) return 0;
     if(numParticles == 0) numParticles = fh.nbodies;
     switch(fh.code) {
         case int8:
-            return readField<char>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<char>(buf, nbytes, fh.ndim, numParticles);
         case uint8:
-            return readField<unsigned char>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<unsigned char>(buf, nbytes, fh.ndim, numParticles);
         case int16:
-            return readField<short>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<short>(buf, nbytes, fh.ndim, numParticles);
         case uint16:
-            return readField<unsigned short>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<unsigned short>(buf, nbytes, fh.ndim, numParticles);
         case int32:
-            return readField<int>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<int>(buf, nbytes, fh.ndim, numParticles);
         case uint32:
-            return readField<unsigned int>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<unsigned int>(buf, nbytes, fh.ndim, numParticles);
         case int64:
-            return readField<int64_t>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<int64_t>(buf, nbytes, fh.ndim, numParticles);
         case uint64:
-            return readField<u_int64_t>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<u_int64_t>(buf, nbytes, fh.ndim, numParticles);
         case float32:
-            return readField<float>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<float>(buf, nbytes, fh.ndim, numParticles);
         case float64:
-            return readField<double>(xdrs, fh.ndim, numParticles, startParticle);
+            return readField<double>(buf, nbytes, fh.ndim, numParticles);
         default:
             return 0;
     }
 }
 
+///free a field allocated by \ref readField
+inline void freeField(const struct nchilada_dump& fh, void *data) {
+    if (data==0) return;
+    switch(fh.code) {
+        case int8: delete[] (char*)data; break;
+        case uint8: delete[] (unsigned char*)data; break;
+        case int16: delete[] (short*)data; break;
+        case uint16: delete[] (unsigned short*)data; break;
+        case int32: delete[] (int*)data; break;
+        case uint32: delete[] (unsigned int*)data; break;
+        case int64: delete[] (int64_t*)data; break;
+        case uint64: delete[] (u_int64_t*)data; break;
+        case float32: delete[] (float*)data; break;
+        case float64: delete[] (double*)data; break;
+    }
+}
+
 ///read a particular data field from a nchilada file
 void *readFieldData(FILE *&infile, nchilada_dump &fh, unsigned int dim, u_int64_t numParticles, u_int64_t startParticle);
 void *readFieldData(const string filename, nchilada_dump &fh, unsigned int dim, u_int64_t numParticles, u_int64_t startParticle);
@@ -7,6 +7,7 @@
 #include "allvars.h"
 
 #include "fofalgo.h"
+#include "streamitems.h"
 #include "fitting.h"
 
 #ifndef STFPROTO_H
@@ -36,29 +37,74 @@ bool FileExists(const char *fname);
 
 ///Reads the header information
 Int_t ReadHeader(Options &opt);
-///Reads particle data
-void ReadData(Options &opt, vector<Particle> &Part, const Int_t nbodies, Particle *&Pbaryons, Int_t nbaryons=0);
+///Reads particle data. Without mpi, nbodies and nbaryons are updated to the number of particles stored, which is smaller when the input is subsampled
+void ReadData(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons);
 ///Read gadget file
-void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons=0);
+void ReadGadget(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons);
 ///Read tipsy file
-void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons=0);
+void ReadTipsy(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons);
 #ifdef USEHDF
 ///Read HDF format
-void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons=0);
+void ReadHDF(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons);
 #endif
 ///Read ramses file
-void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons=0);
+void ReadRamses(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons);
 ///Read Nchilada file
-void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons=0);
+void ReadNchilada(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons);
+///Where particles of a type are stored by the streaming reader, 0 not read, 1 with the particles searched, 2 with the baryons
+int StreamTypeStorage(Options &opt, int itype);
+///Columns the streaming reader decodes for particles of a type
+int StreamColumns(Options &opt, Stream_Reader &reader, int itype);
+///List the blocks of the particle types used in a file of a streaming reader, in pieces of at most the input chunk size
+void StreamListPieces(Options &opt, Stream_Reader &reader, int ifile, int icolumnsmask, vector<Stream_Block> &pieces);
+///Decode the blocks of the particle types used in a file of a streaming reader, passing each block to load
+void StreamDecodeFile(Options &opt, Stream_Reader &reader, int ifile, int icolumnsmask, function<void(Stream_Block&)> load);
+///Decode the files listed, concurrently if the format allows it, loading the blocks on the calling thread
+void StreamDecodeFiles(Options &opt, Stream_Reader &reader, const vector<int> &files, int icolumnsmask, function<void(Stream_Block&)> load,
+    function<void(int)> filedone=nullptr);
+///Convert the particles of a decoded block to code units, flagging those kept when subsampling
+void StreamConvertBlock(Options &opt, Stream_Reader &reader, Stream_Block &b, vector<Particle> &Pblock, vector<int> &ikeep);
+///Read the particles of an input described by a streaming reader
+void StreamReadParticles(Options &opt, Stream_Reader &reader, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons);
+///Set the streaming reader of a tipsy file, reading its header
+struct tipsy_dump;
+void TipsySetStreamReader(Options &opt, Stream_Reader &reader, tipsy_dump &header, fstream &Ftip, Double_t *posfirst);
+///Release the memory of the particles counted in the header but not stored, moving the baryons to follow the particles searched
+void CompactReadParticles(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons);
+///Rescale masses and linking lengths of a subsampled input
+void SubsampleAdjust(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons);
+///Find the region of a zoom simulation occupied by its high resolution dark matter
+void ZoomRegionFind(Options &opt);
+///Read the positions of the high resolution dark matter of gadget input
+void GadgetZoomRegionPositions(Options &opt, double &boxsize, function<void(const double*, Int_t)> add);
+#ifdef USEHDF
+///Read the positions of the high resolution dark matter of hdf input
+void HDFZoomRegionPositions(Options &opt, double &boxsize, function<void(const double*, Int_t)> add);
+#endif
 
 ///Read local velocity density
 void ReadLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part);
 ///Writes local velocity density of each particle to a file
 void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part);
 
+///Set the name of a checkpoint file
+void GetCheckpointFileName(Options &opt, int stage, char *fname);
+///Writes checkpoint of a completed stage of the search
+void WriteCheckpoint(Options &opt, int stage, vector<Particle> &Part, Int_t nbodies, Particle *Pbaryons, Int_t nbaryons, Int_t ngroup, Int_t nhalos,
+    Int_t *pfof, Int_t npfofall, Int_t *pfofall, Int_t npdata, PropData *pdata);
+///Returns the number of particles over all tasks stored in checkpoints
+long long GetCheckpointParticleTotal(Options &opt, Int_t nbodies, Int_t nbaryons);
+///Checks whether compatible checkpoint of a stage exists
+int CheckCheckpoint(Options &opt, int stage, long long ntotal);
+///Returns last stage for which all tasks have a checkpoint
+int GetCheckpointStage(Options &opt, Int_t nbodies, Int_t nbaryons);
+///Reads checkpoint of a completed stage of the search
+void ReadCheckpoint(Options &opt, int stage, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons, Int_t &ngroup, Int_t &nhalos,
+    Int_t *&pfof, Int_t &npfofall, Int_t *&pfofall, Int_t &npdata, PropData *&pdata);
+
 
 ///Writes a tipsy formatted fof.grpfile
-void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof);
+void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof, Particle *Part);
 ///Writes a pg list file (first in effective index order of input file(s), second is particle ids
 void WritePGList(Options &opt, const Int_t ngroups, const Int_t ng, Int_t *numingroup, Int_t **pglist, Int_t *ids);
 ///Write catalog information (number of groups, number in groups, number of particles in groups, particle pids)
@@ -122,6 +168,10 @@ void WriteExtendedOutput (Options &opt, Int_t numgroups, Int_t nbodies, PropData
 KDTree* InitializeTreeGrid(Options &opt, const Int_t nbodies, Particle *Part);
 ///Fill cells of grid from tree
 void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *&tree, Particle *Part, GridCell* &grid);
+///Set up and fill non-uniform grid using octree of Morton ordered particles
+GridCell* FillMortonGrid(Options &opt, const Int_t nbodies, Particle *Part, Int_t &ngrid);
+///Set up and fill grid of type given by \ref Options.gridtype
+GridCell* BuildGrid(Options &opt, const Int_t nbodies, Particle *Part, Int_t &ngrid);
 
 //@}
 
@@ -141,6 +191,14 @@ Matrix *GetCellVelDisp(Options &opt, const Int_t nbodies, Particle *Part, Int_t
 
 ///Calculate local velocity density
 void GetVelocityDensity(Options &opt, const Int_t nbodies, Particle *Part, KDTree *tree=NULL);
+#if defined(USEMPI) && !defined(HALOONLYDEN)
+///calculate the velocity density of a range of particles using local particles, flagging those whose search region overlaps other mpi domains
+void GetVelocityDensityLocalList(Options &opt, Particle *Part, KDTree *tree, Double_t *maxrdist, Int_t start, Int_t end, Int_t *list=NULL);
+///calculate the velocity density of flagged particles using local particles and those imported from other mpi domains
+void GetVelocityDensityImported(Options &opt, const Int_t nbodies, Particle *Part, KDTree *tree, Int_t nimport, Particle *Pimport, Double_t densityflag, Double_t *period);
+///calculate the velocity density processing particles near domain boundaries first so that communication overlaps the interior calculation
+void GetVelocityDensityOverlap(Options &opt, const Int_t nbodies, Particle *Part, KDTree *tree, Double_t *maxrdist, Double_t *period);
+#endif
 
 //@}
 
@@ -186,6 +244,10 @@ void HaloCoreGrowth(Options &opt, const Int_t nsubset, Particle *&Partsubset, In
 int CheckSignificance(Options &opt, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, Int_t *numingroups, Int_t *pfof, Int_t **pglist);
 ///Search for Baryonic structures associated with dark matter structures in phase-space
 Int_t* SearchBaryons(Options &opt, Int_t &nbaryons, Particle *&Pbaryons, const Int_t ndark, vector<Particle> &Partsubset, Int_t *&pfofdark, Int_t &ngroupdark, Int_t &nhalos, int ihaloflag=0, int iinclusive=0, PropData *phalos=NULL);
+///Build grid flagging cells overlapping spheres padded by the search length
+void BuildBaryonSearchGrid(const Int_t nspheres, Coordinate *centre, Double_t *radius, Double_t searchlength, Double_t *period, BaryonSearchGrid &grid);
+///Get spatially sorted list of baryons lying in flagged cells of the grid, returning the number of baryons in the list
+Int_t GetBaryonSearchOrder(BaryonSearchGrid &grid, const Int_t nbaryons, Particle *Pbaryons, Int_t *order);
 ///Get the hierarchy of structures found
 Int_t GetHierarchy(Options &opt, Int_t ngroups, Int_t *nsub, Int_t *parentgid, Int_t *uparentgid, Int_t *stype);
 ///Copy hierarchy to PropData structure
@@ -194,6 +256,19 @@ void CopyHierarchy(Options &opt, PropData *pdata,Int_t ngroups, Int_t *nsub, Int
 void AdjustStructureForPeriod(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t numgroups, Int_t *pfof);
 //@}
 
+/// \name Grid based FOF search of small particle sets
+/// see \ref fofgrid.cxx for implementation
+//@{
+
+///FOF search using a hash grid of occupied cells of linking length size in 3D or 6D, returning NULL if grid cannot be constructed
+Int_t *FOFCriterionGrid(const Int_t nbodies, Particle *Part, int griddim, FOFcompfunc cmp, Double_t *params, Int_t &numgroup, Int_t minnum=8, int order=0, int ipcheckflag=0, FOFcheckfunc check=Pnocheck,
+    Int_tree_t *pHead=NULL, Int_tree_t *pNext=NULL, Int_tree_t *pTail=NULL, Int_tree_t *pLen=NULL);
+///FOF search using the grid for small particle sets and the tree otherwise
+Int_t *FOFCriterionGridOrTree(Options &opt, KDTree *tree, const Int_t nbodies, Particle *Part, int griddim, FOFcompfunc cmp, Double_t *params, Int_t &numgroup, Int_t minnum=8, int order=0, int ipcheckflag=0, FOFcheckfunc check=Pnocheck);
+///Report timing of grid and tree FOF searches of the same particle set
+void FOFGridBenchmarkReport(Options &opt, const Int_t nbodies, Double_t tgrid, Double_t ttree, Int_t *pfofgrid, Int_t nggrid, Int_t *pfoftree, Int_t ngtree);
+//@}
+
 /// \name Extra routines used in iterative search
 //@{
 
@@ -328,6 +403,10 @@ void MPIInitialDomainDecomposition();
 void MPIDomainExtent(Options &opt);
 ///domain decomposition
 void MPIDomainDecomposition(Options &opt);
+///decompose the high resolution region of a zoom simulation rather than the whole box
+void MPIZoomRegionExtent(Options &opt);
+///extend the domains on the edges of the high resolution region to the edges of the box
+void MPIZoomRegionDomainEdges(Options &opt);
 
 ///Determine Domain Extent for tipsy input
 void MPIDomainExtentTipsy(Options &opt);
@@ -378,6 +457,10 @@ void MPINumInDomainHDF(Options &opt);
 #endif
 /// Determine number of local particles for Nchilada
 void MPINumInDomainNchilada(Options &opt);
+///Determine the extent of the particles read by a streaming reader
+void MPIDomainExtentStream(Options &opt, Stream_Reader &reader);
+/// Determine number of local particles for an input read by a streaming reader
+void MPINumInDomainStream(Options &opt, Stream_Reader &reader);
 
 ///adjust the domain boundaries to code units
 void MPIAdjustDomain(Options opt);
@@ -391,11 +474,99 @@ int MPISearchForOverlapUsingMesh(Options &opt, Particle &Part, Double_t &rdist);
 int MPISearchForOverlap(Double_t xsearch[3][2]);
 ///determine if search domain overlaps domain
 int MPIInDomain(Double_t xsearch[3][2], Double_t bnd[3][2]);
+///determine if search domain overlaps the domain of a task, using the space filling curve key ranges if enabled
+int MPIInDomain(Double_t xsearch[3][2], int task);
 
 ///determine list of cells of a mesh within a search domain
 vector<int> MPIGetCellListInSearchUsingMesh(Options &opt, Double_t xsearch[3][2], bool ignorelocalcells=true);
 //@}
 
+/// \name MPI space filling curve domain decomposition
+/// see \ref mpiroutines.cxx for implementation
+//@{
+///Peano-Hilbert key of a cell of the space filling curve mesh
+unsigned int MPISFCKey(unsigned int ix, unsigned int iy, unsigned int iz);
+///Peano-Hilbert key of the mesh cell containing a position
+unsigned int MPISFCGetKey(Double_t x, Double_t y, Double_t z);
+///task whose key range contains a key
+int MPISFCGetTask(unsigned int key);
+///set domain bounding boxes from the key ranges
+void MPISFCSetDomainBounds();
+///initial space filling curve decomposition with key ranges of equal length
+void MPISFCInitialDomainDecomposition();
+///check whether the mesh cells of a search region lie in the key range of a task
+int MPISFCSearchInDomain(Double_t xsearch[3][2], int task);
+///move particles to the task owning their key
+void MPISFCExchangeParticles(vector<Particle> &Part, Int_t &nlocal, vector<unsigned int> &keys);
+///rebalance the space filling curve decomposition by estimated work once particles are loaded
+void MPISFCDomainDecomposition(Options &opt, vector<Particle> &Part, Particle *&Pbaryons, Int_t &nbaryons);
+///report the particle and work imbalance across tasks
+void MPIReportDomainImbalance(const char *stage, Int_t nlocal, Double_t relwork=-1);
+//@}
+
+/// \name MPI work balancing of field structures
+/// see \ref mpiroutines.cxx for implementation
+//@{
+///redistribute field structures across tasks by estimated substructure search cost
+Int_t MPIGroupRebalance(Options &opt, vector<Particle> &Part, const Int_t nbodies, Int_t *&pfof, Int_t &ngroup, PropData *&pdata);
+///report the spread across tasks of the time taken by some stage
+void MPIReportTimeImbalance(const char *stage, double time);
+///get the current and peak resident memory of this task
+void MPIGetMemoryUsage(double &current, double &peak);
+///report the high-water mark of the memory used by each task during some stage
+void MPIReportMemoryUsage(Options &opt, const char *stage);
+//@}
+
+/// \name MPI sparse exchange of communication counts
+/// see \ref mpiroutines.cxx for implementation
+//@{
+///determine the number of items received from every task given the number sent to every task, communicating only between tasks that exchange data
+void MPISparseCounts(const Int_t *nsend, Int_t *nrecv);
+///store the local send counts in \ref mpi_nsend and the resulting receive counts in \ref mpi_nrecv
+void MPIExchangeCounts(const Int_t *nsend_local);
+//@}
+
+/// \name MPI hierarchical communication
+/// see \ref mpiroutines.cxx for implementation
+//@{
+///find the tasks sharing each node and set up the communicators used by hierarchical exchanges
+void MPIInitNodeTopology(Options &opt);
+//@}
+
+/// \name MPI progress thread
+/// see \ref mpiroutines.cxx for implementation
+//@{
+///start a thread that progresses nonblocking communication, if requested and the mpi library allows it
+void MPIStartProgressThread(Options &opt);
+///stop and join the progress thread, called before every MPI_Finalize and MPI_Abort
+void MPIStopProgressThread();
+//@}
+
+/// \name MPI nonblocking exchanges overlapped with local computation
+/// see \ref mpiroutines.cxx for implementation
+//@{
+///test if a pending exchange has completed
+void MPIPollExchange(mpi_pending_exchange &pending);
+///complete a pending exchange and accumulate its timing
+void MPIFinishExchange(mpi_pending_exchange &pending);
+///add time spent in blocking communication to the timing of an overlapped stage
+void MPIAddBlockingCommTime(mpi_pending_exchange &pending, double time);
+///report the communication time of an overlapped stage and how much of it was hidden
+void MPIReportCommOverlap(const char *stage, mpi_pending_exchange &pending);
+//@}
+
+/// \name MPI derived datatypes of the compact particle records exchanged in searches
+/// see \ref mpiroutines.cxx for implementation
+//@{
+///build and commit a struct datatype with the given fields whose extent is that of the record
+MPI_Datatype MPIBuildRecordType(int nfields, int *blocklengths, MPI_Aint *displacements, MPI_Datatype *types, MPI_Aint extent);
+///datatypes of the individual records, the argument only selects the record type
+MPI_Datatype MPIRecordType(partposdata_in *);
+MPI_Datatype MPIRecordType(partphasedata_in *);
+MPI_Datatype MPIRecordType(partnndata_in *);
+MPI_Datatype MPIRecordType(partsodata_in *);
+//@}
+
 /// \name MPI send/recv related routines when reading input data
 /// see \ref mpiroutines.cxx for implementation
 //@{
@@ -427,14 +598,16 @@ void MPIGetExportNumUsingMesh(Options &opt, const Int_t nbodies, Particle *Part,
 void MPIBuildParticleExportList(const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Double_t rdist);
 ///Determine and send particles that need to be exported to another mpi thread from local mpi thread based on rdist using the SWIFT mesh
 void MPIBuildParticleExportListUsingMesh(Options &opt, const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Double_t rdist);
-///Link groups across MPI threads using a physical search
-Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2);
-///Link groups across MPI threads using criterion
-Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2, FOFcompfunc &cmp, Double_t *params);
-///Link groups across MPI threads checking particle types
-Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2, FOFcheckfunc &check, Double_t *params);
-///update export list after after linking across
-void MPIUpdateExportList(const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_tree_t *&Len);
+///Determine the particles that need to be exported before the local search and start sending their positions
+void MPIStartParticleExport(const Int_t nbodies, Particle *Part, Double_t rdist, vector<partposdata_in> &exportbuf, vector<partposdata_in> &importbuf, mpi_pending_exchange &pending);
+///Complete the export started with \ref MPIStartParticleExport and send the group ids of the exported particles
+void MPIFinishParticleExport(Particle *Part, Int_t *pfof, Int_tree_t *Len, mpi_pending_exchange &pending);
+///Link groups across MPI threads using a physical search, resolving groups with a distributed union-find
+Int_t MPILinkAcrossUnionFind(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Double_t rdist2, vector<partposdata_in> *imported=NULL);
+///Link groups across MPI threads using criterion, resolving groups with a distributed union-find
+Int_t MPILinkAcrossUnionFind(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Double_t rdist2, FOFcompfunc &cmp, Double_t *params);
+///Link groups across MPI threads checking particle types, resolving groups with a distributed union-find
+Int_t MPILinkAcrossUnionFind(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Double_t rdist2, FOFcheckfunc &check, Double_t *params, vector<partposdata_in> *imported=NULL);
 ///localize groups to a single mpi thread
 Int_t MPIGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof);
 ///Determine the local number of groups and their sizes (groups must be local to an mpi thread)
@@ -444,8 +617,8 @@ Int_t MPIBaryonGroupExchange(const Int_t nbodies, Particle *Part, Int_t *&pfof);
 ///similar to \ref MPICompileGroups but optimised for separate baryon search, assumes only looking at baryons
 Int_t MPIBaryonCompileGroups(const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_t minsize, int iorder=1);
 ///localize baryons particle members of groups to a single mpi thread
-///Collect FOF from all
-void MPICollectFOF(const Int_t nbodies, Int_t *&pfof);
+///Set the offset of the local group ids and the total number of groups
+void MPIUpdateGroupOffsets(const Int_t ngroups);
 ///comparison function to order particles for export
 int fof_export_cmp(const void *a, const void *b);
 ///comparison function to order particles for export and fof group localization.
@@ -472,6 +645,8 @@ void MPIGetNNExportNumUsingMesh(Options &opt, const Int_t nbodies, Particle *Par
 #endif
 ///Determine and send particles that need to be exported to another mpi thread from local mpi thread based on array of distances for each particle for NN search
 void MPIBuildParticleNNExportList(const Int_t nbodies, Particle *Part, Double_t *rdist);
+///Determine the particles that need to be exported for the NN search and start sending them
+void MPIStartParticleNNExport(const Int_t nbodies, Particle *Part, Double_t *rdist, mpi_pending_exchange &pending);
 #ifdef SWIFTINTERFACE
 ///Determine and send particles that need to be exported to another mpi thread from local mpi thread based on array of distances for each particle for NN search
 void MPIBuildParticleNNExportListUsingMesh(Options &opt, const Int_t nbodies, Particle *Part, Double_t *rdist);
@@ -480,15 +655,17 @@ void MPIBuildParticleNNExportListUsingMesh(Options &opt, const Int_t nbodies, Pa
 void MPIGetNNImportNum(const Int_t nbodies, KDTree *tree, Particle *Part);
 ///Determine local particles that need to be exported back based on ball search.
 Int_t MPIBuildParticleNNImportList(const Int_t nbodies, KDTree *tree, Particle *Part, int iallflag=true);
+///Determine local particles that need to be exported back based on ball search and start sending them
+Int_t MPIStartParticleNNImport(const Int_t nbodies, KDTree *tree, Particle *Part, int iallflag, vector<partnndata_in> &exportbuf, vector<partnndata_in> &importbuf, mpi_pending_exchange &pending);
+///Complete the exchange started with \ref MPIStartParticleNNImport, storing the received particles in PartDataGet
+void MPIFinishParticleNNImport(vector<partnndata_in> &importbuf, mpi_pending_exchange &pending);
 ///comparison function to order particles for export
 int nn_export_cmp(const void *a, const void *b);
 ///Determine number of halos whose search regions overlap other mpi domains
 vector<bool> MPIGetHaloSearchExportNum(const Int_t ngroups, PropData *&pdata, vector<Double_t> &rdist);
 ///Build the export list of halo positions and search distances
 void MPIBuildHaloSearchExportList(const Int_t ngroup, PropData *&pdata, vector<Double_t> &rdist, vector<bool> &halooverlap);
-///Determine number of imported particles based on halo search regions
-void MPIGetHaloSearchImportNum(const Int_t nbodies, KDTree *tree, Particle *Part);
-///Builds the import list of particles based on halo positions
+///Builds the import list of particles based on halo positions, allocating and filling PartDataGet
 Int_t MPIBuildHaloSearchImportList(const Int_t nbodies, KDTree *tree, Particle *Part);
 //@}
 #endif
@@ -76,17 +76,60 @@ int RAMSES_fortran_skip(fstream &F, int nskips){
     return byteoffset;
 }
 
+///Reads a part file in one go and decodes the records of the properties selected by iflags (see \ref RAMSESPARTPOS and so on).
+///Files lacking ages and metallicities, as written by dark matter only runs, leave these zero. Returns 0 if the file can not be read.
+int RAMSES_read_part_file(const char *fname, RAMSES_Part_Data &pdata, int iflags)
+{
+    fortran_file_records records;
+    int irec, nrec, iok=1;
+    if (!records.Open(fname)) return 0;
+    nrec=records.NumRecords();
+    //header of ncpu, ndim, npartlocal, local seeds, nstartot, mstartot, mstarlost, nsink
+    if (nrec<8) return 0;
+    iok&=RAMSESRecordValues(records.Record(1),records.nbytes[1],&pdata.ndim,1);
+    iok&=RAMSESRecordValues(records.Record(2),records.nbytes[2],&pdata.npartlocal,1);
+    iok&=RAMSESRecordValues(records.Record(7),records.nbytes[7],&pdata.nsink,1);
+    if (!iok || nrec<11+2*pdata.ndim) return 0;
+    size_t n=pdata.npartlocal;
+    auto decode=[&](int iflag, int ifirst, vector<RAMSESFLOAT> &values, int ndim) {
+        if (!(iflags&iflag)) return;
+        values.resize(ndim*n);
+        for (int idim=0;idim<ndim;idim++) iok&=RAMSESRecordValues(records.Record(ifirst+idim),records.nbytes[ifirst+idim],&values[idim*n],n);
+    };
+    irec=8;
+    decode(RAMSESPARTPOS,irec,pdata.x,pdata.ndim);
+    irec+=pdata.ndim;
+    decode(RAMSESPARTVEL,irec,pdata.v,pdata.ndim);
+    irec+=pdata.ndim;
+    decode(RAMSESPARTMASS,irec++,pdata.mass,1);
+    if (iflags&RAMSESPARTID) {
+        pdata.id.resize(n);
+        iok&=RAMSESRecordValues(records.Record(irec),records.nbytes[irec],pdata.id.data(),n);
+    }
+    irec++;
+    if (iflags&RAMSESPARTLEVEL) {
+        pdata.level.resize(n);
+        iok&=RAMSESRecordValues(records.Record(irec),records.nbytes[irec],pdata.level.data(),n);
+    }
+    irec++;
+    //skip the one byte family and tag records of newer outputs
+    while (irec<nrec && n>0 && records.nbytes[irec]==n) irec++;
+    if (iflags&RAMSESPARTAGE) pdata.age.assign(n,0);
+    if (iflags&RAMSESPARTMET) pdata.met.assign(n,0);
+    if (irec<nrec) decode(RAMSESPARTAGE,irec++,pdata.age,1);
+    if (irec<nrec) decode(RAMSESPARTMET,irec++,pdata.met,1);
+    return iok;
+}
+
 Int_t RAMSES_get_nbodies(char *fname, int ptype, Options &opt)
 {
     char buf[2000],buf1[2000],buf2[2000];
-    double * dummy_age, * dummy_mass;
     double dmp_mass;
     double OmegaM, OmegaB;
     int totalghost = 0;
     int totalstars = 0;
     int totaldm    = 0;
     int alltotal   = 0;
-    int ghoststars = 0;
     string stringbuf;
     sprintf(buf1,"%s/amr_%s.out00001",fname,opt.ramsessnapname);
     sprintf(buf2,"%s/amr_%s.out",fname,opt.ramsessnapname);
@@ -295,118 +338,47 @@ Int_t RAMSES_get_nbodies(char *fname, int ptype, Options &opt)
     Finfo.close();
     dmp_mass = 1.0 / (opt.Neff*opt.Neff*opt.Neff) * (OmegaM - OmegaB) / OmegaM;
 
-    //now particle info
+    //now particle info, with the part files read concurrently as they are only needed for the number of particles of each type
+    int nsinktotal=0;
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(dynamic,1) private(j) reduction(+:totalghost,totalstars,totaldm,alltotal,ireaderror)
+#endif
     for (i=0;i<ramses_header_info.num_files;i++)
     {
-        sprintf(buf1,"%s/part_%s.out%05d",fname,opt.ramsessnapname,i+1);
-        sprintf(buf2,"%s/part_%s.out",fname,opt.ramsessnapname);
-        if (FileExists(buf1)) sprintf(buf,"%s",buf1);
-        else if (FileExists(buf2)) sprintf(buf,"%s",buf2);
-        Framses.open(buf, ios::binary|ios::in);
-
-        ramses_header_info.npart[RAMSESDMTYPE]   = 0;
-        ramses_header_info.npart[RAMSESSTARTYPE] = 0;
-        ramses_header_info.npart[RAMSESSINKTYPE] = 0;
-
-        //number of cpus
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        //number of dimensions
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Total number of LOCAL particles
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&ramses_header_info.npartlocal, sizeof(int));
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Random seeds
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Total number of Stars over all processors
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&ramses_header_info.nstarTotal, sizeof(int));
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Total mass of stars
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Total lost mass of stars
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Number of sink particles over the whole simulation (all are included in
-        // all processors)
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&ramses_header_info.npartTotal[RAMSESSINKTYPE], sizeof(int));
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        //to determine how many particles of each type, need to look at the mass
-        // Skip pos, vel, mass
-        for (j = 0; j < 6; j++)
+        char fbuf[2000];
+        RAMSES_Part_Data pdata;
+        int ndm=0, nstar=0, nghost=0;
+        sprintf(fbuf,"%s/part_%s.out%05d",fname,opt.ramsessnapname,i+1);
+        if (!FileExists(fbuf)) sprintf(fbuf,"%s/part_%s.out",fname,opt.ramsessnapname);
+        //masses and ages are necessary to separate ghost star particles with negative ages from real one
+        if (!RAMSES_read_part_file(fbuf,pdata,RAMSESPARTMASS|RAMSESPARTAGE)) {ireaderror++;continue;}
+        for (j = 0; j < pdata.npartlocal; j++)
         {
-            Framses.read((char*)&dummy, sizeof(dummy));
-            Framses.seekg(dummy,ios::cur);
-            Framses.read((char*)&dummy, sizeof(dummy));
-        }
-        //allocate memory to store masses and ages
-        dummy_mass = new double [ramses_header_info.npartlocal];
-        dummy_age  = new double [ramses_header_info.npartlocal];
-
-        // Read Mass
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&dummy_mass[0], dummy);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Skip Id
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Skip level
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Read Birth epoch
-        //necessary to separate ghost star particles with negative ages from real one
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&dummy_age[0], dummy);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        ghoststars = 0;
-        for (j = 0; j < ramses_header_info.npartlocal; j++)
-        {
-            if (fabs((dummy_mass[j]-dmp_mass)/dmp_mass) < 1e-5)
-                ramses_header_info.npart[RAMSESDMTYPE]++;
+            if (fabs((pdata.mass[j]-dmp_mass)/dmp_mass) < 1e-5)
+                ndm++;
             else
-                if (dummy_age[j] != 0.0)
-                    ramses_header_info.npart[RAMSESSTARTYPE]++;
+                if (pdata.age[j] != 0.0)
+                    nstar++;
                 else
-                ghoststars++;
+                nghost++;
         }
-        delete [] dummy_age;
-        delete [] dummy_mass;
-        Framses.close();
-
-        totalghost += ghoststars;
-        totalstars += ramses_header_info.npart[RAMSESSTARTYPE];
-        totaldm    += ramses_header_info.npart[RAMSESDMTYPE];
-        alltotal   += ramses_header_info.npartlocal;
-
-        //now with information loaded, set totals
-        ramses_header_info.npartTotal[RAMSESDMTYPE]+=ramses_header_info.npart[RAMSESDMTYPE];
-        ramses_header_info.npartTotal[RAMSESSTARTYPE]+=ramses_header_info.npart[RAMSESSTARTYPE];
-        ramses_header_info.npartTotal[RAMSESSINKTYPE]+=ramses_header_info.npart[RAMSESSINKTYPE];
+        // Number of sink particles over the whole simulation (all are included in
+        // all processors)
+        if (i==ramses_header_info.num_files-1) nsinktotal=pdata.nsink;
+
+        totalghost += nghost;
+        totalstars += nstar;
+        totaldm    += ndm;
+        alltotal   += pdata.npartlocal;
+    }
+    if (ireaderror) {
+        printf("Error. Can't read the particle data of %d files\n", ireaderror);
+        exit(9);
     }
+    //now with information loaded, set totals
+    ramses_header_info.npartTotal[RAMSESDMTYPE]+=totaldm;
+    ramses_header_info.npartTotal[RAMSESSTARTYPE]+=totalstars;
+    ramses_header_info.npartTotal[RAMSESSINKTYPE]=nsinktotal;
     for(j=0, nbodies=0; j<nusetypes; j++) {
         k=usetypes[j];
         nbodies+=ramses_header_info.npartTotal[k];
@@ -426,19 +398,19 @@ Int_t RAMSES_get_nbodies(char *fname, int ptype, Options &opt)
 /// assuming LCDM or small deviations from this) to estimate the mean interparticle
 /// spacing and scales physical linking length passed by this distance. Also reads
 /// header and overrides passed cosmological parameters with ones stored in header.
-void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Particle *&Pbaryons, Int_t nbaryons)
+void ReadRamses(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons)
 {
     char buf[2000],buf1[2000],buf2[2000];
     string stringbuf,orderingstring;
     fstream Finfo;
     fstream *Famr;
     fstream *Fhydro;
-    fstream *Fpart, *Fpartvel,*Fpartid,*Fpartmass, *Fpartlevel, *Fpartage, *Fpartmet;
+    fstream *Fpart;
     RAMSES_Header *header;
     int intbuff[NRAMSESTYPE];
     long long longbuff[NRAMSESTYPE];
     int i,j,k,n,idim,ivar,igrid,ireaderror=0;
-    Int_t count2,bcount2;
+    Int_t count2,bcount2,ncellfile;
     //IntType inttype;
     int dummy,byteoffset;
     Double_t MP_DM=MAXVALUE,LN,N_DM,MP_B=0;
@@ -468,19 +440,13 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     ///\todo because of the stupid fortran format, easier if chunksize is BIG so that
     ///number of particles local to a file are smaller
     Int_t chunksize=RAMSESCHUNKSIZE,nchunk;
-    RAMSESFLOAT *xtempchunk, *vtempchunk, *mtempchunk, *sphtempchunk, *agetempchunk, *mettempchunk, *hydrotempchunk;
-    RAMSESIDTYPE *idvalchunk, *levelchunk;
+    RAMSESFLOAT *xtempchunk, *vtempchunk, *mtempchunk, *sphtempchunk, *agetempchunk, *hydrotempchunk;
+    RAMSESIDTYPE *idvalchunk;
     int *icellchunk;
 
     Famr       = new fstream[opt.num_files];
     Fhydro     = new fstream[opt.num_files];
     Fpart      = new fstream[opt.num_files];
-    Fpartvel   = new fstream[opt.num_files];
-    Fpartmass  = new fstream[opt.num_files];
-    Fpartid    = new fstream[opt.num_files];
-    Fpartlevel = new fstream[opt.num_files];
-    Fpartage   = new fstream[opt.num_files];
-    Fpartmet   = new fstream[opt.num_files];
     header     = new RAMSES_Header[opt.num_files];
 
 #ifdef USEMPI
@@ -495,10 +461,8 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     int *irecv, sendTask,recvTask,irecvflag, *mpi_irecvflag;
     MPI_Request *mpi_request;
     Int_t inreadsend,totreadsend;
-    Int_t *mpi_nsend_baryon;
     Int_t *mpi_nsend_readthread;
     Int_t *mpi_nsend_readthread_baryon;
-    if (opt.iBaryonSearch) mpi_nsend_baryon=new Int_t[NProcs*NProcs];
     if (opt.nsnapread>1) {
         mpi_nsend_readthread=new Int_t[opt.nsnapread*opt.nsnapread];
         if (opt.iBaryonSearch) mpi_nsend_readthread_baryon=new Int_t[opt.nsnapread*opt.nsnapread];
@@ -658,213 +622,119 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     if (ireadtask[ThisTask]>=0) {
         inreadsend=0;
 #endif
-    //read particle files consists of positions,velocities, mass, id, and level (along with ages and met if some flags set)
-    for (i=0;i<opt.num_files;i++) {
-    if (ireadfile[i]) {
-        sprintf(buf1,"%s/part_%s.out%05d",opt.fname,opt.ramsessnapname,i+1);
-        sprintf(buf2,"%s/part_%s.out",opt.fname,opt.ramsessnapname);
-        if (FileExists(buf1)) sprintf(buf,"%s",buf1);
-        else if (FileExists(buf2)) sprintf(buf,"%s",buf2);
-        Fpart[i].open(buf, ios::binary|ios::in);
-        Fpartvel[i].open(buf, ios::binary|ios::in);
-        Fpartmass[i].open(buf, ios::binary|ios::in);
-        Fpartid[i].open(buf, ios::binary|ios::in);
-        Fpartlevel[i].open(buf, ios::binary|ios::in);
-        Fpartage[i].open(buf, ios::binary|ios::in);
-        Fpartmet[i].open(buf, ios::binary|ios::in);
-
-        //skip header information in each file save for number in the file
-        //@{
-        byteoffset=0;
-        // ncpus
-        byteoffset+=RAMSES_fortran_skip(Fpart[i]);
-        // ndims
-        byteoffset+=RAMSES_fortran_skip(Fpart[i]);
-        // store number of particles locally in file
-        byteoffset+=RAMSES_fortran_read(Fpart[i],header[i].npartlocal);
-        // skip local seeds, nstartot, mstartot, mstarlost, nsink
-        byteoffset+=RAMSES_fortran_skip(Fpart[i],5);
-
-        //byteoffset now stores size of header offset for particles
-        Fpartvel[i].seekg(byteoffset,ios::cur);
-        Fpartmass[i].seekg(byteoffset,ios::cur);
-        Fpartid[i].seekg(byteoffset,ios::cur);
-        Fpartlevel[i].seekg(byteoffset,ios::cur);
-        Fpartage[i].seekg(byteoffset,ios::cur);
-        Fpartmet[i].seekg(byteoffset,ios::cur);
-        //skip positions
-        for(idim=0;idim<header[ifirstfile].ndim;idim++)
-        {
-            RAMSES_fortran_skip(Fpartvel[i]);
-            RAMSES_fortran_skip(Fpartmass[i]);
-            RAMSES_fortran_skip(Fpartid[i]);
-            RAMSES_fortran_skip(Fpartlevel[i]);
-            RAMSES_fortran_skip(Fpartage[i]);
-            RAMSES_fortran_skip(Fpartmet[i]);
-        }
-        //skip velocities
-        for(idim=0;idim<header[ifirstfile].ndim;idim++)
-        {
-            RAMSES_fortran_skip(Fpartmass[i]);
-            RAMSES_fortran_skip(Fpartid[i]);
-            RAMSES_fortran_skip(Fpartlevel[i]);
-            RAMSES_fortran_skip(Fpartage[i]);
-            RAMSES_fortran_skip(Fpartmet[i]);
+    //read particle files consists of positions,velocities, mass, id, and level (along with ages and met if some flags set).
+    //Files are read in batches, each thread loading and decoding whole files, and their particles are then added in file order
+    //so that particles are stored in the same order whatever the number of threads
+    vector<int> ireadlist;
+    for (i=0;i<opt.num_files;i++) if (ireadfile[i]) ireadlist.push_back(i);
+    int nbatch=1;
+#ifdef USEOPENMP
+    nbatch=omp_get_max_threads();
+#endif
+    vector<RAMSES_Part_Data> pdata(nbatch);
+    for (size_t ibatch=0;ibatch<ireadlist.size();ibatch+=nbatch) {
+        int nbatchfiles=min(nbatch,(int)(ireadlist.size()-ibatch));
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(dynamic,1) reduction(+:ireaderror)
+#endif
+        for (int ifile=0;ifile<nbatchfiles;ifile++) {
+            char fbuf[2000];
+            sprintf(fbuf,"%s/part_%s.out%05d",opt.fname,opt.ramsessnapname,ireadlist[ibatch+ifile]+1);
+            if (!FileExists(fbuf)) sprintf(fbuf,"%s/part_%s.out",opt.fname,opt.ramsessnapname);
+            if (!RAMSES_read_part_file(fbuf,pdata[ifile],RAMSESPARTPOS|RAMSESPARTVEL|RAMSESPARTMASS|RAMSESPARTID|RAMSESPARTAGE)) ireaderror++;
         }
-        //skip mass
-        RAMSES_fortran_skip(Fpartid[i]);
-        RAMSES_fortran_skip(Fpartlevel[i]);
-        RAMSES_fortran_skip(Fpartage[i]);
-        RAMSES_fortran_skip(Fpartmet[i]);
-        //skip ids;
-        RAMSES_fortran_skip(Fpartlevel[i]);
-        RAMSES_fortran_skip(Fpartage[i]);
-        RAMSES_fortran_skip(Fpartmet[i]);
-        //skip levels
-        RAMSES_fortran_skip(Fpartage[i]);
-        RAMSES_fortran_skip(Fpartmet[i]);
-        //skip ages
-        RAMSES_fortran_skip(Fpartmet[i]);
-        //@}
-
-        //data loaded into memory in chunks
-        chunksize    = nchunk = header[i].npartlocal;
-        xtempchunk   = new RAMSESFLOAT  [3*chunksize];
-        vtempchunk   = new RAMSESFLOAT  [3*chunksize];
-        mtempchunk   = new RAMSESFLOAT  [chunksize];
-        idvalchunk   = new RAMSESIDTYPE [chunksize];
-        levelchunk   = new RAMSESIDTYPE [chunksize];
-        agetempchunk = new RAMSESFLOAT  [chunksize];
-        mettempchunk = new RAMSESFLOAT  [chunksize];
-
-        for(idim=0;idim<header[ifirstfile].ndim;idim++)
-        {
-            RAMSES_fortran_read(Fpart[i],&xtempchunk[idim*nchunk]);
-            RAMSES_fortran_read(Fpartvel[i],&vtempchunk[idim*nchunk]);
+        if (ireaderror) {
+            cerr<<ThisTask<<" could not read "<<ireaderror<<" ramses particle files"<<endl;
+#ifdef USEMPI
+            MPIStopProgressThread();
+            MPI_Abort(MPI_COMM_WORLD,9);
+#else
+            exit(9);
+#endif
         }
-        RAMSES_fortran_read(Fpartmass[i],  mtempchunk);
-        RAMSES_fortran_read(Fpartid[i],    idvalchunk);
-        RAMSES_fortran_read(Fpartlevel[i], levelchunk);
-        RAMSES_fortran_read(Fpartage[i],   agetempchunk);
-        RAMSES_fortran_read(Fpartmet[i],   mettempchunk);
-
-        RAMSES_fortran_read(Fpartid[i],idvalchunk);
-        for (int nn=0;nn<nchunk;nn++)
-        {
-            if (fabs((mtempchunk[nn]-dmp_mass)/dmp_mass) > 1e-5 && (agetempchunk[nn] == 0.0))
+        for (int ifile=0;ifile<nbatchfiles;ifile++) {
+            i=ireadlist[ibatch+ifile];
+            header[i].npartlocal=pdata[ifile].npartlocal;
+            nchunk=header[i].npartlocal;
+            xtempchunk   = pdata[ifile].x.data();
+            vtempchunk   = pdata[ifile].v.data();
+            mtempchunk   = pdata[ifile].mass.data();
+            idvalchunk   = pdata[ifile].id.data();
+            agetempchunk = pdata[ifile].age.data();
+            for (int nn=0;nn<nchunk;nn++)
             {
-              //  GHOST PARTIRCLE!!!
-            }
-            else
-            {
-                xtemp[0] = xtempchunk[nn];
-                xtemp[1] = xtempchunk[nn+nchunk];
-                xtemp[2] = xtempchunk[nn+2*nchunk];
+                if (fabs((mtempchunk[nn]-dmp_mass)/dmp_mass) > 1e-5 && (agetempchunk[nn] == 0.0))
+                {
+                  //  GHOST PARTIRCLE!!!
+                }
+                //particles not kept when subsampling are skipped like ghosts
+                else if (SubsampleKeep(opt,idvalchunk[nn]))
+                {
+                    xtemp[0] = xtempchunk[nn];
+                    xtemp[1] = xtempchunk[nn+nchunk];
+                    xtemp[2] = xtempchunk[nn+2*nchunk];
 
-                vtemp[0] = vtempchunk[nn];
-                vtemp[1] = vtempchunk[nn+nchunk];
-                vtemp[2] = vtempchunk[nn+2*nchunk];
+                    vtemp[0] = vtempchunk[nn];
+                    vtemp[1] = vtempchunk[nn+nchunk];
+                    vtemp[2] = vtempchunk[nn+2*nchunk];
 
-                idval = idvalchunk[nn];
+                    idval = idvalchunk[nn];
 
-                ///Need to check this for correct 'endianness'
-//             for (int kk=0;kk<3;kk++) {xtemp[kk]=LittleRAMSESFLOAT(xtemp[kk]);vtemp[kk]=LittleRAMSESFLOAT(vtemp[kk]);}
+                    ///Need to check this for correct 'endianness'
+    //             for (int kk=0;kk<3;kk++) {xtemp[kk]=LittleRAMSESFLOAT(xtemp[kk]);vtemp[kk]=LittleRAMSESFLOAT(vtemp[kk]);}
 #ifndef NOMASS
-            mtemp=mtempchunk[nn];
+                mtemp=mtempchunk[nn];
 #else
-            mtemp=1.0;
+                mtemp=1.0;
 #endif
-            ageval = agetempchunk[nn];
-            if (fabs((mtemp-dmp_mass)/dmp_mass) < 1e-5) typeval = DARKTYPE;
-            else typeval = STARTYPE;
-/*
-            if (ageval==0 && idval>0) typeval=DARKTYPE;
-            else if (idval>0) typeval=STARTYPE;
-            else typeval=BHTYPE;
-*/
+                ageval = agetempchunk[nn];
+                //type is set from the mass stored in the file, as when counting particles in each domain
+                if (fabs((mtempchunk[nn]-dmp_mass)/dmp_mass) < 1e-5) typeval = DARKTYPE;
+                else typeval = STARTYPE;
+    /*
+                if (ageval==0 && idval>0) typeval=DARKTYPE;
+                else if (idval>0) typeval=STARTYPE;
+                else typeval=BHTYPE;
+    */
 #ifdef USEMPI
-            //determine processor this particle belongs on based on its spatial position
-            ibuf=MPIGetParticlesProcessor(xtemp[0],xtemp[1],xtemp[2]);
-            ibufindex=ibuf*BufSize+Nbuf[ibuf];
+                //determine processor this particle belongs on based on its spatial position
+                ibuf=MPIGetParticlesProcessor(xtemp[0],xtemp[1],xtemp[2]);
+                ibufindex=ibuf*BufSize+Nbuf[ibuf];
 #endif
-            //reset hydro quantities of buffer
+                //reset hydro quantities of buffer
 #ifdef GASON
-            Pbuf[ibufindex].SetU(0);
+                Pbuf[ibufindex].SetU(0);
 #ifdef STARON
-            Pbuf[ibufindex].SetSFR(0);
-            Pbuf[ibufindex].SetZmet(0);
+                Pbuf[ibufindex].SetSFR(0);
+                Pbuf[ibufindex].SetZmet(0);
 #endif
 #endif
 #ifdef STARON
-            Pbuf[ibufindex].SetZmet(0);
-            Pbuf[ibufindex].SetTage(0);
+                Pbuf[ibufindex].SetZmet(0);
+                Pbuf[ibufindex].SetTage(0);
 #endif
 #ifdef BHON
 #endif
 
-            if (opt.partsearchtype==PSTALL) {
-#ifdef USEMPI
-                Pbuf[ibufindex]=Particle(mtemp*mscale,
-                    xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
-                    vtemp[0]*opt.V+Hubbleflow*xtemp[0],
-                    vtemp[1]*opt.V+Hubbleflow*xtemp[1],
-                    vtemp[2]*opt.V+Hubbleflow*xtemp[2],
-                    count2,typeval);
-                Pbuf[ibufindex].SetPID(idval);
-#ifdef EXTENDEDFOFINFO
-                if (opt.iextendedoutput)
-                {
-                    Pbuf[ibufindex].SetOFile(i);
-                    Pbuf[ibufindex].SetOTask(ThisTask);
-                    Pbuf[ibufindex].SetOIndex(nn);
-                    Pbuf[ibufindex].SetPfof6d(0);
-                    Pbuf[ibufindex].SetPfof6dCore(0);
-                }
-#endif
-                Nbuf[ibuf]++;
-                MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocal, Part.data(), Nreadbuf, Preadbuf);
-#else
-                Part[count2]=Particle(mtemp*mscale,
-                    xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
-                    vtemp[0]*opt.V+Hubbleflow*xtemp[0],
-                    vtemp[1]*opt.V+Hubbleflow*xtemp[1],
-                    vtemp[2]*opt.V+Hubbleflow*xtemp[2],
-                    count2,typeval);
-                Part[count2].SetPID(idval);
-#ifdef EXTENDEDFOFINFO
-                if (opt.iextendedoutput)
-                {
-                  Part[count2].SetOFile(i);
-                  Part[count2].SetOTask(ThisTask);
-                  Part[count2].SetOIndex(nn);
-                  Part[count2].SetPfof6d(0);
-                  Part[count2].SetPfof6dCore(0);
-                }
-#endif
-#endif
-                count2++;
-            }
-            else if (opt.partsearchtype==PSTDARK) {
-                if (!(typeval==STARTYPE||typeval==BHTYPE)) {
+                if (opt.partsearchtype==PSTALL) {
 #ifdef USEMPI
                     Pbuf[ibufindex]=Particle(mtemp*mscale,
                         xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
                         vtemp[0]*opt.V+Hubbleflow*xtemp[0],
                         vtemp[1]*opt.V+Hubbleflow*xtemp[1],
                         vtemp[2]*opt.V+Hubbleflow*xtemp[2],
-                        count2,DARKTYPE);
+                        count2,typeval);
                     Pbuf[ibufindex].SetPID(idval);
 #ifdef EXTENDEDFOFINFO
                     if (opt.iextendedoutput)
                     {
-                      Pbuf[ibufindex].SetOFile(i);
-                      Pbuf[ibufindex].SetOTask(ThisTask);
-                      Pbuf[ibufindex].SetOIndex(nn);
-                      Pbuf[ibufindex].SetPfof6d(0);
-                      Pbuf[ibufindex].SetPfof6dCore(0);
+                        Pbuf[ibufindex].SetOFile(i);
+                        Pbuf[ibufindex].SetOTask(ThisTask);
+                        Pbuf[ibufindex].SetOIndex(nn);
+                        Pbuf[ibufindex].SetPfof6d(0);
+                        Pbuf[ibufindex].SetPfof6dCore(0);
                     }
 #endif
-                    //ensure that store number of particles to be sent to other reading threads
                     Nbuf[ibuf]++;
                     MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocal, Part.data(), Nreadbuf, Preadbuf);
 #else
@@ -888,131 +758,161 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
 #endif
                     count2++;
                 }
-                else if (opt.iBaryonSearch) {
+                else if (opt.partsearchtype==PSTDARK) {
+                    if (!(typeval==STARTYPE||typeval==BHTYPE)) {
 #ifdef USEMPI
-                    Pbuf[ibufindex]=Particle(mtemp*mscale,
-                        xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
-                        vtemp[0]*opt.V+Hubbleflow*xtemp[0],
-                        vtemp[1]*opt.V+Hubbleflow*xtemp[1],
-                        vtemp[2]*opt.V+Hubbleflow*xtemp[2],
-                        count2);
-                    Pbuf[ibufindex].SetPID(idval);
+                        Pbuf[ibufindex]=Particle(mtemp*mscale,
+                            xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
+                            vtemp[0]*opt.V+Hubbleflow*xtemp[0],
+                            vtemp[1]*opt.V+Hubbleflow*xtemp[1],
+                            vtemp[2]*opt.V+Hubbleflow*xtemp[2],
+                            count2,DARKTYPE);
+                        Pbuf[ibufindex].SetPID(idval);
 #ifdef EXTENDEDFOFINFO
-                    if (opt.iextendedoutput)
-                    {
-                      Pbuf[ibufindex].SetOFile(i);
-                      Pbuf[ibufindex].SetOTask(ThisTask);
-                      Pbuf[ibufindex].SetOIndex(nn);
-                      Pbuf[ibufindex].SetPfof6d(0);
-                      Pbuf[ibufindex].SetPfof6dCore(0);
-                    }
+                        if (opt.iextendedoutput)
+                        {
+                          Pbuf[ibufindex].SetOFile(i);
+                          Pbuf[ibufindex].SetOTask(ThisTask);
+                          Pbuf[ibufindex].SetOIndex(nn);
+                          Pbuf[ibufindex].SetPfof6d(0);
+                          Pbuf[ibufindex].SetPfof6dCore(0);
+                        }
 #endif
-                    if (typeval==STARTYPE) Pbuf[ibufindex].SetType(STARTYPE);
-                    else if (typeval==BHTYPE) Pbuf[ibufindex].SetType(BHTYPE);
-                    //ensure that store number of particles to be sent to the reading threads
-                    Nbuf[ibuf]++;
-                    if (ibuf==ThisTask) {
-                        if (k==RAMSESSTARTYPE) Nlocalbaryon[2]++;
-                        else if (k==RAMSESSINKTYPE) Nlocalbaryon[3]++;
-                    }
-                    MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocalbaryon[0], Pbaryons, Nreadbuf, Preadbuf);
+                        //ensure that store number of particles to be sent to other reading threads
+                        Nbuf[ibuf]++;
+                        MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocal, Part.data(), Nreadbuf, Preadbuf);
 #else
-                    Pbaryons[bcount2]=Particle(mtemp*mscale,
-                        xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
-                        vtemp[0]*opt.V+Hubbleflow*xtemp[0],
-                        vtemp[1]*opt.V+Hubbleflow*xtemp[1],
-                        vtemp[2]*opt.V+Hubbleflow*xtemp[2],
-                        count2,typeval);
-                    Pbaryons[bcount2].SetPID(idval);
+                        Part[count2]=Particle(mtemp*mscale,
+                            xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
+                            vtemp[0]*opt.V+Hubbleflow*xtemp[0],
+                            vtemp[1]*opt.V+Hubbleflow*xtemp[1],
+                            vtemp[2]*opt.V+Hubbleflow*xtemp[2],
+                            count2,typeval);
+                        Part[count2].SetPID(idval);
 #ifdef EXTENDEDFOFINFO
-                    if (opt.iextendedoutput)
-                    {
-                      Part[bcount2].SetOFile(i);
-                      Part[bcount2].SetOTask(ThisTask);
-                      Part[bcount2].SetOIndex(nn);
-                      Part[count2].SetPfof6d(0);
-                      Part[count2].SetPfof6dCore(0);
+                        if (opt.iextendedoutput)
+                        {
+                          Part[count2].SetOFile(i);
+                          Part[count2].SetOTask(ThisTask);
+                          Part[count2].SetOIndex(nn);
+                          Part[count2].SetPfof6d(0);
+                          Part[count2].SetPfof6dCore(0);
+                        }
+#endif
+#endif
+                        count2++;
                     }
+                    else if (opt.iBaryonSearch) {
+#ifdef USEMPI
+                        Pbuf[ibufindex]=Particle(mtemp*mscale,
+                            xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
+                            vtemp[0]*opt.V+Hubbleflow*xtemp[0],
+                            vtemp[1]*opt.V+Hubbleflow*xtemp[1],
+                            vtemp[2]*opt.V+Hubbleflow*xtemp[2],
+                            count2);
+                        Pbuf[ibufindex].SetPID(idval);
+#ifdef EXTENDEDFOFINFO
+                        if (opt.iextendedoutput)
+                        {
+                          Pbuf[ibufindex].SetOFile(i);
+                          Pbuf[ibufindex].SetOTask(ThisTask);
+                          Pbuf[ibufindex].SetOIndex(nn);
+                          Pbuf[ibufindex].SetPfof6d(0);
+                          Pbuf[ibufindex].SetPfof6dCore(0);
+                        }
+#endif
+                        if (typeval==STARTYPE) Pbuf[ibufindex].SetType(STARTYPE);
+                        else if (typeval==BHTYPE) Pbuf[ibufindex].SetType(BHTYPE);
+                        //ensure that store number of particles to be sent to the reading threads
+                        Nbuf[ibuf]++;
+                        if (ibuf==ThisTask) {
+                            if (k==RAMSESSTARTYPE) Nlocalbaryon[2]++;
+                            else if (k==RAMSESSINKTYPE) Nlocalbaryon[3]++;
+                        }
+                        MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocalbaryon[0], Pbaryons, Nreadbuf, Preadbuf);
+#else
+                        Pbaryons[bcount2]=Particle(mtemp*mscale,
+                            xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
+                            vtemp[0]*opt.V+Hubbleflow*xtemp[0],
+                            vtemp[1]*opt.V+Hubbleflow*xtemp[1],
+                            vtemp[2]*opt.V+Hubbleflow*xtemp[2],
+                            count2,typeval);
+                        Pbaryons[bcount2].SetPID(idval);
+#ifdef EXTENDEDFOFINFO
+                        if (opt.iextendedoutput)
+                        {
+                          Part[bcount2].SetOFile(i);
+                          Part[bcount2].SetOTask(ThisTask);
+                          Part[bcount2].SetOIndex(nn);
+                          Part[count2].SetPfof6d(0);
+                          Part[count2].SetPfof6dCore(0);
+                        }
 #endif
 #endif
-                    bcount2++;
+                        bcount2++;
+                    }
                 }
-            }
-            else if (opt.partsearchtype==PSTSTAR) {
-                if (typeval==STARTYPE) {
+                else if (opt.partsearchtype==PSTSTAR) {
+                    if (typeval==STARTYPE) {
 #ifdef USEMPI
-                    //if using MPI, determine proccessor and place in ibuf, store particle in particle buffer and if buffer full, broadcast data
-                    //unless ibuf is 0, then just store locally
-                    Pbuf[ibufindex]=Particle(mtemp*mscale,
+                        //if using MPI, determine proccessor and place in ibuf, store particle in particle buffer and if buffer full, broadcast data
+                        //unless ibuf is 0, then just store locally
+                        Pbuf[ibufindex]=Particle(mtemp*mscale,
+                            xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
+                            vtemp[0]*opt.V+Hubbleflow*xtemp[0],
+                            vtemp[1]*opt.V+Hubbleflow*xtemp[1],
+                            vtemp[2]*opt.V+Hubbleflow*xtemp[2],
+                            count2,STARTYPE);
+                        //ensure that store number of particles to be sent to the reading threads
+                        Pbuf[ibufindex].SetPID(idval);
+#ifdef EXTENDEDFOFINFO
+                        if (opt.iextendedoutput)
+                        {
+                          Pbuf[ibufindex].SetOFile(i);
+                          Pbuf[ibufindex].SetOTask(ThisTask);
+                          Pbuf[ibufindex].SetOIndex(nn);
+                          Pbuf[ibufindex].SetPfof6d(0);
+                          Pbuf[ibufindex].SetPfof6dCore(0);
+                        }
+#endif
+                        Nbuf[ibuf]++;
+                        MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocal, Part.data(), Nreadbuf, Preadbuf);
+#else
+                    Part[count2]=Particle(mtemp*mscale,
                         xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
                         vtemp[0]*opt.V+Hubbleflow*xtemp[0],
                         vtemp[1]*opt.V+Hubbleflow*xtemp[1],
                         vtemp[2]*opt.V+Hubbleflow*xtemp[2],
-                        count2,STARTYPE);
-                    //ensure that store number of particles to be sent to the reading threads
-                    Pbuf[ibufindex].SetPID(idval);
-#ifdef EXTENDEDFOFINFO
-                    if (opt.iextendedoutput)
-                    {
-                      Pbuf[ibufindex].SetOFile(i);
-                      Pbuf[ibufindex].SetOTask(ThisTask);
-                      Pbuf[ibufindex].SetOIndex(nn);
-                      Pbuf[ibufindex].SetPfof6d(0);
-                      Pbuf[ibufindex].SetPfof6dCore(0);
-                    }
-#endif
-                    Nbuf[ibuf]++;
-                    MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocal, Part.data(), Nreadbuf, Preadbuf);
-#else
-                Part[count2]=Particle(mtemp*mscale,
-                    xtemp[0]*lscale,xtemp[1]*lscale,xtemp[2]*lscale,
-                    vtemp[0]*opt.V+Hubbleflow*xtemp[0],
-                    vtemp[1]*opt.V+Hubbleflow*xtemp[1],
-                    vtemp[2]*opt.V+Hubbleflow*xtemp[2],
-                    count2,typeval);
-                Part[count2].SetPID(idval);
+                        count2,typeval);
+                    Part[count2].SetPID(idval);
 #ifdef EXTENDEDFOFINFO
-                  if (opt.iextendedoutput)
-                  {
-                    Part[count2].SetOFile(i);
-                    Part[count2].SetOTask(ThisTask);
-                    Part[count2].SetOIndex(nn);
-                    Part[count2].SetPfof6d(0);
-                    Part[count2].SetPfof6dCore(0);
-	              }
+                      if (opt.iextendedoutput)
+                      {
+                        Part[count2].SetOFile(i);
+                        Part[count2].SetOTask(ThisTask);
+                        Part[count2].SetOIndex(nn);
+                        Part[count2].SetPfof6d(0);
+                        Part[count2].SetPfof6dCore(0);
+    	              }
 #endif
 #endif
-                    count2++;
+                        count2++;
+                    }
                 }
-            }
-        }//end of ghost particle check
-        }//end of loop over chunk
-        delete[] xtempchunk;
-        delete[] vtempchunk;
-        delete[] mtempchunk;
-        delete[] idvalchunk;
-        delete[] agetempchunk;
-        delete[] levelchunk;
-        delete[] mettempchunk;
-        Fpart[i].close();
-        Fpartvel[i].close();
-        Fpartmass[i].close();
-        Fpartid[i].close();
-        Fpartlevel[i].close();
-        Fpartage[i].close();
-        Fpartmet[i].close();
+            }//end of ghost particle check
+            }//end of loop over chunk
 #ifdef USEMPI
 
-        //send information between read threads
-        if (opt.nsnapread>1&&inreadsend<totreadsend){
-            MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
-            MPISendParticlesBetweenReadThreads(opt, Preadbuf, Part.data(), ireadtask, readtaskID, Pbaryons, mpi_comm_read, mpi_nsend_readthread, mpi_nsend_readthread_baryon);
-            inreadsend++;
-            for(ibuf = 0; ibuf < opt.nsnapread; ibuf++) Nreadbuf[ibuf]=0;
-        }
+            //send information between read threads
+            if (opt.nsnapread>1&&inreadsend<totreadsend){
+                MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
+                MPISendParticlesBetweenReadThreads(opt, Preadbuf, Part.data(), ireadtask, readtaskID, Pbaryons, mpi_comm_read, mpi_nsend_readthread, mpi_nsend_readthread_baryon);
+                inreadsend++;
+                for(ibuf = 0; ibuf < opt.nsnapread; ibuf++) Nreadbuf[ibuf]=0;
+            }
 #endif
-    }//end of whether reading a file
-    }//end of loop over file
+        }//end of loop over files in batch
+    }//end of loop over batches of files
 #ifdef USEMPI
     //once finished reading the file if there are any particles left in the buffer broadcast them
     for(ibuf = 0; ibuf < NProcs; ibuf++) if (ireadtask[ibuf]<0)
@@ -1045,8 +945,8 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     inreadsend=0;
 #endif
     for (i=0;i<opt.num_files;i++) if (ireadfile[i]) {
-        sprintf(buf1,"%s/amr_%s.out%s%05d",opt.fname,opt.ramsessnapname,i+1);
-        sprintf(buf2,"%s/amr_%s.out%s",opt.fname,opt.ramsessnapname);
+        sprintf(buf1,"%s/amr_%s.out%05d",opt.fname,opt.ramsessnapname,i+1);
+        sprintf(buf2,"%s/amr_%s.out",opt.fname,opt.ramsessnapname);
         if (FileExists(buf1)) sprintf(buf,"%s",buf1);
         else if (FileExists(buf2)) sprintf(buf,"%s",buf2);
         Famr[i].open(buf, ios::binary|ios::in);
@@ -1086,6 +986,8 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
         //@}
     }
     for (i=0;i<opt.num_files;i++) if (ireadfile[i]) {
+        //gas cells carry no id, so when subsampling they are identified by their file and the order of the leaf cells in it
+        ncellfile=0;
         //then apparently read ngridlevels, which appears to be an array storing the number of grids at a given level
         ngridlevel=new int[header[i].nlevelmax];
         ngridfile=new int[(1+header[i].nboundary)*header[i].nlevelmax];
@@ -1143,7 +1045,7 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
                                 //once we have looped over all the hydro data then can start actually storing it into the particle structures
                                 if (ivar==header[i].nvarh-1) {
                                     //if cell has no internal cells or at maximum level produce a particle
-                                    if (icellchunk[idim*chunksize+igrid]==0 || j==header[i].nlevelmax-1) {
+                                    if ((icellchunk[idim*chunksize+igrid]==0 || j==header[i].nlevelmax-1) && SubsampleKeep(opt,((long long)i<<40)+(ncellfile++))) {
                                         //first suggestion is to add some jitter to the particle positions
                                         double dx = pow(0.5, j);
                                         int ix, iy, iz;
@@ -1295,6 +1197,13 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     }
 #endif
     }//end of check if gas loaded
+#ifndef USEMPI
+    //number stored is smaller than that in the header if the input is subsampled
+    if (opt.isubsample>1) {
+        nbodies=count2;
+        if (opt.partsearchtype==PSTDARK&&opt.iBaryonSearch) nbaryons=bcount2;
+    }
+#endif
 
     //update info
     opt.p*=opt.a/opt.h;
@@ -1329,7 +1238,6 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     //a bit of clean up
 #ifdef USEMPI
     MPI_Comm_free(&mpi_comm_read);
-    if (opt.iBaryonSearch) delete[] mpi_nsend_baryon;
     if (opt.nsnapread>1) {
         delete[] mpi_nsend_readthread;
         if (opt.iBaryonSearch) delete[] mpi_nsend_readthread_baryon;
@@ -11,6 +11,10 @@
 #ifndef RAMSESITEMS_H
 #define RAMSESITEMS_H
 
+//for memory mapping ramses files
+#include "fortranitems.h"
+#include <type_traits>
+
 #ifdef RAMSESSINGLEPRECISION
 #define RAMSESFLOAT float
 #else
@@ -37,6 +41,18 @@
 ///how many particle properties are read from file in one go
 #define RAMSESCHUNKSIZE 100000
 
+///\name Flags for the particle properties decoded from a ramses part file
+//@{
+#define RAMSESPARTPOS 1
+#define RAMSESPARTVEL 2
+#define RAMSESPARTMASS 4
+#define RAMSESPARTID 8
+#define RAMSESPARTLEVEL 16
+#define RAMSESPARTAGE 32
+#define RAMSESPARTMET 64
+#define RAMSESPARTALL 127
+//@}
+
 #define NUMRAMSESSPHBLOCKS 1 
 
 ///\name Structures for the RAMSES interface
@@ -89,6 +105,51 @@ struct RAMSES_Header {
         for (int k=0;k<NRAMSESTYPE;k++) npartTotal[k]=npartTotalHW[k]=0;
     }
 };
+
+///decode the n values of a record, converting them if the record was written with another precision. Returns 0 if the record does not hold n values
+template<class T> inline int RAMSESRecordValues(const char *record, size_t nbytes, T *values, size_t n)
+{
+    if (nbytes==n*sizeof(T)) {
+        memcpy(values,record,nbytes);
+        return 1;
+    }
+    if (std::is_floating_point<T>::value) {
+        if (nbytes==n*sizeof(double)) {
+            double value;
+            for (size_t i=0;i<n;i++) {memcpy(&value,record+i*sizeof(double),sizeof(double));values[i]=value;}
+            return 1;
+        }
+        if (nbytes==n*sizeof(float)) {
+            float value;
+            for (size_t i=0;i<n;i++) {memcpy(&value,record+i*sizeof(float),sizeof(float));values[i]=value;}
+            return 1;
+        }
+    }
+    else {
+        if (nbytes==n*sizeof(long long)) {
+            long long value;
+            for (size_t i=0;i<n;i++) {memcpy(&value,record+i*sizeof(long long),sizeof(long long));values[i]=value;}
+            return 1;
+        }
+        if (nbytes==n*sizeof(int)) {
+            int value;
+            for (size_t i=0;i<n;i++) {memcpy(&value,record+i*sizeof(int),sizeof(int));values[i]=value;}
+            return 1;
+        }
+    }
+    return 0;
+}
+
+///particle data of a ramses part file, with arrays of each dimension stored one after the other as in the file
+struct RAMSES_Part_Data
+{
+    int ndim;
+    int npartlocal;
+    ///total number of sink particles, stored in every file
+    int nsink;
+    vector<RAMSESFLOAT> x, v, mass, age, met;
+    vector<RAMSESIDTYPE> id, level;
+};
 //@}
 
 int RAMSES_fortran_read(fstream &, int &);
@@ -97,6 +158,7 @@ int RAMSES_fortran_read(fstream &, int*);
 int RAMSES_fortran_read(fstream &, RAMSESFLOAT *);
 int RAMSES_fortran_read(fstream &, RAMSESIDTYPE *);
 int RAMSES_fortran_skip(fstream &, int nskips=1);
+int RAMSES_read_part_file(const char *fname, RAMSES_Part_Data &pdata, int iflags=RAMSESPARTALL);
 
 /// \name Get the number of particles in the ramses files
 //@{
@@ -80,6 +80,14 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     else fofcmp=&FOF3d;
     //if using mpi no need to locally sort just yet and might as well return the Head, Len, Next arrays
 #ifdef USEMPI
+    //if overlapping communication with computation, the positions of particles near the domain boundaries are sent during the local search
+    vector<partposdata_in> exportpos, importpos;
+    mpi_pending_exchange pendingexport;
+    int ioverlap=(NProcs>1 && opt.impioverlap);
+#ifdef SWIFTINTERFACE
+    ioverlap=0;
+#endif
+    if (ioverlap) MPIStartParticleExport(nbodies, Part.data(), sqrt(param[1]), exportpos, importpos, pendingexport);
     Head=new Int_tree_t[nbodies];Next=new Int_tree_t[nbodies];
     //posible alteration for all particle search
     if (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1) pfof=tree->FOFCriterionSetBasisForLinks(fofcmp,param,numgroups,minsize,0,0,FOFchecktype,Head,Next);
@@ -142,61 +150,56 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     time2=MyGetTime();
 
     //Also must ensure that group ids do not overlap between mpi threads so adjust group ids
-    MPI_Allgather(&numgroups, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
+    MPIUpdateGroupOffsets(numgroups);
     MPIAdjustLocalGroupIDs(nbodies, pfof);
+    //if export already started, complete it now that group ids are known
+    if (ioverlap) {
+        MPIFinishParticleExport(Part.data(), pfof, Len, pendingexport);
+        cout<<ThisTask<<": Finished local search, nexport/nimport = "<<NExport<<" "<<NImport<<" in "<<MyGetTime()-time2<<endl;
+    }
+    else {
     //then determine export particles, declare arrays used to export data
-#ifdef MPIREDUCEMEM
 #ifdef SWIFTINTERFACE
     MPIGetExportNumUsingMesh(libvelociraptorOpt, nbodies, Part.data(), sqrt(param[1]));
 #else
     MPIGetExportNum(nbodies, Part.data(), sqrt(param[1]));
-#endif
 #endif
     //allocate memory to store info
     cout<<ThisTask<<": Finished local search, nexport/nimport = "<<NExport<<" "<<NImport<<" in "<<MyGetTime()-time2<<endl;
 
-    PartDataIn = new Particle[NExport];
-    PartDataGet = new Particle[NImport];
     FoFDataIn = new fofdata_in[NExport];
     FoFDataGet = new fofdata_in[NImport];
     //if using MPI must determine which local particles need to be exported to other threads and used to search
     //that threads particles. This is done by seeing if the any particles have a search radius that overlaps with
     //the boundaries of another threads domain. Then once have exported particles must search local particles
-    //relative to these exported particles. Iterate over search till no new links are found.
+    //relative to these exported particles. The links found are then resolved with a distributed union-find.
 
-    //I have adjusted FOF data structure to have local group length and also seperated the export particles from export fof data
-    //the reason is that will have to update fof data in iterative section but don't need to update particle information.
 #ifdef SWIFTINTERFACE
     MPIBuildParticleExportListUsingMesh(libvelociraptorOpt, nbodies, Part.data(), pfof, Len, sqrt(param[1]));
 #else
     MPIBuildParticleExportList(nbodies, Part.data(), pfof, Len, sqrt(param[1]));
 #endif
     MPI_Barrier(MPI_COMM_WORLD);
+    }
     //Now that have FoFDataGet (the exported particles) must search local volume using said particles
     //This is done by finding all particles in the search volume and then checking if those particles meet the FoF criterion
-    //One must keep iterating till there are no new links.
-    //Wonder if i don't need another loop and a final check
-    Int_t links_across,links_across_total;
+    //The particles are exported only once, the groups they link being merged in a logarithmic number of communication rounds
+    Int_t links_across;
     cout<<ThisTask<<": Starting to linking across MPI domains"<<endl;
-    do {
-        if (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1) {
-            links_across=MPILinkAcross(nbodies, tree, Part.data(), pfof, Len, Head, Next, param[1], fofcheck, param);
-        }
-        else {
-            links_across=MPILinkAcross(nbodies, tree, Part.data(), pfof, Len, Head, Next, param[1]);
-        }
-        if (opt.iverbose>=2) {
-            cout<<ThisTask<<" has found "<<links_across<<" links to particles on other mpi domains "<<endl;
-        }
-        MPI_Allreduce(&links_across, &links_across_total, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
-        MPIUpdateExportList(nbodies,Part.data(),pfof,Len);
-    }while(links_across_total>0);
+    if (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1) {
+        links_across=MPILinkAcrossUnionFind(nbodies, tree, Part.data(), pfof, param[1], fofcheck, param, (ioverlap?&importpos:NULL));
+    }
+    else {
+        links_across=MPILinkAcrossUnionFind(nbodies, tree, Part.data(), pfof, param[1], (ioverlap?&importpos:NULL));
+    }
+    if (opt.iverbose>=2) {
+        cout<<ThisTask<<" has linked "<<links_across<<" particles to groups on other mpi domains "<<endl;
+    }
     if (ThisTask==0) cout<<ThisTask<<": finished linking across MPI domains in "<<MyGetTime()-time2<<endl;
+    if (ioverlap) MPIReportCommOverlap("FOF search", pendingexport);
 
     delete[] FoFDataIn;
     delete[] FoFDataGet;
-    delete[] PartDataIn;
-    delete[] PartDataGet;
 
     //reorder local particle array and delete memory associated with Head arrays, only need to keep Particles, pfof and some id and idexing information
     delete tree;
@@ -221,8 +224,7 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     if (Nmemlocal>Nlocal) {Part.resize(Nlocal);Nmemlocal=Nlocal;}
     cout<<"MPI thread "<<ThisTask<<" has found "<<numgroups<<endl;
     //free up memory now that only need to store pfof and global ids
-    totalgroups=0;
-    for (int j=0;j<NProcs;j++) totalgroups+=mpi_ngroups[j];
+    totalgroups=mpi_ngrouptotal;
     Nlocal=newnbodies;
     }
 #endif
@@ -372,6 +374,7 @@ private(i,vscale2,mtotregion,vx,vy,vz,vmean)
         ///\todo not implemented yet so quit and spit error message
         if (ThisTask==0) cerr<<" THIS TYPE OF PHASE-SPACE HALO SEARCH not implemented yet, quiting. Please use halo search of 3,4, or 5 (adaptive 6d, 6d with single v scale, and 3d only)"<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,8);
 #else
         exit(8);
@@ -381,6 +384,7 @@ private(i,vscale2,mtotregion,vx,vy,vz,vmean)
     else {
         if (ThisTask==0) cerr<<" THIS TYPE OF PHASE-SPACE HALO SEARCH not implemented yet, quiting. Please use halo search of 3,4, or 5 (adaptive 6d, 6d with single v scale, and 3d only)"<<endl;
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,8);
 #else
         exit(8);
@@ -431,17 +435,39 @@ private(i,tid,xscaling,vscaling)
         treeomp[tid]=new KDTree(&Part[noffset[i]],numingroup[i],opt.Bsize,treeomp[tid]->TPHYS,tree->KEPAN,100);
         pfofomp[i]=treeomp[tid]->FOFCriterion(fofcmp,&paramomp[tid*20],ngomp[i],minsize,1,0,Pnocheck,&Head[noffset[i]],&Next[noffset[i]],&Tail[noffset[i]],&Len[noffset[i]]);
         */
-        //scale particle positions
-        xscaling=1.0/sqrt(paramomp[1+tid*20]);vscaling=1.0/sqrt(paramomp[2+tid*20]);
-        for (Int_t j=0;j<numingroup[i];j++) {
-            Part[noffset[i]+j].ScalePhase(xscaling,vscaling);
+        //small groups are searched using a phase-space grid, which avoids building a tree. Ids are set to the
+        //local index as would be done by the tree so that the group array is indexed in the same way
+        Int_t *pfofgrid=NULL, nggrid=0;
+        Double_t tgrid=0, ttree=0;
+        if (numingroup[i]<=opt.fofgridmaxnum) {
+            for (Int_t j=0;j<numingroup[i];j++) Part[noffset[i]+j].SetID(j);
+            tgrid=MyGetTime();
+            pfofgrid=FOFCriterionGrid(numingroup[i],&Part[noffset[i]],6,&FOF6d,&paramomp[tid*20],nggrid,minsize,1,0,Pnocheck,&Head[noffset[i]],&Next[noffset[i]],&Tail[noffset[i]],&Len[noffset[i]]);
+            tgrid=MyGetTime()-tgrid;
+        }
+        if (pfofgrid==NULL || opt.ifofgridbenchmark) {
+            ttree=MyGetTime();
+            //scale particle positions
+            xscaling=1.0/sqrt(paramomp[1+tid*20]);vscaling=1.0/sqrt(paramomp[2+tid*20]);
+            for (Int_t j=0;j<numingroup[i];j++) {
+                Part[noffset[i]+j].ScalePhase(xscaling,vscaling);
+            }
+            xscaling=1.0/xscaling;vscaling=1.0/vscaling;
+            treeomp[tid]=new KDTree(&(Part.data()[noffset[i]]),numingroup[i],opt.Bsize,treeomp[tid]->TPHS,tree->KEPAN,100);
+            pfofomp[i]=treeomp[tid]->FOF(1.0,ngomp[i],minsize,1,&Head[noffset[i]],&Next[noffset[i]],&Tail[noffset[i]],&Len[noffset[i]]);
+            delete treeomp[tid];
+            for (Int_t j=0;j<numingroup[i];j++) {
+                Part[noffset[i]+j].ScalePhase(xscaling,vscaling);
+            }
+            ttree=MyGetTime()-ttree;
         }
-        xscaling=1.0/xscaling;vscaling=1.0/vscaling;
-        treeomp[tid]=new KDTree(&(Part.data()[noffset[i]]),numingroup[i],opt.Bsize,treeomp[tid]->TPHS,tree->KEPAN,100);
-        pfofomp[i]=treeomp[tid]->FOF(1.0,ngomp[i],minsize,1,&Head[noffset[i]],&Next[noffset[i]],&Tail[noffset[i]],&Len[noffset[i]]);
-        delete treeomp[tid];
-        for (Int_t j=0;j<numingroup[i];j++) {
-            Part[noffset[i]+j].ScalePhase(xscaling,vscaling);
+        if (pfofgrid!=NULL) {
+            if (opt.ifofgridbenchmark) {
+                FOFGridBenchmarkReport(opt,numingroup[i],tgrid,ttree,pfofgrid,nggrid,pfofomp[i],ngomp[i]);
+                delete[] pfofomp[i];
+            }
+            pfofomp[i]=pfofgrid;
+            ngomp[i]=nggrid;
         }
     }
 #ifdef USEOPENMP
@@ -576,11 +602,10 @@ private(i,tid,xscaling,vscaling)
         //update number of groups if extra secondary search done
         if (opt.fofbgtype>FOF6D) {
             cout<<"MPI thread "<<ThisTask<<" has found "<<numgroups<<endl;
-            MPI_Allgather(&numgroups, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
+            MPIUpdateGroupOffsets(numgroups);
             //free up memory now that only need to store pfof and global ids
             if (ThisTask==0) {
-                int totalgroups=0;
-                for (int j=0;j<NProcs;j++) totalgroups+=mpi_ngroups[j];
+                Int_t totalgroups=mpi_ngrouptotal;
                 cout<<"Total number of groups found is "<<totalgroups<<endl;
             }
         }
@@ -591,11 +616,10 @@ private(i,tid,xscaling,vscaling)
     //update number of groups if extra secondary search done
     if (opt.fofbgtype<=FOF6D) {
     cout<<"MPI thread "<<ThisTask<<" has found "<<numgroups<<endl;
-    MPI_Allgather(&numgroups, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
+    MPIUpdateGroupOffsets(numgroups);
     //free up memory now that only need to store pfof and global ids
     if (ThisTask==0) {
-        int totalgroups=0;
-        for (int j=0;j<NProcs;j++) totalgroups+=mpi_ngroups[j];
+        Int_t totalgroups=mpi_ngrouptotal;
         cout<<"Total number of groups found is "<<totalgroups<<endl;
     }
     if (ThisTask==0) cout<<ThisTask<<" finished 6d/phase-space fof search in "<<MyGetTime()-time2<<endl;
@@ -1207,11 +1231,8 @@ private(i,tid)
 
         //ONLY calculate grid quantities if substructures have been found
         if (numgroups>0) {
-            tree=InitializeTreeGrid(opt,nsubset,Partsubset);
-            ngrid=tree->GetNumLeafNodes();
+            grid=BuildGrid(opt,nsubset,Partsubset,ngrid);
             if (opt.iverbose) cout<<ThisTask<<" "<<"bg search using "<<ngrid<<" grid cells, with each node containing ~"<<(opt.Ncell=nsubset/ngrid)<<" particles"<<endl;
-            grid=new GridCell[ngrid];
-            FillTreeGrid(opt, nsubset, ngrid, tree, Partsubset, grid);
             gvel=GetCellVel(opt,nsubset,Partsubset,ngrid,grid);
             gveldisp=GetCellVelDisp(opt,nsubset,Partsubset,ngrid,grid,gvel);
             GetDenVRatio(opt,nsubset,Partsubset,ngrid,grid,gvel,gveldisp);
@@ -1478,7 +1499,7 @@ private(i,tid)
         for (i=0;i<nsubset;i++) Partsubset[i].SetPotential(pfof[Partsubset[i].GetID()]);
         for (i=0;i<nsubset;i++) Partsubset[i].SetType(-1);
         param[9]=0.5;
-        pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
+        pfofbg=FOFCriterionGridOrTree(opt,tree,nsubset,Partsubset,6,fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
 
         for (i=0;i<nsubset;i++) if (pfofbg[Partsubset[i].GetID()]<=1 && pfof[Partsubset[i].GetID()]==0) Partsubset[i].SetType(numactiveloops);
 
@@ -1525,7 +1546,7 @@ private(i,tid)
                 //we adjust the particles potentials so as to ignore already tagged particles using FOFcheckbg
                 //here since loop just iterates to search the largest core, we just set all previously tagged particles not belonging to main core as 1
                 for (i=0;i<nsubset;i++) Partsubset[i].SetPotential((pfofbgnew[Partsubset[i].GetID()]!=1)+(pfof[Partsubset[i].GetID()]>0));
-                pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
+                pfofbg=FOFCriterionGridOrTree(opt,tree,nsubset,Partsubset,6,fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
                 //now if numgroupsbg is greater than one, need to update the pfofbgnew array
                 if (numgroupsbg>1) {
                     numactiveloops++;
@@ -1584,7 +1605,7 @@ private(i,tid)
     //if using MPI must determine which local particles need to be exported to other threads and used to search
     //that threads particles. This is done by seeing if the any particles have a search radius that overlaps with
     //the boundaries of another threads domain. Then once have exported particles must search local particles
-    //relative to these exported particles. Iterate over search till no new links are found.
+    //relative to these exported particles. The links found are then resolved with a distributed union-find.
 
     //First have barrier to ensure that all mpi tasks have finished the local search
     MPI_Barrier(MPI_COMM_WORLD);
@@ -1599,24 +1620,17 @@ private(i,tid)
     for (i=1;i<=numgroups;i++)delete[] pglist[i];
     delete[] pglist;
     //Also must ensure that group ids do not overlap between mpi threads so adjust group ids
-    MPI_Allgather(&numgroups, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
+    MPIUpdateGroupOffsets(numgroups);
     MPIAdjustLocalGroupIDs(nsubset, pfof);
 
     //then determine export particles, declare arrays used to export data
-#ifdef MPIREDUCEMEM
 #ifdef SWIFTINTERFACE
-    MPIGetExportNumUsingMesh(libvelociraptorOpt, nbodies, Partsubset, sqrt(param[1]));
+    MPIGetExportNumUsingMesh(libvelociraptorOpt, nsubset, Partsubset, sqrt(param[1]));
 #else
-    MPIGetExportNum(nbodies, Partsubset, sqrt(param[1]));
-#endif
+    MPIGetExportNum(nsubset, Partsubset, sqrt(param[1]));
 #endif
-    //then determine export particles, declare arrays used to export data
-    PartDataIn = new Particle[NExport];
-    PartDataGet = new Particle[NExport];
     FoFDataIn = new fofdata_in[NExport];
-    FoFDataGet = new fofdata_in[NExport];
-    //I have adjusted FOF data structure to have local group length and also seperated the export particles from export fof data
-    //the reason is that will have to update fof data in iterative section but don't need to update particle information.
+    FoFDataGet = new fofdata_in[NImport];
 #ifdef SWIFTINTERFACE
     MPIBuildParticleExportListUsingMesh(libvelociraptorOpt, nsubset, Partsubset, pfof, Len, sqrt(param[1]));
 #else
@@ -1624,14 +1638,7 @@ private(i,tid)
 #endif
     //Now that have FoFDataGet (the exported particles) must search local volume using said particles
     //This is done by finding all particles in the search volume and then checking if those particles meet the FoF criterion
-    //One must keep iterating till there are no new links.
-    //Wonder if i don't need another loop and a final check
-    Int_t links_across,links_across_total;
-    do {
-        links_across=MPILinkAcross(nsubset, tree, Partsubset, pfof, Len, Head, Next, param[1], fofcmp, param);
-        MPIUpdateExportList(nsubset, Partsubset,pfof,Len);
-        MPI_Allreduce(&links_across, &links_across_total, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
-    }while(links_across_total>0);
+    MPILinkAcrossUnionFind(nsubset, tree, Partsubset, pfof, param[1], fofcmp, param);
 
     //reorder local particle array and delete memory associated with Head arrays, only need to keep Particles, pfof and some id and idexing information
     delete tree;
@@ -1641,8 +1648,6 @@ private(i,tid)
     delete[] numingroup;
     delete[] FoFDataIn;
     delete[] FoFDataGet;
-    delete[] PartDataIn;
-    delete[] PartDataGet;
 
     //Now redistribute groups so that they are local to a processor (also orders the group ids according to size
     if (opt.iSingleHalo) opt.MinSize=MinNumOld;//reset minimum size
@@ -1669,8 +1674,7 @@ private(i,tid)
     cout<<"MPI thread "<<ThisTask<<" has found "<<numgroups<<endl;
     //free up memory now that only need to store pfof and global ids
     if (ThisTask==0) {
-        int totalgroups=0;
-        for (int j=0;j<NProcs;j++) totalgroups+=mpi_ngroups[j];
+        Int_t totalgroups=mpi_ngrouptotal;
         cout<<"Total number of groups found is "<<totalgroups<<endl;
     }
     //free up memory now that only need to store pfof and global ids
@@ -2050,7 +2054,6 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
     Int_t *subpfofold;
     Coordinate *gvel;
     Matrix *gveldisp;
-    KDTree *tree;
     GridCell *grid;
     Coordinate cm,cmvel;
     //variables to keep track of structure level, pfof values (ie group ids) and their parent structure
@@ -2187,11 +2190,8 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
                 opt.Ncell=opt.Ncellfac*subnumingroup[i];
                 //if ncell is such that uncertainty would be greater than 0.5% based on Poisson noise, increase ncell till above unless cell would contain >25%
                 while (opt.Ncell<MINCELLSIZE && subnumingroup[i]/4.0>opt.Ncell) opt.Ncell*=2;
-                tree=InitializeTreeGrid(opt,subnumingroup[i],subPart);
-                ngrid=tree->GetNumLeafNodes();
+                grid=BuildGrid(opt,subnumingroup[i],subPart,ngrid);
                 if (opt.iverbose) cout<<ThisTask<<" Substructure "<<i<< " at sublevel "<<sublevel<<" with "<<subnumingroup[i]<<" particles split into are "<<ngrid<<" grid cells, with each node containing ~"<<subnumingroup[i]/ngrid<<" particles"<<endl;
-                grid=new GridCell[ngrid];
-                FillTreeGrid(opt, subnumingroup[i], ngrid, tree, subPart, grid);
                 gvel=GetCellVel(opt,subnumingroup[i],subPart,ngrid,grid);
                 gveldisp=GetCellVelDisp(opt,subnumingroup[i],subPart,ngrid,grid,gvel);
                 opt.HaloLocalSigmaV=0;for (int j=0;j<ngrid;j++) opt.HaloLocalSigmaV+=pow(gveldisp[j].Det(),1./3.);opt.HaloLocalSigmaV/=(double)ngrid;
@@ -2492,7 +2492,7 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
     //update the number of local groups found
 #ifdef USEMPI
     MPI_Barrier(MPI_COMM_WORLD);
-    MPI_Allgather(&ngroup, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
+    MPIUpdateGroupOffsets(ngroup);
     cout<<ThisTask<<" has found a total of "<<ngroup<<endl;
 #endif
 }
@@ -2595,6 +2595,94 @@ private(i)
 
 /// \name Routines searches baryonic or other components separately based on initial dark matter (or other) search
 //@{
+/*!
+ * Builds a grid whose cells are flagged if they overlap any of the spheres padded by the search length. If period is not NULL, the grid
+ * spans the periodic box, otherwise it spans the padded spheres. Cells are no smaller than the search length and there are at most
+ * \ref BARYONGRIDMAXDIM per dimension.
+*/
+void BuildBaryonSearchGrid(const Int_t nspheres, Coordinate *centre, Double_t *radius, Double_t searchlength, Double_t *period, BaryonSearchGrid &grid)
+{
+    Double_t xmax[3], extent, R, R2, dx, d2;
+    int ilo[3], ihi[3], ix[3], jx[3];
+    grid.iperiodic=(period!=NULL);
+    for (int k=0;k<3;k++) {
+        if (grid.iperiodic) {grid.xmin[k]=0;xmax[k]=period[k];}
+        else {grid.xmin[k]=MAXVALUE;xmax[k]=-MAXVALUE;}
+    }
+    if (!grid.iperiodic) {
+        for (Int_t i=0;i<nspheres;i++) for (int k=0;k<3;k++) {
+            R=radius[i]+searchlength;
+            if (grid.xmin[k]>centre[i][k]-R) grid.xmin[k]=centre[i][k]-R;
+            if (xmax[k]<centre[i][k]+R) xmax[k]=centre[i][k]+R;
+        }
+        if (nspheres==0) for (int k=0;k<3;k++) {grid.xmin[k]=0;xmax[k]=1;}
+    }
+    for (int k=0;k<3;k++) {
+        extent=xmax[k]-grid.xmin[k];
+        grid.ndim[k]=max(1,min(BARYONGRIDMAXDIM,(int)(extent/searchlength)));
+        grid.cellsize[k]=extent/(Double_t)grid.ndim[k];
+    }
+    grid.flag.assign((size_t)grid.ndim[0]*grid.ndim[1]*grid.ndim[2],0);
+
+    for (Int_t i=0;i<nspheres;i++) {
+        R=radius[i]+searchlength;
+        R2=R*R;
+        for (int k=0;k<3;k++) {
+            ilo[k]=(int)floor((centre[i][k]-R-grid.xmin[k])/grid.cellsize[k]);
+            ihi[k]=(int)floor((centre[i][k]+R-grid.xmin[k])/grid.cellsize[k]);
+            if (grid.iperiodic) {
+                if (ihi[k]-ilo[k]+1>=grid.ndim[k]) {ilo[k]=0;ihi[k]=grid.ndim[k]-1;}
+            }
+            else {
+                ilo[k]=max(ilo[k],0);
+                ihi[k]=min(ihi[k],grid.ndim[k]-1);
+            }
+        }
+        //flag cells whose minimum distance to the centre is within the padded radius
+        for (ix[0]=ilo[0];ix[0]<=ihi[0];ix[0]++) for (ix[1]=ilo[1];ix[1]<=ihi[1];ix[1]++) for (ix[2]=ilo[2];ix[2]<=ihi[2];ix[2]++) {
+            d2=0;
+            for (int k=0;k<3;k++) {
+                dx=grid.xmin[k]+ix[k]*grid.cellsize[k]-centre[i][k];
+                if (dx<0) {
+                    dx=centre[i][k]-(grid.xmin[k]+(ix[k]+1)*grid.cellsize[k]);
+                    if (dx<0) dx=0;
+                }
+                d2+=dx*dx;
+                jx[k]=ix[k];
+                if (grid.iperiodic) {jx[k]%=grid.ndim[k];if (jx[k]<0) jx[k]+=grid.ndim[k];}
+            }
+            if (d2<=R2) grid.flag[((size_t)jx[0]*grid.ndim[1]+jx[1])*grid.ndim[2]+jx[2]]=1;
+        }
+    }
+}
+
+/*!
+ * Fills order with the indices of the baryons lying in flagged cells of the grid, sorted by cell so that threads searching consecutive
+ * blocks of the list query the same region of the tree. Returns the number of baryons in the list.
+*/
+Int_t GetBaryonSearchOrder(BaryonSearchGrid &grid, const Int_t nbaryons, Particle *Pbaryons, Int_t *order)
+{
+    Int_t ncells=grid.flag.size(), nsearch=0, icell;
+    Int_t *cellindex=new Int_t[nbaryons];
+    Int_t *noffset=new Int_t[ncells+1];
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(icell) schedule(static) if (nbaryons>ompsearchnum)
+#endif
+    for (Int_t i=0;i<nbaryons;i++) {
+        icell=grid.CellIndex(Pbaryons[i].GetPosition());
+        if (icell>=0 && grid.flag[icell]==0) icell=-1;
+        cellindex[i]=icell;
+    }
+    //counting sort by cell
+    for (Int_t i=0;i<=ncells;i++) noffset[i]=0;
+    for (Int_t i=0;i<nbaryons;i++) if (cellindex[i]>=0) {noffset[cellindex[i]+1]++;nsearch++;}
+    for (Int_t i=1;i<=ncells;i++) noffset[i]+=noffset[i-1];
+    for (Int_t i=0;i<nbaryons;i++) if (cellindex[i]>=0) order[noffset[cellindex[i]]++]=i;
+    delete[] cellindex;
+    delete[] noffset;
+    return nsearch;
+}
+
 /*!
  * Searches star and gas particles separately to see if they are associated with any dark matter particles belonging to a substructure
  *
@@ -2608,7 +2696,7 @@ private(i)
 Int_t* SearchBaryons(Options &opt, Int_t &nbaryons, Particle *&Pbaryons, const Int_t ndark, vector<Particle> &Part, Int_t *&pfofdark, Int_t &ngroupdark, Int_t &nhalos, int ihaloflag, int iinclusive, PropData *pdata)
 {
     KDTree *tree;
-    Double_t *period;
+    Double_t *period=NULL;
     Int_t *pfofbaryons, *pfofall, *pfofold;
     Int_t i,pindex,npartingroups,ng,nghalos,nhalosold=nhalos, baryonfofold;
     Int_t *ids, *storeval,*storeval2;
@@ -2626,6 +2714,10 @@ Int_t* SearchBaryons(Options &opt, Int_t &nbaryons, Particle *&Pbaryons, const I
     Int_t nparts=ndark+nbaryons;
     Int_t nhierarchy=1,gidval;
     StrucLevelData *ppsldata,**papsldata;
+    Int_t ii,nsearchbaryons,*searchorder;
+    Coordinate *gcentre;
+    Double_t *gradius;
+    BaryonSearchGrid searchgrid;
 #ifndef USEMPI
     int ThisTask=0,NProcs=1;
 #endif
@@ -2746,6 +2838,50 @@ Int_t* SearchBaryons(Options &opt, Int_t &nbaryons, Particle *&Pbaryons, const I
         cout<<"Parameters used are : ellphys="<<sqrt(param[6])<<" Lunits, ellvel="<<sqrt(param[7])<<" Vunits.\n";
         cout<<"Building tree to search dm containing "<<npartingroups<<endl;
     }
+    //a baryon is only associated with a group if it lies within the linking length of a particle in the group, that is within the bounding
+    //sphere of the group padded by the linking length. Flag the cells of a grid overlapping these spheres so that only baryons in these cells
+    //are searched and sort these baryons spatially so that threads search nearby baryons.
+    gcentre=new Coordinate[ngroupdark+1];
+    gradius=new Double_t[ngroupdark+1];
+    for (i=0;i<=ngroupdark;i++) gradius[i]=-1;
+    for (i=0;i<npartingroups;i++) {
+        gidval=pfofdark[ids[i]];
+        if (gradius[gidval]<0) {
+            gcentre[gidval]=Coordinate(Part[i].GetPosition());
+            gradius[gidval]=0;
+        }
+    }
+    //get bounding box relative to a member particle (allowing for periodicity) and use its centre
+    {
+    Coordinate *gmin=new Coordinate[ngroupdark+1], *gmax=new Coordinate[ngroupdark+1];
+    for (i=0;i<=ngroupdark;i++) {gmin[i]=Coordinate(0.);gmax[i]=Coordinate(0.);}
+    for (i=0;i<npartingroups;i++) {
+        gidval=pfofdark[ids[i]];
+        for (int k=0;k<3;k++) {
+            dval=Part[i].GetPosition(k)-gcentre[gidval][k];
+            if (opt.p>0) {if (dval>0.5*opt.p) dval-=opt.p;else if (dval<-0.5*opt.p) dval+=opt.p;}
+            if (gmin[gidval][k]>dval) gmin[gidval][k]=dval;
+            if (gmax[gidval][k]<dval) gmax[gidval][k]=dval;
+        }
+    }
+    for (i=1;i<=ngroupdark;i++) if (gradius[i]==0) {
+        for (int k=0;k<3;k++) gcentre[i][k]+=0.5*(gmin[i][k]+gmax[i][k]);
+        gradius[i]=0.5*sqrt(pow(gmax[i][0]-gmin[i][0],2.0)+pow(gmax[i][1]-gmin[i][1],2.0)+pow(gmax[i][2]-gmin[i][2],2.0));
+    }
+    delete[] gmin;
+    delete[] gmax;
+    }
+    //compact list of groups with particles
+    ng=0;
+    for (i=1;i<=ngroupdark;i++) if (gradius[i]>=0) {gcentre[ng]=gcentre[i];gradius[ng]=gradius[i];ng++;}
+    BuildBaryonSearchGrid(ng,gcentre,gradius,sqrt(param[6]),period,searchgrid);
+    delete[] gcentre;
+    delete[] gradius;
+    searchorder=new Int_t[nbaryons+1];
+    nsearchbaryons=GetBaryonSearchOrder(searchgrid,nbaryons,Pbaryons,searchorder);
+    searchgrid.flag.clear();
+    cout<<ThisTask<<" baryon search skips "<<nbaryons-nsearchbaryons<<" of "<<nbaryons<<" baryons ("<<((nbaryons>0)?(nbaryons-nsearchbaryons)/(Double_t)nbaryons:0)<<") lying outside group bounding spheres"<<endl;
+
     //build tree of baryon particles (in groups if a full particle search was done, otherwise npartingroups=nbaryons
     tree=new KDTree(Part.data(),npartingroups,nsearch/2,tree->TPHYS,tree->KEPAN,100,0,0,0,period);
     //allocate memory for search
@@ -2757,18 +2893,19 @@ private(i,tid,p1,pindex,x1,D2,dval,rval,icheck,nnID,dist2,baryonfofold)
 {
     nnID=new Int_t[nsearch];
     dist2=new Double_t[nsearch];
-#pragma omp for
+#pragma omp for schedule(dynamic,BARYONSEARCHBLOCK)
 #else
     nnID=new Int_t[nsearch];
     dist2=new Double_t[nsearch];
 #endif
-    for (i=0;i<nbaryons;i++)
+    for (ii=0;ii<nsearchbaryons;ii++)
     {
 #ifdef USEOPENMP
         tid=omp_get_thread_num();
 #else
         tid=0;
 #endif
+        i=searchorder[ii];
 
         //if all particles have been searched for field objects then ignore baryons not associated with a group
         if (opt.partsearchtype==PSTALL && pfofbaryons[i]==0) continue;
@@ -2814,6 +2951,7 @@ private(i,tid,p1,pindex,x1,D2,dval,rval,icheck,nnID,dist2,baryonfofold)
 #ifdef USEOPENMP
 }
 #endif
+    delete[] searchorder;
     }
 
 #ifdef USEMPI
@@ -2833,7 +2971,6 @@ private(i,tid,p1,pindex,x1,D2,dval,rval,icheck,nnID,dist2,baryonfofold)
         //to store local mpi task
         mpi_foftask=MPISetTaskID(nbaryons);
         //then determine export particles, declare arrays used to export data
-        PartDataIn = new Particle[NExport+1];
         PartDataGet = new Particle[NImport+1];
         FoFDataIn = new fofdata_in[NExport+1];
         FoFDataGet = new fofdata_in[NImport+1];
@@ -2854,7 +2991,6 @@ private(i,tid,p1,pindex,x1,D2,dval,rval,icheck,nnID,dist2,baryonfofold)
         //reorder local particle array and delete memory associated with Head arrays, only need to keep Particles, pfof and some id and idexing information
         delete[] FoFDataIn;
         delete[] FoFDataGet;
-        delete[] PartDataIn;
         delete[] PartDataGet;
 
         Int_t newnbaryons=MPIBaryonGroupExchange(nbaryons,Pbaryons,pfofbaryons);
@@ -3119,11 +3255,10 @@ private(i,tid,p1,pindex,x1,D2,dval,rval,icheck,nnID,dist2,baryonfofold)
     //if number of groups has changed then update
     if (opt.uinfo.unbindflag) {
     cout<<"MPI thread "<<ThisTask<<" has found "<<ngroupdark<<endl;
-    MPI_Allgather(&ngroupdark, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
+    MPIUpdateGroupOffsets(ngroupdark);
     //free up memory now that only need to store pfof and global ids
     if (ThisTask==0) {
-        int totalgroups=0;
-        for (int j=0;j<NProcs;j++) totalgroups+=mpi_ngroups[j];
+        Int_t totalgroups=mpi_ngrouptotal;
         cout<<"Total number of groups found is "<<totalgroups<<endl;
     }
     }
@@ -3178,7 +3313,7 @@ void CopyHierarchy(Options &opt,PropData *pdata, Int_t ngroups, Int_t *nsub, Int
 {
     Int_t i,haloidoffset=0;
 #ifdef USEMPI
-    for (int j=0;j<ThisTask;j++)haloidoffset+=mpi_ngroups[j];
+    haloidoffset=mpi_ngroupoffset;
 #endif
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
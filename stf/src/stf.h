@@ -313,8 +313,10 @@ never used as would use mpi with each mpi process having fewer than MAXINT parti
 Note that for practical reasons, the combination of OpenMP/MPI only works on correctly setup environments where one can explicitly state how many MPI threads to start on a given node. Otherwise, many systems will fill up a node with mpi threads and do so till all asked for mpi threads are active. Consequently, the openmp threads spawned by the MPI threads will compete with the MPI threads on the same node and the other OpenMP threads started by other MPI threads.
 - \b USEOPENMP \n Code is compiled with openmp
 - \b USEMPI \n Code is compiled with mpi. must also set the appropriate compiler
-- \b MPIREDUCEMEM \n If this flag is set, then the amount of memory allocated for MPI routines is reduced and one does not have to worry as much about the
-MPI factors \ref Options.
+- \b MPIREDUCEMEM \n No longer changes how memory is allocated. Particle storage and mpi communication buffers are always allocated from
+the exact numbers of particles in each mpi domain and exchanged between mpi threads, which are determined before any data is moved.
+- \b MPITHREADMULTIPLE \n With USEOPENMP, mpi is initialised with MPI_THREAD_MULTIPLE so that openmp threads post and complete their own exchanges,
+as is done when importing particles for spherical overdensity calculations (see \ref MPIBuildHaloSearchImportList), and a progress thread can be run (see \ref Options.impiprogressthread).
 - \b LARGEMPIDOMAIN \n If set, number of mpi threads can be > maxshort
 
 \n
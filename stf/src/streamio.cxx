@@ -0,0 +1,434 @@
+/*! \file streamio.cxx
+ *  \brief this file contains the streaming reader shared by the input formats
+ *
+ *  A format describes its input with a \ref Stream_Reader, listing the blocks of particles stored in each file and decoding
+ *  a block into columns. The routines here select the blocks of the particle types used, read them ahead of the conversion
+ *  with a prefetch thread, or several files at once with a pool of threads if the format allows it, convert the particles with
+ *  several threads, subsample them, and either store them or, with mpi,
+ *  distribute them to the tasks whose domain they lie in, using the same read tasks and buffers as the other readers.
+ */
+
+//-- STREAMING IO
+
+#include "stf.h"
+
+/// \name Streaming reader
+//@{
+
+/*! Where particles of a type are stored given the search: 0 if they are not read, 1 if they are stored with the particles
+    searched and 2 if they are stored with the baryons of a separate baryon search
+*/
+int StreamTypeStorage(Options &opt, int itype)
+{
+    int ibaryon=(opt.partsearchtype==PSTDARK && opt.iBaryonSearch)?2:0;
+    if (itype==GASTYPE) {
+        if (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTGAS) return 1;
+        return ibaryon;
+    }
+    if (itype==DARKTYPE) return (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTDARK);
+    if (itype==DARK2TYPE||itype==DARK3TYPE) return (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTDARK) && opt.iuseextradarkparticles;
+    if (itype==STARTYPE) {
+        if (opt.partsearchtype==PSTSTAR) return 1;
+        if (opt.iusestarparticles==0) return 0;
+        if (opt.partsearchtype==PSTALL) return 1;
+        return ibaryon;
+    }
+    if (itype==BHTYPE) {
+        if (opt.partsearchtype==PSTBH) return 1;
+        if (opt.iusesinkparticles==0) return 0;
+        if (opt.partsearchtype==PSTALL) return 1;
+        return ibaryon;
+    }
+    if (itype==WINDTYPE) return (opt.partsearchtype==PSTALL && opt.iusewindparticles);
+    return 0;
+}
+
+///Columns decoded for the particles of a type, limited to the fields the format stores and the search uses
+int StreamColumns(Options &opt, Stream_Reader &reader, int itype)
+{
+    int icolumns=STREAMPOS|STREAMVEL|STREAMID|STREAMMASS;
+    if (itype==GASTYPE) {
+        if (opt.iinputfields&INPUTFIELDU) icolumns|=STREAMU;
+        if (opt.iinputfields&INPUTFIELDSFR) icolumns|=STREAMSFR;
+        if (opt.iinputfields&INPUTFIELDZMET) icolumns|=STREAMZMET;
+    }
+    else if (itype==STARTYPE) {
+        if (opt.iinputfields&INPUTFIELDZMET) icolumns|=STREAMZMET;
+        if (opt.iinputfields&INPUTFIELDTAGE) icolumns|=STREAMTAGE;
+    }
+    return icolumns&reader.icolumns;
+}
+
+///List the blocks of a file holding particles of the types used, split into pieces of at most \ref Options.inputbufsize particles,
+///setting the columns of each to decode, limited to those in icolumnsmask
+void StreamListPieces(Options &opt, Stream_Reader &reader, int ifile, int icolumnsmask, vector<Stream_Block> &pieces)
+{
+    vector<Stream_Block> blocks;
+    Int_t nchunk=max((Int_t)1,(Int_t)opt.inputbufsize);
+    pieces.clear();
+    reader.ListBlocks(ifile, blocks);
+    for (auto &b:blocks) {
+        b.ifile=ifile;
+        if (StreamTypeStorage(opt,b.itype)) b.icolumns=StreamColumns(opt,reader,b.itype)&icolumnsmask;
+#ifdef HIGHRES
+        //the highest resolution dark matter particles set the interparticle spacing even when not searched
+        else if (b.itype==DARKTYPE) b.icolumns=STREAMMASS&reader.icolumns&icolumnsmask;
+#endif
+        else b.icolumns=0;
+        if (b.icolumns==0) continue;
+        for (long long n=0;n<b.num;n+=nchunk) {
+            pieces.push_back(b);
+            pieces.back().noffset=b.noffset+n;
+            pieces.back().num=min((long long)nchunk,b.num-n);
+        }
+    }
+}
+
+/*! Decode the pieces of a file listed by \ref StreamListPieces, passing each to load. With \ref Options.inputnprefetchbuffers>0
+    a prefetch thread, the only thread calling the format, fills a ring of blocks while the blocks already decoded are loaded.
+*/
+void StreamDecodeFile(Options &opt, Stream_Reader &reader, int ifile, int icolumnsmask, function<void(Stream_Block&)> load)
+{
+    vector<Stream_Block> pieces;
+    StreamListPieces(opt,reader,ifile,icolumnsmask,pieces);
+    if (opt.inputnprefetchbuffers>0 && pieces.size()>1) {
+        Stream_Ring<Stream_Block> ring(opt.inputnprefetchbuffers);
+        Stream_Block *c;
+        thread prefetch([&](){
+            for (auto &b:pieces) {
+                Stream_Block *cfill=ring.NextFree();
+                cfill->SetBlock(b);
+                cfill->Resize();
+                reader.DecodeBlock(*cfill);
+                ring.Filled();
+            }
+            ring.Finished();
+        });
+        while ((c=ring.NextFilled())!=NULL) {
+            load(*c);
+            ring.Emptied();
+        }
+        prefetch.join();
+    }
+    else {
+        Stream_Block c;
+        for (auto &b:pieces) {
+            c.SetBlock(b);
+            c.Resize();
+            reader.DecodeBlock(c);
+            load(c);
+        }
+    }
+    if (reader.CloseFile) reader.CloseFile(ifile);
+}
+
+/*! Decode the files listed, passing each block to load and, once all the blocks of a file are loaded, calling filedone if given.
+    If the format sets \ref Stream_Reader.iconcurrentfiles and prefetching is on, the files are shared among a pool of threads, one
+    per openmp thread, each decoding its files into a queue of \ref Options.inputnprefetchbuffers blocks per thread. Blocks are
+    always loaded by the calling thread, so load and filedone may use mpi and need not be thread safe.
+*/
+void StreamDecodeFiles(Options &opt, Stream_Reader &reader, const vector<int> &files, int icolumnsmask, function<void(Stream_Block&)> load,
+    function<void(int)> filedone)
+{
+    int nfilethreads=1;
+#ifdef USEOPENMP
+    nfilethreads=min((int)files.size(),omp_get_max_threads());
+#endif
+    if (reader.iconcurrentfiles==0 || opt.inputnprefetchbuffers==0 || nfilethreads<=1) {
+        for (auto ifile:files) {
+            StreamDecodeFile(opt,reader,ifile,icolumnsmask,load);
+            if (filedone) filedone(ifile);
+        }
+        return;
+    }
+    //a block with no particles marks the end of a file, its ifile being the file finished
+    Stream_Queue<Stream_Block> queue(opt.inputnprefetchbuffers*nfilethreads,nfilethreads);
+    atomic<int> inext(0);
+    vector<thread> decoders;
+    Stream_Block *c;
+    for (int k=0;k<nfilethreads;k++) decoders.emplace_back([&](){
+        vector<Stream_Block> pieces;
+        Stream_Block *cfill;
+        int i;
+        while ((i=inext++)<(int)files.size()) {
+            StreamListPieces(opt,reader,files[i],icolumnsmask,pieces);
+            for (auto &b:pieces) {
+                cfill=queue.NextFree();
+                cfill->SetBlock(b);
+                cfill->Resize();
+                reader.DecodeBlock(*cfill);
+                queue.Filled(cfill);
+            }
+            if (reader.CloseFile) reader.CloseFile(files[i]);
+            cfill=queue.NextFree();
+            cfill->ifile=files[i];
+            cfill->num=0;
+            queue.Filled(cfill);
+        }
+        queue.Finished();
+    });
+    while ((c=queue.NextFilled())!=NULL) {
+        if (c->num>0) load(*c);
+        else if (filedone) filedone(c->ifile);
+        queue.Emptied(c);
+    }
+    for (auto &t:decoders) t.join();
+}
+
+///whether a particle of a decoded block is stored, used both when counting the particles of each mpi domain and when loading them
+inline bool StreamKeep(Options &opt, Stream_Block &b, Int_t n)
+{
+    return (b.id.size()==0 || SubsampleKeep(opt,b.id[n]));
+}
+
+/*! Convert the particles of a decoded block to code units. Particles dropped by subsampling are flagged with ikeep=0. The
+    smallest dark matter and gas masses are tracked in the reader, in input units.
+*/
+void StreamConvertBlock(Options &opt, Stream_Reader &reader, Stream_Block &b, vector<Particle> &Pblock, vector<int> &ikeep)
+{
+    double mmin=MAXVALUE;
+    Pblock.resize(b.num);
+    ikeep.resize(b.num);
+    if (b.mass.size()) {
+        for (Int_t n=0;n<b.num;n++) if (b.mass[n]<mmin) mmin=b.mass[n];
+        if (b.itype==DARKTYPE && mmin<reader.MP_DM) reader.MP_DM=mmin;
+        else if (b.itype==GASTYPE && mmin<reader.MP_B) reader.MP_B=mmin;
+    }
+    //a block only read for the mass of the highest resolution particles is not stored
+    if (StreamTypeStorage(opt,b.itype)==0) {
+        for (Int_t n=0;n<b.num;n++) ikeep[n]=0;
+        return;
+    }
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (Int_t n=0;n<b.num;n++) {
+        Particle &p=Pblock[n];
+        double *x=&b.pos[3*n],*v=&b.vel[3*n];
+        ikeep[n]=StreamKeep(opt,b,n);
+        if (!ikeep[n]) continue;
+        p=Particle((b.mass.size()?b.mass[n]:0)*reader.mscale,
+            x[0]*reader.lscale,x[1]*reader.lscale,x[2]*reader.lscale,
+            v[0]*reader.vscale+reader.Hubbleflow*x[0],
+            v[1]*reader.vscale+reader.Hubbleflow*x[1],
+            v[2]*reader.vscale+reader.Hubbleflow*x[2],
+            0,b.itype);
+        if (b.id.size()) p.SetPID(b.id[n]);
+#ifdef GASON
+        if (b.u.size()) p.SetU(b.u[n]*reader.uscale);
+#endif
+#ifdef STARON
+        if (b.sfr.size()) p.SetSFR(b.sfr[n]);
+        if (b.zmet.size()) p.SetZmet(b.zmet[n]);
+        if (b.tage.size()) p.SetTage(b.tage[n]);
+#endif
+    }
+}
+
+/*! Read the particles of an input described by a \ref Stream_Reader. Without mpi the particles are stored in Part, or in
+    Pbaryons for a separate baryon search, and the numbers stored returned in nbodies and nbaryons. With mpi the read tasks
+    read the files set by \ref MPISetFilesRead and send the particles to the tasks whose domain they lie in, positions in input
+    units being used to find the domain, as the domains are only adjusted to code units once all particles are loaded.
+*/
+void StreamReadParticles(Options &opt, Stream_Reader &reader, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons)
+{
+    vector<Particle> Pblock;
+    vector<int> ikeep;
+#ifndef USEMPI
+    Int_t count=0,bcount=0;
+    vector<int> files(reader.nfiles);
+    for (int i=0;i<reader.nfiles;i++) files[i]=i;
+    StreamDecodeFiles(opt,reader,files,~0,[&](Stream_Block &b){
+        int istore=StreamTypeStorage(opt,b.itype);
+        StreamConvertBlock(opt,reader,b,Pblock,ikeep);
+        for (Int_t n=0;n<b.num;n++) if (ikeep[n]) {
+            if (istore==2) Pbaryons[bcount++]=Pblock[n];
+            else {Part[count]=Pblock[n];Part[count].SetID(count);count++;}
+        }
+    });
+    nbodies=count;
+    if (Pbaryons!=NULL) {
+        nbaryons=bcount;
+        for (Int_t i=0;i<nbaryons;i++) Pbaryons[i].SetID(i+nbodies);
+    }
+#else
+    MPI_Comm mpi_comm_read;
+    Particle *Pbuf=NULL;
+    vector<Particle> *Preadbuf, *Preadbufbaryon;
+    Int_t BufSize=opt.mpiparticlebufsize;
+    Int_t *Nbuf, *Nreadbuf, *Nreadbufbaryon;
+    Int_t ibufindex;
+    Int_t *Nlocalthreadbuf;
+    int *irecv, *mpi_irecvflag;
+    MPI_Request *mpi_request;
+    Int_t inreadsend,totreadsend;
+    Int_t *mpi_nsend_readthread, *mpi_nsend_readthread_baryon;
+    int *ireadtask, *readtaskID, *ireadfile;
+    double MP_DM, MP_B;
+
+    Nbuf=new Int_t[NProcs];
+    for (int j=0;j<NProcs;j++) Nbuf[j]=0;
+    ireadtask=new int[NProcs];
+    readtaskID=new int[opt.nsnapread];
+    MPIDistributeReadTasks(opt,ireadtask,readtaskID);
+    MPI_Comm_split(MPI_COMM_WORLD, (ireadtask[ThisTask]>=0), ThisTask, &mpi_comm_read);
+    if (ThisTask==0) cout<<"There are "<<opt.nsnapread<<" threads reading "<<reader.nfiles<<" files "<<endl;
+    Nlocal=0;
+    if (opt.iBaryonSearch) Nlocalbaryon[0]=0;
+
+    if (ireadtask[ThisTask]>=0) {
+        Pbuf=new Particle[BufSize*NProcs];
+        //particles sent to other read tasks are kept until all read tasks exchange them, with the baryons of a separate
+        //baryon search kept apart as they are sent after the dark matter
+        Nreadbuf=new Int_t[opt.nsnapread];
+        Nreadbufbaryon=new Int_t[opt.nsnapread];
+        Preadbuf=new vector<Particle>[opt.nsnapread];
+        Preadbufbaryon=new vector<Particle>[opt.nsnapread];
+        for (int j=0;j<opt.nsnapread;j++) Nreadbuf[j]=Nreadbufbaryon[j]=0;
+        mpi_nsend_readthread=new Int_t[opt.nsnapread*opt.nsnapread];
+        mpi_nsend_readthread_baryon=new Int_t[opt.nsnapread*opt.nsnapread];
+        for (int j=0;j<opt.nsnapread*opt.nsnapread;j++) mpi_nsend_readthread_baryon[j]=0;
+        MPISetFilesRead(opt,ireadfile,ireadtask);
+        inreadsend=0;
+        for (int j=0;j<opt.num_files;j++) inreadsend+=ireadfile[j];
+        MPI_Allreduce(&inreadsend,&totreadsend,1,MPI_Int_t,MPI_MIN,mpi_comm_read);
+
+        auto exchange=[&]() {
+            for (int j=0;j<opt.nsnapread;j++) if (Nreadbufbaryon[j]>0) {
+                if ((Int_t)Preadbuf[j].size()<Nreadbuf[j]+Nreadbufbaryon[j]) Preadbuf[j].resize(Nreadbuf[j]+Nreadbufbaryon[j]);
+                for (Int_t n=0;n<Nreadbufbaryon[j];n++) Preadbuf[j][Nreadbuf[j]+n]=Preadbufbaryon[j][n];
+            }
+            MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
+            if (opt.iBaryonSearch) MPI_Allgather(Nreadbufbaryon, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread_baryon, opt.nsnapread, MPI_Int_t, mpi_comm_read);
+            MPISendParticlesBetweenReadThreads(opt, Preadbuf, Part.data(), ireadtask, readtaskID, Pbaryons, mpi_comm_read, mpi_nsend_readthread, mpi_nsend_readthread_baryon);
+            for (int j=0;j<opt.nsnapread;j++) Nreadbuf[j]=Nreadbufbaryon[j]=0;
+        };
+
+        vector<int> files;
+        for (int i=0;i<reader.nfiles;i++) if (ireadfile[i]) files.push_back(i);
+        StreamDecodeFiles(opt,reader,files,~0,[&](Stream_Block &b){
+            int istore=StreamTypeStorage(opt,b.itype);
+            StreamConvertBlock(opt,reader,b,Pblock,ikeep);
+            for (Int_t n=0;n<b.num;n++) {
+                if (!ikeep[n]) continue;
+                int ibuf=(b.task>=0)?b.task:MPIGetParticlesProcessor(b.pos[3*n],b.pos[3*n+1],b.pos[3*n+2]);
+                ibufindex=ibuf*BufSize+Nbuf[ibuf];
+                Pbuf[ibufindex]=Pblock[n];
+                Nbuf[ibuf]++;
+                if (istore==2) MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocalbaryon[0], Pbaryons, Nreadbufbaryon, Preadbufbaryon);
+                else MPIAddParticletoAppropriateBuffer(ibuf, ibufindex, ireadtask, BufSize, Nbuf, Pbuf, Nlocal, Part.data(), Nreadbuf, Preadbuf);
+            }
+        },[&](int ifile){
+            if (opt.nsnapread>1 && inreadsend<totreadsend) {exchange();inreadsend++;}
+        });
+        //once finished reading the files send the particles left in the buffers
+        for (int ibuf=0;ibuf<NProcs;ibuf++) if (ireadtask[ibuf]<0) {
+            if (Nbuf[ibuf]>0) {
+                MPI_Ssend(&Nbuf[ibuf],1,MPI_Int_t, ibuf, ibuf+NProcs, MPI_COMM_WORLD);
+                MPI_Ssend(&Pbuf[ibuf*BufSize], sizeof(Particle)*Nbuf[ibuf], MPI_BYTE, ibuf, ibuf, MPI_COMM_WORLD);
+                Nbuf[ibuf]=0;
+            }
+            //last send with Nbuf[ibuf]=0 so that receiver knows no more particles are to be sent
+            MPI_Ssend(&Nbuf[ibuf],1,MPI_Int_t,ibuf,ibuf+NProcs,MPI_COMM_WORLD);
+        }
+        if (opt.nsnapread>1) exchange();
+        delete[] Pbuf;
+        delete[] Nreadbuf;
+        delete[] Nreadbufbaryon;
+        delete[] Preadbuf;
+        delete[] Preadbufbaryon;
+        delete[] mpi_nsend_readthread;
+        delete[] mpi_nsend_readthread_baryon;
+        delete[] ireadfile;
+    }
+    else {
+        Nlocalthreadbuf=new Int_t[opt.nsnapread];
+        irecv=new int[opt.nsnapread];
+        mpi_irecvflag=new int[opt.nsnapread];
+        mpi_request=new MPI_Request[opt.nsnapread];
+        for (int j=0;j<opt.nsnapread;j++) irecv[j]=1;
+        MPIReceiveParticlesFromReadThreads(opt,Pbuf,Part.data(),readtaskID, irecv, mpi_irecvflag, Nlocalthreadbuf, mpi_request,Pbaryons);
+        delete[] Nlocalthreadbuf;
+        delete[] irecv;
+        delete[] mpi_irecvflag;
+        delete[] mpi_request;
+    }
+    //index the particles local to this task, the baryons by their position in the baryon array used once it is allocated
+    for (Int_t i=0;i<Nlocal;i++) Part[i].SetID(i);
+    if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (Int_t i=0;i<Nlocalbaryon[0];i++) Pbaryons[i].SetID(i);
+    MPI_Allreduce(&reader.MP_DM,&MP_DM,1,MPI_DOUBLE,MPI_MIN,MPI_COMM_WORLD);
+    MPI_Allreduce(&reader.MP_B,&MP_B,1,MPI_DOUBLE,MPI_MIN,MPI_COMM_WORLD);
+    reader.MP_DM=MP_DM;
+    reader.MP_B=MP_B;
+    MPI_Comm_free(&mpi_comm_read);
+    delete[] Nbuf;
+    delete[] ireadtask;
+    delete[] readtaskID;
+#endif
+}
+
+#ifdef USEMPI
+/*! Determine the extent of the particles of the types used, in input units, reading only their positions. Every task
+    reads a share of the files and the limits are combined and broadcast in \ref mpi_xlim.
+*/
+void MPIDomainExtentStream(Options &opt, Stream_Reader &reader)
+{
+    Double_t xlim[3][2],xlimall[3][2];
+    for (int j=0;j<3;j++) {xlim[j][0]=MAXVALUE;xlim[j][1]=-MAXVALUE;}
+    vector<int> files;
+    for (int i=ThisTask;i<reader.nfiles;i+=NProcs) files.push_back(i);
+    StreamDecodeFiles(opt,reader,files,STREAMPOS,[&](Stream_Block &b){
+        if (StreamTypeStorage(opt,b.itype)==0) return;
+        for (Int_t n=0;n<b.num;n++) for (int j=0;j<3;j++) {
+            if (b.pos[3*n+j]<xlim[j][0]) xlim[j][0]=b.pos[3*n+j];
+            if (b.pos[3*n+j]>xlim[j][1]) xlim[j][1]=b.pos[3*n+j];
+        }
+    });
+    for (int j=0;j<3;j++) {
+        MPI_Allreduce(&xlim[j][0],&xlimall[j][0],1,MPI_Real_t,MPI_MIN,MPI_COMM_WORLD);
+        MPI_Allreduce(&xlim[j][1],&xlimall[j][1],1,MPI_Real_t,MPI_MAX,MPI_COMM_WORLD);
+        mpi_xlim[j][0]=xlimall[j][0];mpi_xlim[j][1]=xlimall[j][1];
+    }
+}
+
+/*! Count the particles kept in each mpi domain, reading only positions, and ids when subsampling, so that exactly the memory
+    needed is allocated before \ref StreamReadParticles. The files are shared by all tasks as in \ref MPINumInDomain.
+*/
+void MPINumInDomainStream(Options &opt, Stream_Reader &reader)
+{
+    Int_t *Nbuf=new Int_t[NProcs], *Nbaryonbuf=new Int_t[NProcs];
+    int *ireadtask=new int[NProcs], *readtaskID, *ireadfile;
+    int icolumns=STREAMPOS|((opt.isubsample>1)?STREAMID:0);
+    for (int j=0;j<NProcs;j++) Nbuf[j]=Nbaryonbuf[j]=0;
+    opt.nsnapread=min(NProcs,reader.nfiles);
+    readtaskID=new int[opt.nsnapread];
+    MPIDistributeReadTasks(opt,ireadtask,readtaskID);
+    if (ireadtask[ThisTask]>=0) {
+        MPISetFilesRead(opt,ireadfile,ireadtask);
+        vector<int> files;
+        for (int i=0;i<reader.nfiles;i++) if (ireadfile[i]) files.push_back(i);
+        StreamDecodeFiles(opt,reader,files,icolumns,[&](Stream_Block &b){
+            int istore=StreamTypeStorage(opt,b.itype);
+            Int_t *nbuf=(istore==2)?Nbaryonbuf:Nbuf;
+            if (istore==0) return;
+            for (Int_t n=0;n<b.num;n++) {
+                if (!StreamKeep(opt,b,n)) continue;
+                nbuf[(b.task>=0)?b.task:MPIGetParticlesProcessor(b.pos[3*n],b.pos[3*n+1],b.pos[3*n+2])]++;
+            }
+        });
+        delete[] ireadfile;
+    }
+    MPI_Allreduce(Nbuf,mpi_nlocal,NProcs,MPI_Int_t,MPI_SUM,MPI_COMM_WORLD);
+    Nlocal=mpi_nlocal[ThisTask];
+    if (opt.iBaryonSearch) {
+        MPI_Allreduce(Nbaryonbuf,mpi_nlocal,NProcs,MPI_Int_t,MPI_SUM,MPI_COMM_WORLD);
+        Nlocalbaryon[0]=mpi_nlocal[ThisTask];
+    }
+    delete[] Nbuf;
+    delete[] Nbaryonbuf;
+    delete[] ireadtask;
+    delete[] readtaskID;
+}
+#endif
+
+//@}
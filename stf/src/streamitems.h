@@ -0,0 +1,213 @@
+/*! \file streamitems.h
+ *  \brief this file contains the definitions of the streaming reader shared by the input formats
+ *
+ *  A format supplies a \ref Stream_Reader, listing the blocks of particles stored in each of its files and decoding a block
+ *  into columns. The routines in \ref streamio.cxx then handle the buffering, prefetching, threaded conversion, type
+ *  selection, unit conversion and distribution of the particles to the mpi domains.
+ */
+
+#ifndef STREAMITEMS_H
+#define STREAMITEMS_H
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+///\defgroup STREAMCOLUMNS columns a format is asked to decode for a block of particles
+//@{
+#define STREAMPOS 1
+#define STREAMVEL 2
+#define STREAMID 4
+#define STREAMMASS 8
+#define STREAMU 16
+#define STREAMSFR 32
+#define STREAMZMET 64
+#define STREAMTAGE 128
+//@}
+
+///\name Streaming reader
+//@{
+///Particles of a single type stored contiguously in a file. Values are decoded as double and ids as long long in input units,
+///one column per field of a vector of the fields requested, with positions and velocities stored as x,y,z triplets
+struct Stream_Block {
+    ///file storing the block and particle type of its particles (\ref GASTYPE, \ref DARKTYPE, ...)
+    int ifile, itype;
+    ///task to which all particles in the block belong if the format knows where they are, -1 otherwise
+    int task;
+    ///offset of the block within the particles of this type in the file and number of particles in the block
+    long long noffset, num;
+    ///columns to decode, a combination of the \ref STREAMCOLUMNS flags
+    int icolumns;
+    vector<double> pos, vel, mass, u, sfr, zmet, tage;
+    vector<long long> id;
+
+    Stream_Block() {
+        ifile=itype=0;
+        task=-1;
+        noffset=num=0;
+        icolumns=0;
+    }
+    ///copies the description of a block but not its data
+    void SetBlock(const Stream_Block &b) {
+        ifile=b.ifile; itype=b.itype; task=b.task; noffset=b.noffset; num=b.num; icolumns=b.icolumns;
+    }
+    ///size the columns requested for the num particles of the block
+    void Resize() {
+        pos.resize((icolumns&STREAMPOS)?3*num:0);
+        vel.resize((icolumns&STREAMVEL)?3*num:0);
+        id.resize((icolumns&STREAMID)?num:0);
+        mass.resize((icolumns&STREAMMASS)?num:0);
+        u.resize((icolumns&STREAMU)?num:0);
+        sfr.resize((icolumns&STREAMSFR)?num:0);
+        zmet.resize((icolumns&STREAMZMET)?num:0);
+        tage.resize((icolumns&STREAMTAGE)?num:0);
+    }
+};
+
+///Ring of buffers filled by a prefetch thread and emptied by the thread loading the particles
+template<class T> struct Stream_Ring {
+    vector<T> chunks;
+    mutex mtx;
+    condition_variable cond;
+    ///number of buffers filled but not yet emptied and the next buffers to fill and to empty
+    int nfilled, ifill, iempty;
+    ///set once the prefetch thread will fill no more buffers
+    int ifinished;
+
+    Stream_Ring(int nbuffers) : chunks(nbuffers) {
+        nfilled=ifill=iempty=ifinished=0;
+    }
+    ///wait for a buffer to fill
+    T *NextFree() {
+        unique_lock<mutex> lock(mtx);
+        cond.wait(lock, [this]{return nfilled<(int)chunks.size();});
+        return &chunks[ifill];
+    }
+    void Filled() {
+        {
+            lock_guard<mutex> lock(mtx);
+            ifill=(ifill+1)%chunks.size();
+            nfilled++;
+        }
+        cond.notify_all();
+    }
+    void Finished() {
+        {
+            lock_guard<mutex> lock(mtx);
+            ifinished=1;
+        }
+        cond.notify_all();
+    }
+    ///wait for a filled buffer, returning NULL if no more will be filled
+    T *NextFilled() {
+        unique_lock<mutex> lock(mtx);
+        cond.wait(lock, [this]{return nfilled>0 || ifinished;});
+        if (nfilled==0) return NULL;
+        return &chunks[iempty];
+    }
+    void Emptied() {
+        {
+            lock_guard<mutex> lock(mtx);
+            iempty=(iempty+1)%chunks.size();
+            nfilled--;
+        }
+        cond.notify_all();
+    }
+};
+
+///Queue of buffers filled by several threads, each decoding its own files, and emptied by the thread loading the particles.
+///Buffers emptied are filled again, so no more than nbuffers are used
+template<class T> struct Stream_Queue {
+    vector<T> chunks;
+    deque<T*> filled, empty;
+    mutex mtx;
+    condition_variable cond;
+    ///number of threads still filling buffers
+    int nfilling;
+
+    Stream_Queue(int nbuffers, int nthreads) : chunks(nbuffers) {
+        for (auto &c:chunks) empty.push_back(&c);
+        nfilling=nthreads;
+    }
+    ///wait for a buffer to fill
+    T *NextFree() {
+        unique_lock<mutex> lock(mtx);
+        cond.wait(lock, [this]{return !empty.empty();});
+        T *c=empty.front();
+        empty.pop_front();
+        return c;
+    }
+    void Filled(T *c) {
+        {
+            lock_guard<mutex> lock(mtx);
+            filled.push_back(c);
+        }
+        cond.notify_all();
+    }
+    ///called by each thread once it will fill no more buffers
+    void Finished() {
+        {
+            lock_guard<mutex> lock(mtx);
+            nfilling--;
+        }
+        cond.notify_all();
+    }
+    ///wait for a filled buffer, returning NULL once all threads have finished and all buffers are emptied
+    T *NextFilled() {
+        unique_lock<mutex> lock(mtx);
+        cond.wait(lock, [this]{return !filled.empty() || nfilling==0;});
+        if (filled.empty()) return NULL;
+        T *c=filled.front();
+        filled.pop_front();
+        return c;
+    }
+    void Emptied(T *c) {
+        {
+            lock_guard<mutex> lock(mtx);
+            empty.push_back(c);
+        }
+        cond.notify_all();
+    }
+};
+
+///The callbacks and unit conversions a format supplies to be read by \ref StreamReadParticles. Blocks are listed and decoded
+///by a single thread, so the callbacks need not be thread safe but may themselves decode a block with several threads, unless
+///the format sets iconcurrentfiles.
+struct Stream_Reader {
+    ///number of files making up the input
+    int nfiles;
+    ///set if the callbacks of different files may be called at the same time from different threads, so that files are
+    ///decoded concurrently (see \ref StreamDecodeFiles)
+    int iconcurrentfiles;
+    ///columns the format stores, a combination of the \ref STREAMCOLUMNS flags
+    int icolumns;
+    ///append the blocks stored in a file to the list, setting ifile, itype, noffset and num
+    function<void(int, vector<Stream_Block>&)> ListBlocks;
+    ///decode the columns requested of a block, the columns having been sized by \ref Stream_Block.Resize
+    function<void(Stream_Block&)> DecodeBlock;
+    ///called once all the blocks of a file are decoded, can be left empty
+    function<void(int)> CloseFile;
+    ///conversion of the input mass, length, velocity and internal energy units, with the hubble flow added
+    ///to velocities, in velocity units per input length unit
+    double mscale, lscale, vscale, uscale, Hubbleflow;
+    ///smallest mass of the highest resolution dark matter and of the baryons read, in input units
+    double MP_DM, MP_B;
+
+    Stream_Reader() {
+        nfiles=1;
+        iconcurrentfiles=0;
+        icolumns=STREAMPOS|STREAMVEL|STREAMID|STREAMMASS;
+        mscale=lscale=vscale=uscale=1.0;
+        Hubbleflow=0.;
+        MP_DM=MP_B=MAXVALUE;
+    }
+};
+//@}
+
+#endif
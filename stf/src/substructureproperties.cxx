@@ -2104,11 +2104,8 @@ private(i,j,k,x,y,z)
         NNDataGet = new nndata_in[NImport];
         //build the exported halo group list using NNData structures
         MPIBuildHaloSearchExportList(ngroup, pdata, maxrdist,halooverlap);
-        MPIGetHaloSearchImportNum(nbodies, tree, Part);
-        PartDataIn = new Particle[NExport+1];
-        PartDataGet = new Particle[NImport+1];
         //run search on exported particles and determine which local particles need to be exported back (or imported)
-        nimport=MPIBuildParticleNNImportList(nbodies, tree, Part);
+        nimport=MPIBuildHaloSearchImportList(nbodies, tree, Part);
         if (nimport>0) treeimport=new KDTree(PartDataGet,nimport,opt.HaloMinSize,tree->TPHYS,tree->KEPAN,100,0,0,0,period);
         }
 #endif
@@ -2153,11 +2150,11 @@ private(i,j,k,taggedparts,radii,masses,indices,n,dx,EncMass,rc,rhoval,rhoval2,ti
                     masses.resize(masses.size()+taggedparts.size());
                     if (opt.iSphericalOverdensityPartList) SOpids.resize(SOpids.size()+taggedparts.size());
                     for (j=0;j<taggedparts.size();j++) {
-                        masses[offset+j]=Part[taggedparts[j]].GetMass();
-                        if (opt.iSphericalOverdensityPartList) SOpids[j+offset]=Part[taggedparts[j]].GetPID();
+                        masses[offset+j]=PartDataGet[taggedparts[j]].GetMass();
+                        if (opt.iSphericalOverdensityPartList) SOpids[j+offset]=PartDataGet[taggedparts[j]].GetPID();
                         radii[offset+j]=0;
                         for (k=0;k<3;k++) {
-                            dx=Part[taggedparts[j]].GetPosition(k)-pdata[i].gcm[k];
+                            dx=PartDataGet[taggedparts[j]].GetPosition(k)-pdata[i].gcm[k];
                             //correct for period
                             if (opt.p>0) {
                                 if (dx>opt.p*0.5) dx-=opt.p;
@@ -2267,7 +2264,6 @@ private(i,j,k,taggedparts,radii,masses,indices,n,dx,EncMass,rc,rhoval,rhoval2,ti
         if (NProcs>1) {
             if (treeimport!=NULL) delete treeimport;
             delete[] PartDataGet;
-            delete[] PartDataIn;
             delete[] NNDataGet;
             delete[] NNDataIn;
         }
@@ -18,8 +18,8 @@ int InitVelociraptor(char* configname, char* outputname, cosmoinfo c, unitinfo u
     MPI_Comm_size(MPI_COMM_WORLD,&NProcs);
     //mpi_domain=new MPI_Domain[NProcs];
     mpi_nlocal=new Int_t[NProcs];
-    mpi_nsend=new Int_t[NProcs*NProcs];
-    mpi_ngroups=new Int_t[NProcs];
+    mpi_nsend=new Int_t[NProcs];
+    mpi_nrecv=new Int_t[NProcs];
     //and this processes' rank is
     MPI_Comm_rank(MPI_COMM_WORLD,&ThisTask);
     //store MinSize as when using mpi prior to stitching use min of 2;
@@ -155,7 +155,6 @@ int InvokeVelociraptor(const size_t num_gravity_parts, const size_t num_hydro_pa
     libvelociraptorOpt.cellnodeids = cell_node_ids;
 
     Nlocal=Nmemlocal=num_gravity_parts;
-    Nmemlocal*=(1+libvelociraptorOpt.mpipartfac); /* JSW: Not set in parameter file. */
 #ifdef USEMPI
     MPI_Allreduce(&Nlocal, &Ntotal, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
     MPI_Allgather(&Nlocal, 1, MPI_Int_t, mpi_nlocal, 1, MPI_Int_t, MPI_COMM_WORLD);
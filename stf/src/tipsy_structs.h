@@ -3,7 +3,14 @@
 #ifndef TIPSY_STRUCTS_H
 #define TIPSY_STRUCTS_H
 
+#include <fstream>
 #include "endianutils.h"
+
+///number of particle structures the buffered tipsy readers load and convert at once
+#define TIPSYCHUNKSIZE 262144
+///number of particle structures above which their endian conversion is split across threads
+#define TIPSYOMPSWAPNUM 16384
+
 ///dark matter particles
 struct tipsy_dark_particle {
     float mass;
@@ -90,4 +97,16 @@ struct tipsy_simple_particle {
     float vel[3];
 } ;
 
+///reads n particle structures in one go and converts them from big endian. All the particle structures
+///are made up of floats so each is swapped as a flat float array, with the block split across threads
+template<class T> inline void TipsyReadParticles(std::fstream &F, T *p, long long n)
+{
+    F.read((char*)p,sizeof(T)*n);
+    if (BigEndianSystem) return;
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static) if (n>TIPSYOMPSWAPNUM)
+#endif
+    for (long long i=0;i<n;i++) ByteSwap4Array(&p[i],sizeof(T)/sizeof(float));
+}
+
 #endif
@@ -9,60 +9,134 @@
 #include "tipsy_structs.h"
 #include "endianutils.h"
 
-///reads a tipsy file
-void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons)
+///decodes a block of gas, dark or star particles, all of which start with the mass, position and velocity. Gas and star
+///positions are moved to the periodic replica closest to the first particle searched. Particles in tipsy files are
+///identified by their position in the file, which is used as the id of the particles
+template<class T> static void TipsyDecodeBlock(Options &opt, fstream &Ftip, streamoff offset, long long nidoffset, int iwrap, Double_t *posfirst, Stream_Block &b)
+{
+    vector<T> pblock(b.num);
+    Ftip.seekg(offset+b.noffset*sizeof(T));
+    TipsyReadParticles(Ftip,pblock.data(),b.num);
+    iwrap=(iwrap && opt.p>0.0);
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (long long n=0;n<b.num;n++) {
+        T &p=pblock[n];
+        if (b.pos.size()) for (int j=0;j<3;j++) {
+            b.pos[3*n+j]=p.pos[j];
+            if (iwrap) {
+                if (p.pos[j]-posfirst[j]>opt.p/2.0) b.pos[3*n+j]-=opt.p;
+                else if (p.pos[j]-posfirst[j]<-opt.p/2.0) b.pos[3*n+j]+=opt.p;
+            }
+        }
+        if (b.vel.size()) for (int j=0;j<3;j++) b.vel[3*n+j]=p.vel[j];
+        if (b.mass.size()) b.mass[n]=p.mass;
+        if (b.id.size()) b.id[n]=nidoffset+b.noffset+n;
+    }
+}
+
+/*! Set the \ref Stream_Reader of a tipsy file. The file holds the gas, dark matter and star particles one after the other,
+    each type being listed as a single block. The header is read and, if the input is periodic, the position of the first
+    particle of the types searched, about which gas and star particles are placed, stored in posfirst.
+    The file is opened by the reader as it is needed and closed once all its blocks are decoded.
+*/
+void TipsySetStreamReader(Options &opt, Stream_Reader &reader, tipsy_dump &tipsyheader, fstream &Ftip, Double_t *posfirst)
 {
-    struct tipsy_dump tipsyheader;
     struct tipsy_gas_particle gas;
     struct tipsy_dark_particle dark;
     struct tipsy_star_particle star;
-    Int_t  count,oldcount,ngas,nstar,ndark, Ntot;
-    double time,aadjust,z,Hubble,Hubbleflow,mtotold;
-    double MP_DM=MAXVALUE, MP_B=MAXVALUE;
-    int temp;
-    Double_t mscale,lscale,lvscale,LN=1.0;
-    Double_t posfirst[3];
-    fstream Ftip;
-#ifndef USEMPI
-    int ThisTask=0,NProcs=1;
-#endif
-
-    //if MPI is used, Processor zero opens the file and loads the data into a particle buffer
-    //this particle buffer is used to broadcast data to the appropriate processor
-#ifdef USEMPI
-    MPI_Status status;
-    Particle *Pbuf;
-    Int_t BufSize=opt.mpiparticlebufsize;
-    Pbuf=new Particle[BufSize*NProcs];
-    if (ThisTask==0) Pbuf=new Particle[BufSize*NProcs];
-    Int_t Nlocalbuf,ibuf=0,*Nbuf;
-    if (ThisTask==0) {
-        Nbuf=new Int_t[NProcs];
-        for (int j=0;j<NProcs;j++) Nbuf[j]=0;
-    }
-    Nlocal=0;
-    MPIDomainExtentTipsy(opt);
-    MPIInitialDomainDecomposition();
-    if (ThisTask==0) {
-#endif
+    int count=0;
 
     Ftip.open(opt.fname, ios::in | ios::binary);
     if (!Ftip){cerr<<"ERROR: Unable to open " <<opt.fname<<endl;exit(8);}
-    else cout<<"Reading tipsy format from "<<opt.fname<<endl;
 
     InitEndian();
-
     //read tipsy header.
     Ftip.read((char*)&tipsyheader,sizeof(tipsy_dump));
     tipsyheader.SwitchtoBigEndian();
+    opt.numpart[GASTYPE]=tipsyheader.nsph;
+    opt.numpart[DARKTYPE]=tipsyheader.ndark;
+    opt.numpart[STARTYPE]=tipsyheader.nstar;
+    //tipsy input is always a single file
+    opt.num_files=1;
+
+    //determine first particle about which use period, seeking straight to the first particle of the searched types
+    if (opt.p>0) {
+        if ((opt.partsearchtype==PSTALL||opt.partsearchtype==PSTGAS)&&tipsyheader.nsph>0) {
+            Ftip.seekg(sizeof(tipsy_dump));
+            TipsyReadParticles(Ftip,&gas,1);
+            posfirst[0]=gas.pos[0];posfirst[1]=gas.pos[1];posfirst[2]=gas.pos[2];
+            count++;
+        }
+        if (count==0 && (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTDARK)&&tipsyheader.ndark>0) {
+            Ftip.seekg(sizeof(tipsy_dump)+tipsyheader.nsph*sizeof(tipsy_gas_particle));
+            TipsyReadParticles(Ftip,&dark,1);
+            posfirst[0]=dark.pos[0];posfirst[1]=dark.pos[1];posfirst[2]=dark.pos[2];
+            count++;
+        }
+        if (count==0 && (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTSTAR)&&tipsyheader.nstar>0) {
+            Ftip.seekg(sizeof(tipsy_dump)+tipsyheader.nsph*sizeof(tipsy_gas_particle)+tipsyheader.ndark*sizeof(tipsy_dark_particle));
+            TipsyReadParticles(Ftip,&star,1);
+            posfirst[0]=star.pos[0];posfirst[1]=star.pos[1];posfirst[2]=star.pos[2];
+            count++;
+        }
+    }
     Ftip.close();
+
+    reader.nfiles=1;
+    reader.icolumns=STREAMPOS|STREAMVEL|STREAMID|STREAMMASS;
+    reader.ListBlocks=[&tipsyheader](int ifile, vector<Stream_Block> &blocks) {
+        Stream_Block b;
+        b.num=tipsyheader.nsph;b.itype=GASTYPE;
+        if (b.num>0) blocks.push_back(b);
+        b.num=tipsyheader.ndark;b.itype=DARKTYPE;
+        if (b.num>0) blocks.push_back(b);
+        b.num=tipsyheader.nstar;b.itype=STARTYPE;
+        if (b.num>0) blocks.push_back(b);
+    };
+    reader.DecodeBlock=[&opt,&tipsyheader,&Ftip,posfirst](Stream_Block &b) {
+        streamoff offset=sizeof(tipsy_dump);
+        long long ngas=tipsyheader.nsph, ndark=tipsyheader.ndark;
+        if (!Ftip.is_open()) {
+            Ftip.open(opt.fname, ios::in | ios::binary);
+            if (!Ftip){cerr<<"ERROR: Unable to open " <<opt.fname<<endl;exit(8);}
+        }
+        if (b.itype==GASTYPE) TipsyDecodeBlock<tipsy_gas_particle>(opt,Ftip,offset,0,1,posfirst,b);
+        else if (b.itype==DARKTYPE) TipsyDecodeBlock<tipsy_dark_particle>(opt,Ftip,offset+ngas*sizeof(tipsy_gas_particle),ngas,0,posfirst,b);
+        else TipsyDecodeBlock<tipsy_star_particle>(opt,Ftip,offset+ngas*sizeof(tipsy_gas_particle)+ndark*sizeof(tipsy_dark_particle),ngas+ndark,1,posfirst,b);
+    };
+    reader.CloseFile=[&Ftip](int ifile) {
+        if (Ftip.is_open()) Ftip.close();
+    };
+}
+
+///reads a tipsy file
+void ReadTipsy(Options &opt, vector<Particle> &Part, Int_t &nbodies, Particle *&Pbaryons, Int_t &nbaryons)
+{
+    struct tipsy_dump tipsyheader;
+    Stream_Reader reader;
+    Int_t ngas,nstar,ndark,Ntot;
+    double time,aadjust,z,Hubble;
+    Double_t LN=1.0;
+    Double_t posfirst[3];
+    fstream Ftip;
+#ifndef USEMPI
+    int ThisTask=0,NProcs=1;
+#endif
+
+    //every task reads the header and sets the reader, the particle data being read by the mpi read tasks
+    TipsySetStreamReader(opt,reader,tipsyheader,Ftip,posfirst);
+    if (ThisTask==0) cout<<"Reading tipsy format from "<<opt.fname<<endl;
     //offset stream by a double (time),  an integer (nbodies) ,integer (ndim), an integer (ngas)
     //read an integer (ndark), skip an integer (nstar), then data begins.
     time=tipsyheader.time;
     if ((opt.a-time)/opt.a>1e-2)
     {
+        if (ThisTask==0) {
         cout<<"Note that atime provided != to time in tipsy file (a,t): "<<opt.a<<","<<time<<endl;
         cout<<"Setting atime to that in file "<<endl;
+        }
         opt.a=time;
     }
     if (opt.comove) aadjust=1.0;
@@ -71,9 +145,6 @@ void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particl
     ngas=tipsyheader.nsph;
     nstar=tipsyheader.nstar;
     ndark=tipsyheader.ndark;
-    opt.numpart[GASTYPE]=ngas;
-    opt.numpart[DARKTYPE]=ndark;
-    opt.numpart[STARTYPE]=nstar;
 
     //Hubble flow and scale units
     z=1./opt.a-1.;
@@ -84,239 +155,28 @@ void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particl
     //if opt.virlevel<0, then use virial overdensity based on Bryan and Norman 1997 virialization level is given by
     if (opt.virlevel<0) opt.virlevel=opt.virBN98;
 
-    mscale=opt.M;lscale=opt.L*aadjust;lvscale=opt.L*opt.a;
+    reader.mscale=opt.M;reader.lscale=opt.L*aadjust;reader.vscale=opt.V;
     //normally Hubbleflow=lvscale*Hubble but we only care about peculiar velocities
     //ignore hubble flow
-    Hubbleflow=0.;
+    reader.Hubbleflow=0.;
 
+    if (ThisTask==0) {
     cout<<"File contains "<<Ntot<<" particles at is at time "<<opt.a<<endl;
     cout<<"There "<<ngas<<" gas, "<<ndark<<" dark, "<<nstar<<" stars."<<endl;
     cout<<"System to be searched contains "<<nbodies<<" particles of type "<<opt.partsearchtype<<" at time "<<opt.a<<endl;
-
-    count=0;mtotold=0;
-
-    //determine first particle about which use period
-    if (opt.p>0) {
-        count=0;
-        Ftip.open(opt.fname, ios::in | ios::binary);
-        Ftip.read((char*)&tipsyheader,sizeof(tipsy_dump));
-        tipsyheader.SwitchtoBigEndian();
-        for (Int_t i=0;i<ngas;i++)
-        {
-            Ftip.read((char*)&gas,sizeof(tipsy_gas_particle));
-            gas.SwitchtoBigEndian();
-            if ((opt.partsearchtype==PSTALL||opt.partsearchtype==PSTGAS)&&count==0) {
-                posfirst[0]=gas.pos[0];posfirst[1]=gas.pos[1];posfirst[2]=gas.pos[2];
-                count++;
-                break;
-            }
-        }
-        if (count==0) {
-        for (Int_t i=0;i<ndark;i++)
-        {
-            Ftip.read((char*)&dark,sizeof(tipsy_dark_particle));
-            dark.SwitchtoBigEndian();
-            if ((opt.partsearchtype==PSTALL||opt.partsearchtype==PSTDARK)&&count==0) {
-                posfirst[0]=dark.pos[0];posfirst[1]=dark.pos[1];posfirst[2]=dark.pos[2];
-                count++;
-                break;
-            }
-        }
-        }
-        if (count==0) {
-        for (Int_t i=0;i<nstar;i++)
-        {
-            Ftip.read((char*)&star,sizeof(tipsy_star_particle));
-            star.SwitchtoBigEndian();
-            if ((opt.partsearchtype==PSTALL||opt.partsearchtype==PSTSTAR)&&count==0) {
-                posfirst[0]=star.pos[0];posfirst[1]=star.pos[1];posfirst[2]=star.pos[2];
-                count++;
-                break;
-            }
-        }
-        }
-        Ftip.close();
     }
 
-    oldcount=count=0;
-    Ftip.open(opt.fname, ios::in | ios::binary);
-    Ftip.read((char*)&tipsyheader,sizeof(tipsy_dump));
-    tipsyheader.SwitchtoBigEndian();
-    for (Int_t i=0;i<ngas;i++)
-    {
-        Ftip.read((char*)&gas,sizeof(tipsy_gas_particle));
-        gas.SwitchtoBigEndian();
-        //if particle is closer do to periodicity then alter position
-        if (opt.p>0.0)
-        {
-            for (int j=0;j<3;j++) {
-                if (gas.pos[j]-posfirst[j]>opt.p/2.0) gas.pos[j]-=opt.p;
-                else if (gas.pos[j]-posfirst[j]<-opt.p/2.0) gas.pos[j]+=opt.p;
-            }
-        }
-        if (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTGAS) {
+    StreamReadParticles(opt,reader,Part,nbodies,Pbaryons,nbaryons);
 #ifndef USEMPI
-            Part[count]=Particle(gas.mass*mscale,
-                gas.pos[0]*lscale,gas.pos[1]*lscale,gas.pos[2]*lscale,
-                gas.vel[0]*opt.V+Hubbleflow*gas.pos[0],
-                gas.vel[1]*opt.V+Hubbleflow*gas.pos[1],
-                gas.vel[2]*opt.V+Hubbleflow*gas.pos[2],
-                count,GASTYPE);
-#else
-            //if using MPI, determine ibuf, store particle in particle buffer and if buffer full, broadcast data
-            //unless ibuf is 0, then just store locally
-            ibuf=MPIGetParticlesProcessor(gas.pos[0],gas.pos[1],gas.pos[2]);
-            Pbuf[ibuf*BufSize+Nbuf[ibuf]]=Particle(gas.mass*mscale,
-                gas.pos[0]*lscale,gas.pos[1]*lscale,gas.pos[2]*lscale,
-                gas.vel[0]*opt.V+Hubbleflow*gas.pos[0],
-                gas.vel[1]*opt.V+Hubbleflow*gas.pos[1],
-                gas.vel[2]*opt.V+Hubbleflow*gas.pos[2],
-                count,GASTYPE);
-            Nbuf[ibuf]++;
-            if(ibuf==0){
-                Nbuf[ibuf]--;
-                Part[Nlocal++]=Pbuf[ibuf*BufSize+Nbuf[ibuf]];
-            }
-            else {
-                if(Nbuf[ibuf]==BufSize) {
-                    MPI_Ssend(&Nbuf[ibuf], 1, MPI_Int_t, ibuf, ibuf+NProcs, MPI_COMM_WORLD);
-                    MPI_Ssend(&Pbuf[ibuf*BufSize],sizeof(Particle)*Nbuf[ibuf],MPI_BYTE,ibuf,ibuf,MPI_COMM_WORLD);
-                    Nbuf[ibuf] = 0;
-                }
-            }
-#endif
-        count++;
-        }
-    }
-    cout<<"Finished storing "<<count-oldcount<<" gas particles"<<endl;
-    oldcount=count;
-    for (Int_t i=0;i<ndark;i++)
-    {
-        Ftip.read((char*)&dark,sizeof(tipsy_dark_particle));
-        dark.SwitchtoBigEndian();
-        if (MP_DM>dark.mass) MP_DM=dark.mass;
-        //if particle is closer do to periodicity then alter position
-        if (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTDARK) {
-#ifndef USEMPI
-        Part[count]=Particle(dark.mass*mscale,
-            dark.pos[0]*lscale,dark.pos[1]*lscale,dark.pos[2]*lscale,
-            dark.vel[0]*opt.V+Hubbleflow*dark.pos[0],
-            dark.vel[1]*opt.V+Hubbleflow*dark.pos[1],
-            dark.vel[2]*opt.V+Hubbleflow*dark.pos[2],
-            count,DARKTYPE);
-#else
-            ibuf=MPIGetParticlesProcessor(dark.pos[0],dark.pos[1],dark.pos[2]);
-            Pbuf[ibuf*BufSize+Nbuf[ibuf]]=Particle(dark.mass*mscale,
-                dark.pos[0]*lscale,dark.pos[1]*lscale,dark.pos[2]*lscale,
-                dark.vel[0]*opt.V+Hubbleflow*dark.pos[0],
-                dark.vel[1]*opt.V+Hubbleflow*dark.pos[1],
-                dark.vel[2]*opt.V+Hubbleflow*dark.pos[2],
-                count,DARKTYPE);
-            Nbuf[ibuf]++;
-            if(ibuf==0){
-                Nbuf[ibuf]--;
-                Part[Nlocal++]=Pbuf[ibuf*BufSize+Nbuf[ibuf]];
-            }
-            else {
-                if(Nbuf[ibuf]==BufSize) {
-                    MPI_Ssend(&Nbuf[ibuf], 1, MPI_Int_t, ibuf, ibuf+NProcs, MPI_COMM_WORLD);
-                    MPI_Ssend(&Pbuf[ibuf*BufSize],sizeof(Particle)*Nbuf[ibuf],MPI_BYTE,ibuf,ibuf,MPI_COMM_WORLD);
-                    Nbuf[ibuf] = 0;
-                }
-            }
-#endif
-        count++;
-        }
-    }
-    cout<<"Finished storing "<<count-oldcount<<" dark particles"<<endl;
-    oldcount=count;
-    for (Int_t i=0;i<nstar;i++)
-    {
-        Ftip.read((char*)&star,sizeof(tipsy_star_particle));
-        star.SwitchtoBigEndian();
-        //if particle is closer do to periodicity then alter position
-        if (opt.p>0.0)
-        {
-            for (int j=0;j<3;j++) {
-                if (star.pos[j]-posfirst[j]>opt.p/2.0) star.pos[j]-=opt.p;
-                else if (star.pos[j]-posfirst[j]<-opt.p/2.0) star.pos[j]+=opt.p;
-            }
-        }
-        if (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTSTAR) {
-#ifndef USEMPI
-        Part[count]=Particle(star.mass*mscale,
-            star.pos[0]*lscale,star.pos[1]*lscale,star.pos[2]*lscale,
-            star.vel[0]*opt.V+Hubbleflow*star.pos[0],
-            star.vel[1]*opt.V+Hubbleflow*star.pos[1],
-            star.vel[2]*opt.V+Hubbleflow*star.pos[2],
-            count,STARTYPE);
-#else
-            ibuf=MPIGetParticlesProcessor(star.pos[0],star.pos[1],star.pos[2]);
-            Pbuf[ibuf*BufSize+Nbuf[ibuf]]=Particle(star.mass*mscale,
-                star.pos[0]*lscale,star.pos[1]*lscale,star.pos[2]*lscale,
-                star.vel[0]*opt.V+Hubbleflow*star.pos[0],
-                star.vel[1]*opt.V+Hubbleflow*star.pos[1],
-                star.vel[2]*opt.V+Hubbleflow*star.pos[2],
-                count,STARTYPE);
-            Nbuf[ibuf]++;
-            if(ibuf==0){
-                Nbuf[ibuf]--;
-                Part[Nlocal++]=Pbuf[ibuf*BufSize+Nbuf[ibuf]];
-            }
-            else {
-                if(Nbuf[ibuf]==BufSize) {
-                    MPI_Ssend(&Nbuf[ibuf], 1, MPI_Int_t, ibuf, ibuf+NProcs, MPI_COMM_WORLD);
-                    MPI_Ssend(&Pbuf[ibuf*BufSize],sizeof(Particle)*Nbuf[ibuf],MPI_BYTE,ibuf,ibuf,MPI_COMM_WORLD);
-                    Nbuf[ibuf]=0;
-                }
-            }
-#endif
-        count++;
-        }
-    }
-
-    cout<<"Finished storing "<<count-oldcount<<" star particles"<<endl;
-    //once finished reading the file if there are any particles left in the buffer broadcast them
-#ifdef USEMPI
-    for(ibuf = 1; ibuf < NProcs; ibuf++)
-    {
-        while(Nbuf[ibuf])
-        {
-            MPI_Ssend(&Nbuf[ibuf],1,MPI_Int_t, ibuf, ibuf+NProcs, MPI_COMM_WORLD);
-            MPI_Ssend(&Pbuf[ibuf*BufSize], sizeof(Particle)*Nbuf[ibuf], MPI_BYTE, ibuf, ibuf, MPI_COMM_WORLD);
-            Nbuf[ibuf]=0;
-        }
-        //last broadcast with Nbuf[ibuf]=0 so that receiver knows no more particles are to be broadcast
-        MPI_Ssend(&Nbuf[ibuf],1,MPI_Int_t,ibuf,ibuf+NProcs,MPI_COMM_WORLD);
-    }
-#endif
-    Ftip.close();
-
-#ifdef USEMPI
-    }
-    else {
-        do {
-            MPI_Recv(&Nlocalbuf, 1, MPI_Int_t, 0, ThisTask+NProcs, MPI_COMM_WORLD, &status);
-            if(Nlocalbuf) {
-                MPI_Recv(&Part[Nlocal],sizeof(Particle)*Nlocalbuf,MPI_BYTE,0,ThisTask, MPI_COMM_WORLD,&status);
-                Nlocal+=Nlocalbuf;
-            }
-        } while(Nlocalbuf);
-    }
-    //store global ids and index locally
-    //for (Int_t i=0;i<Nlocal;i++) mpi_indexlist[i]=Part[i].GetID();
-    //for (Int_t i=0;i<Nlocal;i++) mpi_idlist[i]=Part[i].GetPID();
-    //if (ThisTask==0) {
-        //MPI_Bcast(&cm,sizeof(Coordinate),MPI_BYTE,0,MPI_COMM_WORLD);
-        //MPI_Bcast(&cmvel,sizeof(Coordinate),MPI_BYTE,0,MPI_COMM_WORLD);
-    //}
+    cout<<"Finished storing "<<nbodies<<" particles"<<endl;
+    if (Pbaryons!=NULL) cout<<"Finished storing "<<nbaryons<<" baryon particles"<<endl;
 #endif
 
     //calculate the interparticle spacing
 #ifdef HIGHRES
     if (opt.Neff==-1) {
         //Once smallest mass particle is found (which should correspond to highest resolution area,
-        LN=pow(((MP_DM)*opt.M)/(opt.Omega_cdm*3.0*opt.H*opt.h*opt.H*opt.h/(8.0*M_PI*opt.G)),1./3.)*opt.a;
+        LN=pow(((reader.MP_DM)*opt.M)/(opt.Omega_cdm*3.0*opt.H*opt.h*opt.H*opt.h/(8.0*M_PI*opt.G)),1./3.)*opt.a;
     }
     else {
         LN=opt.p/(Double_t)opt.Neff;
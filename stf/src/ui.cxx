@@ -11,7 +11,7 @@ void GetArgs(int argc, char *argv[], Options &opt)
     int option;
     int NumArgs = 0;
     int configflag=0;
-    while ((option = getopt(argc, argv, ":C:I:i:s:Z:o:G:S:B:t:")) != EOF)
+    while ((option = getopt(argc, argv, ":C:I:i:s:Z:o:G:S:B:t:R")) != EOF)
     {
         switch(option)
         {
@@ -56,6 +56,10 @@ void GetArgs(int argc, char *argv[], Options &opt)
                 opt.ramsessnapname = optarg;
                 NumArgs += 2;
                 break;
+            case 'R':
+                opt.irestart = 1;
+                NumArgs += 1;
+                break;
             case '?':
                 usage();
         }
@@ -88,6 +92,7 @@ void usage(void)
     cerr<<"-s <number of files per output for gadget input 1 [default]>"<<endl;
     cerr<<"-Z <number of threads used in parallel read ("<<opt.nsnapread<<")>"<<endl;
     cerr<<"-o <output filename>"<<endl;
+    cerr<<"-R restart from the last stage for which checkpoints were written"<<endl;
     cerr<<" ===== EXTRA OPTIONS FOR GADGET INPUT ====== "<<endl;
     cerr<<"-g <number of extra sph/gas blocks for gadget>"<<endl;
     cerr<<"-s <number of extra star blocks for gadget>"<<endl;
@@ -97,6 +102,7 @@ void usage(void)
 
 #ifdef USEMPI
     }
+    MPIStopProgressThread();
     MPI_Finalize();
 #endif
     exit(1);
@@ -144,6 +150,7 @@ void usage(void)
         - \b 1 \e standard physical shannon entropy, balanced KD tree volume decomposition into cells
         - \b 2 \e phase phase-space shannon entropy, balanced KD tree volume decomposition into cells
         - \b 3 \e simple simple physical balanced KD tree decomposition of volume into cells
+        - \b 4 \e morton octree of Morton ordered particles with cells containing fewer than \ref Options.Ncell particles, cheaper to build than a KD tree
 
     \section fofconfig Parameters related to FOF search
     See \ref search.cxx \ref fofalgo.h for more details
@@ -191,6 +198,8 @@ void usage(void)
     \arg <b> \e Halo_core_loop_ellv_fac </b> Factor by which velocity linking length is decreased when running loops for core search.  Typically values are \f$ \sim0.75 \f$. \ref Options.halocorevfaciter
     \arg <b> \e Halo_core_loop_elln_fac </b> Factor by which min group size is changed when running loops for core search.  Typically values are \f$ \sim1.25 \f$. \ref Options.halocorenumfaciter
     \arg <b> \e Halo_core_phase_significance </b> Significance a core must be in terms of phase-space distance scaled by dispersions (sigma).
+    \arg <b> \e FOF_grid_max_size </b> Particle sets with at most this number of particles searched with 6DFOF (field 6DFOF search of 3DFOF groups and the halo core search) use a hash grid of cells scaled to the linking lengths rather than building a kd-tree. 0 disables the grid (100000). \ref Options.fofgridmaxnum \n
+    \arg <b> \e FOF_grid_benchmark </b> 0/1 flag, if 1 also runs the kd-tree search on every set searched with the grid and reports the timings of both and whether the groups found agree (0). \ref Options.ifofgridbenchmark \n
 
     \section unbindconfig Unbinding Parameters
     See \ref unbinding and \ref unbind.cxx for more details
@@ -246,11 +255,25 @@ void usage(void)
     \section ioconfigs I/O options
     \arg <b> \e Cosmological_input </b> 1/0 indicating that input simulation is cosmological or not. With cosmological input, a variety of length/velocity scales are set to determine such things as the virial overdensity, linking length. \ref Options.icosmologicalin \n
     \arg <b> \e Input_chunk_size </b> Amount of information to read from input file in one go (100000). \ref Options.inputbufsize \n
-    \arg <b> \e Write_group_array_file </b> 0/1 flag indicating whether write a single large tipsy style group assignment file is written. \ref Options.iwritefof \n
+    \arg <b> \e Input_prefetch_buffers </b> Number of chunks of Input_chunk_size particles read ahead by a separate thread while the chunks already read are loaded (2).
+    0 reads synchronously. Used when loading hdf input with mpi. \ref Options.inputnprefetchbuffers \n
+    \arg <b> \e Input_subsample_factor </b> Keep only one in this many particles of the input for a quick look at a simulation (1). The masses of the
+    particles kept are scaled up by this factor and the linking lengths by its cube root. \ref Options.isubsample \n
+    \arg <b> \e Input_subsample_type </b> 0/1 flag indicating whether the particles kept are those whose id is a multiple of the subsampling factor or are
+    chosen pseudo-randomly from a hash of their id. \ref Options.isubsampletype \n
+    \arg <b> \e Input_fields </b> Sum of the flags of the gas and star fields read from gadget and hdf input, 1 internal energy, 2 sph density, 4 star formation rate,
+    8 metallicity, 16 stellar age, overriding the fields derived from the search (-1). Fields not listed are not read and set to zero. \ref Options.iinputfields \n
+    \arg <b> \e Zoom_region_only </b> 1/0 flag indicating whether only the low resolution dark matter (gadget and hdf types 2 and 3) within a buffer about the region occupied by the
+    high resolution dark matter (type 1) of a zoom simulation is read, the mpi domains then spanning this region. \ref Options.izoomregiononly \n
+    \arg <b> \e Zoom_region_buffer </b> Width of the buffer about the high resolution region in units of the largest extent of the region (0.1). \ref Options.zoomregionbuffer \n
+    \arg <b> \e Zoom_region_cells </b> Number of cells along each axis of a grid following the shape of the high resolution region, 0 using its bounding box (0). \ref Options.zoomregionncells \n
+    \arg <b> \e Write_group_array_file </b> 0/1/2 flag indicating whether write a single large tipsy style group assignment file is written, or with mpi, one file per task if 2. \ref Options.iwritefof \n
     \arg <b> \e Separate_output_files </b> 1/0 flag indicating whether separate files are written for field and subhalo groups. \ref Options.iseparatefiles \n
     \arg <b> \e Binary_output </b> 3/2/1/0 flag indicating whether output is hdf, binary or ascii. \ref Options.ibinaryout, \ref OUTADIOS, \ref OUTHDF, \ref OUTBINARY, \ref OUTASCII \n
     \arg <b> \e Extensive_halo_properties_output </b> 1/0 flag indicating whether to calculate/output even more halo properties. \ref Options.iextrahalooutput \n
     \arg <b> \e Extended_output </b> 1/0 flag indicating whether produce extended output for quick particle extraction from input catalog of particles in structures \ref Options.iextendedoutput \n
+    \arg <b> \e Write_checkpoints </b> 1/0 flag indicating whether checkpoints are written after each stage of the search (field halos, substructure, baryons) so that a run can be restarted. \ref Options.icheckpoint \n
+    \arg <b> \e Restart_from_checkpoint </b> 1/0 flag indicating whether the search restarts from the last stage for which checkpoints exist (also set with -R). \ref Options.irestart \n
     \arg <b> \e Comoving_units </b> 1/0 flag indicating whether the properties output is in physical or comoving little h units. \ref Options.icomoveunit \n
 
     \section inputflags input flags related to varies input formats
@@ -266,11 +289,22 @@ void usage(void)
     \arg <b> \e Input_includes_star_particle </b> If star particle specific information is in the input file. \ref Options.iusestarparticles \n
 
     \section mpiconfigs MPI specific options
-    \arg <b> \e MPI_part_allocation_fac </b> Memory allocated in mpi mode to store particles is (1+factor)* the memory need for the initial mpi decomposition.
-    This factor should be >0 and is mean to allow a little room for particles to be exchanged between mpi threads withouth having to require new memory allocations and copying
-    of data. \ref Options.mpipartfac \n
     \arg <b> \e MPI_particle_total_buf_size </b> Total memory size in bytes used to store particles in temporary buffer such that
     particles are sent to non-reading mpi processes in one communication round in chunks of size buffer_size/NProcs/sizeof(Particle). \ref Options.mpiparticlebufsize \n
+    \arg <b> \e MPI_use_sfc_decomposition </b> 1/0 flag to decompose the volume into contiguous ranges of a Peano-Hilbert curve on a 2^\ref MPISFCLEVEL mesh
+    chosen so that each mpi process has a similar estimated amount of work, rather than regular slabs. Works for any number of mpi processes. \ref Options.impisfc \n
+    \arg <b> \e MPI_group_rebalance </b> 1/0 flag to move field structures between mpi processes before the substructure search so that each has a similar
+    estimated search and unbinding cost. \ref Options.impigrouprebalance \n
+    \arg <b> \e MPI_overlap_communication </b> 1/0 flag to send the data of particles near domain boundaries with nonblocking communication while the
+    local fof and velocity density searches proceed, reporting how much of the communication is hidden. \ref Options.impioverlap \n
+    \arg <b> \e MPI_hierarchical_communication </b> 1/0 flag to exchange data between mpi processes on the same node through shared memory and to
+    aggregate data sent between nodes into one message per pair of nodes. \ref Options.impihierarchical \n
+    \arg <b> \e MPI_progress_thread </b> 1/0 flag to run a thread that progresses nonblocking communication while other threads compute.
+    Requires compilation with MPITHREADMULTIPLE. \ref Options.impiprogressthread \n
+    \arg <b> \e MPI_single_pass_read </b> 1/0 flag for reading tasks to keep the positions they read while counting the particles in each mpi domain,
+    so that particle positions are read from gadget and hdf input only once. \ref Options.impisinglepassread \n
+    \arg <b> \e MPI_read_by_cell </b> 1/0 flag for hdf input carrying an index of the particles in each top level cell (SWIFT snapshots) to be decomposed
+    along cell boundaries, with every mpi process reading the cells in its domain directly. \ref Options.impireadcells \n
 
 
 
@@ -287,6 +321,7 @@ void GetParamFile(Options &opt)
     if (!FileExists(opt.pname)){
             cerr<<"Config file: "<<opt.pname <<" does not exist or can't be read, terminating"<<endl;
 #ifdef USEMPI
+            MPIStopProgressThread();
             MPI_Abort(MPI_COMM_WORLD,9);
 #else
             exit(9);
@@ -324,6 +359,7 @@ void GetParamFile(Options &opt)
         if (opt.outname==NULL) {
             cerr<<"No output name given, terminating"<<endl;
 #ifdef USEMPI
+            MPIStopProgressThread();
             MPI_Finalize();
 #endif
             exit(9);
@@ -437,6 +473,12 @@ void GetParamFile(Options &opt)
                     else if (strcmp(tbuff, "Halo_core_phase_significance")==0)
                         opt.halocorephasedistsig = atof(vbuff);
 
+                    //for grid based fof searches of small particle sets
+                    else if (strcmp(tbuff, "FOF_grid_max_size")==0)
+                        opt.fofgridmaxnum = atol(vbuff);
+                    else if (strcmp(tbuff, "FOF_grid_benchmark")==0)
+                        opt.ifofgridbenchmark = atoi(vbuff);
+
                     //for changing factors used in iterative search
                     else if (strcmp(tbuff, "Iterative_threshold_factor")==0)
                         opt.ellfac = atof(vbuff);
@@ -531,11 +573,37 @@ void GetParamFile(Options &opt)
                     //input read related
                     else if (strcmp(tbuff, "Input_chunk_size")==0)
                         opt.inputbufsize = atol(vbuff);
+                    else if (strcmp(tbuff, "Input_prefetch_buffers")==0)
+                        opt.inputnprefetchbuffers = atoi(vbuff);
+                    else if (strcmp(tbuff, "Input_subsample_factor")==0)
+                        opt.isubsample = atoi(vbuff);
+                    else if (strcmp(tbuff, "Input_subsample_type")==0)
+                        opt.isubsampletype = atoi(vbuff);
+                    else if (strcmp(tbuff, "Input_fields")==0)
+                        opt.iinputfields = atoi(vbuff);
+                    else if (strcmp(tbuff, "Zoom_region_only")==0)
+                        opt.izoomregiononly = atoi(vbuff);
+                    else if (strcmp(tbuff, "Zoom_region_buffer")==0)
+                        opt.zoomregionbuffer = atof(vbuff);
+                    else if (strcmp(tbuff, "Zoom_region_cells")==0)
+                        opt.zoomregionncells = atoi(vbuff);
                     else if (strcmp(tbuff, "MPI_particle_total_buf_size")==0)
                         opt.mpiparticletotbufsize = atol(vbuff);
                     //mpi memory related
-                    else if (strcmp(tbuff, "MPI_part_allocation_fac")==0)
-                        opt.mpipartfac = atof(vbuff);
+                    else if (strcmp(tbuff, "MPI_use_sfc_decomposition")==0)
+                        opt.impisfc = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_group_rebalance")==0)
+                        opt.impigrouprebalance = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_overlap_communication")==0)
+                        opt.impioverlap = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_hierarchical_communication")==0)
+                        opt.impihierarchical = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_progress_thread")==0)
+                        opt.impiprogressthread = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_single_pass_read")==0)
+                        opt.impisinglepassread = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_read_by_cell")==0)
+                        opt.impireadcells = atoi(vbuff);
 
                     //output related
                     else if (strcmp(tbuff, "Separate_output_files")==0)
@@ -548,6 +616,10 @@ void GetParamFile(Options &opt)
                         opt.iextrahalooutput = atof(vbuff);
                     else if (strcmp(tbuff, "Extended_output")==0)
                         opt.iextendedoutput = atof(vbuff);
+                    else if (strcmp(tbuff, "Write_checkpoints")==0)
+                        opt.icheckpoint = atoi(vbuff);
+                    else if (strcmp(tbuff, "Restart_from_checkpoint")==0)
+                        opt.irestart = atoi(vbuff);
                     else if (strcmp(tbuff, "Spherical_overdensity_halo_particle_list_output")==0)
                         opt.iSphericalOverdensityPartList = atof(vbuff);
 
@@ -590,6 +662,7 @@ inline void ConfigCheck(Options &opt)
 #endif
         cerr<<"Must provide input and output file names\n";
 #ifdef USEMPI
+            MPIStopProgressThread();
             MPI_Abort(MPI_COMM_WORLD,8);
 #else
             exit(8);
@@ -601,6 +674,7 @@ inline void ConfigCheck(Options &opt)
 #endif
         cerr<<"Conflict in config file: both gas/star/etc particle type search AND the separate baryonic (gas,star,etc) search flag are on. Check config\n";
 #ifdef USEMPI
+            MPIStopProgressThread();
             MPI_Abort(MPI_COMM_WORLD,8);
 #else
             exit(8);
@@ -614,6 +688,7 @@ inline void ConfigCheck(Options &opt)
 #endif
         cerr<<"Invalid number of input files (<1) \n";
 #ifdef USEMPI
+            MPIStopProgressThread();
             MPI_Abort(MPI_COMM_WORLD,8);
 #else
             exit(8);
@@ -626,11 +701,68 @@ inline void ConfigCheck(Options &opt)
 #endif
         cerr<<"Invalid read buf size (<1)\n";
 #ifdef USEMPI
+            MPIStopProgressThread();
+            MPI_Abort(MPI_COMM_WORLD,8);
+#else
+            exit(8);
+#endif
+    }
+    if (opt.inputnprefetchbuffers<0){
+#ifdef USEMPI
+    if (ThisTask==0)
+#endif
+        cerr<<"Invalid number of prefetch buffers (<0)\n";
+#ifdef USEMPI
+            MPIStopProgressThread();
+            MPI_Abort(MPI_COMM_WORLD,8);
+#else
+            exit(8);
+#endif
+    }
+    if (opt.isubsample<1 || (opt.isubsampletype!=SUBSAMPLEREGULAR && opt.isubsampletype!=SUBSAMPLERANDOM)){
+#ifdef USEMPI
+    if (ThisTask==0)
+#endif
+        cerr<<"Invalid input subsampling, factor must be >=1 and type 0 or 1\n";
+#ifdef USEMPI
+            MPIStopProgressThread();
+            MPI_Abort(MPI_COMM_WORLD,8);
+#else
+            exit(8);
+#endif
+    }
+    if (opt.iinputfields<-1 || opt.iinputfields>INPUTFIELDALL){
+#ifdef USEMPI
+    if (ThisTask==0)
+#endif
+        cerr<<"Invalid input fields, must be -1 or a sum of flags between 0 and "<<INPUTFIELDALL<<"\n";
+#ifdef USEMPI
+            MPIStopProgressThread();
             MPI_Abort(MPI_COMM_WORLD,8);
 #else
             exit(8);
 #endif
     }
+    if (opt.izoomregiononly && (opt.zoomregionbuffer<0 || opt.zoomregionncells<0 || opt.zoomregionncells>ZOOMREGIONMAXCELLS)){
+#ifdef USEMPI
+    if (ThisTask==0)
+#endif
+        cerr<<"Invalid zoom region, buffer must be >=0 and number of cells between 0 and "<<ZOOMREGIONMAXCELLS<<"\n";
+#ifdef USEMPI
+            MPIStopProgressThread();
+            MPI_Abort(MPI_COMM_WORLD,8);
+#else
+            exit(8);
+#endif
+    }
+    //unless given, read only the fields that are used. Gas kept in groups enters the unbinding and the association of baryons
+    //through its internal energy and the gas properties through that, its star formation rate and metallicity. Stars kept
+    //enter the star properties through their ages and metallicities. Sph densities are not used
+    if (opt.iinputfields==-1) {
+        opt.iinputfields=0;
+        if (opt.partsearchtype==PSTALL || opt.partsearchtype==PSTGAS || opt.iBaryonSearch) opt.iinputfields|=INPUTFIELDU|INPUTFIELDSFR|INPUTFIELDZMET;
+        if (opt.partsearchtype==PSTALL || opt.partsearchtype==PSTSTAR || opt.iBaryonSearch) opt.iinputfields|=INPUTFIELDTAGE|INPUTFIELDZMET;
+    }
 
     if (opt.lengthtokpc<=0){
 #ifdef USEMPI
@@ -638,6 +770,7 @@ inline void ConfigCheck(Options &opt)
 #endif
         cerr<<"Invalid unit conversion, length unit to kpc is <=0 or was not set. Update config file\n";
 #ifdef USEMPI
+            MPIStopProgressThread();
             MPI_Abort(MPI_COMM_WORLD,8);
 #else
             exit(8);
@@ -649,6 +782,7 @@ inline void ConfigCheck(Options &opt)
 #endif
         cerr<<"Invalid unit conversion, velocity unit to km/s is <=0 or was not set. Update config file\n";
 #ifdef USEMPI
+            MPIStopProgressThread();
             MPI_Abort(MPI_COMM_WORLD,8);
 #else
             exit(8);
@@ -660,6 +794,7 @@ inline void ConfigCheck(Options &opt)
 #endif
         cerr<<"Invalid unit conversion, mass unit to solar mass is <=0 or was not set. Update config file\n";
 #ifdef USEMPI
+            MPIStopProgressThread();
             MPI_Abort(MPI_COMM_WORLD,8);
 #else
             exit(8);
@@ -672,6 +807,7 @@ inline void ConfigCheck(Options &opt)
             cerr<<"Invalid input particle buffer send size, mininmum input buffer size given paritcle byte size ";
             cerr<<sizeof(Particle)<<" and have "<<NProcs<<" mpi processes is "<<sizeof(Particle)*NProcs<<endl;
         }
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,8);
     }
     //if total buffer size is -1 then calculate individual buffer size based on default mpi size
@@ -682,17 +818,6 @@ inline void ConfigCheck(Options &opt)
     else {
         opt.mpiparticlebufsize=opt.mpiparticletotbufsize/NProcs/sizeof(Particle);
     }
-    if (opt.mpipartfac<0){
-        if (ThisTask==0) {
-            cerr<<"Invalid MPI particle allocation factor, must be >0."<<endl;
-        }
-        MPI_Abort(MPI_COMM_WORLD,8);
-    }
-    else if (opt.mpipartfac>1){
-        if (ThisTask==0) {
-            cerr<<"WARNING: MPI Particle allocation factor is high (>1)."<<endl;
-        }
-    }
 #endif
 
 #ifndef USEHDF
@@ -702,6 +827,7 @@ inline void ConfigCheck(Options &opt)
 #endif
         cerr<<"Code not compiled with HDF output enabled. Recompile with this enabled or change Binary_output.\n";
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,8);
 #else
         exit(8);
@@ -716,6 +842,7 @@ inline void ConfigCheck(Options &opt)
 #endif
         cerr<<"Code not compiled with ADIOS output enabled. Recompile with this enabled or change Binary_output.\n";
 #ifdef USEMPI
+        MPIStopProgressThread();
         MPI_Abort(MPI_COMM_WORLD,8);
 #else
         exit(8);